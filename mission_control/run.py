@@ -39,6 +39,14 @@ if __name__ == "__main__":
     opt_parser.add_option("-G", "--non-graphical", action="store_false",
                           dest="graphical", default=True,
                           help="Takes vision out of debug mode, disallowing windows to be displayed.")
+    opt_parser.add_option("-S", "--shared-frames", action="store_true",
+                          default=False, dest="shared_frames",
+                          help="Capture each camera once and share its frames between all "
+                          "vision entities using it.")
+    opt_parser.add_option("-p", "--profile", action="store_true",
+                          default=False, dest="profile",
+                          help="Time each stage of the vision entities and publish the "
+                          "results as VisionProfile.* variables.")
     opt_parser.add_option("-s", "--simulator", action="store_true",
                           default=False, dest="simulator",
                           help="Connect to the simulator instead of starting vision processes.")
@@ -164,7 +172,7 @@ if __name__ == "__main__":
         "delay": options.delay,
         "cameras": cameras_dict,
         "debug": options.graphical,
-    })
+    }, shared_frames=options.shared_frames, profile=options.profile)
 
     try:
         while True:
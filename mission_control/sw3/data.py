@@ -1,4 +1,6 @@
 
+import threading
+
 import seawolf as sw
 
 __all__ = ["data"]
@@ -6,13 +8,56 @@ __all__ = ["data"]
 VARS_TO_FREEZE = ["SEA.Yaw", "Depth"]
 
 
+class VarMirror(object):
+
+    """ Local copy of seawolf variables
+
+    Each variable is subscribed to the first time it is read. After that its
+    value is only fetched again once the hub has sent an update for it, so
+    polling a variable that hasn't changed never leaves this process.
+    """
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.values = {}
+
+    def __refresh(self, var):
+        """ Bring var up to date. Called with the lock held """
+        if var not in self.values:
+            sw.var.subscribe(var)
+            self.values[var] = sw.var.get(var)
+        elif sw.var.stale(var):
+            self.values[var] = sw.var.get(var)
+
+    def get(self, var):
+        with self.lock:
+            self.__refresh(var)
+            return self.values[var]
+
+    def snapshot(self, variables, values=None):
+        """ Read a set of variables at once
+
+        The values of every variable in variables are stored in values, a
+        dictionary which is created if not given and returned. The mirror is
+        locked for the whole read, so no other thread's reads are interleaved
+        with it.
+        """
+        if values is None:
+            values = {}
+        with self.lock:
+            for var in variables:
+                self.__refresh(var)
+                values[var] = self.values[var]
+        return values
+
+
 class Imu(object):
 
     def __init__(self, data):
         self.data = data
 
     def yaw(self, freeze_name=None):
-        return self.data.var_get("SEA.Yaw", freeze_name=None)
+        return self.data.var_get("SEA.Yaw", freeze_name)
 
     def pitch(self):
         return self.data.var_get("SEA.Pitch")
@@ -25,10 +70,11 @@ class Data(object):
 
     def __init__(self):
         self.imu = Imu(self)
+        self.mirror = VarMirror()
         self.freezes = {}  # Map freeze name to variable dictionary
 
     def depth(self, freeze_name=None):
-        return self.var_get("Depth", freeze_name=None)
+        return self.var_get("Depth", freeze_name)
 
     def power_status(self):
         return self.var_get("PowerStatus")
@@ -37,12 +83,10 @@ class Data(object):
         if freeze_name in self.freezes and var in self.freezes[freeze_name]:
             return self.freezes[freeze_name][var]
         else:
-            return sw.var.get(var)
+            return self.mirror.get(var)
 
     def freeze(self, freeze_name=None):
-        variables = {}
-        for var in VARS_TO_FREEZE:
-            variables[var] = sw.var.get(var)
+        variables = self.mirror.snapshot(VARS_TO_FREEZE)
         self.freezes[freeze_name] = variables
 
         # Set Default Freeze
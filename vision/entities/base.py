@@ -2,6 +2,8 @@
 import os
 
 import libvision
+from libvision import profiler
+from libvision.profiler import monotonic
 import vision
 import svr
 
@@ -32,6 +34,14 @@ class VisionEntity(object):
     # A human readable name for this entity
     name = "VisionEntity"
 
+    # If the process manager shares frames between entities, whether this
+    # entity takes its frames from the camera's shared frame ring
+    shares_frames = True
+
+    # Set to True if process_frame never writes to the frame.  Entities then
+    # read shared frames in place instead of getting their own copy.
+    frame_readonly = False
+
     """instantiates an entity
     args:
         camera_name -- string indicating which camera/stream the entity,
@@ -59,13 +69,21 @@ class VisionEntity(object):
         self.delay = kwargs.pop('delay', 0)
         self.waitforsync = kwargs.pop('waitforsync', False)
         self.binocular_child = kwargs.pop('binocularworker', False)
+        frame_ring = kwargs.pop('frame_ring', None)
+        profile = kwargs.pop('profile', False)
 
         # Line of communication to mission control
         self.child_conn = child_conn
 
+        # Sequence number of the frame being processed, sent along with the
+        # output
+        self.frame_seq = -1
+
         # Open camera/stream
         self.camera_name = camera_name
-        if self.camera_name in self.cameras:
+        if frame_ring is not None:
+            self.capture = frame_ring.reader(copy=not self.frame_readonly)
+        elif self.camera_name in self.cameras:
             self.capture = libvision.Camera(self.cameras[self.camera_name], display=self.debug)
         else:
             self.capture = svr.Stream(self.camera_name)
@@ -73,6 +91,12 @@ class VisionEntity(object):
 
         self.output = Container()
 
+        # Stage timings, reported to the process manager
+        if profile:
+            self.profiler = profiler.start(self.name)
+        else:
+            self.profiler = None
+
         # Initialization for subclass
         self.init()
 
@@ -114,10 +138,22 @@ class VisionEntity(object):
                     self.child_conn.send(vision.process_manager.SensorCapture())
 
                 #check if a new frame has been captured
+                capture_start = monotonic() if self.profiler else 0
                 frame = self.capture.get_frame()
+                frame_seq = getattr(self.capture, "frame_seq", self.frame_seq + 1)
+                if self.profiler:
+                    self.profiler.record(profiler.CAPTURE, monotonic() - capture_start)
+                    if self.frame_seq >= 0:
+                        self.profiler.count_dropped(frame_seq - self.frame_seq - 1)
+                self.frame_seq = frame_seq
 
                 #process any new frame
+                process_start = monotonic() if self.profiler else 0
                 self.process_frame(frame)
+                if self.profiler:
+                    self.profiler.frame_done(monotonic() - process_start)
+                    if self.profiler.report_due():
+                        self.child_conn.send(self.profiler.report())
                 
                 # track time
                 if PRINT_FRAMERATE:
@@ -141,7 +177,11 @@ class VisionEntity(object):
             self.close()
 
     def return_output(self):
-        #return output
+        #return output, tagged with the frame it came from
+        self.output.frame_seq = self.frame_seq
+        if self.profiler:
+            # Lets the process manager time the transfer
+            self.output.sent_time = monotonic()
         self.child_conn.send(self.output)
 
     def wait_for_parent(self, timeout):
@@ -192,6 +232,9 @@ class MultiCameraVisionEntity(VisionEntity):
     """ spawns and communicates with subprocess, each of which controls a camera """
     subprocess = None
 
+    # Cameras are opened by the subprocesses
+    shares_frames = False
+
     def __init__(self, child_conn, *cameras_to_use, **kwargs):
 
         self.cameras = kwargs.pop('cameras', {})  # Camera index dict
@@ -72,6 +72,9 @@ class BinsEntity(VisionEntity):
         self.adaptive_thresh = 6
         self.max_range = 100
 
+        # Saturation channel of the frame, see process_frame
+        self.channel_converter = libvision.ColorConverter("hsv", "s")
+
     def process_frame(self, frame):
         debug_frame = cv.CreateImage(cv.GetSize(frame), 8, 3)
         cv.Copy(frame, debug_frame)
@@ -79,12 +82,7 @@ class BinsEntity(VisionEntity):
         cv.Smooth(frame, frame, cv.CV_MEDIAN, 7, 7)
 
         # Set binary image to have saturation channel
-        hsv = cv.CreateImage(cv.GetSize(frame), 8, 3)
-        binary = cv.CreateImage(cv.GetSize(frame), 8, 1)
-        cv.CvtColor(frame, hsv, cv.CV_BGR2HSV)
-        cv.SetImageCOI(hsv, 2)
-        cv.Copy(hsv, binary)
-        cv.SetImageCOI(hsv, 0)
+        binary = self.channel_converter.convert(frame)
 
         cv.AdaptiveThreshold(binary, binary,
                              255,
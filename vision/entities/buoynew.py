@@ -6,7 +6,6 @@ from time import time
 from math import sqrt
 
 import cv
-import os
 import svr
 
 from base import VisionEntity, Container
@@ -16,10 +15,17 @@ Point = namedtuple("Point", ["x", "y"])
 
 ############################### Tuning Values ###############################
 INIT_TRACKING_THRESHOLD = 6  # Frames to see buoys before tracking
-TRACKING_MIN_Z_SCORE = 10
+TRACKING_MIN_CONTRAST = 0.4
 TRACKING_ALPHA = 0.2
 MOVEMENT_THRESHOLD = 50  # Pixel distance the buoys are considered the same when finding buoys to track
 CANDIDATE_TIMEOUT = 2  # Time before the current buoy candidate is forgotten
+MIN_BUOY_SIZE = 10  # Smallest cascade window width, in pixels
+MAX_BUOY_SIZE = 200  # Largest cascade window width, in pixels
+RED_ADAPTIVE_THRESH = 10  # How much redder than its surroundings a buoy pixel is
+RED_ADAPTIVE_THRESH_BLOCKSIZE = 51  # Size of those surroundings, must be odd
+MIN_BLOB_SIZE = 50  # Pixels in the smallest red blob the cascade looks around
+MAX_BLOBS = 8
+BLOB_MARGIN = 0.5  # How far around a blob the cascade looks, as a fraction of its size
 
 
 class BuoyNewEntity(VisionEntity):
@@ -30,6 +36,11 @@ class BuoyNewEntity(VisionEntity):
         self.seen_buoy_count = 0  # Used in initial_search
         self.last_buoy = None
         self.last_buoy_time = None
+        self.cascade = libvision.CascadeDetector(
+            libvision.cascade.cascade_path("buoy_cascade_4.xml"),
+            min_size=MIN_BUOY_SIZE, max_size=MAX_BUOY_SIZE, min_neighbors=0)
+        # Cascade is run around red blobs and last frame's buoys
+        self.roi_scheduler = libvision.RoiScheduler()
 
     def process_frame(self, frame):
         buoy_locations = []
@@ -101,7 +112,7 @@ class BuoyNewEntity(VisionEntity):
                 middle_buoy,
                 template_size,
                 tracking_size,
-                min_z_score=TRACKING_MIN_Z_SCORE,
+                min_contrast=TRACKING_MIN_CONTRAST,
                 alpha=TRACKING_ALPHA,
                 # debug=True,
             )
@@ -140,14 +151,9 @@ class BuoyNewEntity(VisionEntity):
         cv.CvtColor(frame, hsv, cv.CV_BGR2HSV)
         grey = libvision.misc.get_channel(hsv, 2)
 
-        # load a haar classifier
-        #hc = cv.Load("/home/seawolf/software/seawolf5/vision/buoy_cascade_4.xml")
-        hc = cv.Load(os.path.join(os.path.dirname(os.path.dirname(__file__)), "./cascades/buoy_cascade_4.xml"))
-
         # use classifier to detect buoys
-        minsize = (10, 10)
-        maxsize = (200, 200)
-        buoys = cv.HaarDetectObjects(grey, hc, cv.CreateMemStorage(), min_neighbors=0, min_size=minsize)  # , max_size=maxsize
+        buoys = self.cascade.detect(grey, self.roi_scheduler.rois(self.find_blobs(frame)))
+        self.roi_scheduler.update(buoys)
 
         if not buoys:
             return None, None
@@ -156,6 +162,29 @@ class BuoyNewEntity(VisionEntity):
         (x, y, w, h), n = buoys[0]
         return (x, y), w
 
+    def find_blobs(self, frame):
+        '''Returns the regions around red blobs, as (x, y, width, height).'''
+
+        red = libvision.misc.get_channel(frame, 2)
+        cv.AdaptiveThreshold(red, red,
+                             255,
+                             cv.CV_ADAPTIVE_THRESH_MEAN_C,
+                             cv.CV_THRESH_BINARY,
+                             RED_ADAPTIVE_THRESH_BLOCKSIZE,
+                             -1 * RED_ADAPTIVE_THRESH,
+                             )
+
+        labeled_image = cv.CreateImage(cv.GetSize(red), 8, 1)
+        blobs = libvision.blob.find_blobs(red, labeled_image, MIN_BLOB_SIZE, MAX_BLOBS)
+
+        regions = []
+        for blob in blobs:
+            x, y, w, h = blob.roi
+            d_x = int(w * BLOB_MARGIN)
+            d_y = int(h * BLOB_MARGIN)
+            regions.append((x - d_x, y - d_y, w + 2 * d_x, h + 2 * d_y))
+        return regions
+
 
 def scale_in_place(image, new_size):
     '''Mutates image to have size of new_size.
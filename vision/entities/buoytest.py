@@ -3,7 +3,6 @@ from __future__ import division
 import math
 
 import cv
-import os
 import svr
 
 from base import VisionEntity
@@ -69,6 +68,11 @@ class BuoyTestEntity(VisionEntity):
         # Thresholds
         self.minsize = 20
         self.maxsize = 40
+
+        # Buoy cascade, run around last frame's buoys
+        self.cascade = libvision.CascadeDetector(
+            libvision.cascade.cascade_path("buoy_cascade_4.xml"), min_size=self.minsize)
+        self.roi_scheduler = libvision.RoiScheduler()
         # Buoy Classes
         self.new = []
         self.candidates = []
@@ -90,15 +94,10 @@ class BuoyTestEntity(VisionEntity):
         cv.CvtColor(frame, hsv, cv.CV_BGR2HSV)
         grey = libvision.misc.get_channel(hsv, 2)
 
-        # load a haar classifier
-        #hc = cv.Load("/home/seawolf/software/seawolf5/vision/output.xml")
-        hc = cv.Load(os.path.join(os.path.dirname(os.path.dirname(__file__)), "./cascades/buoy_cascade_4.xml"))
-        #hc = cv.Load("/home/seawolf/software/seawolf5/vision/buoy_cascade_4.xml")
-
         # use classifier to detect buoys
-        minsize = (int(self.minsize), int(self.minsize))
-        maxsize = (int(self.maxsize), int(self.maxsize))
-        buoys = cv.HaarDetectObjects(grey, hc, cv.CreateMemStorage(), min_size=minsize)
+        self.cascade.set_size_range(int(self.minsize))
+        buoys = self.cascade.detect(grey, self.roi_scheduler.rois())
+        self.roi_scheduler.update(buoys)
 
         # compute average buoy size and extract to a list
         avg_w = 0
@@ -212,8 +212,9 @@ class DoublePathEntity(VisionEntity):
         self.path = None
         self.path_manager = PathManager(self.angle_hint, self.max_angle_distance)
 
-        self.hough_threshold = 55
+        self.min_line_length = 55
         self.lines_to_consider = 10
+        self.line_detector = libvision.LineDetector(min_length=self.min_line_length)
 
         sw.loadConfig("../conf/seawolf.conf")
         sw.init("DoublePath")
@@ -242,20 +243,12 @@ class DoublePathEntity(VisionEntity):
             mapping[blob.id] = 255
         libvision.greymap.greymap(blob_map, binary, mapping)
 
+        # Find the edges of the paths as lines
+        lines = self.line_detector.find_lines(binary, self.lines_to_consider)
+
         # Get Edges
         cv.Canny(binary, binary, 30, 40)
 
-        # Hough Transform
-        line_storage = cv.CreateMemStorage()
-        lines = cv.HoughLines2(binary, line_storage, cv.CV_HOUGH_STANDARD,
-                               rho=1,
-                               theta=math.pi / 180,
-                               threshold=self.hough_threshold,
-                               param1=0,
-                               param2=0
-                               )
-        lines = lines[:self.lines_to_consider]  # Limit number of lines
-
         if not lines:
             return
 
@@ -50,7 +50,8 @@ class GateEntity(VisionEntity):
         # Thresholds
         self.vertical_threshold = .26  # How close to vertical lines must be
         self.horizontal_threshold = 0.2  # How close to horizontal lines must be
-        self.hough_threshold = 30
+        self.min_line_length = 30
+        self.max_lines = 64
         self.adaptive_thresh_blocksize = 19
         self.adaptive_thresh = 4
         self.max_range = 300
@@ -70,11 +71,16 @@ class GateEntity(VisionEntity):
 
         self.found = False
 
+        self.line_detector = libvision.LineDetector(min_length=0)
+
+        # Hue channel of the frame, see process_frame
+        self.channel_converter = libvision.ColorConverter("hsv", "h")
+
         if self.debug:
             pass
             #cv.NamedWindow("Gate")
             #self.create_trackbar("adaptive_thresh", 20)
-            #self.create_trackbar("hough_threshold", 100)
+            #self.create_trackbar("min_line_length", 100)
 
     def process_frame(self, frame):
         (w,h) = cv.GetSize(frame)
@@ -109,12 +115,7 @@ class GateEntity(VisionEntity):
         cv.Smooth(frame, frame, cv.CV_MEDIAN, 7, 7)
 
         # Set binary image to have saturation channel
-        hsv = cv.CreateImage(cv.GetSize(frame), 8, 3)
-        binary = cv.CreateImage(cv.GetSize(frame), 8, 1)
-        cv.CvtColor(frame, hsv, cv.CV_BGR2HSV)
-        cv.SetImageCOI(hsv, 1)
-        cv.Copy(hsv, binary)
-        cv.SetImageCOI(hsv, 0)  #reset COI
+        binary = self.channel_converter.convert(frame)
         
         #shift hue of image such that orange->red are at top of spectrum
         '''
@@ -145,18 +146,9 @@ class GateEntity(VisionEntity):
         if self.debug:
             color_filtered = cv.CloneImage(binary)
 
-        # Get Edges
-        cv.Canny(binary, binary, 30, 40)
-
-        # Hough Transform
-        line_storage = cv.CreateMemStorage()
-        raw_lines = cv.HoughLines2(binary, line_storage, cv.CV_HOUGH_STANDARD,
-                                   rho=1,
-                                   theta=math.pi/180,
-                                   threshold=self.hough_threshold,
-                                   param1=0,
-                                   param2=0
-                                   )
+        # Find the edges of the poles as lines
+        raw_lines = self.line_detector.find_lines(binary, self.max_lines,
+                                                  self.min_line_length)
 
         # Get vertical lines
         vertical_lines = []
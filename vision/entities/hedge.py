@@ -79,6 +79,9 @@ class HedgeEntity(VisionEntity):
 
         self.frame_boundary_thresh = 32
 
+        # Saturation channel of the frame, see process_frame
+        self.channel_converter = libvision.ColorConverter("hsv", "s")
+
         if self.debug:
             pass
             # cv.NamedWindow("Hedge")
@@ -102,12 +105,7 @@ class HedgeEntity(VisionEntity):
         cv.Smooth(frame, frame, cv.CV_MEDIAN, 7, 7)
 
         # Set binary image to have value channel
-        hsv = cv.CreateImage(cv.GetSize(frame), 8, 3)
-        binary = cv.CreateImage(cv.GetSize(frame), 8, 1)
-        cv.CvtColor(frame, hsv, cv.CV_BGR2HSV)
-        cv.SetImageCOI(hsv, 2)
-        cv.Copy(hsv, binary)
-        cv.SetImageCOI(hsv, 0)
+        binary = self.channel_converter.convert(frame)
 
         cv.AdaptiveThreshold(binary, binary,
                              255,
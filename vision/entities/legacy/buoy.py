@@ -19,7 +19,7 @@ BUOY_YELLOW = 2
 INIT_SEARCH_LOST_TIMEOUT = 5  # Frames we stop looking for features after we don't see any features
 INIT_TRACKING_THRESHOLD = 3  # Frames to see buoys before tracking
 
-TRACKING_MIN_Z_SCORE = 10
+TRACKING_MIN_CONTRAST = 0.4
 TRACKING_ALPHA = 0.6
 TRACKING_TEMPLATE_MULTIPLIER = 0.25
 TRACKING_SEARCH_AREA_MULTIPLIER = 0.6
@@ -105,7 +105,7 @@ class BuoyEntity(VisionEntity):
                  buoy_dist * TRACKING_TEMPLATE_MULTIPLIER),
                 (buoy_dist * TRACKING_SEARCH_AREA_MULTIPLIER,
                  buoy_dist * TRACKING_SEARCH_AREA_MULTIPLIER),
-                min_z_score=TRACKING_MIN_Z_SCORE,
+                min_contrast=TRACKING_MIN_CONTRAST,
                 alpha=TRACKING_ALPHA,
                 # debug=True,
             )
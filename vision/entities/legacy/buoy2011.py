@@ -24,7 +24,7 @@ FILTER_SIZE = 11
 # However, if we align with the path first, the buoys will be much closer, and
 # this can be raised to 200.
 MIN_BLOB_SIZE = 200
-TRACKING_MIN_Z_SCORE = 15
+TRACKING_MIN_CONTRAST = 0.5
 TRACKING_ALPHA = 0.6
 TRACKING_TEMPLATE_MULTIPLIER = 2
 TRACKING_SEARCH_AREA_MULTIPLIER = 6
@@ -118,7 +118,7 @@ class Buoy2011Entity(VisionEntity):
                  blob.roi[3] * TRACKING_TEMPLATE_MULTIPLIER),
                 (blob.roi[2] * TRACKING_SEARCH_AREA_MULTIPLIER,
                  blob.roi[3] * TRACKING_SEARCH_AREA_MULTIPLIER),
-                min_z_score=TRACKING_MIN_Z_SCORE,
+                min_contrast=TRACKING_MIN_CONTRAST,
                 alpha=TRACKING_ALPHA,
                 debug=False,
             )
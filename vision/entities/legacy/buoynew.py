@@ -16,7 +16,7 @@ Point = namedtuple("Point", ["x", "y"])
 
 ############################### Tuning Values ###############################
 INIT_TRACKING_THRESHOLD = 6  # Frames to see buoys before tracking
-TRACKING_MIN_Z_SCORE = 10
+TRACKING_MIN_CONTRAST = 0.4
 TRACKING_ALPHA = 0.2
 MOVEMENT_THRESHOLD = 50  # Pixel distance the buoys are considered the same when finding buoys to track
 CANDIDATE_TIMEOUT = 2  # Time before the current buoy candidate is forgotten
@@ -101,7 +101,7 @@ class BuoyNewEntity(VisionEntity):
                 middle_buoy,
                 template_size,
                 tracking_size,
-                min_z_score=TRACKING_MIN_Z_SCORE,
+                min_contrast=TRACKING_MIN_CONTRAST,
                 alpha=TRACKING_ALPHA,
                 # debug=True,
             )
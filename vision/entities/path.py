@@ -26,7 +26,7 @@ class PathEntity(VisionEntity):
         self.min_value = 100
         self.max_value = 255
         self.theta_threshold = 0.1
-        self.hough_threshold = 55
+        self.min_line_length = 55
         self.lines_to_consider = 4  # Only consider the strongest so many lines
         self.seen_in_a_row_threshold = 2  # Must see path this many times in a row before reporting it
         self.R = 250
@@ -42,6 +42,8 @@ class PathEntity(VisionEntity):
 
         self.seen_in_a_row = 0
 
+        self.line_detector = libvision.LineDetector(min_length=0)
+
         if self.debug:
             cv.NamedWindow("Path")
             self.create_trackbar("R", 255) #250
@@ -57,7 +59,7 @@ class PathEntity(VisionEntity):
             #self.create_trackbar("max_saturation")
             #self.create_trackbar("min_value")
             #self.create_trackbar("max_value")
-            self.create_trackbar("hough_threshold", 100)
+            self.create_trackbar("min_line_length", 100)
             self.create_trackbar("lines_to_consider", 10)
 
     def process_frame(self, frame):
@@ -75,20 +77,13 @@ class PathEntity(VisionEntity):
             color_filtered = cv.CloneImage(binary)
             svr.debug("color_filtered", color_filtered)
 
+        # Find the edges of the path as lines
+        lines = self.line_detector.find_lines(binary, self.lines_to_consider,
+                                              self.min_line_length)
+
         # Get Edges
         cv.Canny(binary, binary, 30, 40)
 
-        # Hough Transform
-        line_storage = cv.CreateMemStorage()
-        lines = cv.HoughLines2(binary, line_storage, cv.CV_HOUGH_STANDARD,
-                               rho=1,
-                               theta=math.pi / 180,
-                               threshold=self.hough_threshold,
-                               param1=0,
-                               param2=0
-                               )
-        lines = lines[:self.lines_to_consider]  # Limit number of lines
-
         # If there are at least 2 lines and they are close to parallel...
         # There's a path!
         #print lines
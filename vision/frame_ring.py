@@ -0,0 +1,291 @@
+'''
+Shared memory ring of frames, written by one capture process and read by any
+number of entity processes.
+
+Each camera gets one FrameRing.  A capture process (see
+process_manager.run_capture) grabs and decodes every frame once and copies it
+into a free slot of the ring.  Entities read the most recent frame straight out
+of shared memory, so adding an entity on a camera doesn't add another decode
+or copy of every frame.
+
+Every frame put in the ring gets a sequence number, counting up from 0.
+Entities attach the sequence number of the frame their output was computed
+from, so results from different entities can be matched to the same frame.
+
+A slot is never overwritten while a reader holds it: each slot has a count of
+the readers using it, and the writer only picks slots that are not in use and
+aren't the newest frame.  If every slot is busy the new frame is dropped.
+
+Each reference also records the pid of the process holding it, so the slots
+of a reader that died without releasing them are not lost: when the writer
+finds no free slot, it first drops every reference held by a process that no
+longer exists.
+'''
+
+import ctypes
+import errno
+import os
+import time
+from multiprocessing import Condition
+from multiprocessing.sharedctypes import RawArray, RawValue
+
+import cv
+
+from libvision.cmodules.cmodule import to_iplimage_p
+
+# Enough for a 1920x1080 BGR frame
+DEFAULT_MAX_FRAME_BYTES = 1920 * 1080 * 3
+
+# Each reader holds at most one slot, and the writer needs one free slot on top
+# of the newest frame
+DEFAULT_SLOTS = 6
+
+# Most processes that can hold the same slot at once
+DEFAULT_MAX_READERS = 16
+
+
+class SlotHeader(ctypes.Structure):
+
+    '''Describes the frame held in one slot of the ring.'''
+    _fields_ = [
+        ("seq", ctypes.c_longlong),
+        ("width", ctypes.c_int),
+        ("height", ctypes.c_int),
+        ("depth", ctypes.c_int),
+        ("channels", ctypes.c_int),
+        ("step", ctypes.c_int),
+        ("refcount", ctypes.c_int),
+    ]
+
+
+class FrameRing(object):
+
+    '''A ring of frame slots in shared memory.
+
+    Must be created before the processes using it are started, and passed to
+    them as an argument.
+
+    Arguments:
+
+        slots - Number of frames the ring holds.  Should be at least the
+            number of readers plus two, or frames will be dropped.
+
+        max_frame_bytes - Size of each slot.  Frames larger than this can't be
+            put in the ring.
+
+        max_readers - Most reader processes that can hold the same slot.
+
+    '''
+
+    def __init__(self, slots=DEFAULT_SLOTS, max_frame_bytes=DEFAULT_MAX_FRAME_BYTES,
+                 max_readers=DEFAULT_MAX_READERS):
+        self.slots = slots
+        self.max_frame_bytes = max_frame_bytes
+        self.max_readers = max_readers
+        self.data = RawArray(ctypes.c_char, slots * max_frame_bytes)
+        self.headers = RawArray(SlotHeader, slots)
+
+        # Pid of the process holding each reference, max_readers entries per
+        # slot.  0 marks an unused entry.
+        self.holders = RawArray(ctypes.c_int, slots * max_readers)
+        self.condition = Condition()
+
+        # Slot holding the newest frame, and its sequence number
+        self.latest_slot = RawValue(ctypes.c_int, -1)
+        self.latest_seq = RawValue(ctypes.c_longlong, -1)
+
+        # Frames the writer had no free slot for
+        self.dropped = RawValue(ctypes.c_longlong, 0)
+
+        for header in self.headers:
+            header.seq = -1
+
+    def put(self, frame):
+        '''Copy frame into the ring and make it the newest frame.
+
+        Only one process may put frames in a ring.  Returns the sequence
+        number given to the frame, or None if it was dropped.
+        '''
+        step = frame.width * frame.nChannels * (frame.depth & 0xff) / 8
+        if step * frame.height > self.max_frame_bytes:
+            raise ValueError("Frame of %d bytes doesn't fit in ring slots of %d bytes" %
+                             (step * frame.height, self.max_frame_bytes))
+
+        with self.condition:
+            slot = self._free_slot()
+            if slot is None and self._reclaim():
+                slot = self._free_slot()
+            if slot is None:
+                self.dropped.value += 1
+                return None
+            seq = self.latest_seq.value + 1
+
+        # Readers only attach to the newest slot, so this one can be filled
+        # without holding the lock
+        image = to_iplimage_p(frame).contents
+        source = ctypes.cast(image.imageData, ctypes.c_void_p).value
+        destination = ctypes.addressof(self.data) + slot * self.max_frame_bytes
+        if image.widthStep == step:
+            ctypes.memmove(destination, source, step * frame.height)
+        else:
+            for row in xrange(frame.height):
+                ctypes.memmove(destination + row * step,
+                               source + row * image.widthStep, step)
+
+        with self.condition:
+            header = self.headers[slot]
+            header.seq = seq
+            header.width = frame.width
+            header.height = frame.height
+            header.depth = frame.depth
+            header.channels = frame.nChannels
+            header.step = step
+            self.latest_slot.value = slot
+            self.latest_seq.value = seq
+            self.condition.notify_all()
+
+        return seq
+
+    def _free_slot(self):
+        '''Oldest slot that is neither in use nor the newest frame.'''
+        best = None
+        for slot, header in enumerate(self.headers):
+            if slot == self.latest_slot.value or header.refcount > 0:
+                continue
+            if best is None or header.seq < self.headers[best].seq:
+                best = slot
+        return best
+
+    def _reclaim(self):
+        '''Drop the references held by processes that have exited.  Returns
+        the number of references dropped.'''
+        dropped = 0
+        for slot, header in enumerate(self.headers):
+            if header.refcount <= 0:
+                continue
+            for i in xrange(slot * self.max_readers, (slot + 1) * self.max_readers):
+                pid = self.holders[i]
+                if pid and not _process_exists(pid):
+                    self.holders[i] = 0
+                    header.refcount -= 1
+                    dropped += 1
+        return dropped
+
+    def acquire(self, after_seq, timeout=None):
+        '''Wait for a frame newer than after_seq and take a reference to it.
+
+        Returns (slot, seq), or None if no new frame arrived within timeout
+        seconds.  The slot must be given back with release().
+        '''
+        deadline = None if timeout is None else time.time() + timeout
+        with self.condition:
+            while self.latest_seq.value <= after_seq:
+                remaining = None if deadline is None else deadline - time.time()
+                if remaining is not None and remaining <= 0:
+                    return None
+                self.condition.wait(remaining)
+
+            slot = self.latest_slot.value
+            first = slot * self.max_readers
+            for i in xrange(first, first + self.max_readers):
+                if self.holders[i] == 0:
+                    self.holders[i] = os.getpid()
+                    break
+            else:
+                raise RuntimeError("More than %d readers hold the same frame" % self.max_readers)
+            self.headers[slot].refcount += 1
+            return slot, self.headers[slot].seq
+
+    def release(self, slot):
+        '''Give back a slot taken with acquire() by this process.'''
+        pid = os.getpid()
+        first = slot * self.max_readers
+        with self.condition:
+            for i in xrange(first, first + self.max_readers):
+                if self.holders[i] == pid:
+                    self.holders[i] = 0
+                    self.headers[slot].refcount -= 1
+                    break
+
+    def view(self, slot):
+        '''An IplImage whose data is the slot's memory.  No data is copied.'''
+        header = self.headers[slot]
+        size = header.step * header.height
+        buf = (ctypes.c_char * size).from_buffer(self.data, slot * self.max_frame_bytes)
+        image = cv.CreateImageHeader((header.width, header.height),
+                                     header.depth, header.channels)
+        cv.SetData(image, buf, header.step)
+        return image
+
+    def reader(self, copy=True, timeout=5):
+        return FrameRingReader(self, copy, timeout)
+
+
+def _process_exists(pid):
+    '''Whether a process with the given pid is running.  A process that
+    has exited but not been waited for by its parent doesn't count.'''
+    try:
+        os.kill(pid, 0)
+    except OSError as e:
+        return e.errno != errno.ESRCH
+
+    # The state follows the command name, which is in parentheses
+    try:
+        with open("/proc/%d/stat" % pid) as f:
+            return f.read().rsplit(")", 1)[1].split()[0] != "Z"
+    except (IOError, IndexError):
+        return True
+
+
+class FrameRingReader(object):
+
+    '''Reads the newest frames out of a FrameRing, one at a time.
+
+    Has the get_frame() method of libvision.Camera and svr.Stream, so an
+    entity can use it as its capture device.  Each get_frame() waits for a
+    frame newer than the last one returned, then hands back the previous
+    frame's slot.
+
+    Arguments:
+
+        copy - If True, get_frame() returns a private copy of the frame, which
+            may be drawn on.  If False it returns a view of shared memory,
+            which must not be written to, and is only valid until the next
+            get_frame() or close().
+
+        timeout - Seconds to wait for a new frame before raising
+            CaptureError.
+
+    '''
+
+    def __init__(self, ring, copy=True, timeout=5):
+        self.ring = ring
+        self.copy = copy
+        self.timeout = timeout
+        self.slot = None
+        self.frame_seq = -1
+
+    def get_frame(self):
+        acquired = self.ring.acquire(self.frame_seq, self.timeout)
+        if acquired is None:
+            raise self.CaptureError("No frame from the capture process in %s seconds" % self.timeout)
+
+        self.close()
+        self.slot, self.frame_seq = acquired
+
+        frame = self.ring.view(self.slot)
+        if self.copy:
+            frame = cv.CloneImage(frame)
+        return frame
+
+    def close(self):
+        if self.slot is not None:
+            self.ring.release(self.slot)
+            self.slot = None
+
+    __del__ = close
+
+    class CaptureError(ValueError):
+
+        '''No frame could be read from the ring.'''
+        pass
@@ -4,11 +4,20 @@ import blob
 from convert import *
 import letters
 import cmodules
+from cmodules import set_threads
 import filters
 import hist
 import misc
 import greymap
 import error
 from tracking import Tracker
-from buoy_analyzer import buoy_analyzer
+from buoy_analyzer import buoy_analyzer, buoy_region_stats, BuoyIntegral
 from line_reducer import hough_line_reduce
+from pipeline import Pipeline
+from pyramid import Pyramid
+import profiler
+import recording
+from line_segments import LineDetector
+from color_convert import ColorConverter
+from multi_tracker import MultiTracker
+from cascade import CascadeDetector, IntegralImages, RoiScheduler
@@ -5,11 +5,15 @@ from . import cmodules
 
 class Blob(object):
 
-    def __init__(self, cblob):
+    def __init__(self, cblob, track_id=None):
         # Id of blob. This is the index used in the image output by find_blobs
         # for this blob
         self.id = cblob.contents.id
 
+        # Id that stays the same from frame to frame, see BlobTracker.  For
+        # untracked blobs this is the same as id.
+        self.track_id = self.id if track_id is None else track_id
+
         # Pixels contained by the blob
         self.size = cblob.contents.size
 
@@ -22,8 +26,8 @@ class Blob(object):
                     cblob.contents.y_1 - cblob.contents.y_0)
 
 
-def find_blobs(img_in, img_out, min_blob_size, max_blobs, out_coloring=0):
-    """ find_blobs(img_in, img_out, min_blob_size, max_blobs, out_coloring=0)
+def find_blobs(img_in, img_out, min_blob_size, max_blobs, out_coloring=0, roi=None):
+    """ find_blobs(img_in, img_out, min_blob_size, max_blobs, out_coloring=0, roi=None)
 
     Locate blobs in the binary image img_in. Choose blobs having at least
     min_blob_size pixels, and choose no more than max_blobs. The blobs which
@@ -31,12 +35,55 @@ def find_blobs(img_in, img_out, min_blob_size, max_blobs, out_coloring=0):
     indexed image img_out. The index of a pixel in img_out is the id of the blob
     it belongs too (with 0 being no blob).
 
+    If roi is given as an (x, y, width, height) tuple, only that part of img_in
+    is searched.  Blob centroids and rois are still in full image coordinates.
+
     """
 
+    if roi is not None:
+        roi = cmodules.CvRect(*[int(v) for v in roi])
+
     num_blobs = ctypes.c_int()
-    cblobs = cmodules.cblob_mod._wrap_find_blobs(ctypes.py_object(img_in), ctypes.py_object(img_out), ctypes.pointer(num_blobs), min_blob_size, max_blobs, out_coloring)
+    cblobs = cmodules.cblob_mod._wrap_find_blobs_roi(ctypes.py_object(img_in), ctypes.py_object(img_out), ctypes.pointer(num_blobs), min_blob_size, max_blobs, out_coloring, roi)
 
     blobs = [Blob(cblobs[i]) for i in range(0, num_blobs.value)]
     cmodules.cblob_mod.free_blobs(cblobs, num_blobs)
 
     return blobs
+
+
+class BlobTracker(object):
+    """ BlobTracker(full_scan_interval=10, margin=16)
+
+    find_blobs for consecutive frames of one video stream.  Only the areas
+    around the previous frame's blobs are searched, growing their bounding
+    boxes by margin pixels.  The whole image is searched every
+    full_scan_interval frames, and whenever a blob is lost or moves more than
+    margin pixels, so new blobs appearing away from the others are found
+    within full_scan_interval frames.
+
+    Each blob returned has a track_id, which is kept from frame to frame while
+    the blob is followed.
+
+    """
+
+    def __init__(self, full_scan_interval=10, margin=16):
+        self.tracker = cmodules.cblob_mod.blob_tracker_new(full_scan_interval, margin)
+
+    def find_blobs(self, img_in, img_out, min_blob_size, max_blobs, out_coloring=0):
+        """Same as find_blobs, over the next frame of the stream."""
+        num_blobs = ctypes.c_int()
+        track_ids = (ctypes.c_uint32 * max_blobs)()
+        cblobs = cmodules.cblob_mod._wrap_find_blobs_tracked(self.tracker, ctypes.py_object(img_in), ctypes.py_object(img_out), ctypes.pointer(num_blobs), track_ids, min_blob_size, max_blobs, out_coloring)
+
+        blobs = [Blob(cblobs[i], track_ids[i]) for i in range(0, num_blobs.value)]
+        cmodules.cblob_mod.free_blobs(cblobs, num_blobs)
+
+        return blobs
+
+    def close(self):
+        if self.tracker:
+            cmodules.cblob_mod.blob_tracker_free(self.tracker)
+            self.tracker = None
+
+    __del__ = close
@@ -1,21 +1,83 @@
-
 import ctypes
 from . import cmodules
 
 
-def buoy_analyzer(src, buoys):
-    """Determine color of buoys in a single frame """
-
-    if not len(buoys):
-        return
-
+def _buoy_rois(buoys):
     rois = (cmodules.BuoyROIStruct_p * len(buoys))()
     # extract regions of interest for each buoy
     for i, buoy in enumerate(buoys):
         buoy_struct = cmodules.BuoyROIStruct(buoy.x, buoy.y, buoy.width, buoy.width)
         rois[i] = ctypes.pointer(buoy_struct)
+    return rois
+
+
+class BuoyIntegral(object):
+
+    '''Per channel integral images of a BGR frame.  Build them once per frame
+    with update() and pass them to every buoy_analyzer and buoy_region_stats
+    call on that frame.  Each instance belongs to one caller; share one
+    between threads only with your own locking.'''
+
+    def __init__(self):
+        self.integral = cmodules.buoy_analyzer.buoy_integral_new()
+
+    def update(self, src):
+        '''Sums src, an 8 bit 3 channel image.  Returns self.'''
+        cmodules.buoy_analyzer.buoy_integral_update(self.integral, src)
+        return self
+
+    def __del__(self):
+        if getattr(self, "integral", None):
+            cmodules.buoy_analyzer.buoy_integral_free(self.integral)
+            self.integral = None
+
+
+def buoy_analyzer(src, buoys, integral=None):
+    """Determine color of buoys in a single frame
+
+    If integral is given, the frame's average color is taken from it and the
+    buoys are analyzed with a vectorized kernel, which is much cheaper when
+    there are many candidate buoys.  integral is a BuoyIntegral already
+    updated with src, or True to build one for just this call.
 
-    color_sequence = cmodules.buoy_analyzer.buoy_color(src, rois, len(buoys))
+    """
+
+    if not len(buoys):
+        return
+
+    rois = _buoy_rois(buoys)
+
+    if integral:
+        if integral is True:
+            integral = BuoyIntegral().update(src)
+        color_sequence = cmodules.buoy_analyzer.buoy_color_integral(src, integral.integral, rois, len(buoys))
+    else:
+        color_sequence = cmodules.buoy_analyzer.buoy_color(src, rois, len(buoys))
 
     for i, buoy in enumerate(buoys):
         buoy.color = color_sequence[i]
+
+
+def buoy_region_stats(src, buoys, integral=None):
+    """Mean and variance of each channel over each buoy's region
+
+    Returns a list with a ((b, g, r), (b, g, r)) tuple of means and variances
+    for each buoy.  The sums come from integral, a BuoyIntegral already
+    updated with src, or one built for this call if not given.  Each buoy
+    costs the same no matter how large it is.
+
+    """
+
+    if not len(buoys):
+        return []
+
+    if integral is None:
+        integral = BuoyIntegral().update(src)
+
+    rois = _buoy_rois(buoys)
+    means = (ctypes.c_double * (3 * len(buoys)))()
+    variances = (ctypes.c_double * (3 * len(buoys)))()
+    cmodules.buoy_analyzer.buoy_region_stats(integral.integral, rois, len(buoys), means, variances)
+
+    return [(tuple(means[3*i:3*i+3]), tuple(variances[3*i:3*i+3]))
+            for i in range(len(buoys))]
@@ -1,19 +1,198 @@
 import os
+import threading
+import time
+import traceback
+import Queue
+
 import cv
 import cv2
+import numpy
 import svr
 
+from recording import RecordingReader, RecordingWriter, is_recording
+
+# Frames buffered by a capture thread: one being captured into, the newest
+# captured frame, and the one returned by the last get_frame()
+CAPTURE_BUFFERS = 3
+
+# Seconds close() waits for a capture thread to finish the frame it is
+# reading.  A camera that stops answering can block a read indefinitely, and
+# the thread is a daemon, so it is then left behind.
+CAPTURE_STOP_TIMEOUT = 2
+
+# Frames waiting to be written by the record thread before new frames are
+# dropped from the recording
+DEFAULT_RECORD_QUEUE_SIZE = 16
+
+# Seconds close() waits for the record thread to write the frames still
+# queued.  Any left are written after close() returns.
+RECORD_STOP_TIMEOUT = 5
+
+
+class CaptureThread(threading.Thread):
+
+    '''Captures frames from a camera in the background.
+
+    Frames are read into CAPTURE_BUFFERS buffers in turn.  The buffer given
+    out by the last get() is never captured into, so it stays valid until the
+    next get().  Any frame that is replaced by a newer one before get() is
+    called is dropped.
+
+    cv2 is used rather than cv because it lets other threads run while it
+    waits for the camera.
+
+    '''
+
+    def __init__(self, index):
+        threading.Thread.__init__(self, name="capture %s" % index)
+        self.daemon = True
+
+        self.index = index
+        self.capture = cv2.VideoCapture(index)
+        self.buffers = [None] * CAPTURE_BUFFERS
+        self.condition = threading.Condition()
+        self.running = True
+        self.error = None
+
+        # Buffer index, sequence number and time of the newest frame
+        self.newest = None
+        self.newest_seq = -1
+        self.newest_time = None
+
+        # Buffer index and sequence number of the frame last given out
+        self.held = None
+        self.held_seq = -1
+
+        # Frames replaced before they were given out
+        self.dropped = 0
+
+    def run(self):
+        while self.running:
+            with self.condition:
+                buffer_index = [i for i in xrange(CAPTURE_BUFFERS)
+                                if i != self.newest and i != self.held][0]
+
+            ok, image = self.capture.read(self.buffers[buffer_index])
+            now = time.time()
+
+            with self.condition:
+                if not ok:
+                    self.error = 'Could not capture frame from identifier "%s"' % self.index
+                    self.running = False
+                    self.condition.notify_all()
+                    break
+                if self.newest is not None and self.newest_seq != self.held_seq:
+                    self.dropped += 1
+                self.buffers[buffer_index] = image
+                self.newest = buffer_index
+                self.newest_seq += 1
+                self.newest_time = now
+                self.condition.notify_all()
+
+        self.capture.release()
+
+    def get(self):
+        '''Waits for a frame newer than the last one given out, and returns
+        (image, seq, timestamp).  image is a numpy array, which is valid until
+        the next call.'''
+        with self.condition:
+            while self.newest_seq == self.held_seq and self.running:
+                self.condition.wait(1)
+            if self.newest_seq == self.held_seq:
+                raise Camera.CaptureError(self.error or "The capture thread stopped.")
+            self.held = self.newest
+            self.held_seq = self.newest_seq
+            return self.buffers[self.held], self.held_seq, self.newest_time
+
+    def stop(self, timeout=CAPTURE_STOP_TIMEOUT):
+        '''Stops capturing.  Returns False if the thread was still reading a
+        frame after timeout seconds.'''
+        self.running = False
+        self.join(timeout)
+        return not self.is_alive()
+
+
+class RecordThread(threading.Thread):
+
+    '''Writes recorded frames in the background.
+
+    Frames are queued by put() and written by write(image, timestamp,
+    frame_number, variables), the arguments RecordingWriter.write() takes,
+    where image is a numpy array.  When the queue is full, put() drops the
+    frame instead of waiting, so recording never holds up vision.  A frame
+    that write() raises an exception for is left out and the exception is
+    printed.  close, if given, is called once the last frame is written.
+
+    '''
+
+    def __init__(self, write, queue_size=DEFAULT_RECORD_QUEUE_SIZE, close=None):
+        threading.Thread.__init__(self, name="record")
+        self.daemon = True
+        self.write = write
+        self.close = close
+        self.queue = Queue.Queue(queue_size)
+        self.stopping = False
+
+        # Frames not recorded because the queue was full
+        self.dropped = 0
+
+        # Frames not recorded because write() raised an exception
+        self.failed = 0
+
+    def put(self, image, timestamp, frame_number, variables=None):
+        '''Queues a copy of image, a numpy array, to be written.'''
+        try:
+            self.queue.put_nowait((numpy.array(image), timestamp, frame_number, variables))
+        except Queue.Full:
+            self.dropped += 1
+
+    def run(self):
+        try:
+            while True:
+                item = self.queue.get()
+                if item is None:
+                    break
+                try:
+                    self.write(*item)
+                except Exception:
+                    self.failed += 1
+                    traceback.print_exc()
+                # stop() can't queue None when the queue is full
+                if self.stopping and self.queue.empty():
+                    break
+        finally:
+            if self.close:
+                try:
+                    self.close()
+                except Exception:
+                    traceback.print_exc()
+
+    def stop(self, timeout=RECORD_STOP_TIMEOUT):
+        '''Writes the frames still queued, then stops.  No more frames may be
+        put.  Returns False if frames were still being written after timeout
+        seconds, in which case the thread goes on to finish them.'''
+        self.stopping = True
+        try:
+            self.queue.put_nowait(None)
+        except Queue.Full:
+            pass
+        self.join(timeout)
+        return not self.is_alive()
+
 
 class Camera(object):
 
     '''An wrapper for OpenCV's camera functionality.
 
-    Supports camera indexes, video files, and image files.
+    Supports camera indexes, video files, image files, and recordings (see
+    libvision.recording).
 
     '''
 
     def __init__(self, identifier, display=False, window_name=None,
-                 record_path=False):
+                 record_path=False, threaded=False,
+                 record_queue_size=DEFAULT_RECORD_QUEUE_SIZE,
+                 record_variables=None, record_compression="raw"):
         '''
         Arguments:
 
@@ -21,7 +200,8 @@ class Camera(object):
             passed to cv.CaptureFromFile() (if indentifier is a string) or
             cv.CaptureFromCAM() (if indentifier is an int).  This argument
             should be a filename of a video file, an index of a camera, or a
-            filename of an image.
+            filename of an image.  A filename ending in
+            libvision.recording.RECORDING_EXTENSION is read as a recording.
 
         display - If True, a graphical window will display the images captured
             from this camera.  cv.WaitKey must be called at some point for the
@@ -33,7 +213,29 @@ class Camera(object):
         record_path - If False, nothing will be recorded.  Otherwise a path to a
             directory to record video in should be given.  Video will be
             recorded into jpg files in the following format:
-            "<record_path>/%d.jpg".
+            "<record_path>/%d.jpg".  If record_path ends in
+            libvision.recording.RECORDING_EXTENSION, a single recording file
+            is written instead, which also holds each frame's capture time
+            and record_variables.  Frames are encoded and written by a
+            separate thread, see record_queue_size.
+
+        threaded - If True, cameras are captured by a background thread, and
+            get_frame() returns the newest frame captured, dropping any older
+            ones that weren't returned.  The frame returned points into the
+            thread's buffers and is only valid until the next get_frame(), so
+            it must be copied to be kept.  Files, which shouldn't drop frames,
+            are never captured in a thread.
+
+        record_queue_size - Number of frames that may wait to be recorded.
+            When the record thread falls further behind, frames are left out
+            of the recording rather than making get_frame() wait.
+
+        record_variables - A function returning a dict of values to store
+            with each frame of a recording, such as seawolf variables.  It is
+            called by get_frame() as each frame is captured.
+
+        record_compression - Compression of the frames of a recording, see
+            libvision.recording.RecordingWriter.
 
         '''
 
@@ -45,6 +247,22 @@ class Camera(object):
         self.capture = None  # Underlying opencv capture object
         self.frame_count = 0
         self.dc1394_capture = None
+        self.threaded = threaded
+        self.record_queue_size = record_queue_size
+        self.record_variables = record_variables
+        self.record_compression = record_compression
+        self.capture_thread = None
+        self.record_thread = None
+        self.recording = None  # Recording being replayed
+
+        # Variables stored with the frame last returned, when replaying a
+        # recording
+        self.variables = None
+
+        # Sequence number and time.time() of the frame last returned.  With a
+        # capture thread, gaps in frame_seq are frames that were dropped.
+        self.frame_seq = -1
+        self.frame_time = None
 
         if display:
             pass  # cv.NamedWindow(self.get_window_name())
@@ -59,12 +277,29 @@ class Camera(object):
         '''Gets a frame from the camera.'''
         self.frame_count += 1
 
-        if not self.capture and not self.image and not self.dc1394_capture:
+        if not self.capture and not self.image and not self.dc1394_capture \
+                and not self.capture_thread and not self.recording:
             self.open_capture()
 
         if self.image:
             return cv.CloneImage(self.image)
 
+        if self.recording:
+            if self.frame_seq + 1 >= len(self.recording):
+                raise self.CaptureError("The video has run out of frames.")
+            self.frame_seq += 1
+            frame, self.frame_time, _, self.variables = self.recording.frame(self.frame_seq)
+            self._show_and_record(frame)
+            return frame
+
+        if self.capture_thread:
+            image, self.frame_seq, self.frame_time = self.capture_thread.get()
+            frame = cv.GetImage(cv.fromarray(image))
+            self._show_and_record(frame, image)
+            return frame
+
+        self.frame_seq += 1
+        self.frame_time = time.time()
         if self.dc1394_capture:
             frame = self.dc1394_capture.get_frame()
         else:
@@ -99,16 +334,44 @@ class Camera(object):
             #      permissions for the file.
 
 
+        self._show_and_record(frame)
+        return frame
+
+    def _show_and_record(self, frame, image=None):
+        '''Displays and records frame.  image is frame as a numpy array, if
+        the caller has it.'''
+
         #TODO: doesn't work. svr.debug doesn't accept debug request?
         if self.display:
             #cv.ShowImage(self.get_window_name(), frame)
             svr.debug(self.get_window_name(), frame)
 
         if self.record_path:
-            filename = os.path.join(self.record_path, "%s.jpg" % self.frame_count)
-            cv.SaveImage(filename, frame)
-
-        return frame
+            if not self.record_thread:
+                if is_recording(self.record_path):
+                    writer = RecordingWriter(self.record_path, self.record_compression)
+                    self.record_thread = RecordThread(writer.write, self.record_queue_size, writer.close)
+                else:
+                    self.record_thread = RecordThread(self._write_jpg, self.record_queue_size)
+                self.record_thread.start()
+            if image is None:
+                image = numpy.asarray(frame[:, :])
+            variables = self.record_variables() if self.record_variables else None
+            self.record_thread.put(image, self.frame_time, self.frame_count, variables)
+
+    def _write_jpg(self, image, timestamp, frame_number, variables):
+        '''Runs in the record thread.'''
+        filename = os.path.join(self.record_path, "%s.jpg" % frame_number)
+        cv2.imwrite(filename, image)
+
+    def seek(self, frame_number):
+        '''Makes frame_number the next frame get_frame() returns.  Only
+        recordings can be seeked.'''
+        if not is_recording(self.identifier):
+            raise self.CaptureError("Only recordings can be seeked.")
+        if not self.recording:
+            self.open_capture()
+        self.frame_seq = frame_number - 1
 
     def open_capture(self):
         '''Opens the underlying capture device.
@@ -121,13 +384,20 @@ class Camera(object):
             self.identifier = int(self.identifier)
         except ValueError:
             pass
-        if isinstance(self.identifier, basestring):
+        if is_recording(self.identifier):
+            self.recording = RecordingReader(self.identifier)
+            self.record_path = False  # Don't re-record recordings
+        elif isinstance(self.identifier, basestring):
             self.capture = cv.CaptureFromFile(self.identifier)
             self.record_path = False  # Don't re-record avi files
+        elif self.threaded:
+            self.capture_thread = CaptureThread(self.identifier)
+            self.capture_thread.start()
         else:
             self.capture = cv.CaptureFromCAM(self.identifier)
 
-        if self.record_path and not os.path.exists(self.record_path):
+        if self.record_path and not is_recording(self.record_path) \
+                and not os.path.exists(self.record_path):
             os.mkdir(self.record_path)
 
     def close(self):
@@ -139,6 +409,17 @@ class Camera(object):
         if self.capture:
             del self.capture
         self.capture = None
+        if getattr(self, "capture_thread", None):
+            if not self.capture_thread.stop():
+                print "Warning: camera %s is not answering, its capture thread was left running" % self.identifier
+            self.capture_thread = None
+        if getattr(self, "record_thread", None):
+            if not self.record_thread.stop():
+                print "Warning: recording to %s is still being written" % self.record_path
+            self.record_thread = None
+        if getattr(self, "recording", None):
+            self.recording.close()
+            self.recording = None
         if self.dc1394_capture:
             self.dc1394_capture.close()
             self.dc1394_capture = None
@@ -0,0 +1,192 @@
+'''
+Haar cascade detection, restricted to the window sizes and regions of a frame
+that are worth looking at.
+
+The cascades in vision/cascades were run with cv.HaarDetectObjects over the
+whole frame, which is too slow to keep up with the camera.  CascadeDetector
+runs the same cascades in C (see cmodules/src/cascade.c), and only:
+
+    - over a range of window sizes,
+    - inside given regions of the frame, such as the blobs found by color
+      thresholding, or around last frame's hits (see RoiScheduler),
+    - on integral images computed once per frame (see IntegralImages), which
+      every detector run on the frame shares.
+
+Window sizes are shared between the threads set with libvision.set_threads.
+Hits are the same as a full frame scan would find inside the regions,
+whatever the number of threads.
+'''
+
+import ctypes
+import os
+
+import cv
+
+from . import cmodules
+
+CASCADE_DIR = os.path.join(os.path.dirname(os.path.dirname(os.path.abspath(__file__))), "cascades")
+
+# Most hits returned from one detection
+DEFAULT_MAX_HITS = 256
+
+
+def cascade_path(name):
+    '''Path of a cascade in vision/cascades, such as "buoy_cascade_4.xml".'''
+    return os.path.join(CASCADE_DIR, name)
+
+
+class IntegralImages(object):
+
+    '''The sum, sum of squares and 45 degree tilted sum of a grey frame, as
+    computed by cv.Integral.  Compute them once per frame with update() and
+    pass them to every CascadeDetector.detect call on it.'''
+
+    def __init__(self):
+        self.size = None
+        self.sum = None
+        self.sqsum = None
+        self.tilted = None
+
+    def update(self, grey):
+        '''Computes the sums of grey, an 8 bit single channel image.  Returns
+        self.'''
+        size = cv.GetSize(grey)
+        if size != self.size:
+            self.size = size
+            sum_size = (size[0] + 1, size[1] + 1)
+            self.sum = cv.CreateImage(sum_size, cv.IPL_DEPTH_32S, 1)
+            self.sqsum = cv.CreateImage(sum_size, cv.IPL_DEPTH_64F, 1)
+            self.tilted = cv.CreateImage(sum_size, cv.IPL_DEPTH_32S, 1)
+        cv.Integral(grey, self.sum, self.sqsum, self.tilted)
+        return self
+
+
+class CascadeDetector(object):
+
+    '''Finds objects with a Haar cascade.
+
+    Arguments:
+
+        path - Cascade file, as written by opencv_haartraining.  See
+            cascade_path.
+
+        min_size, max_size - Smallest and largest window widths tried, in
+            pixels.  A max_size of 0 tries windows up to the size of the frame.
+
+        scale_factor - Ratio between one window size and the next, as given to
+            cv.HaarDetectObjects.
+
+        min_neighbors - As given to cv.HaarDetectObjects: hits are grouped,
+            and groups of min_neighbors hits or fewer are dropped.  0 returns
+            every hit without grouping.
+
+        num_threads - Most threads to share window sizes between, out of
+            those set with libvision.set_threads.  0 for all of them.
+
+    '''
+
+    def __init__(self, path, min_size=0, max_size=0, scale_factor=1.1,
+                 min_neighbors=3, num_threads=0, max_hits=DEFAULT_MAX_HITS):
+
+        self.config = cmodules.CascadeConfig()
+        self.config.min_size = int(min_size)
+        self.config.max_size = int(max_size)
+        self.config.scale_factor = scale_factor
+        self.config.min_neighbors = min_neighbors
+        self.config.num_threads = num_threads
+
+        self.max_hits = max_hits
+        self.results = (cmodules.CascadeHit * max_hits)()
+        self.integral = IntegralImages()
+        self.cascade = cmodules.cascade.cascade_new(path, ctypes.byref(self.config))
+        if not self.cascade:
+            raise ValueError("Could not load cascade %s" % path)
+
+    def set_size_range(self, min_size, max_size=0):
+        '''Changes the range of window widths tried.'''
+        self.config.min_size = int(min_size)
+        self.config.max_size = int(max_size)
+        cmodules.cascade.cascade_set_config(self.cascade, ctypes.byref(self.config))
+
+    def detect(self, grey, rois=None, integral=None):
+        '''Finds objects in grey, an 8 bit single channel image.
+
+        rois is a list of (x, y, width, height) regions to look in, or None
+        for the whole frame.  Regions are clipped to the frame, and those that
+        overlap are merged.  integral is an IntegralImages already updated
+        with grey, computed here if not given.
+
+        Returns the objects found as a list of ((x, y, width, height),
+        neighbors), like cv.HaarDetectObjects.
+        '''
+        if integral is None:
+            integral = self.integral.update(grey)
+
+        crois = None
+        num_rois = 0
+        if rois is not None:
+            num_rois = len(rois)
+            crois = (cmodules.CvRect * max(num_rois, 1))()
+            for i, roi in enumerate(rois):
+                crois[i] = cmodules.CvRect(*[int(v) for v in roi])
+
+        count = cmodules.cascade.cascade_detect(
+            self.cascade, integral.sum, integral.sqsum, integral.tilted,
+            crois, num_rois, self.results, self.max_hits)
+        if count < 0:
+            raise ValueError("Cascade detection failed")
+
+        hits = self.results[:min(count, self.max_hits)]
+        return [((h.x, h.y, h.width, h.height), h.neighbors) for h in hits]
+
+    def close(self):
+        if getattr(self, "cascade", None):
+            cmodules.cascade.cascade_free(self.cascade)
+            self.cascade = None
+
+    __del__ = close
+
+
+class RoiScheduler(object):
+
+    '''Chooses the regions a CascadeDetector looks in each frame.
+
+    Objects are looked for around where they were last frame, and in any
+    regions suggested for the frame, such as blobs of the object's color.  The
+    whole frame is scanned every full_scan_interval frames, and whenever
+    there is nowhere else to look, so new objects are still found.
+
+    Arguments:
+
+        margin - How far around a hit to look next frame, as a fraction of
+            the hit's size on each side.
+
+        full_scan_interval - Frames between full frame scans.  0 never scans
+            the whole frame while there are regions to look in.
+
+    '''
+
+    def __init__(self, margin=0.5, full_scan_interval=10):
+        self.margin = margin
+        self.full_scan_interval = full_scan_interval
+        self.frames_since_full_scan = 0
+        self.previous = []
+
+    def rois(self, suggested=()):
+        '''Returns the regions to look in this frame, or None to scan the
+        whole frame.  suggested is a list of (x, y, width, height) regions.'''
+        rois = list(suggested) + self.previous
+        if not rois or (self.full_scan_interval and
+                        self.frames_since_full_scan >= self.full_scan_interval):
+            self.frames_since_full_scan = 0
+            return None
+        self.frames_since_full_scan += 1
+        return rois
+
+    def update(self, hits):
+        '''Records this frame's hits, as returned by CascadeDetector.detect.'''
+        self.previous = []
+        for (x, y, w, h), n in hits:
+            d_x = int(w * self.margin)
+            d_y = int(h * self.margin)
+            self.previous.append((x - d_x, y - d_y, w + 2 * d_x, h + 2 * d_y))
@@ -55,28 +55,51 @@ module.
 
 Limitations
 -----------
-TODO
+IplImage_p arguments are handed to C as the image's own IplImage, without
+copying any image data.  C functions may write to them, and the changes are
+seen from Python.  This is the cheapest way to get output from a module:
+create the output image once in Python and pass it in on every call.
+
+None may be given for an IplImage_p argument, and is passed as NULL.  Only
+do this where the C function documents the image as optional.
+
+An IplImage_p return value has to be copied into a new Python image and the C
+image is then released, so it must have been allocated with cvCreateImage.
 
 '''
-# TODO: Write Limitations section
 # TODO: Where does documentation for modules go?
 
 import ctypes
 
 from cmodule import CModule, CFunction
-from cvtypes import IplImage, IplImage_p, CvPoint
+from cvtypes import IplImage, IplImage_p, CvPoint, CvRect, CvRect_p
 
 
 # Target Color Module
+#
+# The _roi variants take two extra arguments: a CvRect (or None for the whole
+# frame) limiting where thresholding is done, and a decimation factor for the
+# sampling grid the color histogram is built from.  The _into variants take
+# the same arguments, but write into the single channel image given after the
+# frame instead of returning a new one.  The _level variants threshold a
+# subsampled copy of a frame, see libvision.pyramid.
 
 target_color_rgb = CModule("target_color_rgb.so", [
-    CFunction("find_target_color_rgb", IplImage_p, [IplImage_p, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_double])
+    CFunction("find_target_color_rgb", IplImage_p, [IplImage_p, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_double]),
+    CFunction("find_target_color_rgb_roi", IplImage_p, [IplImage_p, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_double, CvRect_p, ctypes.c_int]),
+    CFunction("find_target_color_rgb_into", ctypes.c_int, [IplImage_p, IplImage_p, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_double, CvRect_p, ctypes.c_int]),
+    CFunction("find_target_color_rgb_level", ctypes.c_int, [IplImage_p, IplImage_p, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_double, ctypes.c_int]),
+    CFunction("pool_set_threads", None, [ctypes.c_int]),
 ])
 
 # Target Color HSV Module
 
 target_color_hsv = CModule("target_color_hsv.so", [
-    CFunction("find_target_color_hsv", IplImage_p, [IplImage_p, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_double])
+    CFunction("find_target_color_hsv", IplImage_p, [IplImage_p, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_double]),
+    CFunction("find_target_color_hsv_roi", IplImage_p, [IplImage_p, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_double, CvRect_p, ctypes.c_int]),
+    CFunction("find_target_color_hsv_into", ctypes.c_int, [IplImage_p, IplImage_p, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_double, CvRect_p, ctypes.c_int]),
+    CFunction("find_target_color_hsv_level", ctypes.c_int, [IplImage_p, IplImage_p, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_double, ctypes.c_int]),
+    CFunction("pool_set_threads", None, [ctypes.c_int]),
 ])
 
 # Shape Detect Module
@@ -112,7 +135,13 @@ class BuoyROIStruct(ctypes.Structure):
 BuoyROIStruct_p = ctypes.POINTER(BuoyROIStruct)
 BuoyROIStruct_p_p = ctypes.POINTER(BuoyROIStruct_p)
 buoy_analyzer = CModule("buoy_analyzer.so", [
-    CFunction("buoy_color", ctypes.POINTER(ctypes.c_int), [IplImage_p, BuoyROIStruct_p_p, ctypes.c_int])
+    CFunction("buoy_color", ctypes.POINTER(ctypes.c_int), [IplImage_p, BuoyROIStruct_p_p, ctypes.c_int]),
+    CFunction("buoy_integral_new", ctypes.c_void_p, []),
+    CFunction("buoy_integral_update", None, [ctypes.c_void_p, IplImage_p]),
+    CFunction("buoy_integral_free", None, [ctypes.c_void_p]),
+    CFunction("buoy_color_integral", ctypes.POINTER(ctypes.c_int), [IplImage_p, ctypes.c_void_p, BuoyROIStruct_p_p, ctypes.c_int]),
+    CFunction("buoy_region_stats", None, [ctypes.c_void_p, BuoyROIStruct_p_p, ctypes.c_int, ctypes.POINTER(ctypes.c_double), ctypes.POINTER(ctypes.c_double)]),
+    CFunction("pool_set_threads", None, [ctypes.c_int]),
 ])
 
 # Instantiate CModule objects below:
@@ -161,9 +190,289 @@ cBlob_p_p = ctypes.POINTER(cBlob_p)
 
 cblob_mod = CModule("blob2.so", [
     CFunction("_wrap_find_blobs", cBlob_p_p, [ctypes.py_object, ctypes.py_object, ctypes.POINTER(ctypes.c_int), ctypes.c_int, ctypes.c_int, ctypes.c_int]),
-    CFunction("free_blobs", None, [cBlob_p_p, ctypes.c_int])
+    CFunction("_wrap_find_blobs_roi", cBlob_p_p, [ctypes.py_object, ctypes.py_object, ctypes.POINTER(ctypes.c_int), ctypes.c_int, ctypes.c_int, ctypes.c_int, CvRect_p]),
+    CFunction("free_blobs", None, [cBlob_p_p, ctypes.c_int]),
+    CFunction("blob_tracker_new", ctypes.c_void_p, [ctypes.c_int, ctypes.c_int]),
+    CFunction("_wrap_find_blobs_tracked", cBlob_p_p, [ctypes.c_void_p, ctypes.py_object, ctypes.py_object, ctypes.POINTER(ctypes.c_int), ctypes.POINTER(ctypes.c_uint32), ctypes.c_int, ctypes.c_int, ctypes.c_int]),
+    CFunction("blob_tracker_free", None, [ctypes.c_void_p]),
+    CFunction("pool_set_threads", None, [ctypes.c_int]),
 ])
 
 cgreymap_mod = CModule("greymap.so", [
-    CFunction("_wrap_greymap", None, [ctypes.py_object, ctypes.py_object, ctypes.c_ubyte * 256])
+    CFunction("_wrap_greymap", ctypes.c_int, [ctypes.py_object, ctypes.py_object, ctypes.c_ubyte * 256]),
+    CFunction("_wrap_greymap_bands", ctypes.c_int, [ctypes.py_object, ctypes.py_object, ctypes.c_ubyte * 256, ctypes.c_int]),
+    CFunction("pool_set_threads", None, [ctypes.c_int]),
+])
+
+# Pipeline Module
+#
+# Runs color targeting, morphology, blob labeling and buoy color analysis in a
+# single call.  See pipeline.c and libvision.pipeline.
+
+PIPELINE_RGB = 0
+PIPELINE_HSV = 1
+
+
+class PipelineConfig(ctypes.Structure):
+    _fields_ = [
+        ("color_space", ctypes.c_int),
+        ("target", ctypes.c_int * 3),
+        ("min_blobsize", ctypes.c_int),
+        ("dev_threshold", ctypes.c_int),
+        ("precision_threshold", ctypes.c_double),
+        ("decimation", ctypes.c_int),
+        ("morph_open", ctypes.c_int),
+        ("morph_close", ctypes.c_int),
+        ("min_blob_size", ctypes.c_int),
+        ("max_blobs", ctypes.c_int),
+        ("analyze_color", ctypes.c_int),
+    ]
+PipelineConfig_p = ctypes.POINTER(PipelineConfig)
+
+
+class PipelineBlob(ctypes.Structure):
+    _fields_ = [
+        ("id", ctypes.c_int32),
+        ("size", ctypes.c_int32),
+        ("c_x", ctypes.c_int32),
+        ("c_y", ctypes.c_int32),
+        ("x", ctypes.c_int32),
+        ("y", ctypes.c_int32),
+        ("w", ctypes.c_int32),
+        ("h", ctypes.c_int32),
+        ("color", ctypes.c_int32),
+    ]
+PipelineBlob_p = ctypes.POINTER(PipelineBlob)
+
+pipeline = CModule("pipeline.so", [
+    CFunction("pipeline_new", ctypes.c_void_p, [PipelineConfig_p]),
+    CFunction("pipeline_run", ctypes.c_int, [ctypes.c_void_p, IplImage_p, CvRect_p, PipelineBlob_p, ctypes.c_int]),
+    CFunction("pipeline_free", None, [ctypes.c_void_p]),
+    CFunction("pool_set_threads", None, [ctypes.c_int]),
 ])
+
+# Pyramid Module
+#
+# Color targeting and blob finding on a downsampled copy of the frame, refined
+# at full resolution.  See pyramid.c and libvision.pyramid.
+
+PYRAMID_RGB = 0
+PYRAMID_HSV = 1
+
+pyramid = CModule("pyramid.so", [
+    CFunction("pyramid_new", ctypes.c_void_p, [ctypes.c_int, ctypes.c_int]),
+    CFunction("pyramid_find_blobs", cBlob_p_p, [ctypes.c_void_p, IplImage_p, ctypes.POINTER(ctypes.c_int), ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_double, ctypes.c_int, ctypes.c_int]),
+    CFunction("pyramid_last_level", ctypes.c_int, [ctypes.c_void_p]),
+    CFunction("pyramid_free", None, [ctypes.c_void_p]),
+    CFunction("free_blobs", None, [cBlob_p_p, ctypes.c_int]),
+    CFunction("pool_set_threads", None, [ctypes.c_int]),
+])
+
+# Line Segments Module
+#
+# Line segment detection on a mask, without a Hough transform.  See
+# line_segments.c and libvision.line_segments.
+
+
+class LineConfig(ctypes.Structure):
+    _fields_ = [
+        ("gradient_threshold", ctypes.c_double),
+        ("angle_tolerance", ctypes.c_double),
+        ("min_density", ctypes.c_double),
+        ("min_length", ctypes.c_double),
+        ("merge_angle", ctypes.c_double),
+        ("merge_distance", ctypes.c_double),
+        ("merge_gap", ctypes.c_double),
+    ]
+LineConfig_p = ctypes.POINTER(LineConfig)
+
+
+class LineSegment(ctypes.Structure):
+    _fields_ = [
+        ("x_0", ctypes.c_float),
+        ("y_0", ctypes.c_float),
+        ("x_1", ctypes.c_float),
+        ("y_1", ctypes.c_float),
+        ("width", ctypes.c_float),
+        ("length", ctypes.c_float),
+        ("angle", ctypes.c_float),
+        ("pixels", ctypes.c_int32),
+    ]
+LineSegment_p = ctypes.POINTER(LineSegment)
+
+line_segments = CModule("line_segments.so", [
+    CFunction("line_detector_new", ctypes.c_void_p, [LineConfig_p]),
+    CFunction("line_detector_run", ctypes.c_int, [ctypes.c_void_p, IplImage_p, LineSegment_p, ctypes.c_int]),
+    CFunction("line_detector_free", None, [ctypes.c_void_p]),
+])
+
+# Color Convert Module
+#
+# BGR to HSV or Lab, written to one single channel image per channel.  Any of
+# the outputs may be None.  threshold_hsv is libvision.filters.hsv_filter's
+# thresholding.  See color_convert.c and libvision.color_convert.
+
+color_convert = CModule("color_convert.so", [
+    CFunction("convert_hsv", ctypes.c_int, [IplImage_p, IplImage_p, IplImage_p, IplImage_p]),
+    CFunction("convert_lab", ctypes.c_int, [IplImage_p, IplImage_p, IplImage_p, IplImage_p]),
+    CFunction("threshold_hsv", ctypes.c_int, [IplImage_p, IplImage_p, ctypes.c_double, ctypes.c_double, ctypes.c_double, ctypes.c_double, ctypes.c_double, ctypes.c_double, ctypes.c_int]),
+])
+
+# Histogram Module
+#
+# Grey level histogram of an image, its mean, variance, a z score and Otsu's
+# threshold in one call.  See histogram.c and libvision.hist.image_stats.
+
+
+class HistogramStats(ctypes.Structure):
+    _fields_ = [
+        ("counts", ctypes.c_uint32 * 256),
+        ("total", ctypes.c_uint32),
+        ("mean", ctypes.c_double),
+        ("variance", ctypes.c_double),
+        ("z_score", ctypes.c_double),
+        ("otsu_threshold", ctypes.c_int),
+    ]
+HistogramStats_p = ctypes.POINTER(HistogramStats)
+
+histogram = CModule("histogram.so", [
+    CFunction("histogram_stats", ctypes.c_int, [IplImage_p, CvRect_p, ctypes.c_double, HistogramStats_p]),
+])
+
+# Template Tracker Module
+#
+# Tracks an object between frames by normalized cross correlation, searched
+# coarse to fine on an image pyramid.  See template_tracker.c and
+# libvision.tracking.Tracker.
+
+
+class TrackerMatch(ctypes.Structure):
+    _fields_ = [
+        ("x", ctypes.c_int32),
+        ("y", ctypes.c_int32),
+        ("score", ctypes.c_double),
+        ("contrast", ctypes.c_double),
+        ("found", ctypes.c_int32),
+    ]
+TrackerMatch_p = ctypes.POINTER(TrackerMatch)
+
+template_tracker = CModule("template_tracker.so", [
+    CFunction("template_tracker_new", ctypes.c_void_p, [IplImage_p, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_int, ctypes.c_double, ctypes.c_double, ctypes.c_int]),
+    CFunction("template_tracker_locate", ctypes.c_int, [ctypes.c_void_p, IplImage_p, TrackerMatch_p]),
+    CFunction("template_tracker_template", ctypes.c_int, [ctypes.c_void_p, IplImage_p]),
+    CFunction("template_tracker_free", None, [ctypes.c_void_p]),
+])
+
+# Multi Tracker Module
+#
+# Follows many objects from frame to frame, from the detections found in each
+# frame.  See multi_tracker.c and libvision.multi_tracker.
+
+
+class MotConfig(ctypes.Structure):
+    _fields_ = [
+        ("process_noise", ctypes.c_double),
+        ("measurement_noise", ctypes.c_double),
+        ("initial_speed", ctypes.c_double),
+        ("gate", ctypes.c_double),
+        ("max_size_ratio", ctypes.c_double),
+        ("confirm_hits", ctypes.c_int32),
+        ("max_missed", ctypes.c_int32),
+        ("greedy", ctypes.c_int32),
+    ]
+MotConfig_p = ctypes.POINTER(MotConfig)
+
+
+class MotDetection(ctypes.Structure):
+    _fields_ = [
+        ("x", ctypes.c_float),
+        ("y", ctypes.c_float),
+        ("size", ctypes.c_float),
+    ]
+MotDetection_p = ctypes.POINTER(MotDetection)
+
+
+class MotTrack(ctypes.Structure):
+    _fields_ = [
+        ("id", ctypes.c_uint32),
+        ("state", ctypes.c_int32),
+        ("x", ctypes.c_float),
+        ("y", ctypes.c_float),
+        ("v_x", ctypes.c_float),
+        ("v_y", ctypes.c_float),
+        ("sigma_x", ctypes.c_float),
+        ("sigma_y", ctypes.c_float),
+        ("size", ctypes.c_float),
+        ("hits", ctypes.c_int32),
+        ("missed", ctypes.c_int32),
+        ("detection", ctypes.c_int32),
+    ]
+MotTrack_p = ctypes.POINTER(MotTrack)
+
+multi_tracker = CModule("multi_tracker.so", [
+    CFunction("mot_new", ctypes.c_void_p, [MotConfig_p]),
+    CFunction("mot_update", ctypes.c_int, [ctypes.c_void_p, MotDetection_p, ctypes.c_int, MotTrack_p, ctypes.c_int]),
+    CFunction("mot_free", None, [ctypes.c_void_p]),
+])
+
+# Line Reducer Module
+#
+# Groups line segments, such as the output of cv2.HoughLinesP, into one line
+# per edge.  See line_reducer.c and libvision.line_reducer.
+
+line_reducer = CModule("line_reducer.so", [
+    CFunction("line_reduce", ctypes.c_int, [ctypes.POINTER(ctypes.c_float), ctypes.c_int, ctypes.c_double, ctypes.c_double, ctypes.c_double, ctypes.POINTER(ctypes.c_float)]),
+])
+
+# Cascade Module
+#
+# Haar cascade detection from precomputed integral images, over a range of
+# window sizes and only inside given regions.  See cascade.c and
+# libvision.cascade.
+
+
+class CascadeConfig(ctypes.Structure):
+    _fields_ = [
+        ("min_size", ctypes.c_int32),
+        ("max_size", ctypes.c_int32),
+        ("scale_factor", ctypes.c_double),
+        ("min_neighbors", ctypes.c_int32),
+        ("num_threads", ctypes.c_int32),
+    ]
+CascadeConfig_p = ctypes.POINTER(CascadeConfig)
+
+
+class CascadeHit(ctypes.Structure):
+    _fields_ = [
+        ("x", ctypes.c_int32),
+        ("y", ctypes.c_int32),
+        ("width", ctypes.c_int32),
+        ("height", ctypes.c_int32),
+        ("neighbors", ctypes.c_int32),
+    ]
+CascadeHit_p = ctypes.POINTER(CascadeHit)
+
+cascade = CModule("cascade.so", [
+    CFunction("cascade_new", ctypes.c_void_p, [ctypes.c_char_p, CascadeConfig_p]),
+    CFunction("cascade_set_config", None, [ctypes.c_void_p, CascadeConfig_p]),
+    CFunction("cascade_detect", ctypes.c_int, [ctypes.c_void_p, IplImage_p, IplImage_p, IplImage_p, CvRect_p, ctypes.c_int, CascadeHit_p, ctypes.c_int]),
+    CFunction("cascade_free", None, [ctypes.c_void_p]),
+    CFunction("pool_set_threads", None, [ctypes.c_int]),
+])
+
+# Thread Pool
+#
+# The color targeting, blob, greymap and buoy analysis kernels split large
+# images into bands of rows, and cascade detection shares out window sizes,
+# run on a pool of threads each module keeps (see src/common/pool.h).  Results
+# don't depend on the number of threads.
+
+
+def set_threads(num_threads):
+    '''Sets the number of threads the kernels of every module run on,
+    counting the calling thread.  1 runs them in the calling thread.  0 for
+    one per CPU, or the LIBVISION_THREADS environment variable if it is set,
+    which is also the default.'''
+    for module in (target_color_rgb, target_color_hsv, buoy_analyzer,
+                   cblob_mod, cgreymap_mod, pipeline, pyramid, cascade):
+        module.pool_set_threads(num_threads)
@@ -0,0 +1,657 @@
+/**
+ * \file bench.c
+ * \brief Offline benchmark of the C modules over a recorded clip
+ *
+ * Usage: vision_bench [-n frames] [-r runs] [-m module_dir]
+ *                     [-g golden_file] [-w golden_file] clip
+ *
+ * clip is a video file, or a directory of 0.jpg, 1.jpg, ... as written by
+ * svr_record_all.py. Every frame is loaded into memory before anything is
+ * timed, so disk and decoding don't show up in the results.
+ *
+ * The modules are loaded from module_dir (src by default, run from the
+ * cmodules directory) with dlopen, exactly as the Python side loads them.
+ * Each frame goes through:
+ *
+ *   find_target_color_hsv, find_target_color_rgb
+ *   find_blobs, find_blobs_roi (on the rgb threshold)
+ *   find_bins
+ *   buoy_color, buoy_color_integral (on the blobs found)
+ *
+ * Each call is made runs times per frame. For every function the mean
+ * ns/pixel, frames/s and allocations per call are reported. Allocations are
+ * counted by replacing malloc and friends in this binary, which the modules
+ * and OpenCV pick up since the binary is linked with -rdynamic.
+ *
+ * The output of each call is reduced to a 64 bit hash per frame. -w writes
+ * them to a golden file, -g compares against one and makes the exit status 1
+ * if any output changed.
+ */
+
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cv.h>
+#include <highgui.h>
+
+#include "../src/common/types.h"
+
+/* Arguments given to the modules, matching those used by the entities */
+#define TARGET_RGB 250, 125, 0
+#define TARGET_HSV 15, 255, 255
+#define TARGET_MIN_BLOBSIZE 1500
+#define TARGET_DEV_THRESHOLD 500
+#define TARGET_PRECISION .3
+
+#define BLOB_MIN_SIZE 50
+#define BLOB_KEEP 10
+
+/* Longest clip that is loaded */
+#define MAX_FRAMES 100000
+
+enum {
+    BENCH_HSV,
+    BENCH_RGB,
+    BENCH_BLOBS,
+    BENCH_BLOBS_ROI,
+    BENCH_BINS,
+    BENCH_BUOY,
+    BENCH_BUOY_INTEGRAL,
+    NUM_BENCH
+};
+
+static const char* bench_names[NUM_BENCH] = {
+    "find_target_color_hsv",
+    "find_target_color_rgb",
+    "find_blobs",
+    "find_blobs_roi",
+    "find_bins",
+    "buoy_color",
+    "buoy_color_integral",
+};
+
+typedef struct BenchStats_s {
+    uint64_t ns;
+    uint64_t calls;
+    uint64_t pixels;
+    uint64_t allocs;
+    uint64_t alloc_bytes;
+
+    /* Frames whose output differed from the golden file, or that it has no
+       result for */
+    int mismatches;
+    int missing;
+} BenchStats;
+
+/* Opaque, see buoy_analyzer.c */
+typedef struct BuoyIntegral_s BuoyIntegral;
+
+/* Functions of the modules, looked up with dlsym */
+typedef struct Modules_s {
+    IplImage* (*find_target_color_hsv)(IplImage*, int, int, int, int, int, double);
+    IplImage* (*find_target_color_rgb)(IplImage*, int, int, int, int, int, double);
+    Blob** (*find_blobs)(IplImage*, IplImage*, int*, int, int, uint8_t);
+    Blob** (*find_blobs_roi)(IplImage*, IplImage*, int*, int, int, uint8_t, CvRect*);
+    void (*free_blobs)(Blob**, int);
+    Rect** (*find_bins)(IplImage*, int*);
+    void (*free_bins)(Rect**, int);
+    int* (*buoy_color)(IplImage*, BuoyROI**, int);
+    BuoyIntegral* (*buoy_integral_new)(void);
+    void (*buoy_integral_update)(BuoyIntegral*, IplImage*);
+    int* (*buoy_color_integral)(IplImage*, BuoyIntegral*, BuoyROI**, int);
+
+    /* Integral images for buoy_color_integral, kept for the whole clip the
+       way a caller would keep them between frames */
+    BuoyIntegral* integral;
+} Modules;
+
+/* Golden results, hashes[bench][frame] */
+typedef struct Golden_s {
+    int num_frames;
+    uint64_t* hashes[NUM_BENCH];
+    uint8_t* present[NUM_BENCH];
+} Golden;
+
+/*******************************
+ ******  Allocation counts ******
+ *******************************/
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* ptr);
+
+/* Allocations are only counted while a module function is being timed */
+static volatile int counting = 0;
+static uint64_t alloc_count = 0;
+static uint64_t alloc_bytes = 0;
+
+static inline void count_alloc(size_t size) {
+    if(counting) {
+        __sync_fetch_and_add(&alloc_count, 1);
+        __sync_fetch_and_add(&alloc_bytes, size);
+    }
+}
+
+void* malloc(size_t size) {
+    count_alloc(size);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    count_alloc(count * size);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    count_alloc(size);
+    return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size) {
+    count_alloc(size);
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr ? 0 : ENOMEM;
+}
+
+void free(void* ptr) {
+    __libc_free(ptr);
+}
+
+/*******************************
+ ******  Timing             ******
+ *******************************/
+
+static uint64_t now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+/* Time one call of a module function, counting its allocations */
+#define MEASURE(stats, frame, call) do {                          \
+        uint64_t _allocs = alloc_count;                           \
+        uint64_t _bytes = alloc_bytes;                            \
+        uint64_t _start;                                          \
+        counting = 1;                                             \
+        _start = now_ns();                                        \
+        call;                                                     \
+        (stats)->ns += now_ns() - _start;                         \
+        counting = 0;                                             \
+        (stats)->calls++;                                         \
+        (stats)->pixels += (uint64_t) (frame)->width * (frame)->height; \
+        (stats)->allocs += alloc_count - _allocs;                 \
+        (stats)->alloc_bytes += alloc_bytes - _bytes;             \
+    } while(0)
+
+/*******************************
+ ******  Output hashes      ******
+ *******************************/
+
+#define FNV_OFFSET 14695981039346656037ull
+#define FNV_PRIME 1099511628211ull
+
+static uint64_t hash_bytes(uint64_t hash, const void* data, size_t size) {
+    const uint8_t* bytes = data;
+    size_t i;
+
+    for(i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+static uint64_t hash_image(uint64_t hash, IplImage* image) {
+    int row_bytes = image->width * image->nChannels * ((image->depth & 0xff) / 8);
+    int y;
+
+    for(y = 0; y < image->height; y++) {
+        hash = hash_bytes(hash, image->imageData + y * image->widthStep, row_bytes);
+    }
+    return hash;
+}
+
+static uint64_t hash_blobs(Blob** blobs, int num_blobs, IplImage* labels) {
+    uint64_t hash = hash_bytes(FNV_OFFSET, &num_blobs, sizeof(num_blobs));
+    int i;
+
+    for(i = 0; i < num_blobs; i++) {
+        hash = hash_bytes(hash, blobs[i], sizeof(Blob));
+    }
+    return hash_image(hash, labels);
+}
+
+/*******************************
+ ******  Loading            ******
+ *******************************/
+
+static void* load_symbol(void* module, const char* module_name, const char* name) {
+    void* symbol = dlsym(module, name);
+    if(symbol == NULL) {
+        fprintf(stderr, "%s has no function %s\n", module_name, name);
+        exit(2);
+    }
+    return symbol;
+}
+
+static void* load_module(const char* module_dir, const char* name) {
+    char path[4096];
+    void* module;
+
+    snprintf(path, sizeof(path), "%s/%s", module_dir, name);
+    module = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if(module == NULL) {
+        fprintf(stderr, "Could not open %s: %s\n", path, dlerror());
+        exit(2);
+    }
+    return module;
+}
+
+static void load_modules(const char* module_dir, Modules* modules) {
+    void* hsv = load_module(module_dir, "target_color_hsv.so");
+    void* rgb = load_module(module_dir, "target_color_rgb.so");
+    void* blob = load_module(module_dir, "blob2.so");
+    void* shape = load_module(module_dir, "shape_detect.so");
+    void* buoy = load_module(module_dir, "buoy_analyzer.so");
+
+    *(void**) &modules->find_target_color_hsv = load_symbol(hsv, "target_color_hsv.so", "find_target_color_hsv");
+    *(void**) &modules->find_target_color_rgb = load_symbol(rgb, "target_color_rgb.so", "find_target_color_rgb");
+    *(void**) &modules->find_blobs = load_symbol(blob, "blob2.so", "find_blobs");
+    *(void**) &modules->find_blobs_roi = load_symbol(blob, "blob2.so", "find_blobs_roi");
+    *(void**) &modules->free_blobs = load_symbol(blob, "blob2.so", "free_blobs");
+    *(void**) &modules->find_bins = load_symbol(shape, "shape_detect.so", "find_bins");
+    *(void**) &modules->free_bins = load_symbol(shape, "shape_detect.so", "free_bins");
+    *(void**) &modules->buoy_color = load_symbol(buoy, "buoy_analyzer.so", "buoy_color");
+    *(void**) &modules->buoy_integral_new = load_symbol(buoy, "buoy_analyzer.so", "buoy_integral_new");
+    *(void**) &modules->buoy_integral_update = load_symbol(buoy, "buoy_analyzer.so", "buoy_integral_update");
+    *(void**) &modules->buoy_color_integral = load_symbol(buoy, "buoy_analyzer.so", "buoy_color_integral");
+
+    modules->integral = modules->buoy_integral_new();
+}
+
+/* Load every frame of a video file or directory of numbered jpgs */
+static IplImage** load_clip(const char* path, int max_frames, int* num_frames) {
+    IplImage** frames = malloc(max_frames * sizeof(IplImage*));
+    struct stat path_stat;
+    int n = 0;
+
+    if(stat(path, &path_stat) != 0) {
+        fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+        exit(2);
+    }
+
+    if(S_ISDIR(path_stat.st_mode)) {
+        char file_name[4096];
+
+        while(n < max_frames) {
+            snprintf(file_name, sizeof(file_name), "%s/%d.jpg", path, n);
+            frames[n] = cvLoadImage(file_name, CV_LOAD_IMAGE_COLOR);
+            if(frames[n] == NULL) {
+                break;
+            }
+            n++;
+        }
+    } else {
+        CvCapture* capture = cvCreateFileCapture(path);
+        IplImage* frame;
+
+        if(capture == NULL) {
+            fprintf(stderr, "Could not read video %s\n", path);
+            exit(2);
+        }
+        while(n < max_frames && (frame = cvQueryFrame(capture)) != NULL) {
+            frames[n++] = cvCloneImage(frame);
+        }
+        cvReleaseCapture(&capture);
+    }
+
+    *num_frames = n;
+    return frames;
+}
+
+/*******************************
+ ******  Golden files       ******
+ *******************************/
+
+static void golden_init(Golden* golden, int num_frames) {
+    int i;
+
+    golden->num_frames = num_frames;
+    for(i = 0; i < NUM_BENCH; i++) {
+        golden->hashes[i] = calloc(num_frames, sizeof(uint64_t));
+        golden->present[i] = calloc(num_frames, sizeof(uint8_t));
+    }
+}
+
+static void golden_set(Golden* golden, int bench, int frame, uint64_t hash) {
+    if(frame >= 0 && frame < golden->num_frames) {
+        golden->hashes[bench][frame] = hash;
+        golden->present[bench][frame] = 1;
+    }
+}
+
+static int bench_index(const char* name) {
+    int i;
+
+    for(i = 0; i < NUM_BENCH; i++) {
+        if(strcmp(name, bench_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Each line of a golden file is: function frame hash */
+static void golden_read(Golden* golden, const char* file_name) {
+    FILE* f = fopen(file_name, "r");
+    char line[256];
+    char name[128];
+    int frame;
+    uint64_t hash;
+    int bench;
+
+    if(f == NULL) {
+        fprintf(stderr, "Could not open %s: %s\n", file_name, strerror(errno));
+        exit(2);
+    }
+
+    while(fgets(line, sizeof(line), f)) {
+        if(line[0] == '#') {
+            continue;
+        }
+        if(sscanf(line, "%127s %d %" SCNx64, name, &frame, &hash) != 3) {
+            continue;
+        }
+        bench = bench_index(name);
+        if(bench >= 0) {
+            golden_set(golden, bench, frame, hash);
+        }
+    }
+
+    fclose(f);
+}
+
+static void golden_write(Golden* golden, const char* file_name) {
+    FILE* f = fopen(file_name, "w");
+    int bench, frame;
+
+    if(f == NULL) {
+        fprintf(stderr, "Could not write %s: %s\n", file_name, strerror(errno));
+        exit(2);
+    }
+
+    fprintf(f, "# vision_bench golden results: function frame hash\n");
+    for(bench = 0; bench < NUM_BENCH; bench++) {
+        for(frame = 0; frame < golden->num_frames; frame++) {
+            if(golden->present[bench][frame]) {
+                fprintf(f, "%s %d %016" PRIx64 "\n", bench_names[bench], frame, golden->hashes[bench][frame]);
+            }
+        }
+    }
+
+    fclose(f);
+}
+
+static void golden_free(Golden* golden) {
+    int i;
+
+    for(i = 0; i < NUM_BENCH; i++) {
+        free(golden->hashes[i]);
+        free(golden->present[i]);
+    }
+}
+
+/*******************************
+ ******  Benchmark          ******
+ *******************************/
+
+/* Run every function over one frame, runs times, and record the hash of its
+   output in results */
+static void bench_frame(Modules* m, IplImage* frame, int frame_index, int runs,
+                        BenchStats* stats, Golden* results) {
+    IplImage* labels = cvCreateImage(cvGetSize(frame), IPL_DEPTH_8U, 1);
+    CvRect roi = cvRect(frame->width / 4, frame->height / 4, frame->width / 2, frame->height / 2);
+    IplImage* binary = NULL;
+    Blob** blobs = NULL;
+    Rect** bins = NULL;
+    int* colors = NULL;
+    BuoyROI rois[BLOB_KEEP];
+    BuoyROI* roi_pointers[BLOB_KEEP];
+    int num_blobs = 0;
+    int num_bins = 0;
+    int num_rois;
+    uint64_t hash;
+    int run, i;
+
+    for(run = 0; run < runs; run++) {
+        if(binary) {
+            cvReleaseImage(&binary);
+        }
+        MEASURE(&stats[BENCH_HSV], frame,
+                binary = m->find_target_color_hsv(frame, TARGET_HSV, TARGET_MIN_BLOBSIZE, TARGET_DEV_THRESHOLD, TARGET_PRECISION));
+    }
+    golden_set(results, BENCH_HSV, frame_index, hash_image(FNV_OFFSET, binary));
+    cvReleaseImage(&binary);
+
+    /* The rgb threshold is kept as the input of the blob functions */
+    for(run = 0; run < runs; run++) {
+        if(binary) {
+            cvReleaseImage(&binary);
+        }
+        MEASURE(&stats[BENCH_RGB], frame,
+                binary = m->find_target_color_rgb(frame, TARGET_RGB, TARGET_MIN_BLOBSIZE, TARGET_DEV_THRESHOLD, TARGET_PRECISION));
+    }
+    golden_set(results, BENCH_RGB, frame_index, hash_image(FNV_OFFSET, binary));
+
+    for(run = 0; run < runs; run++) {
+        if(blobs) {
+            m->free_blobs(blobs, num_blobs);
+        }
+        MEASURE(&stats[BENCH_BLOBS_ROI], frame,
+                blobs = m->find_blobs_roi(binary, labels, &num_blobs, BLOB_MIN_SIZE, BLOB_KEEP, 0, &roi));
+    }
+    golden_set(results, BENCH_BLOBS_ROI, frame_index, hash_blobs(blobs, num_blobs, labels));
+    m->free_blobs(blobs, num_blobs);
+    blobs = NULL;
+
+    /* The blobs of the whole frame are kept as the buoy rois */
+    for(run = 0; run < runs; run++) {
+        if(blobs) {
+            m->free_blobs(blobs, num_blobs);
+        }
+        MEASURE(&stats[BENCH_BLOBS], frame,
+                blobs = m->find_blobs(binary, labels, &num_blobs, BLOB_MIN_SIZE, BLOB_KEEP, 0));
+    }
+    golden_set(results, BENCH_BLOBS, frame_index, hash_blobs(blobs, num_blobs, labels));
+
+    for(run = 0; run < runs; run++) {
+        if(bins) {
+            m->free_bins(bins, num_bins);
+        }
+        MEASURE(&stats[BENCH_BINS], frame,
+                bins = m->find_bins(frame, &num_bins));
+    }
+    hash = hash_bytes(FNV_OFFSET, &num_bins, sizeof(num_bins));
+    for(i = 0; i < num_bins; i++) {
+        hash = hash_bytes(hash, bins[i], sizeof(Rect));
+    }
+    golden_set(results, BENCH_BINS, frame_index, hash);
+    m->free_bins(bins, num_bins);
+
+    /* buoy_color needs at least one roi */
+    num_rois = num_blobs < BLOB_KEEP ? num_blobs : BLOB_KEEP;
+    for(i = 0; i < num_rois; i++) {
+        rois[i].x = blobs[i]->x_0;
+        rois[i].y = blobs[i]->y_0;
+        rois[i].w = blobs[i]->x_1 - blobs[i]->x_0 + 1;
+        rois[i].h = blobs[i]->y_1 - blobs[i]->y_0 + 1;
+        roi_pointers[i] = &rois[i];
+    }
+
+    if(num_rois > 0) {
+        for(run = 0; run < runs; run++) {
+            free(colors);
+            MEASURE(&stats[BENCH_BUOY], frame,
+                    colors = m->buoy_color(frame, roi_pointers, num_rois));
+        }
+        golden_set(results, BENCH_BUOY, frame_index, hash_bytes(FNV_OFFSET, colors, num_rois * sizeof(int)));
+        free(colors);
+        colors = NULL;
+
+        for(run = 0; run < runs; run++) {
+            free(colors);
+            MEASURE(&stats[BENCH_BUOY_INTEGRAL], frame,
+                    m->buoy_integral_update(m->integral, frame);
+                    colors = m->buoy_color_integral(frame, m->integral, roi_pointers, num_rois));
+        }
+        golden_set(results, BENCH_BUOY_INTEGRAL, frame_index, hash_bytes(FNV_OFFSET, colors, num_rois * sizeof(int)));
+        free(colors);
+    }
+
+    m->free_blobs(blobs, num_blobs);
+    cvReleaseImage(&binary);
+    cvReleaseImage(&labels);
+}
+
+/* Compare results with golden, counting the differences in stats */
+static void golden_compare(Golden* golden, Golden* results, BenchStats* stats) {
+    int bench, frame;
+
+    for(bench = 0; bench < NUM_BENCH; bench++) {
+        for(frame = 0; frame < results->num_frames; frame++) {
+            if(!results->present[bench][frame]) {
+                continue;
+            }
+            if(!golden->present[bench][frame]) {
+                stats[bench].missing++;
+            } else if(golden->hashes[bench][frame] != results->hashes[bench][frame]) {
+                if(stats[bench].mismatches == 0) {
+                    printf("%s: first differing output at frame %d\n", bench_names[bench], frame);
+                }
+                stats[bench].mismatches++;
+            }
+        }
+    }
+}
+
+static void print_report(BenchStats* stats, int checked) {
+    int bench;
+
+    printf("%-22s %8s %10s %10s %12s %12s  %s\n",
+           "function", "calls", "ns/pixel", "frames/s", "allocs/call", "KiB/call", checked ? "golden" : "");
+    for(bench = 0; bench < NUM_BENCH; bench++) {
+        BenchStats* s = &stats[bench];
+        char golden[64] = "";
+
+        if(s->calls == 0) {
+            printf("%-22s %8s\n", bench_names[bench], "not run");
+            continue;
+        }
+
+        if(checked) {
+            if(s->mismatches) {
+                snprintf(golden, sizeof(golden), "%d frames differ", s->mismatches);
+            } else if(s->missing) {
+                snprintf(golden, sizeof(golden), "ok, %d frames missing", s->missing);
+            } else {
+                snprintf(golden, sizeof(golden), "ok");
+            }
+        }
+
+        printf("%-22s %8" PRIu64 " %10.2f %10.1f %12.1f %12.1f  %s\n",
+               bench_names[bench], s->calls,
+               (double) s->ns / s->pixels,
+               s->calls * 1e9 / s->ns,
+               (double) s->allocs / s->calls,
+               s->alloc_bytes / 1024.0 / s->calls,
+               golden);
+    }
+}
+
+static void usage(const char* program) {
+    fprintf(stderr, "Usage: %s [-n frames] [-r runs] [-m module_dir] [-g golden_file] [-w golden_file] clip\n", program);
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    const char* module_dir = "src";
+    const char* golden_in = NULL;
+    const char* golden_out = NULL;
+    int max_frames = MAX_FRAMES;
+    int runs = 1;
+    BenchStats stats[NUM_BENCH];
+    Modules modules;
+    Golden results;
+    IplImage** frames;
+    int num_frames;
+    int failed = 0;
+    int opt, i;
+
+    while((opt = getopt(argc, argv, "n:r:m:g:w:")) != -1) {
+        switch(opt) {
+            case 'n': max_frames = atoi(optarg); break;
+            case 'r': runs = atoi(optarg); break;
+            case 'm': module_dir = optarg; break;
+            case 'g': golden_in = optarg; break;
+            case 'w': golden_out = optarg; break;
+            default: usage(argv[0]);
+        }
+    }
+    if(optind != argc - 1 || max_frames < 1 || runs < 1) {
+        usage(argv[0]);
+    }
+
+    load_modules(module_dir, &modules);
+
+    frames = load_clip(argv[optind], max_frames, &num_frames);
+    if(num_frames == 0) {
+        fprintf(stderr, "No frames in %s\n", argv[optind]);
+        return 2;
+    }
+    printf("%d frames of %dx%d, %d runs each\n", num_frames, frames[0]->width, frames[0]->height, runs);
+
+    memset(stats, 0, sizeof(stats));
+    golden_init(&results, num_frames);
+
+    for(i = 0; i < num_frames; i++) {
+        bench_frame(&modules, frames[i], i, runs, stats, &results);
+    }
+
+    if(golden_in) {
+        Golden golden;
+
+        golden_init(&golden, num_frames);
+        golden_read(&golden, golden_in);
+        golden_compare(&golden, &results, stats);
+        golden_free(&golden);
+
+        for(i = 0; i < NUM_BENCH; i++) {
+            failed |= stats[i].mismatches != 0;
+        }
+    }
+
+    print_report(stats, golden_in != NULL);
+
+    if(golden_out) {
+        golden_write(&results, golden_out);
+    }
+
+    for(i = 0; i < num_frames; i++) {
+        cvReleaseImage(&frames[i]);
+    }
+    free(frames);
+    golden_free(&results);
+
+    return failed;
+}
@@ -10,7 +10,7 @@ import ctypes
 
 import cv
 
-from cvtypes import IplImage, IplImage_p
+from cvtypes import IplImage, IplImage_p, c_char_p
 
 SOURCE_DIRECTORY = path.realpath(
     path.join(path.abspath(__file__), "../src/")
@@ -20,56 +20,77 @@ CFunction = namedtuple("CFunction",
                        ['name', 'return_type', 'argument_types']
                        )
 
+# If set, every C function call is made as profile_hook(name, func, args),
+# which must call func(*args) and return its result.  Set by
+# libvision.profiler to time C modules.
+profile_hook = None
+
+
+class PyIplImage(ctypes.Structure):
+
+    '''Representation of an OpenCV IplImage within Python.
+
+    Pulled from OpenCV Python interface code (modules/python/cv.cpp).  This is
+    the same struct iplimage_t that the _wrap_ functions of the C modules take.
+    The image data lives in the Python object data, offset bytes in.
+    '''
+    _fields_ = [
+        ("ob_refcnt", ctypes.c_ssize_t),
+        ("ob_type", ctypes.c_void_p),
+        ("a", IplImage_p),
+        ("data", ctypes.py_object),
+        ("offset", ctypes.c_size_t),
+    ]
+
 
 def iplimage_errcheck(iplimage_pointer, func, arguments):
     '''Convert an IplImage struct into an OpenCV Python object.
 
     This function should be used only for IplImages that were created in C code
-    and returned as a return value from a C function.
+    and returned as a return value from a C function.  The image data has to be
+    copied once to be owned by Python.  Functions that write into an image
+    given as an argument avoid that copy.
     '''
-    # TODO: It seems that widthStep doesn't get set correctly here.  The
-    #      structure has the correct widthStep, but I don't know how to set
-    #      widthStep on the Python IplImage type.
 
     iplimage = iplimage_pointer.contents
     converted_image = cv.CreateImageHeader((iplimage.width, iplimage.height),
                                            iplimage.depth, iplimage.nChannels)
     cv.SetData(converted_image,
-               iplimage.imageData[:iplimage.width * iplimage.height * iplimage.nChannels])
+               iplimage.imageData[:iplimage.imageSize], iplimage.widthStep)
     _internal_c.releaseImage(iplimage_pointer)
     return converted_image
 
 
 def to_iplimage_p(image):
-    '''Turns an OpenCV Python IplImage type into a ctypes struct.'''
-    image_data = ctypes.create_string_buffer(image.tostring())
-    Four_C_Int = ctypes.c_int * 4
-    Four_C_Char = ctypes.c_char * 4
-    iplimage_struct = IplImage(
-        nSize=ctypes.sizeof(IplImage),
-        ID=0,  # Ignored by OpenCV
-        nChannels=image.nChannels,
-        alphaChannel=0,  # Ignored by OpenCV
-        depth=image.depth,
-        colorModel="0000",  # Ignored by OpenCV
-        channelSeq="0000",  # Ignored by OpenCV
-        dataOrder=0,  # Interleaved color channels
-        origin=0,  # Top left
-        align=4,  # Ignored by OpenCV
-        width=image.width,
-        height=image.height,
-        roi=ctypes.c_void_p(),  # No ROI
-        maskROI=ctypes.c_void_p(),  # Ignored by OpenCV
-        imageId=ctypes.c_void_p(),  # Ignored by OpenCV
-        tileInfo=ctypes.c_void_p(),  # Ignored by OpenCV
-        imageSize=image.width * image.height * image.nChannels,
-        imageData=image_data,
-        widthStep=image.width * image.nChannels,
-        BorderMode=Four_C_Int(0, 0, 0, 0),  # Ignored by OpenCV
-        BorderConst=Four_C_Int(0, 0, 0, 0),  # Ignored by OpenCV
-        imageDataOrigin=image_data,
-    )
-    return ctypes.pointer(iplimage_struct)
+    '''Returns a pointer to the IplImage underlying an OpenCV Python image.
+
+    No image data is copied.  Before returning, imageData is pointed at the
+    Python object's buffer, which is what OpenCV's own Python interface does
+    before handing an image to OpenCV.  The C function sees the image exactly
+    as it is, including its widthStep and any ROI, and anything it writes to
+    the image is visible from Python.
+
+    The pointer is only valid while image is alive.
+    '''
+    if type(image).__name__ != "iplimage":
+        raise TypeError("Expected an IplImage, got %s" % type(image).__name__)
+
+    python_image = PyIplImage.from_address(id(image))
+    try:
+        data = python_image.data
+    except ValueError:
+        raise ValueError("IplImage has no data")
+
+    if isinstance(data, str):
+        # c_char_p refers to the string's own buffer, it does not copy it
+        address = ctypes.cast(ctypes.c_char_p(data), ctypes.c_void_p).value
+    else:
+        address = ctypes.addressof(ctypes.c_char.from_buffer(data))
+
+    iplimage_pointer = python_image.a
+    iplimage_pointer.contents.imageData = ctypes.cast(
+        address + python_image.offset, c_char_p)
+    return iplimage_pointer
 
 
 class CModule(object):
@@ -82,6 +103,10 @@ class CModule(object):
     Python IplImage object as provided by the new Python interface of OpenCV
     will be expected or returned.
 
+    IplImage_p arguments are passed to C without copying the image, so a C
+    function can write its output into an image the caller created (see the
+    *_into functions).  Returning an IplImage_p costs one copy of the image.
+
     After instantiating this class, you can call the methods in a similar
     manner to ctypes.  For example:
     >>> import cv
@@ -161,9 +186,14 @@ class CModule(object):
 
         # If the function has no IplImage_p types, it doesn't need to be
         # wrapped.
-        if IplImage_p not in argument_types:
-            return func
+        if IplImage_p in argument_types:
+            func = self.wrap_iplimage_arguments(func, argument_types)
+
+        if profile_hook is not None:
+            return lambda *args: profile_hook(function_name, func, args)
+        return func
 
+    def wrap_iplimage_arguments(self, func, argument_types):
         def func_wrapper(*args):
             '''
             Wraps the ctypes object so that all IplImage_p type arguments are
@@ -171,7 +201,9 @@ class CModule(object):
             '''
             arguments = []
             for i, arg_type in enumerate(argument_types):
-                if arg_type is IplImage_p:
+                if arg_type is IplImage_p and args[i] is None:
+                    arguments.append(None)  # NULL, for optional images
+                elif arg_type is IplImage_p:
                     arguments.append(to_iplimage_p(args[i]))
                 else:
                     arguments.append(args[i])
@@ -46,3 +46,13 @@ class CvPoint(ctypes.Structure):
         ("x", ctypes.c_int),
         ("y", ctypes.c_int),
     ]
+
+
+class CvRect(ctypes.Structure):
+    _fields_ = [
+        ("x", ctypes.c_int),
+        ("y", ctypes.c_int),
+        ("width", ctypes.c_int),
+        ("height", ctypes.c_int),
+    ]
+CvRect_p = ctypes.POINTER(CvRect)
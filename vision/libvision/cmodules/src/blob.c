@@ -8,6 +8,8 @@
 #include <cv.h>
 #include <highgui.h>
 
+#include "pixel.h"
+
 typedef struct {
     int top; /**< Upper most pixel in the blob. */
     int left; /**< Left most pixel in the blob. */
@@ -24,6 +26,10 @@ typedef struct {
 int find_blobs(IplImage* Img, BLOB** blobs, int tracking_number, int minimum_blob_area);
 BLOB* findPrimary(IplImage* Img, int target_number, int minimum_blob_area, int *blobs_found);
 int checkPixel(IplImage* Img, int x, int y, unsigned int** pixlog, BLOB* blob, int depth); 
+PIXEL_INLINE BLOB* find_primary(const int channels, IplImage* Img, int tracking_number, int minimum_blob_area, int *blobnumber);
+PIXEL_INLINE int check_pixel(const int channels, IplImage* Img, int x, int y, unsigned int** pixlog, BLOB* blob, int depth);
+static int check_pixel_1(IplImage* Img, int x, int y, unsigned int** pixlog, BLOB* blob, int depth);
+static int check_pixel_3(IplImage* Img, int x, int y, unsigned int** pixlog, BLOB* blob, int depth);
 void blob_copy(BLOB* dest, BLOB* src);
 void blob_free(BLOB* blobs, int blobs_found);
 
@@ -68,6 +74,10 @@ int find_blobs(IplImage* Img, BLOB** targets, int tracking_number, int minimum_b
         printf("Error: find_blobs only accepts char type images.\n");
         return -1;
     }
+    if (Img->nChannels != 1 && Img->nChannels != 3) {
+        printf("Error: find_blobs only accepts 1 or 3 channel images.\n");
+        return -1;
+    }
 
     int blobnumber; // Holds the number of blobs we found
 
@@ -148,6 +158,15 @@ int find_blobs(IplImage* Img, BLOB** targets, int tracking_number, int minimum_b
  */
 
 BLOB* findPrimary(IplImage* Img, int tracking_number, int minimum_blob_area, int *blobnumber){
+    *blobnumber = 0;
+    return PIXEL_DISPATCH(Img, NULL, find_primary, Img, tracking_number, minimum_blob_area, blobnumber);
+}
+
+/**
+ * \brief findPrimary() for an image with the given number of channels
+ * \private
+ */
+PIXEL_INLINE BLOB* find_primary(const int channels, IplImage* Img, int tracking_number, int minimum_blob_area, int *blobnumber){
 
     //usefull variables
     int height = Img->height;
@@ -187,7 +206,7 @@ BLOB* findPrimary(IplImage* Img, int tracking_number, int minimum_blob_area, int
         uchar* ptr = (uchar*) (Img->imageData + y * Img->widthStep);
         for(x=0; x<width-3; x+=4 ) {
             //if the pixel hasn't been blacked out as the wrong color AND has not yet been checked
-            if((ptr[Img->nChannels*x+0]||ptr[Img->nChannels*x+1]||ptr[Img->nChannels*x+2])&& pixlog[x][y]==0){
+            if(pixel_any(ptr, x, channels) && pixlog[x][y]==0){
                 //we've found a new blob, so let's initialize it's values
                 blobs[*blobnumber].area = 0;
                 blobs[*blobnumber].top = 0;
@@ -201,7 +220,10 @@ BLOB* findPrimary(IplImage* Img, int tracking_number, int minimum_blob_area, int
                 blobs[*blobnumber].pixels = (CvPoint*)cvAlloc(sizeof(CvPoint)*MAX_BLOB_AREA);
                 //now let's examine the blob and update it's properties
                 int depth = 0;
-                checkPixel(Img, x,y, pixlog, &blobs[*blobnumber], depth);
+                if(channels == 1)
+                    check_pixel_1(Img, x,y, pixlog, &blobs[*blobnumber], depth);
+                else
+                    check_pixel_3(Img, x,y, pixlog, &blobs[*blobnumber], depth);
 
                 //don't bother sorting if we are asked to return ALL the blobs (argument: tracking_number of zero)
                 if(tracking_number > 0){
@@ -263,6 +285,22 @@ BLOB* findPrimary(IplImage* Img, int tracking_number, int minimum_blob_area, int
  */
  
 int checkPixel(IplImage* Img, int x, int y, unsigned int** pixlog, BLOB* blob, int depth){
+    return PIXEL_DISPATCH(Img, 2, check_pixel, Img, x, y, pixlog, blob, depth);
+}
+
+static int check_pixel_1(IplImage* Img, int x, int y, unsigned int** pixlog, BLOB* blob, int depth){
+    return check_pixel(1, Img, x, y, pixlog, blob, depth);
+}
+
+static int check_pixel_3(IplImage* Img, int x, int y, unsigned int** pixlog, BLOB* blob, int depth){
+    return check_pixel(3, Img, x, y, pixlog, blob, depth);
+}
+
+/**
+ * \brief checkPixel() for an image with the given number of channels
+ * \private
+ */
+PIXEL_INLINE int check_pixel(const int channels, IplImage* Img, int x, int y, unsigned int** pixlog, BLOB* blob, int depth){
 
     //we will crash if we keep going, so let's just stop now
     if(++depth > 100000)
@@ -275,7 +313,7 @@ int checkPixel(IplImage* Img, int x, int y, unsigned int** pixlog, BLOB* blob, i
 
     //check too see if the pixel is part of the blob
     uchar* ptr = (uchar*) (Img->imageData + y * Img->widthStep);
-    if((ptr[Img->nChannels*x+0] || ptr[Img->nChannels*x+1] || ptr[Img->nChannels*x+2]) == 0){
+    if(!pixel_any(ptr, x, channels)){
         return 2; //the pixel has been blacked out and shouldn't be used
     }
 
@@ -308,9 +346,13 @@ int checkPixel(IplImage* Img, int x, int y, unsigned int** pixlog, BLOB* blob, i
     for(w = x-1; w <= x+1; w++){
         for(z = y-1; z <= y+1; z++){
             //save from overfow
-            if((w > 1)&&(z > 1)&&(w < width -1)&&(z < height-1))
+            if((w > 1)&&(z > 1)&&(w < width -1)&&(z < height-1)){
                 //now that we know we are on the image, check this pixel
-                checkPixel(Img,w,z,pixlog, blob, depth);
+                if(channels == 1)
+                    check_pixel_1(Img,w,z,pixlog, blob, depth);
+                else
+                    check_pixel_3(Img,w,z,pixlog, blob, depth);
+            }
         }
     }
     return 0;
@@ -23,6 +23,14 @@
  * Now a mapping of pixels to BlobParts has been established, and all
  * BlobParts point to their Blobs. At this point the list of Blobs is filtered,
  * and the blob indexes written to the output image.
+ *
+ * Large images are split into bands of rows, which are labeled in parallel on
+ * the thread pool (see common/pool.h), each with its own BlobParts. Blobs
+ * crossing from one band into the next are then joined, by looking at the
+ * pixels either side of each boundary. When blobs are joined the one created
+ * first survives, so every blob ends up as the one created at its first pixel
+ * in raster order, however the image was split. The blobs returned and their
+ * ids are the same for any number of threads.
  */
 
 #include <seawolf.h>
@@ -30,6 +38,9 @@
 
 #include <stdint.h>
 
+#include "common/pool.h"
+#include "common/types.h"
+
 #ifdef __SW_LIBVISION
 # include <Python.h>
 #endif
@@ -37,6 +48,9 @@
 /* Number of BlobPart structures to allocate at once */
 #define BLOB_PART_TABLE_ALLOC_UNIT 256
 
+/* Fewest rows labeled as a band of their own */
+#define BLOB_MIN_BAND_ROWS 32
+
 /* Indexes into the adjacency table. These are positions relative to the current
    input pixel */
 #define UP_LEFT  0
@@ -45,38 +59,123 @@
 #define LEFT     3
 
 typedef uint32_t BlobPartId;
-typedef uint32_t BlobId;
 
-typedef struct Blob_s {
-    BlobId id;
-
-    /* If size == -1 then the blob is no longer valid. This is set when two
-       blobs are joined. Otherwise, this gives the size of the blob in pixels */
-    int32_t size;
+typedef struct BlobPart_s {
+    Blob* blob;
+    struct BlobPart_s* next;
+    struct BlobPart_s* prev;
+} BlobPart;
 
-    /* Centroid */
+/* Centroid totals and bounding box of a kept blob over one band */
+typedef struct BlobTotals_s {
     uint32_t c_x;
     uint32_t c_y;
-
-    /* Bound box */
     uint16_t x_0;
     uint16_t x_1;
     uint16_t y_0;
     uint16_t y_1;
-} Blob;
+} BlobTotals;
 
-typedef struct BlobPart_s {
-    Blob* blob;
-    struct BlobPart_s* next;
-    struct BlobPart_s* prev;
-} BlobPart;
+/* Rows of the labeled area given to one thread */
+typedef struct LabelBand_s {
+    /* Rows of the area, from row_0 up to but not including row_1 */
+    uint32_t row_0;
+    uint32_t row_1;
+
+    BlobPart** blob_parts;
+    size_t blob_part_table_size;
+    BlobPartId next_part_id;
+
+    /* Blobs as they're created. While labeling, each blob's id is its
+       position here, counting from 1 */
+    List* raw_blobs;
+    int num_raw_blobs;
+
+    /* Position of the band's first blob among the blobs of all bands */
+    int first_blob;
+
+    /* Totals of each kept blob over the band's rows */
+    BlobTotals* totals;
+} LabelBand;
+
+typedef struct LabelJob_s {
+    IplImage* img_in;
+    IplImage* blobs_out;
+    CvRect area;
+    uint8_t out_coloring;
+
+    /* Blob part of each pixel of the area, by its band's BlobParts */
+    BlobPartId* blob_mapping;
+
+    int first_id;
+    int num_blobs;
+
+    int num_bands;
+    LabelBand bands[POOL_MAX_BANDS];
+} LabelJob;
+
+/* A blob found in the previous frame, as remembered by a BlobTracker */
+typedef struct BlobTrack_s {
+    uint32_t track_id;
+
+    /* Centroid and bounding box */
+    uint32_t c_x;
+    uint32_t c_y;
+    int x_0;
+    int x_1;
+    int y_0;
+    int y_1;
+} BlobTrack;
+
+/**
+ * \brief State kept between frames by find_blobs_tracked
+ */
+typedef struct BlobTracker_s {
+    /* A full frame scan is made at least this often, in frames */
+    int full_scan_interval;
+
+    /* Pixels the previous bounding boxes are grown by to give the areas
+       relabeled on the next frame */
+    int margin;
+
+    int frames_since_scan;
+
+    /* Blobs of the previous frame */
+    BlobTrack* tracks;
+    int num_tracks;
+    int tracks_size;
+
+    uint32_t next_track_id;
+} BlobTracker;
 
 static void join_blob_parts(BlobPart** parts, BlobPartId i, BlobPartId j);
+static void label_band(void* job, int band);
+static void write_band(void* job, int band);
+static Blob** join_bands(LabelJob* job, int* r_num_raw_blobs);
+static CvRect clip_roi(IplImage* img, CvRect* roi);
+static Blob** label_area(IplImage* img_in, IplImage* blobs_out, CvRect area, int* r_num_blobs, int min_size, int keep_number, uint8_t out_coloring, int first_id);
+
+Blob** find_blobs_roi(IplImage* img_in, IplImage* blobs_out, int* r_num_blobs, int min_size, int keep_number, uint8_t out_coloring, CvRect* roi);
+Blob** find_blobs_area(IplImage* img_in, IplImage* blobs_out, int* r_num_blobs, int min_size, int keep_number, uint8_t out_coloring, CvRect* roi);
+BlobTracker* blob_tracker_new(int full_scan_interval, int margin);
+Blob** find_blobs_tracked(BlobTracker* tracker, IplImage* img_in, IplImage* blobs_out, int* r_num_blobs, uint32_t* track_ids, int min_size, int keep_number, uint8_t out_coloring);
+void blob_tracker_free(BlobTracker* tracker);
 
 static void join_blob_parts(BlobPart** parts, BlobPartId i, BlobPartId j) {
-    BlobPart* tail = parts[i];
-    BlobPart* head = parts[j];
-    Blob* blob = parts[i]->blob;
+    BlobPart* tail;
+    BlobPart* head;
+    Blob* blob;
+
+    /* The blob created first survives */
+    if(parts[j]->blob->id < parts[i]->blob->id) {
+        BlobPartId swap = i;
+        i = j;
+        j = swap;
+    }
+
+    tail = parts[i];
+    head = parts[j];
+    blob = parts[i]->blob;
 
     while(tail->next) {
         tail = tail->next;
@@ -98,6 +197,22 @@ static void join_blob_parts(BlobPart** parts, BlobPartId i, BlobPartId j) {
     }
 }
 
+/* Clip roi to the image. A NULL roi gives the whole image */
+static CvRect clip_roi(IplImage* img, CvRect* roi) {
+    int x0, y0, x1, y1;
+
+    if(roi == NULL) {
+        return cvRect(0, 0, img->width, img->height);
+    }
+
+    x0 = Util_inRange(0, roi->x, img->width);
+    y0 = Util_inRange(0, roi->y, img->height);
+    x1 = Util_inRange(x0, roi->x + roi->width, img->width);
+    y1 = Util_inRange(y0, roi->y + roi->height, img->height);
+
+    return cvRect(x0, y0, x1 - x0, y1 - y0);
+}
+
 static BlobPart** grow_blob_parts_table(BlobPart** parts, size_t* current_size) {
     size_t old_size = *current_size;
     size_t new_size = old_size + BLOB_PART_TABLE_ALLOC_UNIT;
@@ -139,44 +254,233 @@ static BlobPart** grow_blob_parts_table(BlobPart** parts, size_t* current_size)
  * \return A list of blobs
  */
 Blob** find_blobs(IplImage* img_in, IplImage* blobs_out, int* r_num_blobs, int min_size, int keep_number, uint8_t out_coloring) {
-    size_t blob_part_table_size = 0;
-    BlobPart** blob_parts = NULL;
+    return find_blobs_roi(img_in, blobs_out, r_num_blobs, min_size, keep_number, out_coloring, NULL);
+}
 
-    BlobPartId* blob_mapping = calloc(sizeof(BlobPartId), img_in->height * img_in->widthStep);
+/**
+ * \brief Locate blobs in a region of interest of a binary image
+ *
+ * Identical to find_blobs, except only the pixels inside roi are
+ * labeled. Blobs touching the edge of the roi are cut off there. Centroids and
+ * bounding boxes of the returned blobs are still given in full frame
+ * coordinates and blobs_out is cleared outside of roi, so the output can be
+ * used exactly like the output of find_blobs.
+ *
+ * \param roi The region to label, or NULL to label the whole image
+ */
+Blob** find_blobs_roi(IplImage* img_in, IplImage* blobs_out, int* r_num_blobs, int min_size, int keep_number, uint8_t out_coloring, CvRect* roi) {
+    /* Region of the image being labeled */
+    CvRect area = clip_roi(img_in, roi);
+    uint8_t* img_pixel;
+    int row;
+
+    /* Clear the output image outside of the labeled area */
+    for(row = 0; row < blobs_out->height; row++) {
+        img_pixel = (uint8_t*) blobs_out->imageData + row * blobs_out->widthStep;
+
+        if(row < area.y || row >= area.y + area.height) {
+            memset(img_pixel, 0, blobs_out->width);
+        } else {
+            memset(img_pixel, 0, area.x);
+            memset(img_pixel + area.x + area.width, 0, blobs_out->width - area.x - area.width);
+        }
+    }
 
-    BlobPartId* pixel_above = blob_mapping - img_in->widthStep;
-    BlobPartId* map_pixel = blob_mapping;
-    uint8_t* img_pixel = (uint8_t*) img_in->imageData;
-    uint8_t row_padding = img_in->widthStep - img_in->width;
-    
-    BlobPartId next_part_id = 1;
-    BlobPartId adjacent_parts[4];
-    BlobPartId assigned_to;
+    return label_area(img_in, blobs_out, area, r_num_blobs, min_size, keep_number, out_coloring, 1);
+}
 
-    /* Blobs as their created. This includes "decommissioned" blobs */
-    List* raw_blobs = List_new();
-    int num_raw_blobs = 0;
+/**
+ * \brief find_blobs_roi without clearing the rest of the output image
+ *
+ * Only the pixels of blobs_out inside roi are written, so labeling several
+ * small areas of a large image one after another costs only the size of the
+ * areas. blobs_out outside of roi is left as it was.
+ */
+Blob** find_blobs_area(IplImage* img_in, IplImage* blobs_out, int* r_num_blobs, int min_size, int keep_number, uint8_t out_coloring, CvRect* roi) {
+    return label_area(img_in, blobs_out, clip_roi(img_in, roi), r_num_blobs, min_size, keep_number, out_coloring, 1);
+}
+
+/* Label the blobs inside area, which must lie within the image. Only the
+   pixels of blobs_out inside area are written. Blobs kept are given ids from
+   first_id up */
+static Blob** label_area(IplImage* img_in, IplImage* blobs_out, CvRect area, int* r_num_blobs, int min_size, int keep_number, uint8_t out_coloring, int first_id) {
+    LabelJob job;
+
+    /* Blobs of all bands as their created. This includes "decommissioned"
+       blobs */
+    Blob** raw_blobs;
+    int num_raw_blobs;
 
     /* Blobs that we return. May be less than keep_number, but the memories
        cheaper than the CPU cycles */
     Blob** blobs = malloc(sizeof(Blob*) * keep_number);
     int num_blobs = 0;
 
-    uint32_t row, column;
-    uint32_t height = img_in->height;
-    uint32_t width = img_in->width;
-
+    LabelBand* band;
+    BlobTotals* totals;
     Blob* b;
     int i, j;
 
-    /* Go through the input image and construct all the blob parts and raw blobs */
-    for(row = 0; row < height; row++) {
+    job.img_in = img_in;
+    job.blobs_out = blobs_out;
+    job.area = area;
+    job.out_coloring = out_coloring;
+    job.first_id = first_id;
+
+    /* The mapping only covers the labeled area */
+    job.blob_mapping = calloc(sizeof(BlobPartId), area.height * area.width + 1);
+
+    job.num_bands = pool_bands(area.height, BLOB_MIN_BAND_ROWS);
+    for(i = 0; i < job.num_bands; i++) {
+        band = &job.bands[i];
+        memset(band, 0, sizeof(LabelBand));
+        band->row_0 = pool_band_start(area.height, job.num_bands, i);
+        band->row_1 = pool_band_start(area.height, job.num_bands, i + 1);
+    }
+
+    /* Go through the input image and construct all the blob parts and raw
+       blobs, then join the blobs crossing between bands */
+    pool_run(label_band, &job, job.num_bands);
+    raw_blobs = join_bands(&job, &num_raw_blobs);
+
+    /* Generate the sorted list of blobs we're keeping. This is done by going
+       through all the raw blobs and when one is found that's bigger than the
+       smallest one we've already selected, we remove the smallest one and add
+       the new one into the list so that the list of blobs to keep stays
+       ordered. */
+    for(i = 0; i < num_raw_blobs; i++) {
+        b = raw_blobs[i];
+
+        if(b->size < min_size) {
+            continue;
+        }
+
+        /* If we've found keep_number of blobs already and this one is smaller
+           than our current smallest, then skip it */
+        if(num_blobs == keep_number && b->size <= blobs[num_blobs - 1]->size) {
+            continue;
+        }
+
+        /* Find the place in the sorted list this blob should go */
+        j = 0;
+        while(j < num_blobs && b->size < blobs[j]->size) {
+            j++;
+        }
+
+        /* If there's already a blob where this one should go then move all the
+           ones after it down by one */
+        if(num_blobs == keep_number) {
+            memmove(blobs + j + 1, blobs + j, (num_blobs - j - 1) * sizeof(Blob*));
+        } else {
+            memmove(blobs + j + 1, blobs + j, (num_blobs - j) * sizeof(Blob*));
+        }
+        blobs[j] = b;
+
+        /* Increment the number of blobs if we don't already have the maximum number */
+        if(num_blobs < keep_number) {
+            num_blobs++;
+        }
+    }
+
+    /* Assigned blob ids to the blobs we are keeping. Remember, id 0 is
+       reserved so we don't use it here */
+    for(i = 0; i < num_blobs; i++) {
+        blobs[i]->id = first_id + i;
+    }
+    job.num_blobs = num_blobs;
+
+    /* Write out the output image and compute blob bounding boxes/regions of
+       interest and blob centroids, band by band */
+    for(i = 0; i < job.num_bands; i++) {
+        job.bands[i].totals = malloc(sizeof(BlobTotals) * (num_blobs + 1));
+    }
+    pool_run(write_band, &job, job.num_bands);
+
+    /* Add up the bands, then divide c_x, c_y by size to give the center of
+       mass of the blob */
+    for(i = 0; i < num_blobs; i++) {
+        b = blobs[i];
+
+        b->x_0 = img_in->width;
+        b->x_1 = 0;
+        b->y_0 = img_in->height;
+        b->y_1 = 0;
+        b->c_x = 0;
+        b->c_y = 0;
+
+        for(j = 0; j < job.num_bands; j++) {
+            totals = &job.bands[j].totals[i];
+
+            b->c_x += totals->c_x;
+            b->c_y += totals->c_y;
+            if(totals->x_0 < b->x_0) b->x_0 = totals->x_0;
+            if(totals->x_1 > b->x_1) b->x_1 = totals->x_1;
+            if(totals->y_0 < b->y_0) b->y_0 = totals->y_0;
+            if(totals->y_1 > b->y_1) b->y_1 = totals->y_1;
+        }
+
+        b->c_x /= b->size;
+        b->c_y /= b->size;
+    }
+
+    for(i = 0; i < job.num_bands; i++) {
+        band = &job.bands[i];
+
+        /* Free each chunk of blob part */
+        for(j = 0; j < band->blob_part_table_size; j += BLOB_PART_TABLE_ALLOC_UNIT) {
+            free(band->blob_parts[j]);
+        }
+        free(band->blob_parts);
+        free(band->totals);
+
+        /* Destroy the list of raw blobs */
+        List_destroy(band->raw_blobs);
+    }
+    free(job.blob_mapping);
+
+    /* Free any blobs that aren't being returned */
+    for(i = 0; i < num_raw_blobs; i++) {
+        if(raw_blobs[i]->id == 0) {
+            free(raw_blobs[i]);
+        }
+    }
+    free(raw_blobs);
+
+    /* Save the number of blobs and return the blobs list */
+    (*r_num_blobs) = num_blobs;
+    return blobs;
+}
+
+/* First pass of label_area over one band. Pixels in the band's first row are
+   labeled as if nothing were above them */
+static void label_band(void* _job, int band_index) {
+    LabelJob* job = _job;
+    LabelBand* band = &job->bands[band_index];
+    uint32_t width = job->area.width;
+
+    BlobPartId* map_pixel = job->blob_mapping + band->row_0 * width;
+    BlobPartId* pixel_above = map_pixel - width;
+    uint8_t* img_pixel;
+
+    BlobPartId adjacent_parts[4];
+    BlobPartId assigned_to;
+
+    uint32_t row, column;
+    Blob* b;
+    int i;
+
+    band->next_part_id = 1;
+    band->raw_blobs = List_new();
+
+    for(row = band->row_0; row < band->row_1; row++) {
+        img_pixel = (uint8_t*) job->img_in->imageData + (job->area.y + row) * job->img_in->widthStep + job->area.x;
+
         for(column = 0; column < width; column++) {
             memset(adjacent_parts, 0, sizeof(adjacent_parts));
             
             if(*img_pixel) {
                 /* Build list of adjacent blob parts */
-                if(row > 0) {
+                if(row > band->row_0) {
                     if(column > 0) {
                         adjacent_parts[UP_LEFT] = pixel_above[-1];
                         adjacent_parts[LEFT] = *(map_pixel - 1);
@@ -202,35 +506,35 @@ Blob** find_blobs(IplImage* img_in, IplImage* blobs_out, int* r_num_blobs, int m
             
                 /* No adjacent blob pixels, create new blob part */
                 if(assigned_to == 0) {
-                    assigned_to = next_part_id;
+                    assigned_to = band->next_part_id;
 
                     /* Grow BlobParts table if there's no free space */
-                    if(assigned_to >= blob_part_table_size) {
-                        blob_parts = grow_blob_parts_table(blob_parts, &blob_part_table_size);
+                    if(assigned_to >= band->blob_part_table_size) {
+                        band->blob_parts = grow_blob_parts_table(band->blob_parts, &band->blob_part_table_size);
                     }
 
                     /* Create the new blob */
                     b = calloc(sizeof(Blob), 1);
 
-                    List_append(raw_blobs, b);
-                    blob_parts[assigned_to]->blob = b;
+                    List_append(band->raw_blobs, b);
+                    band->blob_parts[assigned_to]->blob = b;
                     
-                    next_part_id++;
-                    num_raw_blobs++;
+                    band->next_part_id++;
+                    band->num_raw_blobs++;
+                    b->id = band->num_raw_blobs;
                 }
             
                 /* Store blob part identifier */
                 (*map_pixel) = assigned_to;
 
-                b = blob_parts[assigned_to]->blob;
-                b->size++;
+                band->blob_parts[assigned_to]->blob->size++;
 
                 /* Connect newly adjacent blob parts */
                 for(i = i + 1; i < 4; i++) {
-                    if(adjacent_parts[i] && blob_parts[adjacent_parts[i]]->blob != b) {
+                    if(adjacent_parts[i] && band->blob_parts[adjacent_parts[i]]->blob != band->blob_parts[assigned_to]->blob) {
                         /* Join the blobs, assigning the blob parts in
                            adjacent_parts[j] to the blob in assigned_to */
-                        join_blob_parts(blob_parts, assigned_to, adjacent_parts[i]);
+                        join_blob_parts(band->blob_parts, assigned_to, adjacent_parts[i]);
                     }
                 }
             }
@@ -239,77 +543,140 @@ Blob** find_blobs(IplImage* img_in, IplImage* blobs_out, int* r_num_blobs, int m
             map_pixel++;
             img_pixel++;
         }
+    }
+}
 
-        pixel_above += row_padding;
-        map_pixel += row_padding;
-        img_pixel += row_padding;
+/* Find the first blob of the group of joined blobs holding blob i */
+static int find_first_blob(int* first, int i) {
+    while(first[i] != i) {
+        first[i] = first[first[i]];
+        i = first[i];
     }
+    return i;
+}
 
-    /* Generate the sorted list of blobs we're keeping. This is done by going
-       through all the raw blobs and when one is found that's bigger than the
-       smallest one we've already selected, we remove the smallest one and add
-       the new one into the list so that the list of blobs to keep stays
-       ordered. */
-    for(i = 0; i < num_raw_blobs; i++) {
-        b = List_get(raw_blobs, i);
+/* Position of the blob of a pixel of band among the blobs of all bands */
+static int band_blob(LabelBand* band, BlobPartId part) {
+    return band->first_blob + band->blob_parts[part]->blob->id - 1;
+}
 
-        if(b->size < min_size) {
-            continue;
-        }
+/* Join the blobs which cross from one band into the next, keeping the one
+   created first in raster order. Afterwards every BlobPart points to a
+   surviving blob, and every blob's id is 0. Returns the blobs of all bands in
+   the order they were created, and their number in r_num_raw_blobs */
+static Blob** join_bands(LabelJob* job, int* r_num_raw_blobs) {
+    uint32_t width = job->area.width;
+    LabelBand* band;
+    Blob** raw_blobs;
+    int* first;
+    int num_raw_blobs = 0;
+    int i, j, k, a, b;
+    uint32_t column;
 
-        /* If we've found keep_number of blobs already and this one is smaller
-           than our current smallest, then skip it */
-        if(num_blobs == keep_number && b->size <= blobs[num_blobs - 1]->size) {
-            continue;
+    for(i = 0; i < job->num_bands; i++) {
+        job->bands[i].first_blob = num_raw_blobs;
+        num_raw_blobs += job->bands[i].num_raw_blobs;
+    }
+
+    raw_blobs = malloc(sizeof(Blob*) * (num_raw_blobs + 1));
+    first = malloc(sizeof(int) * (num_raw_blobs + 1));
+    for(i = 0; i < job->num_bands; i++) {
+        band = &job->bands[i];
+        for(j = 0; j < band->num_raw_blobs; j++) {
+            raw_blobs[band->first_blob + j] = List_get(band->raw_blobs, j);
+            first[band->first_blob + j] = band->first_blob + j;
         }
+    }
 
-        /* Find the place in the sorted list this blob should go */
-        j = 0;
-        while(j < num_blobs && b->size < blobs[j]->size) {
-            j++;
+    /* Pixels in the first row of a band touch those of the last row of the
+       band above */
+    for(i = 1; i < job->num_bands; i++) {
+        LabelBand* above = &job->bands[i - 1];
+        BlobPartId* map_pixel = job->blob_mapping + job->bands[i].row_0 * width;
+        BlobPartId* pixel_above = map_pixel - width;
+
+        band = &job->bands[i];
+        for(column = 0; column < width; column++) {
+            if(map_pixel[column] == 0) {
+                continue;
+            }
+
+            a = find_first_blob(first, band_blob(band, map_pixel[column]));
+            for(k = -1; k <= 1; k++) {
+                if((column == 0 && k < 0) || (column == width - 1 && k > 0) || pixel_above[column + k] == 0) {
+                    continue;
+                }
+
+                b = find_first_blob(first, band_blob(above, pixel_above[column + k]));
+                if(a < b) {
+                    first[b] = a;
+                } else if(b < a) {
+                    first[a] = b;
+                    a = b;
+                }
+            }
         }
+    }
 
-        /* If there's already a blob where this one should go then move all the
-           ones after it down by one */
-        if(num_blobs == keep_number) {
-            memmove(blobs + j + 1, blobs + j, (num_blobs - j - 1) * sizeof(Blob*));
-        } else {
-            memmove(blobs + j + 1, blobs + j, (num_blobs - j) * sizeof(Blob*));
+    /* Move the sizes of joined blobs to the first of each group */
+    for(i = 0; i < num_raw_blobs; i++) {
+        a = find_first_blob(first, i);
+        if(a != i && raw_blobs[i]->size != -1) {
+            raw_blobs[a]->size += raw_blobs[i]->size;
+            raw_blobs[i]->size = -1;
         }
-        blobs[j] = b;
+    }
 
-        /* Increment the number of blobs if we don't already have the maximum number */
-        if(num_blobs < keep_number) {
-            num_blobs++;
+    for(i = 0; i < job->num_bands; i++) {
+        band = &job->bands[i];
+        for(j = 1; j < band->next_part_id; j++) {
+            band->blob_parts[j]->blob = raw_blobs[find_first_blob(first, band_blob(band, j))];
         }
     }
 
-    /* Assigned blob ids to the blobs we are keeping and initialize boundings
-       boxes. Remember, id 0 is reserved so we don't use it here */
-    for(i = 0; i < num_blobs; i++) {
-        b = blobs[i];
-        b->id = i + 1;
+    for(i = 0; i < num_raw_blobs; i++) {
+        raw_blobs[i]->id = 0;
+    }
+    free(first);
 
-        /* Set bounding box to extreme values before hand */
-        b->x_0 = img_in->width;
-        b->x_1 = 0;
-        b->y_0 = img_in->height;
-        b->y_1 = 0;
+    *r_num_raw_blobs = num_raw_blobs;
+    return raw_blobs;
+}
 
-        /* Zero the accumulators for the centroid calculation */
-        b->c_x = 0;
-        b->c_y = 0;
+/* Second pass of label_area over one band, writing out the band's rows and
+   the totals of the kept blobs over them */
+static void write_band(void* _job, int band_index) {
+    LabelJob* job = _job;
+    LabelBand* band = &job->bands[band_index];
+    CvRect area = job->area;
+
+    BlobPartId* map_pixel = job->blob_mapping + band->row_0 * area.width;
+    uint8_t* img_pixel;
+
+    BlobTotals* totals;
+    uint32_t row, column;
+    Blob* b;
+    int i;
+
+    /* Set bounding boxes to extreme values before hand */
+    for(i = 0; i < job->num_blobs; i++) {
+        totals = &band->totals[i];
+        totals->c_x = 0;
+        totals->c_y = 0;
+        totals->x_0 = job->img_in->width;
+        totals->x_1 = 0;
+        totals->y_0 = job->img_in->height;
+        totals->y_1 = 0;
     }
 
-    map_pixel = blob_mapping;
-    img_pixel = (uint8_t*) blobs_out->imageData;
+    /* Positions are translated back to full frame coordinates as they're
+       accumulated */
+    for(row = area.y + band->row_0; row < area.y + band->row_1; row++) {
+        img_pixel = (uint8_t*) job->blobs_out->imageData + row * job->blobs_out->widthStep + area.x;
 
-    /* Write out the output image and compute blob bounding boxes/regions of
-       interest and blob centroids */
-    for(row = 0; row < height; row++) {
-        for(column = 0; column < width; column++) {
+        for(column = area.x; column < area.x + area.width; column++) {
             if((*map_pixel)) {
-                b = blob_parts[*map_pixel]->blob;
+                b = band->blob_parts[*map_pixel]->blob;
 
                 /* Save the blob id to the output image (this may be 0, but
                    we're not keeping blobs with id 0 anyway) */
@@ -317,31 +684,33 @@ Blob** find_blobs(IplImage* img_in, IplImage* blobs_out, int* r_num_blobs, int m
 
                 if(b->id) {
                     /* If a static coloring is being used rewrite the pixel value */
-                    if(out_coloring) {
-                        (*img_pixel) = out_coloring;
+                    if(job->out_coloring) {
+                        (*img_pixel) = job->out_coloring;
                     }
+
+                    totals = &band->totals[b->id - job->first_id];
                     
                     /* Running totals of x, y pixel locations in this
                        blob. These are divided by the blob size in the end to
                        get the blob's center of mass */
-                    b->c_x += column;
-                    b->c_y += row;
+                    totals->c_x += column;
+                    totals->c_y += row;
 
                     /* Update the bounds on the bounding box as necessary */
-                    if(column < b->x_0) {
-                        b->x_0 = column;
+                    if(column < totals->x_0) {
+                        totals->x_0 = column;
                     }
 
-                    if(column > b->x_1) {
-                        b->x_1 = column;
+                    if(column > totals->x_1) {
+                        totals->x_1 = column;
                     }
 
-                    if(row < b->y_0) {
-                        b->y_0 = row;
+                    if(row < totals->y_0) {
+                        totals->y_0 = row;
                     }
 
-                    if(row > b->y_1) {
-                        b->y_1 = row;
+                    if(row > totals->y_1) {
+                        totals->y_1 = row;
                     }
 
                 }
@@ -352,54 +721,343 @@ Blob** find_blobs(IplImage* img_in, IplImage* blobs_out, int* r_num_blobs, int m
             map_pixel++;
             img_pixel++;
         }
-        
-        map_pixel += row_padding;
-        img_pixel += row_padding;
     }
+}
+
+/**
+ * \brief Free blobs returned by find_blobs
+ *
+ * Free resources returned by find_blobs
+ *
+ * \param blobs List of pointers to Blob structures as returned by find_blobs.
+ * \param num_blobs Number of Blobs in blobs
+ */
+void free_blobs(Blob** blobs, int num_blobs) {
+    for(int i = 0; i < num_blobs; i++) {
+        free(blobs[i]);
+    }
+    free(blobs);
+}
+
+/**
+ * \brief Create the state for find_blobs_tracked
+ *
+ * \param full_scan_interval The whole frame is labeled at least once every
+ *        this many frames, to pick up blobs away from the tracked ones. 1
+ *        labels every frame in full.
+ * \param margin Pixels the previous frame's bounding boxes are grown by. Blobs
+ *        moving further than this between frames cause a full scan.
+ * \return A new tracker, to be freed with blob_tracker_free
+ */
+BlobTracker* blob_tracker_new(int full_scan_interval, int margin) {
+    BlobTracker* tracker = calloc(1, sizeof(BlobTracker));
+
+    tracker->full_scan_interval = full_scan_interval;
+    tracker->margin = margin;
+    tracker->next_track_id = 1;
+
+    return tracker;
+}
+
+/**
+ * \brief Free a tracker created with blob_tracker_new
+ */
+void blob_tracker_free(BlobTracker* tracker) {
+    free(tracker->tracks);
+    free(tracker);
+}
+
+/* Bounding box of a track, grown by margin and clipped to the image */
+static CvRect track_area(BlobTracker* tracker, BlobTrack* track, IplImage* img) {
+    CvRect area = cvRect(track->x_0 - tracker->margin, track->y_0 - tracker->margin,
+                         track->x_1 - track->x_0 + 1 + 2 * tracker->margin,
+                         track->y_1 - track->y_0 + 1 + 2 * tracker->margin);
+    return clip_roi(img, &area);
+}
+
+static int rect_contains(CvRect r, int x, int y) {
+    return x >= r.x && x < r.x + r.width && y >= r.y && y < r.y + r.height;
+}
+
+static int rects_overlap(CvRect a, CvRect b) {
+    return a.x < b.x + b.width && b.x < a.x + a.width &&
+           a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
+static CvRect rect_union(CvRect a, CvRect b) {
+    int x_0 = a.x < b.x ? a.x : b.x;
+    int y_0 = a.y < b.y ? a.y : b.y;
+    int x_1 = a.x + a.width > b.x + b.width ? a.x + a.width : b.x + b.width;
+    int y_1 = a.y + a.height > b.y + b.height ? a.y + a.height : b.y + b.height;
+    return cvRect(x_0, y_0, x_1 - x_0, y_1 - y_0);
+}
+
+/* Whether blob b reaches an edge of area that isn't an edge of the image,
+   meaning it may continue outside of the area */
+static int touches_area_edge(Blob* b, CvRect area, IplImage* img) {
+    return (b->x_0 == area.x && area.x > 0) ||
+           (b->y_0 == area.y && area.y > 0) ||
+           (b->x_1 == area.x + area.width - 1 && area.x + area.width < img->width) ||
+           (b->y_1 == area.y + area.height - 1 && area.y + area.height < img->height);
+}
+
+/* Pair blobs with tracks, closest centroids first. A blob can only be paired
+   with a track whose grown bounding box holds the blob's centroid. match[i]
+   is set to the track of blobs[i], or -1 */
+static void match_tracks(BlobTracker* tracker, IplImage* img, Blob** blobs, int num_blobs, int* match) {
+    uint8_t* track_used = calloc(tracker->num_tracks + 1, 1);
+    int64_t best_dist, dx, dy;
+    int best_blob, best_track;
+    int i, t;
 
-    /* Divide c_x, c_y by size to give the center of mass of the blob */
     for(i = 0; i < num_blobs; i++) {
-        blobs[i]->c_x /= blobs[i]->size;
-        blobs[i]->c_y /= blobs[i]->size;
+        match[i] = -1;
     }
 
-    /* Free each chunk of blob part */    
-    for(i = 0; i < blob_part_table_size; i += BLOB_PART_TABLE_ALLOC_UNIT) {
-        free(blob_parts[i]);
+    while(1) {
+        best_blob = -1;
+        best_track = -1;
+        best_dist = INT64_MAX;
+
+        for(i = 0; i < num_blobs; i++) {
+            if(match[i] >= 0) {
+                continue;
+            }
+            for(t = 0; t < tracker->num_tracks; t++) {
+                if(track_used[t] || !rect_contains(track_area(tracker, &tracker->tracks[t], img), blobs[i]->c_x, blobs[i]->c_y)) {
+                    continue;
+                }
+                dx = (int64_t) blobs[i]->c_x - tracker->tracks[t].c_x;
+                dy = (int64_t) blobs[i]->c_y - tracker->tracks[t].c_y;
+                if(dx * dx + dy * dy < best_dist) {
+                    best_dist = dx * dx + dy * dy;
+                    best_blob = i;
+                    best_track = t;
+                }
+            }
+        }
+
+        if(best_blob < 0) {
+            break;
+        }
+        match[best_blob] = best_track;
+        track_used[best_track] = 1;
     }
 
-    free(blob_parts);
-    free(blob_mapping);
+    free(track_used);
+}
 
-    /* Free any blobs that aren't being returned */
-    for(i = 0; i < num_raw_blobs; i++) {
-        b = List_get(raw_blobs, i);
-        if(b->id == 0) {
-            free(b);
+/* Label only around the previous frame's blobs. Returns NULL if a tracked blob
+   was lost or outgrew its area, in which case the frame needs a full scan */
+static Blob** find_blobs_incremental(BlobTracker* tracker, IplImage* img_in, IplImage* blobs_out, int* r_num_blobs, uint32_t* track_ids, int min_size, int keep_number, uint8_t out_coloring) {
+    CvRect* areas = malloc(tracker->num_tracks * sizeof(CvRect));
+    int num_areas = 0;
+
+    /* Blobs found in all areas, with the area each came from. Ids are unique
+       across areas, and must fit in the 8 bit output image */
+    Blob* found[256];
+    int found_area[256];
+    int match[256];
+    int num_found = 0;
+    int next_id = 1;
+
+    /* Output id of each id given while labeling */
+    uint8_t remap[256];
+
+    Blob** blobs = NULL;
+    Blob** area_blobs;
+    int num_blobs = 0;
+    int num_area_blobs;
+    int failed = 0;
+    int merged;
+    int i, j, t, row, column;
+
+    /* Grow the previous bounding boxes and merge overlapping ones, so no
+       pixel is labeled twice */
+    for(t = 0; t < tracker->num_tracks; t++) {
+        areas[num_areas++] = track_area(tracker, &tracker->tracks[t], img_in);
+    }
+    do {
+        merged = 0;
+        for(i = 0; i < num_areas; i++) {
+            for(j = i + 1; j < num_areas; j++) {
+                if(rects_overlap(areas[i], areas[j])) {
+                    areas[i] = rect_union(areas[i], areas[j]);
+                    areas[j] = areas[--num_areas];
+                    merged = 1;
+                    j--;
+                }
+            }
         }
+    } while(merged);
+
+    for(row = 0; row < blobs_out->height; row++) {
+        memset(blobs_out->imageData + row * blobs_out->widthStep, 0, blobs_out->width);
     }
 
-    /* Destroy the list of raw blobs */
-    List_destroy(raw_blobs);
+    for(i = 0; i < num_areas; i++) {
+        if(next_id + keep_number > 256) {
+            failed = 1;
+            break;
+        }
 
-    /* Save the number of blobs and return the blobs list */
-    (*r_num_blobs) = num_blobs;
+        area_blobs = label_area(img_in, blobs_out, areas[i], &num_area_blobs, min_size, keep_number, 0, next_id);
+        for(j = 0; j < num_area_blobs; j++) {
+            found[num_found] = area_blobs[j];
+            found_area[num_found] = i;
+            num_found++;
+        }
+        next_id += num_area_blobs;
+        free(area_blobs);
+    }
+
+    if(!failed) {
+        match_tracks(tracker, img_in, found, num_found, match);
+
+        /* Every track must still be there, and not have grown out of its area */
+        for(t = 0; t < tracker->num_tracks && !failed; t++) {
+            failed = 1;
+            for(i = 0; i < num_found; i++) {
+                if(match[i] == t) {
+                    failed = touches_area_edge(found[i], areas[found_area[i]], img_in);
+                    break;
+                }
+            }
+        }
+    }
+
+    if(!failed) {
+        blobs = malloc(sizeof(Blob*) * keep_number);
+        memset(remap, 0, sizeof(remap));
+
+        /* Keep the largest blobs. Untracked blobs cut off by an area edge are
+           only parts of blobs, they are left for the next full scan */
+        for(i = 0; i < num_found; i++) {
+            if(match[i] < 0 && touches_area_edge(found[i], areas[found_area[i]], img_in)) {
+                continue;
+            }
+
+            j = num_blobs;
+            while(j > 0 && found[i]->size > blobs[j - 1]->size) {
+                j--;
+            }
+            if(j >= keep_number) {
+                continue;
+            }
+            if(num_blobs == keep_number) {
+                num_blobs--;
+            }
+            memmove(blobs + j + 1, blobs + j, (num_blobs - j) * sizeof(Blob*));
+            memmove(track_ids + j + 1, track_ids + j, (num_blobs - j) * sizeof(uint32_t));
+            blobs[j] = found[i];
+            track_ids[j] = match[i] >= 0 ? tracker->tracks[match[i]].track_id : tracker->next_track_id++;
+            num_blobs++;
+        }
+
+        /* Renumber the kept blobs by size, like find_blobs, and erase the
+           others from the output */
+        for(i = 0; i < num_blobs; i++) {
+            remap[blobs[i]->id] = out_coloring ? out_coloring : i + 1;
+            blobs[i]->id = i + 1;
+        }
+        for(i = 0; i < num_areas; i++) {
+            for(row = areas[i].y; row < areas[i].y + areas[i].height; row++) {
+                uint8_t* img_pixel = (uint8_t*) blobs_out->imageData + row * blobs_out->widthStep;
+                for(column = areas[i].x; column < areas[i].x + areas[i].width; column++) {
+                    img_pixel[column] = remap[img_pixel[column]];
+                }
+            }
+        }
+    }
+
+    /* Free the blobs not returned */
+    for(i = 0; i < num_found; i++) {
+        for(j = 0; j < num_blobs; j++) {
+            if(blobs[j] == found[i]) {
+                break;
+            }
+        }
+        if(j == num_blobs) {
+            free(found[i]);
+        }
+    }
+    free(areas);
+
+    *r_num_blobs = num_blobs;
     return blobs;
 }
 
+/* Remember the blobs of this frame for the next one */
+static void update_tracks(BlobTracker* tracker, Blob** blobs, int num_blobs, uint32_t* track_ids) {
+    int i;
+
+    if(num_blobs > tracker->tracks_size) {
+        tracker->tracks = realloc(tracker->tracks, num_blobs * sizeof(BlobTrack));
+        tracker->tracks_size = num_blobs;
+    }
+
+    for(i = 0; i < num_blobs; i++) {
+        tracker->tracks[i].track_id = track_ids[i];
+        tracker->tracks[i].c_x = blobs[i]->c_x;
+        tracker->tracks[i].c_y = blobs[i]->c_y;
+        tracker->tracks[i].x_0 = blobs[i]->x_0;
+        tracker->tracks[i].x_1 = blobs[i]->x_1;
+        tracker->tracks[i].y_0 = blobs[i]->y_0;
+        tracker->tracks[i].y_1 = blobs[i]->y_1;
+    }
+    tracker->num_tracks = num_blobs;
+}
+
 /**
- * \brief Free blobs returned by find_blobs
+ * \brief find_blobs for consecutive frames of a video, with stable ids
  *
- * Free resources returned by find_blobs
+ * Rather than labeling the whole frame, only the bounding boxes of the
+ * previous frame's blobs, grown by the tracker's margin, are labeled. The
+ * whole frame is labeled instead when:
  *
- * \param blobs List of pointers to Blob structures as returned by find_blobs.
- * \param num_blobs Number of Blobs in blobs
+ *  - full_scan_interval frames have passed since the last full scan
+ *  - there were no blobs in the previous frame
+ *  - a blob of the previous frame can't be found, or reaches the edge of its
+ *    grown bounding box
+ *
+ * so blobs appearing away from the tracked ones are found on the next full
+ * scan. Each returned blob is given a track id, which stays the same from
+ * frame to frame while the blob is followed. Blob ids and the output image
+ * are as given by find_blobs.
+ *
+ * \param tracker State from blob_tracker_new, one per video stream
+ * \param track_ids Array of keep_number, where the track id of each returned
+ *        blob is stored
+ * \return A list of blobs, to be freed with free_blobs
  */
-void free_blobs(Blob** blobs, int num_blobs) {
-    for(int i = 0; i < num_blobs; i++) {
-        free(blobs[i]);
+Blob** find_blobs_tracked(BlobTracker* tracker, IplImage* img_in, IplImage* blobs_out, int* r_num_blobs, uint32_t* track_ids, int min_size, int keep_number, uint8_t out_coloring) {
+    Blob** blobs = NULL;
+    int* match;
+    int num_blobs;
+    int i;
+
+    if(tracker->num_tracks > 0 && tracker->frames_since_scan + 1 < tracker->full_scan_interval && keep_number < 256) {
+        blobs = find_blobs_incremental(tracker, img_in, blobs_out, &num_blobs, track_ids, min_size, keep_number, out_coloring);
     }
-    free(blobs);
+
+    if(blobs) {
+        tracker->frames_since_scan++;
+    } else {
+        blobs = find_blobs(img_in, blobs_out, &num_blobs, min_size, keep_number, out_coloring);
+        tracker->frames_since_scan = 0;
+
+        match = malloc((num_blobs + 1) * sizeof(int));
+        match_tracks(tracker, img_in, blobs, num_blobs, match);
+        for(i = 0; i < num_blobs; i++) {
+            track_ids[i] = match[i] >= 0 ? tracker->tracks[match[i]].track_id : tracker->next_track_id++;
+        }
+        free(match);
+    }
+
+    update_tracks(tracker, blobs, num_blobs, track_ids);
+
+    *r_num_blobs = num_blobs;
+    return blobs;
 }
 
 #ifdef __SW_LIBVISION
@@ -423,4 +1081,14 @@ Blob** _wrap_find_blobs(struct iplimage_t* _img_in, struct iplimage_t* _blobs_ou
     return find_blobs(_img_in->a, _blobs_out->a, r_num_blobs, min_size, keep_number, (uint8_t) out_coloring);
 }
 
+/* Wrapper around find_blobs_roi. roi may be NULL */
+Blob** _wrap_find_blobs_roi(struct iplimage_t* _img_in, struct iplimage_t* _blobs_out, int* r_num_blobs, int min_size, int keep_number, int out_coloring, CvRect* roi) {
+    return find_blobs_roi(_img_in->a, _blobs_out->a, r_num_blobs, min_size, keep_number, (uint8_t) out_coloring, roi);
+}
+
+/* Wrapper around find_blobs_tracked */
+Blob** _wrap_find_blobs_tracked(BlobTracker* tracker, struct iplimage_t* _img_in, struct iplimage_t* _blobs_out, int* r_num_blobs, uint32_t* track_ids, int min_size, int keep_number, int out_coloring) {
+    return find_blobs_tracked(tracker, _img_in->a, _blobs_out->a, r_num_blobs, track_ids, min_size, keep_number, (uint8_t) out_coloring);
+}
+
 #endif // #ifdef __SW_LIBVISION
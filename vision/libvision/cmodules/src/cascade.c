@@ -0,0 +1,811 @@
+/**
+ * \file cascade.c
+ * \brief Haar cascade object detection restricted to regions of interest
+ *
+ * Runs the cascades trained with opencv_haartraining in vision/cascades
+ * the same way cvHaarDetectObjects does, with the window scaled rather than
+ * the image, but:
+ *
+ *  - The integral images are passed in rather than computed here, so one set
+ *    computed with cv.Integral serves every cascade run on the frame.
+ *  - Only window sizes between min_size and max_size are tried.
+ *  - Only windows inside the given regions of interest are tried. Windows are
+ *    placed on the same grid as in a full frame scan, so a region finds the
+ *    same hits a full scan would inside it.
+ *  - The window sizes are shared out between the module's thread pool (see
+ *    common/pool.h). Each thread scales the cascade into its own buffer, and
+ *    hits are kept per size and joined in order of size, so the result
+ *    doesn't depend on the number of threads.
+ *
+ * Hits are grouped as cvGroupRectangles does, into rectangles with the
+ * number of hits merged into each as its neighbors.
+ *
+ * Only cascades whose stages form a chain are supported, which is what
+ * opencv_haartraining writes.
+ */
+
+#include <cv.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "common/pool.h"
+
+/* How far apart grouped rectangles may be, as cvGroupRectangles' eps */
+#define CASCADE_GROUP_EPS 0.2
+
+/**
+ * \brief Detection parameters, set from Python
+ */
+typedef struct CascadeConfig_s {
+    /* Smallest and largest window widths tried, in pixels. A max_size of 0
+       tries windows up to the size of the frame */
+    int32_t min_size;
+    int32_t max_size;
+
+    /* Ratio between one window size and the next */
+    double scale_factor;
+
+    /* Hits merged into a rectangle for it to be kept. 0 keeps every hit as it
+       is, without grouping */
+    int32_t min_neighbors;
+
+    /* Most threads to share window sizes between, as well as the pool's
+       (see pool_set_threads). 0 for as many as the pool has */
+    int32_t num_threads;
+} CascadeConfig;
+
+/**
+ * \brief One object found by cascade_detect
+ */
+typedef struct CascadeHit_s {
+    int32_t x;
+    int32_t y;
+    int32_t width;
+    int32_t height;
+
+    /* Hits grouped into this one */
+    int32_t neighbors;
+} CascadeHit;
+
+/* A tree node with its feature as trained, at the original window size */
+typedef struct CascadeNode_s {
+    int tilted;
+    int num_rects;
+    CvRect rects[CV_HAAR_FEATURE_MAX];
+    float weights[CV_HAAR_FEATURE_MAX];
+    float threshold;
+
+    /* Next node, or minus the index of the leaf in the tree's alphas */
+    int left;
+    int right;
+} CascadeNode;
+
+typedef struct CascadeTree_s {
+    int first_node;
+    int first_alpha;
+} CascadeTree;
+
+typedef struct CascadeStage_s {
+    int first_tree;
+    int num_trees;
+    float threshold;
+} CascadeStage;
+
+/* A feature rectangle at one window size, as offsets of its corners from
+   the window's corner in the sum or tilted sum */
+typedef struct ScaledRect_s {
+    int p0;
+    int p1;
+    int p2;
+    int p3;
+    float weight;
+} ScaledRect;
+
+typedef struct ScaledNode_s {
+    ScaledRect rects[CV_HAAR_FEATURE_MAX];
+} ScaledNode;
+
+typedef struct CascadeScale_s {
+    double factor;
+    double step;
+    int width;
+    int height;
+
+    /* Windows on each row and column of the full frame grid */
+    int columns;
+    int rows;
+} CascadeScale;
+
+typedef struct HitList_s {
+    CascadeHit* hits;
+    int count;
+    int capacity;
+} HitList;
+
+typedef struct Cascade_s {
+    CascadeConfig config;
+    int window_width;
+    int window_height;
+
+    CascadeNode* nodes;
+    CascadeTree* trees;
+    float* alphas;
+    CascadeStage* stages;
+    int num_nodes;
+    int num_trees;
+    int num_stages;
+
+    /* Per thread scaled nodes */
+    ScaledNode* scaled[POOL_MAX_THREADS];
+
+    /* Window sizes of the last detection, and the hits at each */
+    CascadeScale* scales;
+    HitList* scale_hits;
+    int scales_capacity;
+
+    /* Merged regions of interest of the last detection */
+    CvRect* rois;
+    int rois_capacity;
+
+    /* All hits, and their group labels */
+    CascadeHit* hits;
+    int* labels;
+    int hits_capacity;
+} Cascade;
+
+/* One detection, shared by the threads running it */
+typedef struct CascadeJob_s {
+    Cascade* cascade;
+    const int32_t* sum;
+    const double* sqsum;
+    const int32_t* tilted;
+    int sum_stride;
+    int sqsum_stride;
+
+    const CascadeScale* scales;
+    int num_scales;
+    const CvRect* rois;
+    int num_rois;
+
+    /* Next window size for a thread to take */
+    pthread_mutex_t lock;
+    int next_scale;
+} CascadeJob;
+
+Cascade* cascade_new(const char* path, CascadeConfig* config);
+void cascade_set_config(Cascade* cascade, CascadeConfig* config);
+int cascade_detect(Cascade* cascade, IplImage* sum, IplImage* sqsum, IplImage* tilted,
+                   CvRect* rois, int num_rois, CascadeHit* hits, int max_hits);
+void cascade_free(Cascade* cascade);
+
+static int clamp(int value, int low, int high) {
+    return value < low ? low : (value > high ? high : value);
+}
+
+static void hit_list_push(HitList* list, int x, int y, int width, int height) {
+    CascadeHit* hit;
+
+    if(list->count == list->capacity) {
+        list->capacity = list->capacity ? 2 * list->capacity : 64;
+        list->hits = realloc(list->hits, list->capacity * sizeof(CascadeHit));
+    }
+    hit = &list->hits[list->count++];
+    hit->x = x;
+    hit->y = y;
+    hit->width = width;
+    hit->height = height;
+    hit->neighbors = 0;
+}
+
+/* Copies the trees of a loaded cascade into the cascade's arrays. Returns 0,
+   or -1 if the stages don't form a chain */
+static int flatten(Cascade* cascade, const CvHaarClassifierCascade* source) {
+    int num_nodes = 0;
+    int num_trees = 0;
+    int num_alphas = 0;
+    int i, j, k, n;
+
+    for(i = 0; i < source->count; i++) {
+        const CvHaarStageClassifier* stage = &source->stage_classifier[i];
+        if(stage->parent != i - 1 || stage->next != -1) {
+            return -1;
+        }
+        num_trees += stage->count;
+        for(j = 0; j < stage->count; j++) {
+            num_nodes += stage->classifier[j].count;
+            num_alphas += stage->classifier[j].count + 1;
+        }
+    }
+
+    cascade->window_width = source->orig_window_size.width;
+    cascade->window_height = source->orig_window_size.height;
+    cascade->num_stages = source->count;
+    cascade->num_trees = num_trees;
+    cascade->num_nodes = num_nodes;
+    cascade->stages = malloc(source->count * sizeof(CascadeStage));
+    cascade->trees = malloc(num_trees * sizeof(CascadeTree));
+    cascade->nodes = malloc(num_nodes * sizeof(CascadeNode));
+    cascade->alphas = malloc(num_alphas * sizeof(float));
+
+    num_nodes = num_trees = num_alphas = 0;
+    for(i = 0; i < source->count; i++) {
+        const CvHaarStageClassifier* stage = &source->stage_classifier[i];
+
+        cascade->stages[i].first_tree = num_trees;
+        cascade->stages[i].num_trees = stage->count;
+        cascade->stages[i].threshold = stage->threshold;
+
+        for(j = 0; j < stage->count; j++) {
+            const CvHaarClassifier* classifier = &stage->classifier[j];
+            CascadeTree* tree = &cascade->trees[num_trees++];
+
+            tree->first_node = num_nodes;
+            tree->first_alpha = num_alphas;
+            for(n = 0; n < classifier->count; n++) {
+                const CvHaarFeature* feature = &classifier->haar_feature[n];
+                CascadeNode* node = &cascade->nodes[num_nodes++];
+
+                node->tilted = feature->tilted;
+                node->num_rects = 0;
+                for(k = 0; k < CV_HAAR_FEATURE_MAX && feature->rect[k].r.width; k++) {
+                    node->rects[k] = feature->rect[k].r;
+                    node->weights[k] = feature->rect[k].weight;
+                    node->num_rects++;
+                }
+                node->threshold = classifier->threshold[n];
+                node->left = classifier->left[n];
+                node->right = classifier->right[n];
+            }
+            for(n = 0; n <= classifier->count; n++) {
+                cascade->alphas[num_alphas++] = classifier->alpha[n];
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Load a cascade from an XML file written by opencv_haartraining
+ *
+ * \param path Cascade file
+ * \param config Detection parameters, copied
+ * \return The cascade, or NULL if it can't be loaded
+ */
+Cascade* cascade_new(const char* path, CascadeConfig* config) {
+    CvHaarClassifierCascade* source = (CvHaarClassifierCascade*) cvLoad(path, NULL, NULL, NULL);
+    Cascade* cascade;
+
+    if(!CV_IS_HAAR_CLASSIFIER(source)) {
+        printf("cascade_new: %s is not a Haar cascade\n", path);
+        return NULL;
+    }
+
+    cascade = calloc(1, sizeof(Cascade));
+    cascade_set_config(cascade, config);
+
+    if(flatten(cascade, source) != 0) {
+        printf("cascade_new: the stages of %s are a tree, only chains are supported\n", path);
+        cvReleaseHaarClassifierCascade(&source);
+        cascade_free(cascade);
+        return NULL;
+    }
+    cvReleaseHaarClassifierCascade(&source);
+
+    return cascade;
+}
+
+/**
+ * \brief Change the detection parameters of a cascade
+ *
+ * \param config Detection parameters, copied
+ */
+void cascade_set_config(Cascade* cascade, CascadeConfig* config) {
+    cascade->config = *config;
+    if(cascade->config.scale_factor <= 1) {
+        cascade->config.scale_factor = 1.1;
+    }
+}
+
+/* Makes room for at least num_scales window sizes and their hit lists */
+static void reserve_scales(Cascade* cascade, int num_scales) {
+    int capacity = cascade->scales_capacity ? cascade->scales_capacity : 32;
+
+    if(num_scales <= cascade->scales_capacity) {
+        return;
+    }
+    while(capacity < num_scales) {
+        capacity *= 2;
+    }
+    cascade->scales = realloc(cascade->scales, capacity * sizeof(CascadeScale));
+    cascade->scale_hits = realloc(cascade->scale_hits, capacity * sizeof(HitList));
+    memset(&cascade->scale_hits[cascade->scales_capacity], 0,
+           (capacity - cascade->scales_capacity) * sizeof(HitList));
+    cascade->scales_capacity = capacity;
+}
+
+/* Window sizes for a frame, as cvHaarDetectObjects tries them, in
+   cascade->scales. Returns how many there are */
+static int choose_scales(Cascade* cascade, int width, int height) {
+    const CascadeConfig* config = &cascade->config;
+    int num_scales = 0;
+    double factor;
+
+    for(factor = 1;
+        factor * cascade->window_width < width - 10 && factor * cascade->window_height < height - 10;
+        factor *= config->scale_factor) {
+        CascadeScale* scale;
+
+        reserve_scales(cascade, num_scales + 1);
+        scale = &cascade->scales[num_scales];
+
+        scale->factor = factor;
+        scale->step = factor > 2 ? factor : 2;
+        scale->width = cvRound(cascade->window_width * factor);
+        scale->height = cvRound(cascade->window_height * factor);
+        scale->columns = cvRound((width - scale->width) / scale->step);
+        scale->rows = cvRound((height - scale->height) / scale->step);
+
+        if(scale->width < config->min_size) {
+            continue;
+        }
+        if(config->max_size > 0 && scale->width > config->max_size) {
+            break;
+        }
+        num_scales++;
+    }
+
+    return num_scales;
+}
+
+/* Scales every feature to a window size, as cvSetImagesForHaarClassifierCascade
+   does. The first rectangle of each feature is reweighted so the feature
+   sums to zero over a flat window */
+static void scale_nodes(const Cascade* cascade, double factor, int stride, ScaledNode* scaled) {
+    CvRect window = {cvRound(factor), cvRound(factor),
+                     cvRound((cascade->window_width - 2) * factor),
+                     cvRound((cascade->window_height - 2) * factor)};
+    double weight_scale = 1.0 / (window.width * window.height);
+    int i, k;
+
+    for(i = 0; i < cascade->num_nodes; i++) {
+        const CascadeNode* node = &cascade->nodes[i];
+        ScaledNode* out = &scaled[i];
+        double area_0 = 0;
+        double sum_0 = 0;
+
+        for(k = 0; k < node->num_rects; k++) {
+            CvRect r = {cvRound(node->rects[k].x * factor), cvRound(node->rects[k].y * factor),
+                        cvRound(node->rects[k].width * factor), cvRound(node->rects[k].height * factor)};
+            ScaledRect* rect = &out->rects[k];
+
+            if(!node->tilted) {
+                rect->p0 = r.y * stride + r.x;
+                rect->p1 = r.y * stride + r.x + r.width;
+                rect->p2 = (r.y + r.height) * stride + r.x;
+                rect->p3 = (r.y + r.height) * stride + r.x + r.width;
+                rect->weight = node->weights[k] * weight_scale;
+            } else {
+                rect->p0 = r.y * stride + r.x;
+                rect->p1 = (r.y + r.height) * stride + r.x - r.height;
+                rect->p2 = (r.y + r.width) * stride + r.x + r.width;
+                rect->p3 = (r.y + r.width + r.height) * stride + r.x + r.width - r.height;
+                rect->weight = node->weights[k] * weight_scale * 0.5;
+            }
+
+            if(k == 0) {
+                area_0 = r.width * r.height;
+            } else {
+                sum_0 += rect->weight * r.width * r.height;
+            }
+        }
+        out->rects[0].weight = -sum_0 / area_0;
+    }
+}
+
+static inline double rect_sum(const int32_t* sum, const ScaledRect* rect) {
+    return sum[rect->p0] - sum[rect->p1] - sum[rect->p2] + sum[rect->p3];
+}
+
+/* Runs the cascade on the window with its corner at the given offsets into
+   the sums. Returns 1 if every stage passes */
+static int run_window(const Cascade* cascade, const ScaledNode* scaled, const CascadeJob* job,
+                      const ScaledRect* window, double inverse_area, int offset, int sq_offset) {
+    const int32_t* sum = job->sum + offset;
+    const int32_t* tilted = job->tilted + offset;
+    const double* sqsum = job->sqsum + sq_offset;
+    double mean, variance, norm;
+    int s, t;
+
+    mean = rect_sum(sum, window) * inverse_area;
+    variance = (sqsum[window[1].p0] - sqsum[window[1].p1] - sqsum[window[1].p2] + sqsum[window[1].p3]) *
+               inverse_area - mean * mean;
+    norm = variance >= 0 ? sqrt(variance) : 1;
+
+    for(s = 0; s < cascade->num_stages; s++) {
+        const CascadeStage* stage = &cascade->stages[s];
+        double stage_sum = 0;
+
+        for(t = stage->first_tree; t < stage->first_tree + stage->num_trees; t++) {
+            const CascadeTree* tree = &cascade->trees[t];
+            int index = 0;
+
+            do {
+                const CascadeNode* node = &cascade->nodes[tree->first_node + index];
+                const ScaledNode* scaled_node = &scaled[tree->first_node + index];
+                const int32_t* source = node->tilted ? tilted : sum;
+                double value = rect_sum(source, &scaled_node->rects[0]) * scaled_node->rects[0].weight +
+                               rect_sum(source, &scaled_node->rects[1]) * scaled_node->rects[1].weight;
+
+                if(node->num_rects == 3) {
+                    value += rect_sum(source, &scaled_node->rects[2]) * scaled_node->rects[2].weight;
+                }
+                index = value < node->threshold * norm ? node->left : node->right;
+            } while(index > 0);
+
+            stage_sum += cascade->alphas[tree->first_alpha - index];
+        }
+
+        if(stage_sum < stage->threshold) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* Tries every window of one size inside the regions of interest */
+static void scan_scale(CascadeJob* job, int scale_index, ScaledNode* scaled) {
+    Cascade* cascade = job->cascade;
+    const CascadeScale* scale = &job->scales[scale_index];
+    HitList* hits = &cascade->scale_hits[scale_index];
+    ScaledRect window[2];
+    double inverse_area;
+    int w_x = cvRound(scale->factor);
+    int w_width = cvRound((cascade->window_width - 2) * scale->factor);
+    int w_height = cvRound((cascade->window_height - 2) * scale->factor);
+    int r, i, j;
+
+    scale_nodes(cascade, scale->factor, job->sum_stride, scaled);
+
+    /* The window the mean and variance are taken over, in the sum and in the
+       sum of squares */
+    inverse_area = 1.0 / (w_width * w_height);
+    for(i = 0; i < 2; i++) {
+        int stride = i == 0 ? job->sum_stride : job->sqsum_stride;
+        window[i].p0 = w_x * stride + w_x;
+        window[i].p1 = w_x * stride + w_x + w_width;
+        window[i].p2 = (w_x + w_height) * stride + w_x;
+        window[i].p3 = (w_x + w_height) * stride + w_x + w_width;
+    }
+
+    hits->count = 0;
+    for(r = 0; r < job->num_rois; r++) {
+        const CvRect* roi = &job->rois[r];
+        int i_0 = (int) ceil(roi->y / scale->step - 0.5);
+        int j_0 = (int) ceil(roi->x / scale->step - 0.5);
+
+        for(i = i_0 > 0 ? i_0 : 0; i < scale->rows; i++) {
+            int y = cvRound(i * scale->step);
+
+            if(y < roi->y) {
+                continue;
+            }
+            if(y + scale->height > roi->y + roi->height) {
+                break;
+            }
+
+            for(j = j_0 > 0 ? j_0 : 0; j < scale->columns; j++) {
+                int x = cvRound(j * scale->step);
+
+                if(x < roi->x) {
+                    continue;
+                }
+                if(x + scale->width > roi->x + roi->width) {
+                    break;
+                }
+
+                if(run_window(cascade, scaled, job, window, inverse_area,
+                              y * job->sum_stride + x, y * job->sqsum_stride + x)) {
+                    hit_list_push(hits, x, y, scale->width, scale->height);
+                }
+            }
+        }
+    }
+}
+
+/* Scans window sizes until none are left, with the scaled nodes of one
+   thread. Run by pool_run once per thread */
+static void scan_task(void* _job, int thread) {
+    CascadeJob* job = _job;
+    ScaledNode* scaled = job->cascade->scaled[thread];
+
+    /* The smallest windows, which take longest, are handed out first */
+    while(1) {
+        int scale_index;
+
+        pthread_mutex_lock(&job->lock);
+        scale_index = job->next_scale++;
+        pthread_mutex_unlock(&job->lock);
+
+        if(scale_index >= job->num_scales) {
+            break;
+        }
+        scan_scale(job, scale_index, scaled);
+    }
+}
+
+/* Merges overlapping regions of interest, clipped to the frame, so no window
+   is tried twice. merged must have room for num_rois regions. Returns the
+   number of regions left */
+static int merge_rois(const CvRect* rois, int num_rois, int width, int height, CvRect* merged) {
+    int count = 0;
+    int i, j, changed;
+
+    for(i = 0; i < num_rois; i++) {
+        int x_0 = clamp(rois[i].x, 0, width);
+        int y_0 = clamp(rois[i].y, 0, height);
+        int x_1 = clamp(rois[i].x + rois[i].width, 0, width);
+        int y_1 = clamp(rois[i].y + rois[i].height, 0, height);
+
+        if(x_1 > x_0 && y_1 > y_0) {
+            merged[count++] = cvRect(x_0, y_0, x_1 - x_0, y_1 - y_0);
+        }
+    }
+
+    do {
+        changed = 0;
+        for(i = 0; i < count; i++) {
+            for(j = i + 1; j < count; j++) {
+                CvRect* a = &merged[i];
+                CvRect* b = &merged[j];
+                int x_0, y_0, x_1, y_1;
+
+                if(a->x >= b->x + b->width || b->x >= a->x + a->width ||
+                   a->y >= b->y + b->height || b->y >= a->y + a->height) {
+                    continue;
+                }
+
+                x_0 = a->x < b->x ? a->x : b->x;
+                y_0 = a->y < b->y ? a->y : b->y;
+                x_1 = a->x + a->width > b->x + b->width ? a->x + a->width : b->x + b->width;
+                y_1 = a->y + a->height > b->y + b->height ? a->y + a->height : b->y + b->height;
+                *a = cvRect(x_0, y_0, x_1 - x_0, y_1 - y_0);
+                merged[j--] = merged[--count];
+                changed = 1;
+            }
+        }
+    } while(changed);
+
+    return count;
+}
+
+static int similar(const CascadeHit* a, const CascadeHit* b) {
+    double delta = CASCADE_GROUP_EPS * ((a->width < b->width ? a->width : b->width) +
+                                        (a->height < b->height ? a->height : b->height)) * 0.5;
+
+    return abs(a->x - b->x) <= delta && abs(a->y - b->y) <= delta &&
+           abs(a->x + a->width - b->x - b->width) <= delta &&
+           abs(a->y + a->height - b->y - b->height) <= delta;
+}
+
+static int find_label(int* parents, int i) {
+    while(parents[i] != i) {
+        parents[i] = parents[parents[i]];
+        i = parents[i];
+    }
+    return i;
+}
+
+/* Groups hits as cvGroupRectangles does. Each group with more than
+   min_neighbors hits becomes their average, unless it lies inside a larger
+   group with more hits. Returns the number of groups written to hits */
+static int group_hits(Cascade* cascade, CascadeHit* hits, int count, int min_neighbors) {
+    int* labels = cascade->labels;
+    CascadeHit* groups = cascade->hits + count;
+    int num_groups = 0;
+    int i, j;
+
+    for(i = 0; i < count; i++) {
+        labels[i] = i;
+    }
+    for(i = 0; i < count; i++) {
+        for(j = i + 1; j < count; j++) {
+            if(similar(&hits[i], &hits[j])) {
+                int a = find_label(labels, i);
+                int b = find_label(labels, j);
+                if(a != b) {
+                    labels[a > b ? a : b] = a < b ? a : b;
+                }
+            }
+        }
+    }
+
+    /* Each hit's label becomes the first hit of its group, which is then
+       replaced by the group's number, in order of first hits */
+    for(i = 0; i < count; i++) {
+        labels[i] = find_label(labels, i);
+    }
+    for(i = 0; i < count; i++) {
+        if(labels[i] == i) {
+            memset(&groups[num_groups], 0, sizeof(CascadeHit));
+            labels[i] = -1 - num_groups++;
+        } else {
+            labels[i] = labels[labels[i]];
+        }
+    }
+    for(i = 0; i < count; i++) {
+        CascadeHit* group = &groups[-1 - labels[i]];
+        group->x += hits[i].x;
+        group->y += hits[i].y;
+        group->width += hits[i].width;
+        group->height += hits[i].height;
+        group->neighbors++;
+    }
+    for(i = 0; i < num_groups; i++) {
+        double scale = 1.0 / groups[i].neighbors;
+        groups[i].x = cvRound(groups[i].x * scale);
+        groups[i].y = cvRound(groups[i].y * scale);
+        groups[i].width = cvRound(groups[i].width * scale);
+        groups[i].height = cvRound(groups[i].height * scale);
+    }
+
+    count = 0;
+    for(i = 0; i < num_groups; i++) {
+        const CascadeHit* a = &groups[i];
+        int inside = 0;
+
+        if(a->neighbors <= min_neighbors) {
+            continue;
+        }
+        for(j = 0; j < num_groups && !inside; j++) {
+            const CascadeHit* b = &groups[j];
+            int d_x = cvRound(b->width * CASCADE_GROUP_EPS);
+            int d_y = cvRound(b->height * CASCADE_GROUP_EPS);
+
+            inside = j != i && b->neighbors > min_neighbors &&
+                     a->x >= b->x - d_x && a->y >= b->y - d_y &&
+                     a->x + a->width <= b->x + b->width + d_x &&
+                     a->y + a->height <= b->y + b->height + d_y &&
+                     (b->neighbors > (a->neighbors > 3 ? a->neighbors : 3) || a->neighbors < 3);
+        }
+        if(!inside) {
+            hits[count++] = *a;
+        }
+    }
+
+    return count;
+}
+
+/**
+ * \brief Find objects in a frame with a cascade
+ *
+ * \param cascade Cascade from cascade_new
+ * \param sum Sum of the frame's pixels, from cvIntegral. 32 bit integer,
+ *        one larger than the frame each way
+ * \param sqsum Sum of the squares of the frame's pixels, from cvIntegral. 64
+ *        bit float, the size of sum
+ * \param tilted Sum of the frame's pixels over 45 degree rotated rectangles,
+ *        from cvIntegral. The type and size of sum
+ * \param rois Regions of the frame to look in, clipped to it. Overlapping
+ *        regions are merged. NULL for the whole frame
+ * \param num_rois Number of regions in rois
+ * \param hits Filled with the objects found
+ * \param max_hits Size of hits
+ * \return Number of objects found, which may be more than max_hits, or -1
+ *         if the sums don't match
+ */
+int cascade_detect(Cascade* cascade, IplImage* sum, IplImage* sqsum, IplImage* tilted,
+                   CvRect* rois, int num_rois, CascadeHit* hits, int max_hits) {
+    CascadeJob job;
+    int width = sum->width - 1;
+    int height = sum->height - 1;
+    int num_threads = pool_threads();
+    int count = 0;
+    int i, j;
+
+    if(sum->depth != IPL_DEPTH_32S || tilted->depth != IPL_DEPTH_32S || sqsum->depth != IPL_DEPTH_64F ||
+       sum->nChannels != 1 || tilted->nChannels != 1 || sqsum->nChannels != 1 ||
+       tilted->width != sum->width || tilted->height != sum->height || tilted->widthStep != sum->widthStep ||
+       sqsum->width != sum->width || sqsum->height != sum->height) {
+        printf("cascade_detect: sum and tilted must be 32 bit integer and sqsum 64 bit float images of the same size\n");
+        return -1;
+    }
+
+    job.cascade = cascade;
+    job.sum = (const int32_t*) sum->imageData;
+    job.sqsum = (const double*) sqsum->imageData;
+    job.tilted = (const int32_t*) tilted->imageData;
+    job.sum_stride = sum->widthStep / sizeof(int32_t);
+    job.sqsum_stride = sqsum->widthStep / sizeof(double);
+    job.num_scales = choose_scales(cascade, width, height);
+    job.scales = cascade->scales;
+    job.next_scale = 0;
+
+    if(!rois) {
+        num_rois = 1;
+    }
+    if(num_rois > cascade->rois_capacity) {
+        free(cascade->rois);
+        cascade->rois = malloc((size_t) num_rois * sizeof(CvRect));
+        cascade->rois_capacity = num_rois;
+    }
+    if(rois) {
+        job.num_rois = merge_rois(rois, num_rois, width, height, cascade->rois);
+    } else {
+        job.num_rois = 1;
+        cascade->rois[0] = cvRect(0, 0, width, height);
+    }
+    job.rois = cascade->rois;
+
+    if(cascade->config.num_threads > 0 && cascade->config.num_threads < num_threads) {
+        num_threads = cascade->config.num_threads;
+    }
+    if(num_threads > job.num_scales) {
+        num_threads = job.num_scales > 0 ? job.num_scales : 1;
+    }
+
+    for(i = 0; i < num_threads; i++) {
+        if(!cascade->scaled[i]) {
+            cascade->scaled[i] = malloc(cascade->num_nodes * sizeof(ScaledNode));
+        }
+    }
+
+    pthread_mutex_init(&job.lock, NULL);
+    pool_run(scan_task, &job, num_threads);
+    pthread_mutex_destroy(&job.lock);
+
+    /* Hits are joined smallest window first, then in scan order */
+    for(i = 0; i < job.num_scales; i++) {
+        count += cascade->scale_hits[i].count;
+    }
+    if(2 * count > cascade->hits_capacity) {
+        free(cascade->hits);
+        free(cascade->labels);
+        cascade->hits_capacity = 2 * count;
+        cascade->hits = malloc(cascade->hits_capacity * sizeof(CascadeHit));
+        cascade->labels = malloc(cascade->hits_capacity * sizeof(int));
+    }
+    count = 0;
+    for(i = 0; i < job.num_scales; i++) {
+        HitList* list = &cascade->scale_hits[i];
+        for(j = 0; j < list->count; j++) {
+            cascade->hits[count++] = list->hits[j];
+        }
+    }
+
+    if(cascade->config.min_neighbors > 0) {
+        count = group_hits(cascade, cascade->hits, count, cascade->config.min_neighbors);
+    }
+
+    if(count > 0) {
+        memcpy(hits, cascade->hits, (count < max_hits ? count : max_hits) * sizeof(CascadeHit));
+    }
+    return count;
+}
+
+void cascade_free(Cascade* cascade) {
+    int i;
+
+    for(i = 0; i < POOL_MAX_THREADS; i++) {
+        free(cascade->scaled[i]);
+    }
+    for(i = 0; i < cascade->scales_capacity; i++) {
+        free(cascade->scale_hits[i].hits);
+    }
+    free(cascade->scales);
+    free(cascade->scale_hits);
+    free(cascade->rois);
+    free(cascade->nodes);
+    free(cascade->trees);
+    free(cascade->alphas);
+    free(cascade->stages);
+    free(cascade->hits);
+    free(cascade->labels);
+    free(cascade);
+}
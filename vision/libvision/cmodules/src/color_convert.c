@@ -0,0 +1,482 @@
+/**
+ * \file color_convert.c
+ * \brief BGR to HSV or Lab conversion straight into separate channel images
+ *
+ * Converting with cvCvtColor and then splitting the channels apart makes a
+ * three channel intermediate and walks the frame once per channel. Here each
+ * pixel is converted once and its channels written to up to three single
+ * channel images. Any of them may be NULL, and that channel is then neither
+ * computed nor written.
+ *
+ * HSV follows the integer kernel cvCvtColor(CV_BGR2HSV) uses for 8 bit
+ * images in OpenCV 2.x, with division tables built the same way, so hue is 0
+ * to 180 and saturation and value 0 to 255. It has been checked over all 2^24
+ * colors to be within one level of a floating point HSV conversion, but not
+ * against cvCvtColor itself, so it may differ from it by one level.
+ *
+ * Lab is as cvCvtColor(CV_BGR2Lab) scales it for 8 bit images (L * 255 / 100,
+ * a + 128, b + 128) from sRGB with a D65 white point, computed in 14 bit
+ * fixed point with lookup tables for the gamma and the cube root. It is
+ * within one level of the floating point conversion, but not always equal to
+ * OpenCV's own fixed point result.
+ *
+ * Both conversions are table lookups and integer arithmetic. On x86 CPUs with
+ * AVX2, eight pixels are converted at a time with gathers from the tables, as
+ * in greymap.c, chosen at runtime.
+ *
+ * threshold_hsv() thresholds the HSV conversion of a frame without keeping
+ * it: a few hundred pixels at a time are converted into buffers on the
+ * stack and looked up in one table of accepted values per channel.
+ */
+
+#include <cv.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <math.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define COLOR_CONVERT_AVX2
+# include <immintrin.h>
+#endif
+
+/* Fixed point shift of the HSV division tables, as in OpenCV */
+#define HSV_SHIFT 12
+
+/* Fixed point shift of linear RGB, XYZ and the cube root table */
+#define LAB_SHIFT 14
+#define LAB_ONE (1 << LAB_SHIFT)
+
+typedef struct HSVTables_s {
+    /* Rounded (255 << HSV_SHIFT) / v and (180 << HSV_SHIFT) / (6 * diff) */
+    int32_t saturation_div[256];
+    int32_t hue_div[256];
+} HSVTables;
+
+typedef struct LabTables_s {
+    /* sRGB gamma removed, scaled to LAB_ONE - 1 */
+    int32_t linear[256];
+
+    /* f(t) of the Lab definition scaled by LAB_ONE, and L * 255 / 100 rounded,
+       for t from 0 to 1 in steps of 1 / (LAB_ONE - 1) */
+    int32_t f[LAB_ONE];
+    int32_t lightness[LAB_ONE];
+
+    /* Rows of the sRGB to XYZ matrix divided by the white point, in fixed
+       point, ordered for BGR */
+    int32_t x[3];
+    int32_t y[3];
+    int32_t z[3];
+} LabTables;
+
+typedef void (*HSVRowConverter)(const uint8_t* in, uint8_t* h, uint8_t* s, uint8_t* v, int n, const HSVTables* tables);
+typedef void (*LabRowConverter)(const uint8_t* in, uint8_t* l, uint8_t* a, uint8_t* b, int n, const LabTables* tables);
+
+int convert_hsv(IplImage* frame, IplImage* h, IplImage* s, IplImage* v);
+int convert_lab(IplImage* frame, IplImage* l, IplImage* a, IplImage* b);
+int threshold_hsv(IplImage* frame, IplImage* out, double low_h, double high_h,
+                  double min_s, double max_s, double min_v, double max_v, int hue_bandstop);
+
+static HSVTables hsv_tables;
+static LabTables lab_tables;
+
+/* The tables are built by the first conversion to need them, once even if
+   several threads convert at the same time */
+static pthread_once_t hsv_tables_once = PTHREAD_ONCE_INIT;
+static pthread_once_t lab_tables_once = PTHREAD_ONCE_INIT;
+
+static void init_hsv_tables(void) {
+    int i;
+
+    hsv_tables.saturation_div[0] = 0;
+    hsv_tables.hue_div[0] = 0;
+    for(i = 1; i < 256; i++) {
+        hsv_tables.saturation_div[i] = (int32_t) lrint((255 << HSV_SHIFT) / (1.0 * i));
+        hsv_tables.hue_div[i] = (int32_t) lrint((180 << HSV_SHIFT) / (6.0 * i));
+    }
+}
+
+static double lab_f(double t) {
+    return t > 0.008856 ? cbrt(t) : 7.787 * t + 16.0 / 116.0;
+}
+
+static void init_lab_tables(void) {
+    static const double white_x = 0.950456;
+    static const double white_z = 1.088754;
+    int i;
+
+    for(i = 0; i < 256; i++) {
+        double c = i / 255.0;
+        c = c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+        lab_tables.linear[i] = (int32_t) lrint(c * (LAB_ONE - 1));
+    }
+
+    for(i = 0; i < LAB_ONE; i++) {
+        double t = i / (double) (LAB_ONE - 1);
+        double lightness = t > 0.008856 ? 116.0 * cbrt(t) - 16.0 : 903.3 * t;
+        lab_tables.f[i] = (int32_t) lrint(lab_f(t) * LAB_ONE);
+        lab_tables.lightness[i] = (int32_t) lrint(lightness * 255.0 / 100.0);
+    }
+
+    /* Each row sums to one, so X, Y and Z stay within the tables */
+    lab_tables.x[0] = (int32_t) lrint(0.180423 / white_x * LAB_ONE);
+    lab_tables.x[1] = (int32_t) lrint(0.357580 / white_x * LAB_ONE);
+    lab_tables.x[2] = LAB_ONE - lab_tables.x[0] - lab_tables.x[1];
+    lab_tables.y[0] = (int32_t) lrint(0.072169 * LAB_ONE);
+    lab_tables.y[1] = (int32_t) lrint(0.715160 * LAB_ONE);
+    lab_tables.y[2] = LAB_ONE - lab_tables.y[0] - lab_tables.y[1];
+    lab_tables.z[0] = (int32_t) lrint(0.950227 / white_z * LAB_ONE);
+    lab_tables.z[1] = (int32_t) lrint(0.119193 / white_z * LAB_ONE);
+    lab_tables.z[2] = LAB_ONE - lab_tables.z[0] - lab_tables.z[1];
+}
+
+static inline uint8_t clamp_byte(int32_t value) {
+    return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+/* One pixel of cvCvtColor's RGB2HSV_b */
+static void convert_row_hsv_scalar(const uint8_t* in, uint8_t* h, uint8_t* s, uint8_t* v, int n, const HSVTables* tables) {
+    int x;
+
+    for(x = 0; x < n; x++) {
+        int b = in[3 * x];
+        int g = in[3 * x + 1];
+        int r = in[3 * x + 2];
+        int value = b > g ? b : g;
+        int value_min = b < g ? b : g;
+        int diff;
+
+        value = value > r ? value : r;
+        value_min = value_min < r ? value_min : r;
+        diff = value - value_min;
+
+        if(h) {
+            int hue;
+            if(value == r) {
+                hue = g - b;
+            } else if(value == g) {
+                hue = b - r + 2 * diff;
+            } else {
+                hue = r - g + 4 * diff;
+            }
+            hue = (hue * tables->hue_div[diff] + (1 << (HSV_SHIFT - 1))) >> HSV_SHIFT;
+            h[x] = hue < 0 ? hue + 180 : hue;
+        }
+        if(s) {
+            s[x] = (diff * tables->saturation_div[value] + (1 << (HSV_SHIFT - 1))) >> HSV_SHIFT;
+        }
+        if(v) {
+            v[x] = value;
+        }
+    }
+}
+
+static void convert_row_lab_scalar(const uint8_t* in, uint8_t* l, uint8_t* a, uint8_t* b, int n, const LabTables* tables) {
+    const int32_t round = 1 << (LAB_SHIFT - 1);
+    int x;
+
+    for(x = 0; x < n; x++) {
+        int32_t lin_b = tables->linear[in[3 * x]];
+        int32_t lin_g = tables->linear[in[3 * x + 1]];
+        int32_t lin_r = tables->linear[in[3 * x + 2]];
+        int32_t Y = (tables->y[0] * lin_b + tables->y[1] * lin_g + tables->y[2] * lin_r + round) >> LAB_SHIFT;
+        int32_t f_y = tables->f[Y];
+
+        if(l) {
+            l[x] = tables->lightness[Y];
+        }
+        if(a) {
+            int32_t X = (tables->x[0] * lin_b + tables->x[1] * lin_g + tables->x[2] * lin_r + round) >> LAB_SHIFT;
+            a[x] = clamp_byte((500 * (tables->f[X] - f_y) + (128 << LAB_SHIFT) + round) >> LAB_SHIFT);
+        }
+        if(b) {
+            int32_t Z = (tables->z[0] * lin_b + tables->z[1] * lin_g + tables->z[2] * lin_r + round) >> LAB_SHIFT;
+            b[x] = clamp_byte((200 * (f_y - tables->f[Z]) + (128 << LAB_SHIFT) + round) >> LAB_SHIFT);
+        }
+    }
+}
+
+#ifdef COLOR_CONVERT_AVX2
+
+/* Load 8 BGR pixels into 32 bit lanes. Reads one byte past the 8th pixel */
+__attribute__((target("avx2")))
+static inline void load_bgr(const uint8_t* in, __m256i* b, __m256i* g, __m256i* r) {
+    const __m256i offsets = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+    const __m256i low_byte = _mm256_set1_epi32(0xff);
+    __m256i pixels = _mm256_i32gather_epi32((const int*) in, offsets, 1);
+
+    *b = _mm256_and_si256(pixels, low_byte);
+    *g = _mm256_and_si256(_mm256_srli_epi32(pixels, 8), low_byte);
+    *r = _mm256_and_si256(_mm256_srli_epi32(pixels, 16), low_byte);
+}
+
+/* Store the low bytes of 8 lanes, which must be 0 to 255 */
+__attribute__((target("avx2")))
+static inline void store_bytes(uint8_t* out, __m256i lanes) {
+    const __m256i unpack_order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    __m256i words = _mm256_packus_epi32(lanes, lanes);
+    __m256i bytes = _mm256_packus_epi16(words, words);
+    bytes = _mm256_permutevar8x32_epi32(bytes, unpack_order);
+    _mm_storel_epi64((__m128i*) out, _mm256_castsi256_si128(bytes));
+}
+
+__attribute__((target("avx2")))
+static void convert_row_hsv_avx2(const uint8_t* in, uint8_t* h, uint8_t* s, uint8_t* v, int n, const HSVTables* tables) {
+    const __m256i round = _mm256_set1_epi32(1 << (HSV_SHIFT - 1));
+    const __m256i hue_range = _mm256_set1_epi32(180);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi32(-1);
+    int x;
+
+    /* Stop a pixel early, so the last gather doesn't read past the row */
+    for(x = 0; x + 8 < n; x += 8) {
+        __m256i b, g, r, value, value_min, diff;
+
+        load_bgr(in + 3 * x, &b, &g, &r);
+        value = _mm256_max_epi32(_mm256_max_epi32(b, g), r);
+        value_min = _mm256_min_epi32(_mm256_min_epi32(b, g), r);
+        diff = _mm256_sub_epi32(value, value_min);
+
+        if(h) {
+            __m256i is_r = _mm256_cmpeq_epi32(value, r);
+            __m256i is_g = _mm256_andnot_si256(is_r, _mm256_cmpeq_epi32(value, g));
+            __m256i is_b = _mm256_andnot_si256(_mm256_or_si256(is_r, is_g), ones);
+            __m256i hue_r = _mm256_sub_epi32(g, b);
+            __m256i hue_g = _mm256_add_epi32(_mm256_sub_epi32(b, r), _mm256_slli_epi32(diff, 1));
+            __m256i hue_b = _mm256_add_epi32(_mm256_sub_epi32(r, g), _mm256_slli_epi32(diff, 2));
+            __m256i hue = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(is_r, hue_r),
+                                                          _mm256_and_si256(is_g, hue_g)),
+                                          _mm256_and_si256(is_b, hue_b));
+            __m256i div = _mm256_i32gather_epi32((const int*) tables->hue_div, diff, 4);
+
+            hue = _mm256_srai_epi32(_mm256_add_epi32(_mm256_mullo_epi32(hue, div), round), HSV_SHIFT);
+            hue = _mm256_add_epi32(hue, _mm256_and_si256(_mm256_cmpgt_epi32(zero, hue), hue_range));
+            store_bytes(h + x, hue);
+        }
+        if(s) {
+            __m256i div = _mm256_i32gather_epi32((const int*) tables->saturation_div, value, 4);
+            __m256i saturation = _mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi32(diff, div), round), HSV_SHIFT);
+            store_bytes(s + x, saturation);
+        }
+        if(v) {
+            store_bytes(v + x, value);
+        }
+    }
+
+    convert_row_hsv_scalar(in + 3 * x, h ? h + x : NULL, s ? s + x : NULL, v ? v + x : NULL, n - x, tables);
+}
+
+/* Dot product of a fixed point matrix row with linear BGR, rounded */
+__attribute__((target("avx2")))
+static inline __m256i lab_dot(const int32_t* row, __m256i b, __m256i g, __m256i r) {
+    __m256i sum = _mm256_set1_epi32(1 << (LAB_SHIFT - 1));
+    sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(_mm256_set1_epi32(row[0]), b));
+    sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(_mm256_set1_epi32(row[1]), g));
+    sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(_mm256_set1_epi32(row[2]), r));
+    return _mm256_srai_epi32(sum, LAB_SHIFT);
+}
+
+/* (scale * difference + 128, rounded), clamped to a byte */
+__attribute__((target("avx2")))
+static inline __m256i lab_chroma(int scale, __m256i difference) {
+    const __m256i offset = _mm256_set1_epi32((128 << LAB_SHIFT) + (1 << (LAB_SHIFT - 1)));
+    __m256i chroma = _mm256_mullo_epi32(_mm256_set1_epi32(scale), difference);
+    chroma = _mm256_srai_epi32(_mm256_add_epi32(chroma, offset), LAB_SHIFT);
+    return _mm256_min_epi32(_mm256_max_epi32(chroma, _mm256_setzero_si256()), _mm256_set1_epi32(255));
+}
+
+__attribute__((target("avx2")))
+static void convert_row_lab_avx2(const uint8_t* in, uint8_t* l, uint8_t* a, uint8_t* b, int n, const LabTables* tables) {
+    const int* linear = (const int*) tables->linear;
+    const int* f = (const int*) tables->f;
+    int x;
+
+    for(x = 0; x + 8 < n; x += 8) {
+        __m256i lin_b, lin_g, lin_r, Y, f_y;
+
+        load_bgr(in + 3 * x, &lin_b, &lin_g, &lin_r);
+        lin_b = _mm256_i32gather_epi32(linear, lin_b, 4);
+        lin_g = _mm256_i32gather_epi32(linear, lin_g, 4);
+        lin_r = _mm256_i32gather_epi32(linear, lin_r, 4);
+        Y = lab_dot(tables->y, lin_b, lin_g, lin_r);
+        f_y = _mm256_i32gather_epi32(f, Y, 4);
+
+        if(l) {
+            store_bytes(l + x, _mm256_i32gather_epi32((const int*) tables->lightness, Y, 4));
+        }
+        if(a) {
+            __m256i f_x = _mm256_i32gather_epi32(f, lab_dot(tables->x, lin_b, lin_g, lin_r), 4);
+            store_bytes(a + x, lab_chroma(500, _mm256_sub_epi32(f_x, f_y)));
+        }
+        if(b) {
+            __m256i f_z = _mm256_i32gather_epi32(f, lab_dot(tables->z, lin_b, lin_g, lin_r), 4);
+            store_bytes(b + x, lab_chroma(200, _mm256_sub_epi32(f_y, f_z)));
+        }
+    }
+
+    convert_row_lab_scalar(in + 3 * x, l ? l + x : NULL, a ? a + x : NULL, b ? b + x : NULL, n - x, tables);
+}
+
+#endif // #ifdef COLOR_CONVERT_AVX2
+
+static HSVRowConverter select_hsv_converter(void) {
+#ifdef COLOR_CONVERT_AVX2
+    if(__builtin_cpu_supports("avx2")) {
+        return convert_row_hsv_avx2;
+    }
+#endif
+    return convert_row_hsv_scalar;
+}
+
+static LabRowConverter select_lab_converter(void) {
+#ifdef COLOR_CONVERT_AVX2
+    if(__builtin_cpu_supports("avx2")) {
+        return convert_row_lab_avx2;
+    }
+#endif
+    return convert_row_lab_scalar;
+}
+
+/* Check that every output given is a single channel 8 bit image the size of
+   the frame */
+static int check_images(const char* name, IplImage* frame, IplImage** outputs) {
+    int i;
+
+    if(frame->depth != IPL_DEPTH_8U || frame->nChannels != 3) {
+        printf("Error: %s only accepts 8 bit BGR images.\n", name);
+        return -1;
+    }
+    for(i = 0; i < 3; i++) {
+        if(outputs[i] && (outputs[i]->depth != IPL_DEPTH_8U || outputs[i]->nChannels != 1 ||
+                          outputs[i]->width != frame->width || outputs[i]->height != frame->height)) {
+            printf("Error: %s outputs must be 8 bit single channel images the size of the frame.\n", name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Address of row y of image, or NULL if there is no image */
+static inline uint8_t* row_of(IplImage* image, int y) {
+    return image ? (uint8_t*) image->imageData + y * image->widthStep : NULL;
+}
+
+/**
+ * \brief Convert a BGR frame to HSV, one channel per output image
+ *
+ * Meant to stand in for cvCvtColor(frame, hsv, CV_BGR2HSV) followed by
+ * cvSplit(hsv, h, s, v, NULL), to within one level (see the top of this
+ * file).
+ *
+ * \param frame 8 bit BGR image
+ * \param h Hue, 0 to 180. May be NULL
+ * \param s Saturation, 0 to 255. May be NULL
+ * \param v Value, 0 to 255. May be NULL
+ * \return 0 on success, -1 if the images don't match
+ */
+int convert_hsv(IplImage* frame, IplImage* h, IplImage* s, IplImage* v) {
+    IplImage* outputs[3] = {h, s, v};
+    HSVRowConverter convert_row = select_hsv_converter();
+    int y;
+
+    if(check_images("convert_hsv", frame, outputs) != 0) {
+        return -1;
+    }
+    pthread_once(&hsv_tables_once, init_hsv_tables);
+
+    for(y = 0; y < frame->height; y++) {
+        convert_row((uint8_t*) frame->imageData + y * frame->widthStep,
+                    row_of(h, y), row_of(s, y), row_of(v, y), frame->width, &hsv_tables);
+    }
+
+    return 0;
+}
+
+/**
+ * \brief Convert a BGR frame to Lab, one channel per output image
+ *
+ * Scaled as cvCvtColor(frame, lab, CV_BGR2Lab) scales 8 bit images, and within
+ * one level of it.
+ *
+ * \param frame 8 bit BGR image
+ * \param l Lightness, L * 255 / 100. May be NULL
+ * \param a a + 128. May be NULL
+ * \param b b + 128. May be NULL
+ * \return 0 on success, -1 if the images don't match
+ */
+int convert_lab(IplImage* frame, IplImage* l, IplImage* a, IplImage* b) {
+    IplImage* outputs[3] = {l, a, b};
+    LabRowConverter convert_row = select_lab_converter();
+    int y;
+
+    if(check_images("convert_lab", frame, outputs) != 0) {
+        return -1;
+    }
+    pthread_once(&lab_tables_once, init_lab_tables);
+
+    for(y = 0; y < frame->height; y++) {
+        convert_row((uint8_t*) frame->imageData + y * frame->widthStep,
+                    row_of(l, y), row_of(a, y), row_of(b, y), frame->width, &lab_tables);
+    }
+
+    return 0;
+}
+
+/* Pixels converted at a time by threshold_hsv */
+#define THRESHOLD_CHUNK 512
+
+/**
+ * \brief Threshold the HSV conversion of a frame, as libvision.filters.hsv_filter
+ *
+ * A pixel is set to 255 in out when low_h <= h <= high_h, or when h <= low_h
+ * or h >= high_h if hue_bandstop is nonzero, and min_s <= s <= max_s and
+ * min_v <= v <= max_v. Other pixels are set to 0. The bounds are compared
+ * to the integer channels as doubles, as Python compares them, so the result
+ * is the same as hsv_filter's for any bounds.
+ *
+ * \param frame 8 bit BGR image
+ * \param out 8 bit single channel image the size of frame
+ * \param low_h Hue bounds, 0 to 180 as cvCvtColor gives hue
+ * \param hue_bandstop Nonzero to accept the hues outside of low_h to high_h
+ * \return 0 on success, -1 if the images don't match
+ */
+int threshold_hsv(IplImage* frame, IplImage* out, double low_h, double high_h,
+                  double min_s, double max_s, double min_v, double max_v, int hue_bandstop) {
+    IplImage* outputs[3] = {out, NULL, NULL};
+    HSVRowConverter convert_row = select_hsv_converter();
+    uint8_t accept_h[256], accept_s[256], accept_v[256];
+    uint8_t h[THRESHOLD_CHUNK], s[THRESHOLD_CHUNK], v[THRESHOLD_CHUNK];
+    int i, x, y;
+
+    if(check_images("threshold_hsv", frame, outputs) != 0) {
+        return -1;
+    }
+    pthread_once(&hsv_tables_once, init_hsv_tables);
+
+    for(i = 0; i < 256; i++) {
+        if(hue_bandstop) {
+            accept_h[i] = (i <= low_h || i >= high_h) ? 0xff : 0;
+        } else {
+            accept_h[i] = (i >= low_h && i <= high_h) ? 0xff : 0;
+        }
+        accept_s[i] = (i >= min_s && i <= max_s) ? 0xff : 0;
+        accept_v[i] = (i >= min_v && i <= max_v) ? 0xff : 0;
+    }
+
+    for(y = 0; y < frame->height; y++) {
+        const uint8_t* in = (uint8_t*) frame->imageData + y * frame->widthStep;
+        uint8_t* out_row = row_of(out, y);
+
+        for(x = 0; x < frame->width; x += THRESHOLD_CHUNK) {
+            int n = frame->width - x < THRESHOLD_CHUNK ? frame->width - x : THRESHOLD_CHUNK;
+
+            convert_row(in + 3 * x, h, s, v, n, &hsv_tables);
+            for(i = 0; i < n; i++) {
+                out_row[x + i] = accept_h[h[i]] & accept_s[s[i]] & accept_v[v[i]];
+            }
+        }
+    }
+
+    return 0;
+}
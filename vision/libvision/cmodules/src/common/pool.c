@@ -0,0 +1,202 @@
+/**
+ * \file pool.c
+ * \brief Persistent worker threads shared by the kernels of a module
+ *
+ * See pool.h. The workers are started the first time work is split between
+ * them, and then wait for more until the process exits, so a frame costs a
+ * wake up per worker rather than a thread start.
+ *
+ * One job runs at a time. Kernels may be called from several Python threads
+ * at once, as ctypes releases the GIL, and a job started while another is
+ * running is done entirely by its calling thread, as are jobs started from
+ * inside a task.
+ */
+
+#include "pool.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+typedef struct Pool_s {
+    pthread_mutex_t lock;
+
+    /* Signaled when a job is started, and when it finishes */
+    pthread_cond_t work;
+    pthread_cond_t done;
+
+    /* Threads tasks run on, counting the calling thread. 0 until the first
+       job or pool_set_threads */
+    int num_threads;
+    int num_workers;
+
+    /* The running job, and the number of jobs started so far */
+    int busy;
+    unsigned int generation;
+    PoolTask task;
+    void* arg;
+    int count;
+    int next;
+    int remaining;
+} Pool;
+
+static Pool pool = {
+    PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_COND_INITIALIZER,
+    PTHREAD_COND_INITIALIZER,
+};
+
+/* Threads used when not set with pool_set_threads: LIBVISION_THREADS, or
+   one per CPU */
+static int default_threads(void) {
+    const char* env = getenv("LIBVISION_THREADS");
+    int num_threads = env ? atoi(env) : 0;
+
+    if(num_threads <= 0) {
+        num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    return num_threads;
+}
+
+static int clamp_threads(int num_threads) {
+    if(num_threads < 1) return 1;
+    if(num_threads > POOL_MAX_THREADS) return POOL_MAX_THREADS;
+    return num_threads;
+}
+
+/* Does pieces of the running job until none are left. Called with the lock
+   held, and returns with it held */
+static void run_pieces(void) {
+    while(pool.next < pool.count) {
+        int index = pool.next++;
+        PoolTask task = pool.task;
+        void* arg = pool.arg;
+
+        pthread_mutex_unlock(&pool.lock);
+        task(arg, index);
+        pthread_mutex_lock(&pool.lock);
+
+        if(--pool.remaining == 0) {
+            pthread_cond_broadcast(&pool.done);
+        }
+    }
+}
+
+static void* worker_thread(void* _worker_index) {
+    int worker_index = (int) (long) _worker_index;
+    unsigned int seen;
+
+    /* A worker started for a job joins it */
+    pthread_mutex_lock(&pool.lock);
+    seen = pool.busy ? pool.generation - 1 : pool.generation;
+    while(1) {
+        while(pool.generation == seen) {
+            pthread_cond_wait(&pool.work, &pool.lock);
+        }
+        seen = pool.generation;
+
+        /* Workers beyond the current thread count sit jobs out */
+        if(worker_index + 1 < pool.num_threads) {
+            run_pieces();
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * \brief Set the number of threads tasks are run on
+ *
+ * \param num_threads Threads, counting the thread calling pool_run. 1 runs
+ *        every task in the calling thread. 0 or less for one per CPU, or
+ *        LIBVISION_THREADS if it is set.
+ */
+void pool_set_threads(int num_threads) {
+    pthread_mutex_lock(&pool.lock);
+    pool.num_threads = clamp_threads(num_threads > 0 ? num_threads : default_threads());
+    pthread_mutex_unlock(&pool.lock);
+}
+
+/**
+ * \brief The number of threads tasks are run on, counting the calling thread
+ */
+int pool_threads(void) {
+    int num_threads;
+
+    pthread_mutex_lock(&pool.lock);
+    if(pool.num_threads == 0) {
+        pool.num_threads = clamp_threads(default_threads());
+    }
+    num_threads = pool.num_threads;
+    pthread_mutex_unlock(&pool.lock);
+
+    return num_threads;
+}
+
+/**
+ * \brief Number of bands to split rows into
+ *
+ * \param min_rows Fewest rows worth giving a band of their own
+ * \return Between 1 and POOL_MAX_BANDS, depending only on rows and min_rows
+ */
+int pool_bands(int rows, int min_rows) {
+    int num_bands = min_rows > 0 ? rows / min_rows : rows;
+
+    if(num_bands < 1) return 1;
+    if(num_bands > POOL_MAX_BANDS) return POOL_MAX_BANDS;
+    return num_bands;
+}
+
+/**
+ * \brief Call task(arg, i) for every i from 0 to count - 1, in parallel
+ *
+ * Returns once every call has returned. The calling thread runs tasks too.
+ * Calls may run in any order and on any thread, so tasks must only write to
+ * their own part of arg.
+ */
+void pool_run(PoolTask task, void* arg, int count) {
+    int i;
+
+    if(count <= 1 || pool_threads() == 1) {
+        for(i = 0; i < count; i++) {
+            task(arg, i);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    if(pool.busy) {
+        pthread_mutex_unlock(&pool.lock);
+        for(i = 0; i < count; i++) {
+            task(arg, i);
+        }
+        return;
+    }
+
+    /* Start any workers missing. If one can't be started, the threads that
+       are there do its share */
+    while(pool.num_workers + 1 < pool.num_threads) {
+        pthread_t thread;
+        if(pthread_create(&thread, NULL, worker_thread, (void*) (long) pool.num_workers) != 0) {
+            break;
+        }
+        pthread_detach(thread);
+        pool.num_workers++;
+    }
+
+    pool.busy = 1;
+    pool.task = task;
+    pool.arg = arg;
+    pool.count = count;
+    pool.next = 0;
+    pool.remaining = count;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.work);
+
+    run_pieces();
+    while(pool.remaining > 0) {
+        pthread_cond_wait(&pool.done, &pool.lock);
+    }
+    pool.busy = 0;
+    pthread_mutex_unlock(&pool.lock);
+}
@@ -0,0 +1,48 @@
+/**
+ * \file pool.h
+ * \brief Persistent worker threads shared by the kernels of a module
+ *
+ * Not a module itself: modules that split their work between threads list
+ * src/common/pool.c in their .flags, and include this with
+ * #include "common/pool.h".
+ *
+ * Work is split into a number of pieces, usually bands of rows, and
+ * pool_run() calls a task once per piece, on the pool's threads and the
+ * calling thread, returning when every piece is done. The number of bands an
+ * image is split into comes from pool_bands(), and only depends on the size
+ * of the image, never on the number of threads. Kernels keep per band
+ * results and combine them in band order, so their output is the same
+ * whatever the number of threads, down to the rounding of floating point
+ * sums.
+ */
+
+#ifndef __SW_LIBVISION_POOL_H
+#define __SW_LIBVISION_POOL_H
+
+/* Most threads a pool runs tasks on, counting the calling thread */
+#define POOL_MAX_THREADS 8
+
+/* Most bands pool_bands() splits an image into */
+#define POOL_MAX_BANDS 16
+
+/**
+ * \brief A piece of work given to pool_run
+ *
+ * \param arg As given to pool_run
+ * \param index Which piece to do, from 0 up to the count given to pool_run
+ */
+typedef void (*PoolTask)(void* arg, int index);
+
+void pool_set_threads(int num_threads);
+int pool_threads(void);
+int pool_bands(int rows, int min_rows);
+void pool_run(PoolTask task, void* arg, int count);
+
+/**
+ * \brief First row of band i of rows split into num_bands bands
+ */
+static inline int pool_band_start(int rows, int num_bands, int i) {
+    return (int) ((long long) rows * i / num_bands);
+}
+
+#endif
@@ -0,0 +1,60 @@
+/**
+ * \file types.h
+ * \brief Structures passed between modules
+ *
+ * Modules that call the stages of other modules compiled in with them (see
+ * pipeline.c and pyramid.c), and bench/bench.c, which loads the modules
+ * directly, use these definitions rather than their own copies. The same
+ * layouts are given to ctypes in cmodules/__init__.py (cBlob, cRect and
+ * BuoyROIStruct), which must be kept in step with this file.
+ */
+
+#ifndef __SW_LIBVISION_TYPES_H
+#define __SW_LIBVISION_TYPES_H
+
+#include <stdint.h>
+
+typedef uint32_t BlobId;
+
+/* A blob found by find_blobs (blob2.c) */
+typedef struct Blob_s {
+    BlobId id;
+
+    /* If size == -1 then the blob is no longer valid. This is set when two
+       blobs are joined. Otherwise, this gives the size of the blob in pixels */
+    int32_t size;
+
+    /* Centroid */
+    uint32_t c_x;
+    uint32_t c_y;
+
+    /* Bound box */
+    uint16_t x_0;
+    uint16_t x_1;
+    uint16_t y_0;
+    uint16_t y_1;
+} Blob;
+
+/* A rectangle found by find_bins (shape_detect.c) */
+typedef struct Rect_s {
+
+    /* area of the rectangle */
+    int32_t area;
+
+    /* center of rectangle */
+    int32_t c_x;
+    int32_t c_y;
+
+    /* direction of rectangle */
+    int32_t theta;
+} Rect;
+
+/* A region given to buoy_color (buoy_analyzer.c) */
+typedef struct BuoyROI_s {
+    int x;
+    int y;
+    int w;
+    int h;
+} BuoyROI;
+
+#endif
@@ -0,0 +1,171 @@
+/**
+ * \file histogram.c
+ * \brief Grey level histogram of an image and the statistics taken from it
+ *
+ * histogram_stats() counts the 256 grey levels of an 8 bit single channel
+ * image, or of a rectangle of it, and from the counts finds the mean, the
+ * variance, how many standard deviations a given level is from the mean, and
+ * Otsu's threshold, in one call.
+ *
+ * Counting is done into four tables, one for each of four consecutive
+ * pixels, which are summed at the end. With a single table, a run of equal
+ * pixels (common in masks and in flat areas of a frame) makes each increment
+ * wait on the one before it; with four, consecutive increments go to
+ * different counters.
+ */
+
+#include <cv.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "pixel.h"
+
+/**
+ * \brief Histogram of an image and its statistics
+ */
+typedef struct HistogramStats_s {
+    /* Number of pixels at each grey level */
+    uint32_t counts[256];
+
+    /* Number of pixels counted */
+    uint32_t total;
+
+    double mean;
+    double variance;
+
+    /* (x - mean) / standard deviation, for the x given to histogram_stats.
+       0 if every pixel has the same level */
+    double z_score;
+
+    /* Otsu's threshold: the level t for which splitting the pixels into
+       levels <= t and > t gives the largest between class variance. Pixels
+       of 255 are left out of it */
+    int otsu_threshold;
+} HistogramStats;
+
+int histogram_stats(IplImage* image, CvRect* roi, double x, HistogramStats* stats);
+
+PIXEL_INLINE void count_span(const uint8_t* in, int n, uint32_t counts[4][256]) {
+    int i = 0;
+
+    for(; i + 4 <= n; i += 4) {
+        counts[0][in[i]]++;
+        counts[1][in[i + 1]]++;
+        counts[2][in[i + 2]]++;
+        counts[3][in[i + 3]]++;
+    }
+    for(; i < n; i++) {
+        counts[0][in[i]]++;
+    }
+}
+
+/* Otsu's method, on the counts rather than the normalized histogram so that
+   the weight of an empty class is exactly 0. Ties go to the highest level.
+
+   Pixels of 255 are left out, as they were from the cv histogram over
+   [0, 255] that filters.otsu_get_threshold used to build, so thresholds stay
+   the same as before */
+static int otsu_threshold(const uint32_t counts[256]) {
+    double overall_moment = 0;
+    double moment_b = 0;
+    double highest_variance = 0;
+    uint32_t total = 0;
+    uint32_t count_b = 0;
+    int best_threshold = 0;
+    int t;
+
+    for(t = 0; t < 255; t++) {
+        total += counts[t];
+        overall_moment += (double) t * counts[t];
+    }
+
+    for(t = 0; t < 255; t++) {
+        double weight_b, weight_f, mean_b, mean_f, variance_between;
+
+        count_b += counts[t];
+        if(count_b == 0) {
+            continue;
+        }
+        if(count_b == total) {
+            break;
+        }
+
+        moment_b += (double) t * counts[t];
+        weight_b = (double) count_b / total;
+        weight_f = 1 - weight_b;
+        mean_b = moment_b / count_b;
+        mean_f = (overall_moment - moment_b) / (total - count_b);
+
+        variance_between = weight_b * weight_f * (mean_b - mean_f) * (mean_b - mean_f);
+        if(variance_between >= highest_variance) {
+            highest_variance = variance_between;
+            best_threshold = t;
+        }
+    }
+
+    return best_threshold;
+}
+
+/**
+ * \brief Histogram and statistics of an image, or of a rectangle of it
+ *
+ * \param image 8 bit single channel image
+ * \param roi Rectangle to count, clipped to the image, or NULL for the whole
+ *        image
+ * \param x Level to give the z score of
+ * \param stats Filled with the histogram and statistics. When no pixels are
+ *        counted, everything is 0.
+ * \return 0 on success, -1 if image is not 8 bit single channel
+ */
+int histogram_stats(IplImage* image, CvRect* roi, double x, HistogramStats* stats) {
+    uint32_t counts[4][256];
+    CvRect area = cvRect(0, 0, image->width, image->height);
+    PixelSpans spans;
+    double sum = 0, variance = 0;
+    int i;
+
+    if(image->depth != IPL_DEPTH_8U || image->nChannels != 1) {
+        printf("Error: histogram_stats only accepts 8 bit single channel images.\n");
+        return -1;
+    }
+
+    if(roi != NULL) {
+        int x_0 = roi->x > 0 ? roi->x : 0;
+        int y_0 = roi->y > 0 ? roi->y : 0;
+        int x_1 = roi->x + roi->width < image->width ? roi->x + roi->width : image->width;
+        int y_1 = roi->y + roi->height < image->height ? roi->y + roi->height : image->height;
+        area = cvRect(x_0, y_0, x_1 > x_0 ? x_1 - x_0 : 0, y_1 > y_0 ? y_1 - y_0 : 0);
+    }
+
+    memset(counts, 0, sizeof(counts));
+    spans = pixel_spans(image, NULL, area);
+    for(i = 0; i < spans.count; i++) {
+        count_span(pixel_at(image, area.x, area.y + i), spans.length, counts);
+    }
+
+    memset(stats, 0, sizeof(HistogramStats));
+    for(i = 0; i < 256; i++) {
+        uint32_t count = counts[0][i] + counts[1][i] + counts[2][i] + counts[3][i];
+        stats->counts[i] = count;
+        stats->total += count;
+        sum += (double) i * count;
+    }
+    if(stats->total == 0) {
+        return 0;
+    }
+
+    stats->mean = sum / stats->total;
+    for(i = 0; i < 256; i++) {
+        variance += stats->counts[i] * (i - stats->mean) * (i - stats->mean);
+    }
+    stats->variance = variance / stats->total;
+    if(stats->variance > 0) {
+        stats->z_score = (x - stats->mean) / sqrt(stats->variance);
+    }
+    stats->otsu_threshold = otsu_threshold(stats->counts);
+
+    return 0;
+}
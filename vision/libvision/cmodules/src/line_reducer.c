@@ -0,0 +1,321 @@
+/**
+ * \file line_reducer.c
+ * \brief Reduction of many line segments to the few lines they describe
+ *
+ * The grouping of libvision.line_reducer, which reduces the output of
+ * cv2.HoughLinesP to one line per edge:
+ *
+ *  1. Segments are sorted longest first.
+ *  2. The longest segment not yet in a group starts a new group, and every
+ *     shorter segment not yet in a group is tested against it, in order. A
+ *     segment joins the group if
+ *       - one of its endpoints is within reject_ratio * (length of the first
+ *         segment) of the line through the first segment,
+ *       - each endpoint of the first segment has one of its endpoints within
+ *         (1 + tolerance) * (length of the first segment), and
+ *       - the smallest rectangle around the group's endpoints, with it
+ *         added, is no wider than error_ratio times its length.
+ *     Step 2 repeats until every segment is in a group.
+ *  3. Each group becomes the segment through the middle of its smallest
+ *     rectangle, along the rectangle's length.
+ *
+ * The tests are in that order, cheapest first, so most segments are turned
+ * away without looking at the rectangle. Each group keeps the convex hull of
+ * its endpoints, and the rectangle for a new segment is found from the hull
+ * with the segment's endpoints added. The smallest rectangle around points
+ * has a side along an edge of their convex hull, so only the hull's edges are
+ * tried.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+typedef struct Point_s {
+    double x;
+    double y;
+} Point;
+
+typedef struct Segment_s {
+    Point p0;
+    Point p1;
+    double length;
+
+    /* Position in the input, to keep equal lengths in input order */
+    int index;
+} Segment;
+
+typedef struct Rectangle_s {
+    Point center;
+
+    /* Unit vector along the width */
+    Point axis;
+    double width;
+    double height;
+} Rectangle;
+
+int line_reduce(const float* segments, int count, double error_ratio,
+                double reject_ratio, double tolerance, float* lines);
+
+static double distance(Point a, Point b) {
+    return hypot(b.x - a.x, b.y - a.y);
+}
+
+static double cross(Point o, Point a, Point b) {
+    return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+}
+
+/* Longest first, then in input order */
+static int compare_segments(const void* a, const void* b) {
+    const Segment* s_a = a;
+    const Segment* s_b = b;
+    if(s_a->length != s_b->length) {
+        return s_a->length < s_b->length ? 1 : -1;
+    }
+    return s_a->index - s_b->index;
+}
+
+static int compare_points(const void* a, const void* b) {
+    const Point* p_a = a;
+    const Point* p_b = b;
+    if(p_a->x != p_b->x) {
+        return p_a->x < p_b->x ? -1 : 1;
+    }
+    return (p_a->y > p_b->y) - (p_a->y < p_b->y);
+}
+
+/* Convex hull of points by the monotone chain. points is sorted in place and
+   hull, which must hold count + 1 points, is filled counterclockwise with no
+   collinear points. Returns the number of hull points */
+static int convex_hull(Point* points, int count, Point* hull) {
+    int size = 0;
+    int lower_size;
+    int i;
+
+    qsort(points, count, sizeof(Point), compare_points);
+    if(count < 3) {
+        memcpy(hull, points, count * sizeof(Point));
+        if(count == 2 && points[0].x == points[1].x && points[0].y == points[1].y) {
+            return 1;
+        }
+        return count;
+    }
+
+    for(i = 0; i < count; i++) {
+        while(size >= 2 && cross(hull[size - 2], hull[size - 1], points[i]) <= 0) {
+            size--;
+        }
+        hull[size++] = points[i];
+    }
+    lower_size = size + 1;
+    for(i = count - 2; i >= 0; i--) {
+        while(size >= lower_size && cross(hull[size - 2], hull[size - 1], points[i]) <= 0) {
+            size--;
+        }
+        hull[size++] = points[i];
+    }
+
+    /* The first point is repeated at the end */
+    return size - 1;
+}
+
+/* Smallest rectangle around a convex hull. Every edge of the hull is tried
+   as the direction of a side */
+static Rectangle min_area_rectangle(const Point* hull, int size) {
+    Rectangle best;
+    double best_area = HUGE_VAL;
+    int i, j;
+
+    memset(&best, 0, sizeof(Rectangle));
+    best.axis.x = 1;
+    if(size == 1) {
+        best.center = hull[0];
+        return best;
+    }
+
+    for(i = 0; i < size; i++) {
+        Point a = hull[i];
+        Point b = hull[(i + 1) % size];
+        double length = distance(a, b);
+        double u_x, u_y, min_u = HUGE_VAL, max_u = -HUGE_VAL, min_v = HUGE_VAL, max_v = -HUGE_VAL;
+
+        if(length == 0) {
+            continue;
+        }
+        u_x = (b.x - a.x) / length;
+        u_y = (b.y - a.y) / length;
+
+        for(j = 0; j < size; j++) {
+            double d_x = hull[j].x - a.x;
+            double d_y = hull[j].y - a.y;
+            double u = d_x * u_x + d_y * u_y;
+            double v = -d_x * u_y + d_y * u_x;
+            if(u < min_u) min_u = u;
+            if(u > max_u) max_u = u;
+            if(v < min_v) min_v = v;
+            if(v > max_v) max_v = v;
+        }
+
+        if((max_u - min_u) * (max_v - min_v) < best_area) {
+            double mid_u = (min_u + max_u) / 2;
+            double mid_v = (min_v + max_v) / 2;
+            best_area = (max_u - min_u) * (max_v - min_v);
+            best.axis.x = u_x;
+            best.axis.y = u_y;
+            best.width = max_u - min_u;
+            best.height = max_v - min_v;
+            best.center.x = a.x + mid_u * u_x - mid_v * u_y;
+            best.center.y = a.y + mid_u * u_y + mid_v * u_x;
+        }
+
+        /* A two point hull is a segment, with one direction to try */
+        if(size == 2) {
+            break;
+        }
+    }
+
+    return best;
+}
+
+/* Distance from p to the line through segment s */
+static double line_distance(const Segment* s, Point p) {
+    if(s->length == 0) {
+        return distance(s->p0, p);
+    }
+    return fabs(cross(s->p0, s->p1, p)) / s->length;
+}
+
+static int near_line(const Segment* first, const Segment* s, double reject_ratio) {
+    double max_distance = first->length * reject_ratio;
+    return line_distance(first, s->p0) <= max_distance || line_distance(first, s->p1) <= max_distance;
+}
+
+static int near_ends(const Segment* first, const Segment* s, double tolerance) {
+    double max_distance = first->length * (1 + tolerance);
+
+    if(distance(first->p0, s->p0) > max_distance && distance(first->p0, s->p1) > max_distance) {
+        return 0;
+    }
+    if(distance(first->p1, s->p0) > max_distance && distance(first->p1, s->p1) > max_distance) {
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * \brief Reduce line segments to one line per group of segments
+ *
+ * \param segments count segments as x0, y0, x1, y1
+ * \param error_ratio Widest a group's rectangle may be, as a fraction of its
+ *        length
+ * \param reject_ratio How far from the line through the first segment of a
+ *        group a segment may be, as a fraction of the first segment's length
+ * \param tolerance How much further than the first segment's length a
+ *        segment's endpoints may be from the first segment's endpoints, as a
+ *        fraction of it
+ * \param lines Filled with the lines found as x0, y0, x1, y1. Must hold
+ *        count lines
+ * \return Number of lines written to lines
+ */
+int line_reduce(const float* segments, int count, double error_ratio,
+                double reject_ratio, double tolerance, float* lines) {
+    Segment* sorted;
+    char* grouped;
+    Point* hull;
+    Point* new_hull;
+    Point* swap;
+    Point* points;
+    int num_lines = 0;
+    int first, i;
+
+    if(count <= 0) {
+        return 0;
+    }
+
+    sorted = malloc(count * sizeof(Segment));
+    grouped = calloc(count, 1);
+    /* A hull has at most every endpoint, and is built from the group's hull
+       plus two more */
+    hull = malloc((2 * count + 1) * sizeof(Point));
+    new_hull = malloc((2 * count + 1) * sizeof(Point));
+    points = malloc((2 * count + 1) * sizeof(Point));
+
+    for(i = 0; i < count; i++) {
+        Segment* s = &sorted[i];
+        s->p0.x = segments[4 * i];
+        s->p0.y = segments[4 * i + 1];
+        s->p1.x = segments[4 * i + 2];
+        s->p1.y = segments[4 * i + 3];
+        s->length = distance(s->p0, s->p1);
+        s->index = i;
+    }
+    qsort(sorted, count, sizeof(Segment), compare_segments);
+
+    for(first = 0; first < count; first++) {
+        const Segment* group_first = &sorted[first];
+        Rectangle rectangle;
+        Point along;
+        double half_length;
+        float* line;
+        int hull_size;
+
+        if(grouped[first]) {
+            continue;
+        }
+        grouped[first] = 1;
+
+        points[0] = group_first->p0;
+        points[1] = group_first->p1;
+        hull_size = convex_hull(points, 2, hull);
+
+        for(i = first + 1; i < count; i++) {
+            const Segment* s = &sorted[i];
+            double longer, shorter;
+            int new_size;
+
+            if(grouped[i] || !near_line(group_first, s, reject_ratio) || !near_ends(group_first, s, tolerance)) {
+                continue;
+            }
+
+            memcpy(points, hull, hull_size * sizeof(Point));
+            points[hull_size] = s->p0;
+            points[hull_size + 1] = s->p1;
+            new_size = convex_hull(points, hull_size + 2, new_hull);
+
+            rectangle = min_area_rectangle(new_hull, new_size);
+            longer = rectangle.width > rectangle.height ? rectangle.width : rectangle.height;
+            shorter = rectangle.width > rectangle.height ? rectangle.height : rectangle.width;
+            if(longer > 0 && shorter > error_ratio * longer) {
+                continue;
+            }
+
+            grouped[i] = 1;
+            swap = hull;
+            hull = new_hull;
+            new_hull = swap;
+            hull_size = new_size;
+        }
+
+        /* The line runs along the rectangle's longer side */
+        rectangle = min_area_rectangle(hull, hull_size);
+        along = rectangle.axis;
+        half_length = rectangle.width / 2;
+        if(rectangle.height > rectangle.width) {
+            along.x = -rectangle.axis.y;
+            along.y = rectangle.axis.x;
+            half_length = rectangle.height / 2;
+        }
+        line = &lines[4 * num_lines++];
+        line[0] = rectangle.center.x + along.x * half_length;
+        line[1] = rectangle.center.y + along.y * half_length;
+        line[2] = rectangle.center.x - along.x * half_length;
+        line[3] = rectangle.center.y - along.y * half_length;
+    }
+
+    free(sorted);
+    free(grouped);
+    free(hull);
+    free(new_hull);
+    free(points);
+    return num_lines;
+}
@@ -0,0 +1,739 @@
+/**
+ * \file line_segments.c
+ * \brief Line segment detection without a Hough transform
+ *
+ * Segments are found the way LSD (Grompone von Gioi et al., "LSD: a Line
+ * Segment Detector") finds them:
+ *
+ *  1. The image is smoothed with a 3x3 Gaussian, then the gradient of every
+ *     pixel is taken with a 2x2 mask. Pixels with a gradient below
+ *     gradient_threshold are ignored.
+ *  2. Pixels are visited from the strongest gradient down. Each unused pixel
+ *     seeds a region, which grows into neighbouring pixels whose level line
+ *     angle is within angle_tolerance of the region's mean angle.
+ *  3. A rectangle is fit to each region from its gradient weighted moments.
+ *     Regions filling too little of their rectangle are grown again with half
+ *     the tolerance, and dropped if they are still too sparse.
+ *
+ * LSD's a contrario validation is left out, and its downsampling replaced by
+ * the smoothing. The images we run on are thresholded masks, where every
+ * edge is a strong edge, so the density test and min_length are enough to
+ * reject noise. The smoothing matters on masks: without it, the gradient of a
+ * slanted edge only takes multiples of 45 degrees, and the pixels of the
+ * staircase don't grow into one region.
+ *
+ * Edges broken up by noise come out as several collinear segments. These are
+ * then joined: segments are sorted by angle, and each is only compared to the
+ * segments within merge_angle of it, so joining costs O(n log n) for the
+ * usual handful of segments per angle.
+ *
+ * Every buffer is kept from frame to frame, and only reallocated when the
+ * frame size changes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include <cv.h>
+
+#ifndef M_PI
+# define M_PI 3.14159265358979323846
+#endif
+
+/* Status of a pixel during region growing */
+#define PIXEL_NOTDEF 0
+#define PIXEL_FREE 1
+#define PIXEL_USED 2
+
+/* Bins pixels are sorted into by gradient magnitude. The magnitude of the
+   2x2 gradient of an 8 bit image is at most 255 * sqrt(2) */
+#define MAGNITUDE_BINS 1024
+#define MAX_MAGNITUDE 361.0
+
+/**
+ * \brief Parameters of a line detector, given once to line_detector_new
+ */
+typedef struct LineConfig_s {
+    /* Smallest gradient magnitude of a pixel on a line, in grey levels per
+       pixel */
+    double gradient_threshold;
+
+    /* Largest difference between the gradient angle of a pixel and that of
+       the region it joins, in radians */
+    double angle_tolerance;
+
+    /* Smallest fraction of its rectangle a region must cover */
+    double min_density;
+
+    /* Segments shorter than this many pixels are dropped, after joining */
+    double min_length;
+
+    /* Segments are joined when their angles differ by at most merge_angle
+       radians, the ends of the shorter one are at most merge_distance pixels
+       from the line through the longer one, and the gap between them along
+       that line is at most merge_gap pixels */
+    double merge_angle;
+    double merge_distance;
+    double merge_gap;
+} LineConfig;
+
+/**
+ * \brief Result record for one segment
+ */
+typedef struct LineSegment_s {
+    /* End points */
+    float x_0;
+    float y_0;
+    float x_1;
+    float y_1;
+
+    /* Width of the rectangle fit to the segment's pixels */
+    float width;
+
+    float length;
+
+    /* Direction of the segment in [0, pi), measured from the x axis towards
+       the y axis */
+    float angle;
+
+    /* Number of pixels the segment was fit to */
+    int32_t pixels;
+} LineSegment;
+
+typedef struct LineDetector_s {
+    LineConfig config;
+
+    /* Size of frames the buffers below were created for */
+    CvSize size;
+
+    /* Smoothed image, 16 times the grey level */
+    uint16_t* smoothed;
+
+    /* Per pixel gradient angle, gradient magnitude and status */
+    float* angles;
+    float* magnitudes;
+    uint8_t* status;
+
+    /* Pixel indices, sorted strongest gradient first */
+    int* order;
+    int num_ordered;
+
+    /* Pixels of the region being grown */
+    int* region;
+
+    /* Segments found in the current frame */
+    LineSegment* segments;
+    int max_segments;
+
+    /* Scratch for joining: sort order, union-find parents, where each group
+       starts in the sorted order, and the joined segments */
+    int* by_angle;
+    int* parent;
+    int* group_start;
+    LineSegment* joined;
+} LineDetector;
+
+LineDetector* line_detector_new(LineConfig* config);
+int line_detector_run(LineDetector* detector, IplImage* image, LineSegment* out, int max_out);
+void line_detector_free(LineDetector* detector);
+
+static void release_buffers(LineDetector* detector) {
+    free(detector->smoothed);
+    free(detector->angles);
+    free(detector->magnitudes);
+    free(detector->status);
+    free(detector->order);
+    free(detector->region);
+    detector->smoothed = NULL;
+    detector->angles = NULL;
+    detector->magnitudes = NULL;
+    detector->status = NULL;
+    detector->order = NULL;
+    detector->region = NULL;
+}
+
+/* (Re)allocate the per pixel buffers if the frame size changed */
+static void prepare_buffers(LineDetector* detector, CvSize size) {
+    int pixels = size.width * size.height;
+
+    if(detector->angles && detector->size.width == size.width &&
+       detector->size.height == size.height) {
+        return;
+    }
+
+    release_buffers(detector);
+    detector->size = size;
+    detector->smoothed = malloc(pixels * sizeof(uint16_t));
+    detector->angles = malloc(pixels * sizeof(float));
+    detector->magnitudes = malloc(pixels * sizeof(float));
+    detector->status = malloc(pixels * sizeof(uint8_t));
+    detector->order = malloc(pixels * sizeof(int));
+    detector->region = malloc(pixels * sizeof(int));
+}
+
+/**
+ * \brief Create a line detector
+ *
+ * \param config Parameters of the detector. It is copied, so it does not
+ *        have to outlive the call.
+ * \return A new detector, to be freed with line_detector_free
+ */
+LineDetector* line_detector_new(LineConfig* config) {
+    LineDetector* detector = calloc(1, sizeof(LineDetector));
+    detector->config = *config;
+
+    if(detector->config.angle_tolerance <= 0) {
+        detector->config.angle_tolerance = M_PI / 8;
+    }
+    return detector;
+}
+
+/**
+ * \brief Free a line detector and its buffers
+ */
+void line_detector_free(LineDetector* detector) {
+    release_buffers(detector);
+    free(detector->segments);
+    free(detector->by_angle);
+    free(detector->parent);
+    free(detector->group_start);
+    free(detector->joined);
+    free(detector);
+}
+
+/* Absolute difference of two angles in (-pi, pi] */
+static inline double angle_diff(double a, double b) {
+    double d = fabs(a - b);
+    return d > M_PI ? 2 * M_PI - d : d;
+}
+
+/* Smooth image with the 3x3 kernel [1 2 1]^T [1 2 1], repeating the edge
+   pixels, into detector->smoothed */
+static void smooth(LineDetector* detector, IplImage* image) {
+    int width = image->width;
+    int height = image->height;
+    uint16_t* out = detector->smoothed;
+    int x, y;
+
+    /* Horizontal pass into out, vertical pass in place, one row behind */
+    for(y = 0; y < height; y++) {
+        const uint8_t* row = (uint8_t*) image->imageData + y * image->widthStep;
+        uint16_t* dst = out + y * width;
+
+        dst[0] = 3 * row[0] + row[1];
+        for(x = 1; x < width - 1; x++) {
+            dst[x] = row[x - 1] + 2 * row[x] + row[x + 1];
+        }
+        dst[width - 1] = row[width - 2] + 3 * row[width - 1];
+    }
+
+    {
+        uint16_t above[width];
+        memcpy(above, out, width * sizeof(uint16_t));
+
+        for(y = 0; y < height; y++) {
+            uint16_t* row = out + y * width;
+            const uint16_t* below = y + 1 < height ? row + width : row;
+
+            for(x = 0; x < width; x++) {
+                uint16_t current = row[x];
+                row[x] = above[x] + 2 * current + below[x];
+                above[x] = current;
+            }
+        }
+    }
+}
+
+/* Gradient of every pixel, and the pixels above the threshold sorted into
+   order, strongest first */
+static void compute_gradient(LineDetector* detector, IplImage* image) {
+    int width = image->width;
+    int height = image->height;
+    double threshold = detector->config.gradient_threshold;
+    int bin_counts[MAGNITUDE_BINS];
+    int bin_starts[MAGNITUDE_BINS];
+    int x, y, i, total;
+
+    memset(bin_counts, 0, sizeof(bin_counts));
+    memset(detector->status, PIXEL_NOTDEF, width * height);
+    smooth(detector, image);
+
+    for(y = 0; y < height - 1; y++) {
+        const uint16_t* row_0 = detector->smoothed + y * width;
+        const uint16_t* row_1 = row_0 + width;
+
+        for(x = 0; x < width - 1; x++) {
+            int com_1 = row_1[x + 1] - row_0[x];
+            int com_2 = row_0[x + 1] - row_1[x];
+            double g_x = (com_1 + com_2) / 32.0;
+            double g_y = (com_1 - com_2) / 32.0;
+            double magnitude = sqrt(g_x * g_x + g_y * g_y);
+            int index = y * width + x;
+
+            detector->magnitudes[index] = magnitude;
+            if(magnitude <= threshold) {
+                continue;
+            }
+
+            /* Angle of the level line, perpendicular to the gradient */
+            detector->angles[index] = atan2(g_x, -g_y);
+            detector->status[index] = PIXEL_FREE;
+            bin_counts[(int) (magnitude * (MAGNITUDE_BINS - 1) / MAX_MAGNITUDE)]++;
+        }
+    }
+
+    /* Counting sort, largest magnitude first */
+    total = 0;
+    for(i = MAGNITUDE_BINS - 1; i >= 0; i--) {
+        bin_starts[i] = total;
+        total += bin_counts[i];
+    }
+    detector->num_ordered = total;
+
+    for(y = 0; y < height - 1; y++) {
+        for(x = 0; x < width - 1; x++) {
+            int index = y * width + x;
+            if(detector->status[index] == PIXEL_FREE) {
+                int bin = (int) (detector->magnitudes[index] * (MAGNITUDE_BINS - 1) / MAX_MAGNITUDE);
+                detector->order[bin_starts[bin]++] = index;
+            }
+        }
+    }
+}
+
+/* Grow a region of pixels with about the same angle as seed. Returns the
+   number of pixels in the region, which are left in detector->region and
+   marked as used */
+static int grow_region(LineDetector* detector, int seed, double tolerance, double* r_angle) {
+    int width = detector->size.width;
+    int height = detector->size.height;
+    int* region = detector->region;
+    double angle = detector->angles[seed];
+    double sum_dx = cos(angle);
+    double sum_dy = sin(angle);
+    int size = 1;
+    int i;
+
+    region[0] = seed;
+    detector->status[seed] = PIXEL_USED;
+
+    for(i = 0; i < size; i++) {
+        int x = region[i] % width;
+        int y = region[i] / width;
+        int x_n, y_n;
+
+        for(y_n = y - 1; y_n <= y + 1; y_n++) {
+            if(y_n < 0 || y_n >= height) {
+                continue;
+            }
+            for(x_n = x - 1; x_n <= x + 1; x_n++) {
+                int index = y_n * width + x_n;
+                double a;
+
+                if(x_n < 0 || x_n >= width || detector->status[index] != PIXEL_FREE) {
+                    continue;
+                }
+                a = detector->angles[index];
+                if(angle_diff(a, angle) > tolerance) {
+                    continue;
+                }
+
+                detector->status[index] = PIXEL_USED;
+                region[size++] = index;
+                sum_dx += cos(a);
+                sum_dy += sin(a);
+                angle = atan2(sum_dy, sum_dx);
+            }
+        }
+    }
+
+    *r_angle = angle;
+    return size;
+}
+
+/* Fit a rectangle to the region, as LSD's region2rect. Returns the density
+   of the region in the rectangle */
+static double fit_segment(LineDetector* detector, int size, double region_angle,
+                          double tolerance, LineSegment* segment) {
+    int width = detector->size.width;
+    int* region = detector->region;
+    double sum = 0, c_x = 0, c_y = 0;
+    double i_xx = 0, i_yy = 0, i_xy = 0;
+    double lambda, theta, d_x, d_y;
+    double l_min = 0, l_max = 0, w_sum = 0, w_squares = 0;
+    double length, rect_width;
+    int i;
+
+    for(i = 0; i < size; i++) {
+        double m = detector->magnitudes[region[i]];
+        c_x += (region[i] % width) * m;
+        c_y += (region[i] / width) * m;
+        sum += m;
+    }
+    c_x /= sum;
+    c_y /= sum;
+
+    for(i = 0; i < size; i++) {
+        double m = detector->magnitudes[region[i]];
+        double x = region[i] % width - c_x;
+        double y = region[i] / width - c_y;
+        i_xx += m * y * y;
+        i_yy += m * x * x;
+        i_xy -= m * x * y;
+    }
+
+    /* Direction of the smallest eigenvector of the inertia matrix */
+    lambda = 0.5 * (i_xx + i_yy - sqrt((i_xx - i_yy) * (i_xx - i_yy) + 4 * i_xy * i_xy));
+    if(fabs(i_xx) > fabs(i_yy)) {
+        theta = atan2(lambda - i_xx, i_xy);
+    } else {
+        theta = atan2(i_xy, lambda - i_yy);
+    }
+    if(angle_diff(theta, region_angle) > tolerance) {
+        theta += M_PI;
+    }
+
+    d_x = cos(theta);
+    d_y = sin(theta);
+    for(i = 0; i < size; i++) {
+        double x = region[i] % width - c_x;
+        double y = region[i] / width - c_y;
+        double l = x * d_x + y * d_y;
+        double w = -x * d_y + y * d_x;
+
+        if(l < l_min) l_min = l;
+        if(l > l_max) l_max = l;
+        w_sum += w;
+        w_squares += w * w;
+    }
+
+    /* Gradients are taken between pixels, half a pixel right of and below
+       the pixel they are stored at */
+    c_x += 0.5;
+    c_y += 0.5;
+
+    /* The width is taken from the spread of the pixels across the line, as
+       that of a band of whole pixels with the same variance. The extremes
+       would let a single stray pixel next to a long edge double its width
+       and fail the density test */
+    length = l_max - l_min + 1;
+    rect_width = sqrt(12 * (w_squares / size - (w_sum / size) * (w_sum / size)) + 1);
+
+    segment->x_0 = c_x + l_min * d_x;
+    segment->y_0 = c_y + l_min * d_y;
+    segment->x_1 = c_x + l_max * d_x;
+    segment->y_1 = c_y + l_max * d_y;
+    segment->width = rect_width;
+    segment->length = l_max - l_min;
+    segment->angle = fmod(theta + 2 * M_PI, M_PI);
+    segment->pixels = size;
+
+    return size / (length * rect_width);
+}
+
+/* Release the pixels of the current region, so they can seed or join other
+   regions */
+static void free_region(LineDetector* detector, int size) {
+    int i;
+    for(i = 0; i < size; i++) {
+        detector->status[detector->region[i]] = PIXEL_FREE;
+    }
+}
+
+static int add_segment(LineDetector* detector, int num_segments, LineSegment* segment) {
+    if(num_segments == detector->max_segments) {
+        detector->max_segments = detector->max_segments ? 2 * detector->max_segments : 64;
+        detector->segments = realloc(detector->segments, detector->max_segments * sizeof(LineSegment));
+        detector->by_angle = realloc(detector->by_angle, detector->max_segments * sizeof(int));
+        detector->parent = realloc(detector->parent, detector->max_segments * sizeof(int));
+        detector->group_start = realloc(detector->group_start, (detector->max_segments + 1) * sizeof(int));
+        detector->joined = realloc(detector->joined, detector->max_segments * sizeof(LineSegment));
+    }
+    detector->segments[num_segments] = *segment;
+    return num_segments + 1;
+}
+
+/* Find segments in the image, without joining them */
+static int detect_segments(LineDetector* detector) {
+    double tolerance = detector->config.angle_tolerance;
+    int num_segments = 0;
+    int i;
+
+    for(i = 0; i < detector->num_ordered; i++) {
+        int seed = detector->order[i];
+        LineSegment segment;
+        double region_angle;
+        int size;
+
+        if(detector->status[seed] != PIXEL_FREE) {
+            continue;
+        }
+
+        size = grow_region(detector, seed, tolerance, &region_angle);
+        if(size < 2) {
+            continue;
+        }
+
+        if(fit_segment(detector, size, region_angle, tolerance, &segment) < detector->config.min_density) {
+            /* Curved or noisy region. Try again with a tighter angle */
+            free_region(detector, size);
+            size = grow_region(detector, seed, tolerance / 2, &region_angle);
+            if(size < 2 ||
+               fit_segment(detector, size, region_angle, tolerance / 2, &segment) < detector->config.min_density) {
+                continue;
+            }
+        }
+
+        num_segments = add_segment(detector, num_segments, &segment);
+    }
+
+    return num_segments;
+}
+
+/* qsort context. qsort_r isn't portable */
+static const LineSegment* sort_segments;
+
+static int compare_angle(const void* a, const void* b) {
+    float angle_a = sort_segments[*(const int*) a].angle;
+    float angle_b = sort_segments[*(const int*) b].angle;
+    return (angle_a > angle_b) - (angle_a < angle_b);
+}
+
+static int compare_length(const void* a, const void* b) {
+    float length_a = ((const LineSegment*) a)->length;
+    float length_b = ((const LineSegment*) b)->length;
+    return (length_a < length_b) - (length_a > length_b);
+}
+
+static int find_root(int* parent, int i) {
+    while(parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+/* Whether segment b lies along segment a, closely enough to join them */
+static int joinable(const LineConfig* config, const LineSegment* a, const LineSegment* b) {
+    const LineSegment* longer = a->length >= b->length ? a : b;
+    const LineSegment* shorter = a->length >= b->length ? b : a;
+    double d_x = cos(longer->angle);
+    double d_y = sin(longer->angle);
+    double e_0, e_1, gap;
+
+    /* Distance of the shorter segment's ends from the longer one's line */
+    if(fabs(-(shorter->x_0 - longer->x_0) * d_y + (shorter->y_0 - longer->y_0) * d_x) > config->merge_distance ||
+       fabs(-(shorter->x_1 - longer->x_0) * d_y + (shorter->y_1 - longer->y_0) * d_x) > config->merge_distance) {
+        return 0;
+    }
+
+    /* Gap between the two along the line, measured from the longer one's
+       midpoint, where the longer one spans -length/2 to length/2 */
+    e_0 = (shorter->x_0 - (longer->x_0 + longer->x_1) / 2) * d_x +
+          (shorter->y_0 - (longer->y_0 + longer->y_1) / 2) * d_y;
+    e_1 = (shorter->x_1 - (longer->x_0 + longer->x_1) / 2) * d_x +
+          (shorter->y_1 - (longer->y_0 + longer->y_1) / 2) * d_y;
+    if(e_0 > e_1) {
+        double t = e_0;
+        e_0 = e_1;
+        e_1 = t;
+    }
+    gap = fmax(e_0 - longer->length / 2, -longer->length / 2 - e_1);
+
+    return gap <= config->merge_gap;
+}
+
+/* One segment through all the end points of a group of joined segments */
+static void join_group(const LineSegment* segments, const int* members, int num_members, LineSegment* out) {
+    double sum_length = 0, c_x = 0, c_y = 0;
+    double s_xx = 0, s_yy = 0, s_xy = 0;
+    double angle, d_x, d_y, l_min = 0, l_max = 0;
+    float width = 0;
+    int32_t pixels = 0;
+    int i, e;
+
+    /* Take the segments as rods of uniform weight. Their joint center of
+       mass and principal axis give the joined line, which is less sensitive
+       to errors in the angles of short pieces than averaging angles is */
+    for(i = 0; i < num_members; i++) {
+        const LineSegment* s = &segments[members[i]];
+        double weight = s->length + 1;
+
+        c_x += weight * (s->x_0 + s->x_1) / 2;
+        c_y += weight * (s->y_0 + s->y_1) / 2;
+        sum_length += weight;
+        if(s->width > width) {
+            width = s->width;
+        }
+        pixels += s->pixels;
+    }
+    c_x /= sum_length;
+    c_y /= sum_length;
+
+    for(i = 0; i < num_members; i++) {
+        const LineSegment* s = &segments[members[i]];
+        double weight = s->length + 1;
+        double m_x = (s->x_0 + s->x_1) / 2 - c_x;
+        double m_y = (s->y_0 + s->y_1) / 2 - c_y;
+        double spread = weight * s->length * s->length / 12;
+        double a_x = cos(s->angle);
+        double a_y = sin(s->angle);
+
+        s_xx += weight * m_x * m_x + spread * a_x * a_x;
+        s_yy += weight * m_y * m_y + spread * a_y * a_y;
+        s_xy += weight * m_x * m_y + spread * a_x * a_y;
+    }
+    angle = atan2(2 * s_xy, s_xx - s_yy) / 2;
+    d_x = cos(angle);
+    d_y = sin(angle);
+
+    for(i = 0; i < num_members; i++) {
+        const LineSegment* s = &segments[members[i]];
+        for(e = 0; e < 2; e++) {
+            double x = (e ? s->x_1 : s->x_0) - c_x;
+            double y = (e ? s->y_1 : s->y_0) - c_y;
+            double l = x * d_x + y * d_y;
+            if(l < l_min) l_min = l;
+            if(l > l_max) l_max = l;
+        }
+    }
+
+    out->x_0 = c_x + l_min * d_x;
+    out->y_0 = c_y + l_min * d_y;
+    out->x_1 = c_x + l_max * d_x;
+    out->y_1 = c_y + l_max * d_y;
+    out->width = width;
+    out->length = l_max - l_min;
+    out->angle = fmod(angle + M_PI, M_PI);
+    out->pixels = pixels;
+}
+
+/* Join collinear segments in place. Returns the new number of segments */
+static int join_segments(LineDetector* detector, int num_segments) {
+    const LineConfig* config = &detector->config;
+    LineSegment* segments = detector->segments;
+    int* by_angle = detector->by_angle;
+    int* parent = detector->parent;
+    int* group_start = detector->group_start;
+    LineSegment* joined = detector->joined;
+    int num_joined = 0;
+    int i, j, k;
+
+    if(num_segments < 2) {
+        return num_segments;
+    }
+
+    for(i = 0; i < num_segments; i++) {
+        by_angle[i] = i;
+        parent[i] = i;
+    }
+    sort_segments = segments;
+    qsort(by_angle, num_segments, sizeof(int), compare_angle);
+
+    /* Compare each segment to those following it within merge_angle, going
+       around from pi back to 0 */
+    for(i = 0; i < num_segments; i++) {
+        const LineSegment* a = &segments[by_angle[i]];
+
+        for(k = 1; k < num_segments; k++) {
+            const LineSegment* b;
+            double d;
+
+            j = (i + k) % num_segments;
+            b = &segments[by_angle[j]];
+            d = b->angle - a->angle;
+            if(d < 0) {
+                d += M_PI;
+            }
+            if(d > config->merge_angle) {
+                break;
+            }
+            if(joinable(config, a, b)) {
+                parent[find_root(parent, by_angle[i])] = find_root(parent, by_angle[j]);
+            }
+        }
+    }
+
+    /* Bucket the segments by group, reusing by_angle */
+    memset(group_start, 0, (num_segments + 1) * sizeof(int));
+    for(i = 0; i < num_segments; i++) {
+        parent[i] = find_root(parent, i);
+        group_start[parent[i] + 1]++;
+    }
+    for(i = 0; i < num_segments; i++) {
+        group_start[i + 1] += group_start[i];
+    }
+    for(i = 0; i < num_segments; i++) {
+        by_angle[group_start[parent[i]]++] = i;
+    }
+
+    /* group_start[i] is now where group i ends, and the previous group's end
+       is where it starts */
+    for(i = 0, j = 0; i < num_segments; i++) {
+        int num_members = group_start[i] - j;
+
+        if(num_members == 1) {
+            joined[num_joined++] = segments[by_angle[j]];
+        } else if(num_members > 1) {
+            join_group(segments, by_angle + j, num_members, &joined[num_joined++]);
+        }
+        j = group_start[i];
+    }
+
+    memcpy(segments, joined, num_joined * sizeof(LineSegment));
+    return num_joined;
+}
+
+/**
+ * \brief Find the line segments in an image
+ *
+ * \param detector Detector from line_detector_new
+ * \param image 8 bit single channel image. A thresholded mask works, as does
+ *        a grey image
+ * \param out Where up to max_out segments are written, longest first
+ * \return The number of segments written to out, or -1 if image is not an 8
+ *         bit single channel image
+ */
+int line_detector_run(LineDetector* detector, IplImage* image, LineSegment* out, int max_out) {
+    int num_segments, num_detected, i;
+
+    if(image->depth != IPL_DEPTH_8U || image->nChannels != 1) {
+        printf("Error: line_detector_run only accepts 8 bit single channel images.\n");
+        return -1;
+    }
+    if(image->width < 2 || image->height < 2) {
+        return 0;
+    }
+
+    prepare_buffers(detector, cvGetSize(image));
+    compute_gradient(detector, image);
+    num_segments = detect_segments(detector);
+
+    /* A joined segment has a better angle than its pieces, so it can reach
+       pieces that none of them could. Join until nothing changes */
+    do {
+        num_detected = num_segments;
+        num_segments = join_segments(detector, num_segments);
+    } while(num_segments < num_detected);
+
+    if(num_segments > 1) {
+        qsort(detector->segments, num_segments, sizeof(LineSegment), compare_length);
+    }
+
+    /* Segments are sorted longest first, so the short ones are at the end */
+    while(num_segments > 0 && detector->segments[num_segments - 1].length < detector->config.min_length) {
+        num_segments--;
+    }
+
+    if(num_segments > max_out) {
+        num_segments = max_out;
+    }
+    for(i = 0; i < num_segments; i++) {
+        out[i] = detector->segments[i];
+    }
+
+    return num_segments;
+}
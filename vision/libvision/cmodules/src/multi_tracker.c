@@ -0,0 +1,594 @@
+/**
+ * \file multi_tracker.c
+ * \brief Tracking of many objects at once from per frame detections
+ *
+ * Each frame, the detections found in it (usually blobs, given as a center
+ * and a size) are assigned to the tracks of the objects seen before:
+ *
+ *  1. Every track's position is predicted with a constant velocity Kalman
+ *     filter. x and y are filtered separately, each with a position and
+ *     velocity state.
+ *  2. A detection may only be assigned to a track if it is within gate
+ *     standard deviations of the prediction, and its size is within
+ *     max_size_ratio of the track's. The cost of an assignment is the squared
+ *     normalized distance from the prediction.
+ *  3. Confirmed and lost tracks are assigned first, by the Hungarian method
+ *     (the assignment with the least total cost) or greedily (cheapest pairs
+ *     first). Tentative tracks are then assigned what is left, so a new track
+ *     can't take an object's detection from the track following it.
+ *  4. Assigned tracks are corrected with their detection. Each unassigned
+ *     detection starts a tentative track.
+ *
+ * Tracks go through these states:
+ *
+ *  - Tentative: newly started. Confirmed once assigned a detection in
+ *    confirm_hits consecutive frames, and deleted on the first frame without
+ *    one.
+ *  - Confirmed: assigned a detection this frame.
+ *  - Lost: confirmed, but not assigned a detection for 1 to max_missed frames.
+ *    Its position keeps being predicted, and its gate grows with its
+ *    uncertainty, so the object is picked up again when it reappears nearby.
+ *    Deleted after max_missed frames.
+ *
+ * Track ids start at 1 and are never reused by one tracker.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* Cost of an assignment outside the gates. Larger than any gated cost, so
+   the Hungarian method only uses it when there is nothing else left */
+#define MOT_NO_MATCH 1e9
+
+typedef enum {
+    MOT_TENTATIVE = 0,
+    MOT_CONFIRMED = 1,
+    MOT_LOST = 2
+} MotState;
+
+/**
+ * \brief Settings of a multi object tracker
+ */
+typedef struct MotConfig_s {
+    /* Standard deviation of the change in velocity from frame to frame, in
+       pixels per frame */
+    double process_noise;
+
+    /* Standard deviation of a detection's position, in pixels */
+    double measurement_noise;
+
+    /* Standard deviation of a new track's velocity, in pixels per frame.
+       Roughly how fast an object may be moving when first seen */
+    double initial_speed;
+
+    /* Largest distance from the prediction a detection may be assigned at, in
+       standard deviations */
+    double gate;
+
+    /* Largest ratio of the larger to the smaller of a detection's and a
+       track's size. 0 to not compare sizes */
+    double max_size_ratio;
+
+    /* Consecutive frames a tentative track must be detected in to be
+       confirmed */
+    int32_t confirm_hits;
+
+    /* Frames a lost track is kept without a detection */
+    int32_t max_missed;
+
+    /* Nonzero to assign greedily rather than by the Hungarian method */
+    int32_t greedy;
+} MotConfig;
+
+/**
+ * \brief An object found in one frame
+ */
+typedef struct MotDetection_s {
+    float x;
+    float y;
+
+    /* Any measure of size, such as the pixel count of a blob */
+    float size;
+} MotDetection;
+
+/**
+ * \brief A track as given to the caller
+ */
+typedef struct MotTrack_s {
+    uint32_t id;
+    int32_t state;
+
+    /* Filtered position, or the predicted position when no detection was
+       assigned this frame, and the velocity in pixels per frame */
+    float x;
+    float y;
+    float v_x;
+    float v_y;
+
+    /* Standard deviations of the position */
+    float sigma_x;
+    float sigma_y;
+
+    /* Running average of the sizes of the assigned detections */
+    float size;
+
+    /* Frames detected in, in total, and frames since the last detection */
+    int32_t hits;
+    int32_t missed;
+
+    /* Index of the detection assigned this frame, or -1 */
+    int32_t detection;
+} MotTrack;
+
+/* Position and velocity along one axis, with their covariance */
+typedef struct MotAxis_s {
+    double position;
+    double velocity;
+    double p[2][2];
+} MotAxis;
+
+typedef struct MotTrackState_s {
+    uint32_t id;
+    MotState state;
+    MotAxis x;
+    MotAxis y;
+    double size;
+    int hits;
+    int consecutive_hits;
+    int missed;
+    int detection;
+} MotTrackState;
+
+typedef struct MultiTracker_s {
+    MotConfig config;
+    uint32_t next_id;
+
+    MotTrackState* tracks;
+    int num_tracks;
+    int tracks_capacity;
+
+    /* Scratch space for the assignment, grown as needed */
+    double* costs;
+    size_t costs_capacity;
+    int* assignment;
+    int* detection_used;
+    double* potentials;
+    double* min_costs;
+    int* way;
+    int* used;
+    size_t scratch_capacity;
+} MultiTracker;
+
+MultiTracker* mot_new(MotConfig* config);
+int mot_update(MultiTracker* tracker, MotDetection* detections, int num_detections, MotTrack* tracks, int max_tracks);
+void mot_free(MultiTracker* tracker);
+
+static void axis_init(MotAxis* axis, double position, const MotConfig* config) {
+    axis->position = position;
+    axis->velocity = 0;
+    axis->p[0][0] = config->measurement_noise * config->measurement_noise;
+    axis->p[0][1] = axis->p[1][0] = 0;
+    axis->p[1][1] = config->initial_speed * config->initial_speed;
+}
+
+/* Move one frame ahead. The velocity changes by white noise of variance q
+   over the frame, which moves the position by half as much */
+static void axis_predict(MotAxis* axis, double q) {
+    double p00 = axis->p[0][0], p01 = axis->p[0][1], p10 = axis->p[1][0], p11 = axis->p[1][1];
+
+    axis->position += axis->velocity;
+    axis->p[0][0] = p00 + p01 + p10 + p11 + q / 4;
+    axis->p[0][1] = p01 + p11 + q / 2;
+    axis->p[1][0] = p10 + p11 + q / 2;
+    axis->p[1][1] = p11 + q;
+}
+
+static void axis_correct(MotAxis* axis, double measurement, double r) {
+    double s = axis->p[0][0] + r;
+    double k0 = axis->p[0][0] / s;
+    double k1 = axis->p[1][0] / s;
+    double innovation = measurement - axis->position;
+    double p00 = axis->p[0][0], p01 = axis->p[0][1];
+
+    axis->position += k0 * innovation;
+    axis->velocity += k1 * innovation;
+    axis->p[0][0] -= k0 * p00;
+    axis->p[0][1] -= k0 * p01;
+    axis->p[1][0] -= k1 * p00;
+    axis->p[1][1] -= k1 * p01;
+}
+
+/* Squared distance of a detection from a track's prediction, in standard
+   deviations, or MOT_NO_MATCH if outside the gates */
+static double assignment_cost(const MultiTracker* tracker, const MotTrackState* track, const MotDetection* detection) {
+    const MotConfig* config = &tracker->config;
+    double r = config->measurement_noise * config->measurement_noise;
+    double d_x = detection->x - track->x.position;
+    double d_y = detection->y - track->y.position;
+    double distance = d_x * d_x / (track->x.p[0][0] + r) + d_y * d_y / (track->y.p[0][0] + r);
+
+    if(distance > config->gate * config->gate) {
+        return MOT_NO_MATCH;
+    }
+    if(config->max_size_ratio > 0) {
+        double larger = detection->size > track->size ? detection->size : track->size;
+        double smaller = detection->size > track->size ? track->size : detection->size;
+        if(larger > smaller * config->max_size_ratio) {
+            return MOT_NO_MATCH;
+        }
+    }
+    return distance;
+}
+
+static void reserve_scratch(MultiTracker* tracker, int num_tracks, int num_detections) {
+    /* The gated costs, then the same with the columns for leaving tracks
+       unassigned */
+    size_t costs_size = (size_t) num_tracks * num_detections + (size_t) num_tracks * (num_detections + num_tracks);
+    size_t scratch_size = num_tracks + num_detections + 1;
+
+    if(costs_size > tracker->costs_capacity) {
+        free(tracker->costs);
+        tracker->costs = malloc(costs_size * sizeof(double));
+        tracker->costs_capacity = costs_size;
+    }
+    if(scratch_size > tracker->scratch_capacity) {
+        free(tracker->assignment);
+        free(tracker->detection_used);
+        free(tracker->potentials);
+        free(tracker->min_costs);
+        free(tracker->way);
+        free(tracker->used);
+        tracker->assignment = malloc(scratch_size * sizeof(int));
+        tracker->detection_used = malloc(scratch_size * sizeof(int));
+        tracker->potentials = malloc(2 * scratch_size * sizeof(double));
+        tracker->min_costs = malloc(scratch_size * sizeof(double));
+        tracker->way = malloc(scratch_size * sizeof(int));
+        tracker->used = malloc(scratch_size * sizeof(int));
+        tracker->scratch_capacity = scratch_size;
+    }
+}
+
+/* Hungarian method on an n x m cost matrix (row major, n <= m), with the
+   shortest augmenting path formulation. Sets row_to_column[i] for every row.
+   O(n^2 m) */
+static void hungarian(MultiTracker* tracker, const double* costs, int n, int m, int* row_to_column) {
+    double* u = tracker->potentials;
+    double* v = tracker->potentials + n + 1;
+    double* min_costs = tracker->min_costs;
+    int* column_row = tracker->assignment;
+    int* way = tracker->way;
+    int* used = tracker->used;
+    int i, j;
+
+    /* Row and column 0 are a virtual start, so rows and columns are 1
+       based here */
+    for(i = 0; i <= n; i++) {
+        u[i] = 0;
+    }
+    for(j = 0; j <= m; j++) {
+        v[j] = 0;
+        column_row[j] = 0;
+        way[j] = 0;
+    }
+
+    for(i = 1; i <= n; i++) {
+        int j_0 = 0;
+
+        column_row[0] = i;
+        for(j = 0; j <= m; j++) {
+            min_costs[j] = HUGE_VAL;
+            used[j] = 0;
+        }
+
+        do {
+            int i_0 = column_row[j_0];
+            double delta = HUGE_VAL;
+            int j_1 = 0;
+
+            used[j_0] = 1;
+            for(j = 1; j <= m; j++) {
+                if(!used[j]) {
+                    double reduced = costs[(i_0 - 1) * m + (j - 1)] - u[i_0] - v[j];
+                    if(reduced < min_costs[j]) {
+                        min_costs[j] = reduced;
+                        way[j] = j_0;
+                    }
+                    if(min_costs[j] < delta) {
+                        delta = min_costs[j];
+                        j_1 = j;
+                    }
+                }
+            }
+            for(j = 0; j <= m; j++) {
+                if(used[j]) {
+                    u[column_row[j]] += delta;
+                    v[j] -= delta;
+                } else {
+                    min_costs[j] -= delta;
+                }
+            }
+            j_0 = j_1;
+        } while(column_row[j_0] != 0);
+
+        do {
+            int j_1 = way[j_0];
+            column_row[j_0] = column_row[j_1];
+            j_0 = j_1;
+        } while(j_0 != 0);
+    }
+
+    for(j = 1; j <= m; j++) {
+        if(column_row[j] != 0) {
+            row_to_column[column_row[j] - 1] = j - 1;
+        }
+    }
+}
+
+typedef struct MotPair_s {
+    double cost;
+    int track;
+    int detection;
+} MotPair;
+
+static int compare_pairs(const void* a, const void* b) {
+    double cost_a = ((const MotPair*) a)->cost;
+    double cost_b = ((const MotPair*) b)->cost;
+    return (cost_a > cost_b) - (cost_a < cost_b);
+}
+
+/* Assign the free detections to the tracks in track_indexes. Sets
+   track->detection and marks the detections used */
+static void assign(MultiTracker* tracker, const int* track_indexes, int num_tracks,
+                   const MotDetection* detections, int num_detections) {
+    int* free_detections;
+    int num_free = 0;
+    double* costs;
+    int i, j;
+
+    if(num_tracks <= 0 || num_detections <= 0) {
+        return;
+    }
+
+    free_detections = malloc((size_t) num_detections * sizeof(int));
+    for(j = 0; j < num_detections; j++) {
+        if(!tracker->detection_used[j]) {
+            free_detections[num_free++] = j;
+        }
+    }
+    if(num_free == 0) {
+        free(free_detections);
+        return;
+    }
+
+    costs = tracker->costs;
+    for(i = 0; i < num_tracks; i++) {
+        for(j = 0; j < num_free; j++) {
+            costs[i * num_free + j] = assignment_cost(tracker, &tracker->tracks[track_indexes[i]],
+                                                      &detections[free_detections[j]]);
+        }
+    }
+
+    if(tracker->config.greedy) {
+        MotPair* pairs = malloc((size_t) num_tracks * num_free * sizeof(MotPair));
+        int* track_assigned = calloc((size_t) num_tracks, sizeof(int));
+        int num_pairs = 0;
+
+        for(i = 0; i < num_tracks; i++) {
+            for(j = 0; j < num_free; j++) {
+                if(costs[i * num_free + j] < MOT_NO_MATCH) {
+                    pairs[num_pairs].cost = costs[i * num_free + j];
+                    pairs[num_pairs].track = i;
+                    pairs[num_pairs].detection = j;
+                    num_pairs++;
+                }
+            }
+        }
+        if(num_pairs > 1) {
+            qsort(pairs, num_pairs, sizeof(MotPair), compare_pairs);
+        }
+        for(i = 0; i < num_pairs; i++) {
+            int detection = free_detections[pairs[i].detection];
+            if(!track_assigned[pairs[i].track] && !tracker->detection_used[detection]) {
+                track_assigned[pairs[i].track] = 1;
+                tracker->detection_used[detection] = 1;
+                tracker->tracks[track_indexes[pairs[i].track]].detection = detection;
+            }
+        }
+        free(track_assigned);
+        free(pairs);
+
+    } else {
+        /* One extra column per track for leaving it unassigned, at the cost
+           of a detection on its gate. Without them, the least total cost
+           would first of all assign as many tracks as possible, even when
+           that moves others to worse detections */
+        int columns = num_free + num_tracks;
+        double* matrix = tracker->costs + (size_t) num_tracks * num_free;
+        double unassigned = tracker->config.gate * tracker->config.gate;
+        int* row_to_column = malloc((size_t) num_tracks * sizeof(int));
+
+        for(i = 0; i < num_tracks; i++) {
+            for(j = 0; j < columns; j++) {
+                if(j < num_free) {
+                    matrix[i * columns + j] = costs[i * num_free + j];
+                } else {
+                    matrix[i * columns + j] = j - num_free == i ? unassigned : MOT_NO_MATCH;
+                }
+            }
+        }
+
+        hungarian(tracker, matrix, num_tracks, columns, row_to_column);
+
+        for(i = 0; i < num_tracks; i++) {
+            j = row_to_column[i];
+            if(j < num_free && costs[i * num_free + j] < MOT_NO_MATCH) {
+                tracker->detection_used[free_detections[j]] = 1;
+                tracker->tracks[track_indexes[i]].detection = free_detections[j];
+            }
+        }
+
+        free(row_to_column);
+    }
+
+    free(free_detections);
+}
+
+/**
+ * \brief Create a multi object tracker
+ *
+ * \param config Settings, copied into the tracker
+ * \return New tracker, to be freed with mot_free
+ */
+MultiTracker* mot_new(MotConfig* config) {
+    MultiTracker* tracker = calloc(1, sizeof(MultiTracker));
+    tracker->config = *config;
+    tracker->next_id = 1;
+    if(tracker->config.confirm_hits < 1) {
+        tracker->config.confirm_hits = 1;
+    }
+    return tracker;
+}
+
+/**
+ * \brief Update the tracks with the detections of the next frame
+ *
+ * \param detections Objects found in the frame
+ * \param tracks Filled with the tracks after the update, confirmed and lost
+ *        tracks first, then tentative ones, each in the order they were
+ *        started
+ * \param max_tracks Size of tracks
+ * \return Number of tracks written to tracks
+ */
+int mot_update(MultiTracker* tracker, MotDetection* detections, int num_detections, MotTrack* tracks, int max_tracks) {
+    const MotConfig* config = &tracker->config;
+    double q = config->process_noise * config->process_noise;
+    double r = config->measurement_noise * config->measurement_noise;
+    int* track_indexes;
+    int num_established = 0, num_tentative = 0;
+    int num_out = 0;
+    int i, j, pass;
+
+    if(num_detections < 0) {
+        num_detections = 0;
+    }
+    reserve_scratch(tracker, tracker->num_tracks, num_detections);
+    memset(tracker->detection_used, 0, ((size_t) num_detections + 1) * sizeof(int));
+
+    for(i = 0; i < tracker->num_tracks; i++) {
+        MotTrackState* track = &tracker->tracks[i];
+        axis_predict(&track->x, q);
+        axis_predict(&track->y, q);
+        track->detection = -1;
+    }
+
+    /* Confirmed and lost tracks get first choice of the detections */
+    track_indexes = malloc(((size_t) tracker->num_tracks + 1) * sizeof(int));
+    for(i = 0; i < tracker->num_tracks; i++) {
+        if(tracker->tracks[i].state != MOT_TENTATIVE) {
+            track_indexes[num_established++] = i;
+        }
+    }
+    assign(tracker, track_indexes, num_established, detections, num_detections);
+    for(i = 0; i < tracker->num_tracks; i++) {
+        if(tracker->tracks[i].state == MOT_TENTATIVE) {
+            track_indexes[num_tentative++] = i;
+        }
+    }
+    assign(tracker, track_indexes, num_tentative, detections, num_detections);
+    free(track_indexes);
+
+    /* Correct, change states and delete */
+    j = 0;
+    for(i = 0; i < tracker->num_tracks; i++) {
+        MotTrackState* track = &tracker->tracks[i];
+
+        if(track->detection >= 0) {
+            const MotDetection* detection = &detections[track->detection];
+            axis_correct(&track->x, detection->x, r);
+            axis_correct(&track->y, detection->y, r);
+            track->size = 0.5 * track->size + 0.5 * detection->size;
+            track->hits++;
+            track->consecutive_hits++;
+            track->missed = 0;
+            if(track->state != MOT_TENTATIVE || track->consecutive_hits >= config->confirm_hits) {
+                track->state = MOT_CONFIRMED;
+            }
+        } else {
+            track->consecutive_hits = 0;
+            track->missed++;
+            if(track->state == MOT_TENTATIVE || track->missed > config->max_missed) {
+                continue;
+            }
+            track->state = MOT_LOST;
+        }
+        tracker->tracks[j++] = *track;
+    }
+    tracker->num_tracks = j;
+
+    /* Start tentative tracks on the unassigned detections */
+    for(i = 0; i < num_detections; i++) {
+        MotTrackState* track;
+
+        if(tracker->detection_used[i]) {
+            continue;
+        }
+        if(tracker->num_tracks == tracker->tracks_capacity) {
+            tracker->tracks_capacity = tracker->tracks_capacity ? 2 * tracker->tracks_capacity : 16;
+            tracker->tracks = realloc(tracker->tracks, tracker->tracks_capacity * sizeof(MotTrackState));
+        }
+
+        track = &tracker->tracks[tracker->num_tracks++];
+        memset(track, 0, sizeof(MotTrackState));
+        track->id = tracker->next_id++;
+        track->state = config->confirm_hits > 1 ? MOT_TENTATIVE : MOT_CONFIRMED;
+        axis_init(&track->x, detections[i].x, config);
+        axis_init(&track->y, detections[i].y, config);
+        track->size = detections[i].size;
+        track->hits = 1;
+        track->consecutive_hits = 1;
+        track->detection = i;
+    }
+
+    for(pass = 0; pass < 2; pass++) {
+        for(i = 0; i < tracker->num_tracks && num_out < max_tracks; i++) {
+            const MotTrackState* track = &tracker->tracks[i];
+            MotTrack* out = &tracks[num_out];
+
+            if((track->state == MOT_TENTATIVE) != pass) {
+                continue;
+            }
+            out->id = track->id;
+            out->state = track->state;
+            out->x = track->x.position;
+            out->y = track->y.position;
+            out->v_x = track->x.velocity;
+            out->v_y = track->y.velocity;
+            out->sigma_x = sqrt(track->x.p[0][0]);
+            out->sigma_y = sqrt(track->y.p[0][0]);
+            out->size = track->size;
+            out->hits = track->hits;
+            out->missed = track->missed;
+            out->detection = track->detection;
+            num_out++;
+        }
+    }
+
+    return num_out;
+}
+
+void mot_free(MultiTracker* tracker) {
+    if(tracker == NULL) {
+        return;
+    }
+    free(tracker->tracks);
+    free(tracker->costs);
+    free(tracker->assignment);
+    free(tracker->detection_used);
+    free(tracker->potentials);
+    free(tracker->min_costs);
+    free(tracker->way);
+    free(tracker->used);
+    free(tracker);
+}
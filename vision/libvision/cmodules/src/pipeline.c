@@ -0,0 +1,302 @@
+/**
+ * \file pipeline.c
+ * \brief Multi-stage vision pipeline run as a single cmodule call
+ *
+ * Entities typically run color targeting, then find_blobs, then buoy_color on
+ * every frame, with each step crossing the ctypes boundary and allocating its
+ * own images. A Pipeline describes that whole chain once:
+ *
+ *   color threshold -> morphology -> blob labeling -> per-blob color analysis
+ *
+ * and pipeline_run() runs it in C, reusing the same intermediate images from
+ * frame to frame. Only compact PipelineBlob records come back to the caller.
+ *
+ * Color conversion is part of the threshold stage: find_target_color_hsv_into
+ * converts only the pixels it looks at.
+ *
+ * The stages themselves are the ones in target_color_rgb.c,
+ * target_color_hsv.c, blob2.c and buoy_analyzer.c, which are compiled into
+ * this module (see pipeline.flags).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <seawolf.h>
+#include <cv.h>
+
+#include "common/types.h"
+
+#define PIPELINE_RGB 0
+#define PIPELINE_HSV 1
+
+/* Pixels labeled around a given roi. Must match ROI_MARGIN of the color
+   targeting modules so blobs aren't cut off inside the thresholded area */
+#define ROI_MARGIN 16
+
+/**
+ * \brief Description of a pipeline, given once to pipeline_new
+ */
+typedef struct PipelineConfig_s {
+    /* PIPELINE_RGB or PIPELINE_HSV */
+    int color_space;
+
+    /* Target color, (r, g, b) or (h, s, v) depending on color_space */
+    int target[3];
+
+    /* Arguments to find_target_color_* */
+    int min_blobsize;
+    int dev_threshold;
+    double precision_threshold;
+    int decimation;
+
+    /* Iterations of 3x3 opening and closing on the thresholded image. 0 skips
+       the operation */
+    int morph_open;
+    int morph_close;
+
+    /* Arguments to find_blobs */
+    int min_blob_size;
+    int max_blobs;
+
+    /* If non-zero, buoy_color_integral is run over the bounding boxes of the
+       blobs */
+    int analyze_color;
+} PipelineConfig;
+
+/**
+ * \brief Result record for one blob
+ */
+typedef struct PipelineBlob_s {
+    int32_t id;
+    int32_t size;
+
+    /* Centroid */
+    int32_t c_x;
+    int32_t c_y;
+
+    /* Bounding box */
+    int32_t x;
+    int32_t y;
+    int32_t w;
+    int32_t h;
+
+    /* Color given by buoy_color, or 0 if color analysis is disabled */
+    int32_t color;
+} PipelineBlob;
+
+/* Opaque, see buoy_analyzer.c */
+typedef struct BuoyIntegral_s BuoyIntegral;
+
+typedef struct Pipeline_s {
+    PipelineConfig config;
+
+    /* Size of frames the buffers below were created for */
+    CvSize size;
+
+    /* Output of the threshold and morphology stages */
+    IplImage* binary;
+
+    /* Indexed output of the labeling stage */
+    IplImage* labels;
+
+    /* Buoy ROIs handed to buoy_color, max_blobs of each */
+    BuoyROI* rois;
+    BuoyROI** roi_pointers;
+
+    /* Integral images of the frame, for buoy_color_integral */
+    BuoyIntegral* integral;
+} Pipeline;
+
+/* Stages, from the modules compiled in with this one */
+int find_target_color_rgb_into(IplImage* frame, IplImage* out, int red, int green, int blue, int min_blobsize, int dev_threshold, double precision_threshold, CvRect* roi, int decimation);
+int find_target_color_hsv_into(IplImage* frame, IplImage* out, int hue, int saturation, int value, int min_blobsize, int dev_threshold, double precision_threshold, CvRect* roi, int decimation);
+Blob** find_blobs_roi(IplImage* img_in, IplImage* blobs_out, int* r_num_blobs, int min_size, int keep_number, uint8_t out_coloring, CvRect* roi);
+void free_blobs(Blob** blobs, int num_blobs);
+BuoyIntegral* buoy_integral_new(void);
+void buoy_integral_update(BuoyIntegral* integral, IplImage* src);
+void buoy_integral_free(BuoyIntegral* integral);
+int* buoy_color_integral(IplImage* src, BuoyIntegral* integral, BuoyROI** rois, int num_rois);
+
+Pipeline* pipeline_new(PipelineConfig* config);
+int pipeline_run(Pipeline* pipeline, IplImage* frame, CvRect* roi, PipelineBlob* out, int max_out);
+void pipeline_free(Pipeline* pipeline);
+
+/* Clip rect to the image */
+static CvRect clip_rect(IplImage* img, CvRect rect) {
+    int x0 = Util_inRange(0, rect.x, img->width);
+    int y0 = Util_inRange(0, rect.y, img->height);
+    int x1 = Util_inRange(x0, rect.x + rect.width, img->width);
+    int y1 = Util_inRange(y0, rect.y + rect.height, img->height);
+
+    return cvRect(x0, y0, x1 - x0, y1 - y0);
+}
+
+static void release_buffers(Pipeline* pipeline) {
+    if(pipeline->binary) {
+        cvReleaseImage(&pipeline->binary);
+    }
+    if(pipeline->labels) {
+        cvReleaseImage(&pipeline->labels);
+    }
+}
+
+/* (Re)create the intermediate images if the frame size changed */
+static void prepare_buffers(Pipeline* pipeline, IplImage* frame) {
+    if(pipeline->binary && pipeline->size.width == frame->width && pipeline->size.height == frame->height) {
+        return;
+    }
+
+    release_buffers(pipeline);
+    pipeline->size = cvGetSize(frame);
+    pipeline->binary = cvCreateImage(pipeline->size, IPL_DEPTH_8U, 1);
+    pipeline->labels = cvCreateImage(pipeline->size, IPL_DEPTH_8U, 1);
+}
+
+/**
+ * \brief Create a pipeline
+ *
+ * \param config Description of the pipeline. It is copied, so it need not be
+ *        kept around by the caller.
+ * \return A new pipeline, to be freed with pipeline_free
+ */
+Pipeline* pipeline_new(PipelineConfig* config) {
+    Pipeline* pipeline = calloc(1, sizeof(Pipeline));
+    int i;
+
+    pipeline->config = *config;
+    if(pipeline->config.max_blobs < 1) {
+        pipeline->config.max_blobs = 1;
+    }
+
+    pipeline->rois = calloc(pipeline->config.max_blobs, sizeof(BuoyROI));
+    pipeline->roi_pointers = calloc(pipeline->config.max_blobs, sizeof(BuoyROI*));
+    for(i = 0; i < pipeline->config.max_blobs; i++) {
+        pipeline->roi_pointers[i] = &pipeline->rois[i];
+    }
+    pipeline->integral = buoy_integral_new();
+
+    return pipeline;
+}
+
+/**
+ * \brief Run every stage of the pipeline over a frame
+ *
+ * \param pipeline The pipeline to run
+ * \param frame 8 bit BGR frame
+ * \param roi If not NULL, only this part of the frame (plus a margin) is
+ *        thresholded and labeled. Results are still in frame coordinates.
+ * \param out Array the blob records are written to, largest blob first
+ * \param max_out Size of out
+ * \return Number of blobs written to out, or -1 on error
+ */
+int pipeline_run(Pipeline* pipeline, IplImage* frame, CvRect* roi, PipelineBlob* out, int max_out) {
+    PipelineConfig* config = &pipeline->config;
+    CvRect label_area;
+    CvRect* label_roi = NULL;
+    CvRect morph_area;
+    int morph_reach;
+    Blob** blobs;
+    int num_blobs;
+    int num_out;
+    int* colors = NULL;
+    int status;
+    int i;
+
+    prepare_buffers(pipeline, frame);
+
+    /* Threshold */
+    if(config->color_space == PIPELINE_HSV) {
+        status = find_target_color_hsv_into(frame, pipeline->binary,
+                                            config->target[0], config->target[1], config->target[2],
+                                            config->min_blobsize, config->dev_threshold,
+                                            config->precision_threshold, roi, config->decimation);
+    } else {
+        status = find_target_color_rgb_into(frame, pipeline->binary,
+                                            config->target[0], config->target[1], config->target[2],
+                                            config->min_blobsize, config->dev_threshold,
+                                            config->precision_threshold, roi, config->decimation);
+    }
+    if(status != 0) {
+        return -1;
+    }
+
+    /* Label. Everything outside of roi and its margin is already black */
+    if(roi) {
+        label_area = cvRect(roi->x - ROI_MARGIN, roi->y - ROI_MARGIN,
+                            roi->width + 2 * ROI_MARGIN, roi->height + 2 * ROI_MARGIN);
+        label_roi = &label_area;
+    }
+
+    /* Morphology, in place. With an roi only the labeled area is filtered,
+       grown by how far each pass can move an edge so the labeled pixels come
+       out the same as filtering the whole image */
+    morph_reach = 2 * (config->morph_open + config->morph_close);
+    if(roi && morph_reach > 0) {
+        morph_area = clip_rect(pipeline->binary,
+                               cvRect(label_area.x - morph_reach, label_area.y - morph_reach,
+                                      label_area.width + 2 * morph_reach,
+                                      label_area.height + 2 * morph_reach));
+        if(morph_area.width == 0 || morph_area.height == 0) {
+            morph_reach = 0;
+        } else {
+            cvSetImageROI(pipeline->binary, morph_area);
+        }
+    }
+    if(morph_reach > 0 && config->morph_open > 0) {
+        cvErode(pipeline->binary, pipeline->binary, NULL, config->morph_open);
+        cvDilate(pipeline->binary, pipeline->binary, NULL, config->morph_open);
+    }
+    if(morph_reach > 0 && config->morph_close > 0) {
+        cvDilate(pipeline->binary, pipeline->binary, NULL, config->morph_close);
+        cvErode(pipeline->binary, pipeline->binary, NULL, config->morph_close);
+    }
+    cvResetImageROI(pipeline->binary);
+
+    blobs = find_blobs_roi(pipeline->binary, pipeline->labels, &num_blobs,
+                           config->min_blob_size, config->max_blobs, 0, label_roi);
+
+    num_out = num_blobs < max_out ? num_blobs : max_out;
+
+    /* Per-blob color analysis */
+    if(config->analyze_color && num_out > 0) {
+        for(i = 0; i < num_out; i++) {
+            pipeline->rois[i].x = blobs[i]->x_0;
+            pipeline->rois[i].y = blobs[i]->y_0;
+            pipeline->rois[i].w = blobs[i]->x_1 - blobs[i]->x_0 + 1;
+            pipeline->rois[i].h = blobs[i]->y_1 - blobs[i]->y_0 + 1;
+        }
+        buoy_integral_update(pipeline->integral, frame);
+        colors = buoy_color_integral(frame, pipeline->integral, pipeline->roi_pointers, num_out);
+    }
+
+    /* Pack the results */
+    for(i = 0; i < num_out; i++) {
+        out[i].id = blobs[i]->id;
+        out[i].size = blobs[i]->size;
+        out[i].c_x = blobs[i]->c_x;
+        out[i].c_y = blobs[i]->c_y;
+        out[i].x = blobs[i]->x_0;
+        out[i].y = blobs[i]->y_0;
+        out[i].w = blobs[i]->x_1 - blobs[i]->x_0;
+        out[i].h = blobs[i]->y_1 - blobs[i]->y_0;
+        out[i].color = colors ? colors[i] : 0;
+    }
+
+    free(colors);
+    free_blobs(blobs, num_blobs);
+
+    return num_out;
+}
+
+/**
+ * \brief Free a pipeline and all of its buffers
+ */
+void pipeline_free(Pipeline* pipeline) {
+    release_buffers(pipeline);
+    free(pipeline->rois);
+    buoy_integral_free(pipeline->integral);
+    free(pipeline->roi_pointers);
+    free(pipeline);
+}
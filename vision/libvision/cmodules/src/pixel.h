@@ -0,0 +1,96 @@
+/**
+ * \file pixel.h
+ * \brief Helpers for writing per-pixel kernels once for every image layout
+ *
+ * Modules include this with #include "pixel.h". It is not a module itself.
+ *
+ * Kernels are written as static inline functions taking the number of
+ * channels as an argument, and are only ever called with a literal 1 or 3,
+ * chosen once per call of the module function with PIXEL_DISPATCH. The
+ * compiler then makes one copy of the kernel per channel count, with fixed
+ * strides and no per-pixel test of the layout.
+ *
+ * Row kernels take a pointer to the first pixel and a pixel count, and are
+ * called once per span given by pixel_spans(). When the images have no
+ * padding between rows and the area covers whole rows, the whole area is a
+ * single span, so the kernel runs one long loop the compiler can vectorize.
+ */
+
+#ifndef __SW_LIBVISION_PIXEL_H
+#define __SW_LIBVISION_PIXEL_H
+
+#include <stdint.h>
+#include <cv.h>
+
+#if defined(__GNUC__)
+# define PIXEL_INLINE static inline __attribute__((always_inline))
+#else
+# define PIXEL_INLINE static inline
+#endif
+
+/**
+ * \brief Call KERNEL(channels, ...) with channels a constant 1 or 3
+ *
+ * Evaluates to the kernel's return value, or to ERROR if img is not an 8 bit
+ * image with 1 or 3 channels.
+ */
+#define PIXEL_DISPATCH(img, ERROR, KERNEL, ...) \
+    (((img)->depth != IPL_DEPTH_8U) ? (ERROR) : \
+     ((img)->nChannels == 1) ? KERNEL(1, __VA_ARGS__) : \
+     ((img)->nChannels == 3) ? KERNEL(3, __VA_ARGS__) : (ERROR))
+
+/**
+ * \brief Nonzero if any channel of pixel x in row is nonzero
+ */
+PIXEL_INLINE int pixel_any(const uint8_t* row, int x, const int channels) {
+    if(channels == 1) {
+        return row[x];
+    }
+    return row[3 * x] | row[3 * x + 1] | row[3 * x + 2];
+}
+
+/**
+ * \brief Address of pixel (x, y)
+ */
+PIXEL_INLINE uint8_t* pixel_at(const IplImage* img, int x, int y) {
+    return (uint8_t*) img->imageData + y * img->widthStep + x * img->nChannels;
+}
+
+/**
+ * \brief Nonzero if the rows of img follow each other with no padding
+ */
+PIXEL_INLINE int pixel_contiguous(const IplImage* img) {
+    return img->widthStep == img->width * img->nChannels * ((img->depth & 0xff) / 8);
+}
+
+/**
+ * \brief Spans of pixels a row kernel is called on
+ *
+ * Span i starts at pixel (area.x, area.y + i) of each image and is length
+ * pixels long.
+ */
+typedef struct PixelSpans_s {
+    int count;
+    int length;
+} PixelSpans;
+
+/**
+ * \brief How to walk area of in and out, which must be the same size
+ *
+ * out may be NULL for kernels that only read.
+ */
+PIXEL_INLINE PixelSpans pixel_spans(const IplImage* in, const IplImage* out, CvRect area) {
+    PixelSpans spans;
+
+    if(area.x == 0 && area.width == in->width && pixel_contiguous(in) &&
+       (out == NULL || pixel_contiguous(out))) {
+        spans.count = area.height > 0 ? 1 : 0;
+        spans.length = area.width * area.height;
+    } else {
+        spans.count = area.height;
+        spans.length = area.width;
+    }
+    return spans;
+}
+
+#endif
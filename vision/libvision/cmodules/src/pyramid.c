@@ -0,0 +1,320 @@
+/**
+ * \file pyramid.c
+ * \brief Color targeting and blob search on a downsampled image pyramid
+ *
+ * Large, close targets don't need full camera resolution to be found. A
+ * Pyramid keeps 2x, 4x, ... downsampled copies of each frame. Color
+ * targeting and blob labeling run on the coarsest level at which a blob of
+ * min_blob_size full resolution pixels still covers min_level_pixels pixels.
+ * Then only the areas around the blobs found there are thresholded and
+ * labeled again at full resolution, so the returned centroids and bounding
+ * boxes are exact.
+ *
+ * Levels are built by keeping every other pixel of every other row, not by
+ * averaging, so the color histogram of a level, with each pixel counted
+ * 4^level times, is the one find_target_color_* builds with a decimation of
+ * 2^level. Both passes therefore pick the same color limit, and the coarse
+ * pass finds the blobs the full resolution search would.
+ *
+ * The stages are the ones in target_color_rgb.c, target_color_hsv.c and
+ * blob2.c, which are compiled into this module (see pyramid.flags).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <seawolf.h>
+#include <cv.h>
+
+#include "common/types.h"
+
+#define PYRAMID_RGB 0
+#define PYRAMID_HSV 1
+
+/* Most levels a pyramid can have, including full resolution */
+#define PYRAMID_MAX_LEVELS 5
+
+/* Extra full resolution pixels around a coarse hit that are relabeled, on top
+   of the one coarse pixel downsampling may have cut off */
+#define REFINE_MARGIN 4
+
+typedef struct Pyramid_s {
+    int levels;
+    int min_level_pixels;
+
+    /* Level the last frame was searched at */
+    int last_level;
+
+    /* Downsampled frames. images[0] is never used, level 0 is the frame
+       itself */
+    IplImage* images[PYRAMID_MAX_LEVELS];
+
+    /* Threshold and label images for each level */
+    IplImage* binary[PYRAMID_MAX_LEVELS];
+    IplImage* labels[PYRAMID_MAX_LEVELS];
+} Pyramid;
+
+/* Stages, from the modules compiled in with this one */
+int find_target_color_rgb_level_limit(IplImage* level, IplImage* out, int red, int green, int blue, int min_blobsize, int dev_threshold, double precision_threshold, int scale, int* r_limit);
+int find_target_color_hsv_level_limit(IplImage* level, IplImage* out, int hue, int saturation, int value, int min_blobsize, int dev_threshold, double precision_threshold, int scale, int* r_limit);
+int find_target_color_rgb_rect(IplImage* frame, IplImage* out, int red, int green, int blue, int limit, CvRect area);
+int find_target_color_hsv_rect(IplImage* frame, IplImage* out, int hue, int saturation, int value, int limit, CvRect area);
+Blob** find_blobs_roi(IplImage* img_in, IplImage* blobs_out, int* r_num_blobs, int min_size, int keep_number, uint8_t out_coloring, CvRect* roi);
+Blob** find_blobs_area(IplImage* img_in, IplImage* blobs_out, int* r_num_blobs, int min_size, int keep_number, uint8_t out_coloring, CvRect* roi);
+void free_blobs(Blob** blobs, int num_blobs);
+
+Pyramid* pyramid_new(int levels, int min_level_pixels);
+Blob** pyramid_find_blobs(Pyramid* pyramid, IplImage* frame, int* r_num_blobs, int color_space, int c_0, int c_1, int c_2, int min_blobsize, int dev_threshold, double precision_threshold, int min_blob_size, int max_blobs);
+int pyramid_last_level(Pyramid* pyramid);
+void pyramid_free(Pyramid* pyramid);
+
+/**
+ * \brief Create a pyramid
+ *
+ * \param levels Number of levels, counting full resolution. 1 searches every
+ *        frame at full resolution. At most PYRAMID_MAX_LEVELS.
+ * \param min_level_pixels Fewest pixels a blob of min_blob_size may shrink to
+ *        at the level it is searched at
+ * \return A new pyramid, to be freed with pyramid_free
+ */
+Pyramid* pyramid_new(int levels, int min_level_pixels) {
+    Pyramid* pyramid = calloc(1, sizeof(Pyramid));
+
+    pyramid->levels = Util_inRange(1, levels, PYRAMID_MAX_LEVELS);
+    pyramid->min_level_pixels = min_level_pixels > 1 ? min_level_pixels : 1;
+
+    return pyramid;
+}
+
+static void release_level(Pyramid* pyramid, int level) {
+    if(pyramid->images[level]) {
+        cvReleaseImage(&pyramid->images[level]);
+    }
+    if(pyramid->binary[level]) {
+        cvReleaseImage(&pyramid->binary[level]);
+    }
+    if(pyramid->labels[level]) {
+        cvReleaseImage(&pyramid->labels[level]);
+    }
+}
+
+/**
+ * \brief Free a pyramid and all of its images
+ */
+void pyramid_free(Pyramid* pyramid) {
+    int level;
+
+    for(level = 0; level < PYRAMID_MAX_LEVELS; level++) {
+        release_level(pyramid, level);
+    }
+    free(pyramid);
+}
+
+/**
+ * \brief Level the last frame given to pyramid_find_blobs was searched at
+ */
+int pyramid_last_level(Pyramid* pyramid) {
+    return pyramid->last_level;
+}
+
+/* (Re)create the images of a level if the frame size changed */
+static void prepare_level(Pyramid* pyramid, int level, CvSize size) {
+    IplImage* binary = pyramid->binary[level];
+
+    if(binary && binary->width == size.width && binary->height == size.height) {
+        return;
+    }
+
+    release_level(pyramid, level);
+    if(level > 0) {
+        pyramid->images[level] = cvCreateImage(size, IPL_DEPTH_8U, 3);
+    }
+    pyramid->binary[level] = cvCreateImage(size, IPL_DEPTH_8U, 1);
+    pyramid->labels[level] = cvCreateImage(size, IPL_DEPTH_8U, 1);
+}
+
+/* Keep the top left pixel of each 2x2 square of a 3 channel image. dst is
+   half the size of src, rounded up */
+static void downsample(IplImage* src, IplImage* dst) {
+    int x, y;
+
+    for(y = 0; y < dst->height; y++) {
+        const uint8_t* row = (uint8_t*) src->imageData + 2 * y * src->widthStep;
+        uint8_t* out = (uint8_t*) dst->imageData + y * dst->widthStep;
+
+        for(x = 0; x < dst->width; x++) {
+            out[3 * x + 0] = row[6 * x + 0];
+            out[3 * x + 1] = row[6 * x + 1];
+            out[3 * x + 2] = row[6 * x + 2];
+        }
+    }
+}
+
+static int threshold_level(IplImage* level, IplImage* out, int color_space, int c_0, int c_1, int c_2, int min_blobsize, int dev_threshold, double precision_threshold, int scale, int* r_limit) {
+    if(color_space == PYRAMID_HSV) {
+        return find_target_color_hsv_level_limit(level, out, c_0, c_1, c_2, min_blobsize, dev_threshold, precision_threshold, scale, r_limit);
+    }
+    return find_target_color_rgb_level_limit(level, out, c_0, c_1, c_2, min_blobsize, dev_threshold, precision_threshold, scale, r_limit);
+}
+
+/* Threshold only area of image. out is left as it is outside of area */
+static int threshold(IplImage* image, IplImage* out, int color_space, int c_0, int c_1, int c_2, int limit, CvRect area) {
+    if(color_space == PYRAMID_HSV) {
+        return find_target_color_hsv_rect(image, out, c_0, c_1, c_2, limit, area);
+    }
+    return find_target_color_rgb_rect(image, out, c_0, c_1, c_2, limit, area);
+}
+
+/* Coarsest level at which a blob of min_blob_size keeps min_level_pixels
+   pixels, and which is still at least 16 pixels on each side */
+static int choose_level(Pyramid* pyramid, IplImage* frame, int min_blob_size) {
+    int level = 0;
+
+    while(level + 1 < pyramid->levels &&
+          (min_blob_size >> (2 * (level + 1))) >= pyramid->min_level_pixels &&
+          (frame->width >> (level + 1)) >= 16 && (frame->height >> (level + 1)) >= 16) {
+        level++;
+    }
+    return level;
+}
+
+static int rects_overlap(CvRect a, CvRect b) {
+    return a.x < b.x + b.width && b.x < a.x + a.width &&
+           a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
+static CvRect rect_union(CvRect a, CvRect b) {
+    int x_0 = a.x < b.x ? a.x : b.x;
+    int y_0 = a.y < b.y ? a.y : b.y;
+    int x_1 = a.x + a.width > b.x + b.width ? a.x + a.width : b.x + b.width;
+    int y_1 = a.y + a.height > b.y + b.height ? a.y + a.height : b.y + b.height;
+    return cvRect(x_0, y_0, x_1 - x_0, y_1 - y_0);
+}
+
+/* Insert b into blobs, kept sorted largest first and at most max_blobs long.
+   Blobs that don't make it in are freed */
+static void insert_blob(Blob** blobs, int* num_blobs, int max_blobs, Blob* b) {
+    int j = *num_blobs;
+
+    while(j > 0 && b->size > blobs[j - 1]->size) {
+        j--;
+    }
+    if(j >= max_blobs) {
+        free(b);
+        return;
+    }
+    if(*num_blobs == max_blobs) {
+        free(blobs[--(*num_blobs)]);
+    }
+    memmove(blobs + j + 1, blobs + j, (*num_blobs - j) * sizeof(Blob*));
+    blobs[j] = b;
+    (*num_blobs)++;
+}
+
+/**
+ * \brief find_target_color_* followed by find_blobs, using the pyramid
+ *
+ * The arguments are those of find_target_color_rgb (or _hsv) and find_blobs.
+ * Returned blobs are in full resolution coordinates, largest first, with ids
+ * 1, 2, ... but no label image is written.
+ *
+ * \param pyramid Pyramid from pyramid_new, one per video stream
+ * \param frame 8 bit BGR frame
+ * \param r_num_blobs Where the number of blobs returned is stored
+ * \param color_space PYRAMID_RGB or PYRAMID_HSV, giving the meaning of c_0, c_1, c_2
+ * \return A list of blobs, to be freed with free_blobs, or NULL on error
+ */
+Blob** pyramid_find_blobs(Pyramid* pyramid, IplImage* frame, int* r_num_blobs, int color_space, int c_0, int c_1, int c_2, int min_blobsize, int dev_threshold, double precision_threshold, int min_blob_size, int max_blobs) {
+    int level = choose_level(pyramid, frame, min_blob_size);
+    int scale = 1 << level;
+    IplImage* image = frame;
+    Blob** coarse;
+    Blob** blobs;
+    Blob** area_blobs;
+    CvRect* areas;
+    int num_coarse, num_areas, num_area_blobs;
+    int limit;
+    int num_blobs = 0;
+    int merged;
+    int i, j;
+
+    *r_num_blobs = 0;
+    pyramid->last_level = level;
+
+    if(max_blobs < 1) {
+        return NULL;
+    }
+
+    prepare_level(pyramid, 0, cvGetSize(frame));
+    for(i = 1; i <= level; i++) {
+        prepare_level(pyramid, i, cvSize((image->width + 1) / 2, (image->height + 1) / 2));
+        downsample(image, pyramid->images[i]);
+        image = pyramid->images[i];
+    }
+
+    /* Search the coarse level. Its color limit is the one a full resolution
+       pass with a decimation of scale would find, so it is kept for the
+       refinement below */
+    if(threshold_level(image, pyramid->binary[level], color_space, c_0, c_1, c_2,
+                       min_blobsize, dev_threshold, precision_threshold, scale, &limit) != 0) {
+        return NULL;
+    }
+    coarse = find_blobs_roi(pyramid->binary[level], pyramid->labels[level], &num_coarse,
+                            Util_max(min_blob_size / (scale * scale), 1), max_blobs, 0, NULL);
+
+    if(level == 0) {
+        *r_num_blobs = num_coarse;
+        return coarse;
+    }
+
+    /* Full resolution areas around the hits, merged where they overlap */
+    areas = malloc((num_coarse + 1) * sizeof(CvRect));
+    num_areas = 0;
+    for(i = 0; i < num_coarse; i++) {
+        areas[num_areas++] = cvRect((coarse[i]->x_0 - 1) * scale - REFINE_MARGIN,
+                                    (coarse[i]->y_0 - 1) * scale - REFINE_MARGIN,
+                                    (coarse[i]->x_1 - coarse[i]->x_0 + 3) * scale + 2 * REFINE_MARGIN,
+                                    (coarse[i]->y_1 - coarse[i]->y_0 + 3) * scale + 2 * REFINE_MARGIN);
+    }
+    free_blobs(coarse, num_coarse);
+
+    do {
+        merged = 0;
+        for(i = 0; i < num_areas; i++) {
+            for(j = i + 1; j < num_areas; j++) {
+                if(rects_overlap(areas[i], areas[j])) {
+                    areas[i] = rect_union(areas[i], areas[j]);
+                    areas[j] = areas[--num_areas];
+                    merged = 1;
+                    j--;
+                }
+            }
+        }
+    } while(merged);
+
+    /* Threshold and label each area at full resolution. The areas don't
+       overlap, and only each area is written and read, so nothing else of
+       the full resolution images needs clearing */
+    blobs = malloc(max_blobs * sizeof(Blob*));
+    for(i = 0; i < num_areas; i++) {
+        if(threshold(frame, pyramid->binary[0], color_space, c_0, c_1, c_2, limit, areas[i]) != 0) {
+            break;
+        }
+        area_blobs = find_blobs_area(pyramid->binary[0], pyramid->labels[0], &num_area_blobs,
+                                     min_blob_size, max_blobs, 0, &areas[i]);
+        for(j = 0; j < num_area_blobs; j++) {
+            insert_blob(blobs, &num_blobs, max_blobs, area_blobs[j]);
+        }
+        free(area_blobs);
+    }
+    free(areas);
+
+    for(i = 0; i < num_blobs; i++) {
+        blobs[i]->id = i + 1;
+    }
+
+    *r_num_blobs = num_blobs;
+    return blobs;
+}
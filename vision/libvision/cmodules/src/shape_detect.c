@@ -1,8 +1,11 @@
 #include <stdio.h>
+#include <stdint.h>
 #include <cv.h>
 #include <highgui.h>
 #include <math.h>
 
+#include "common/types.h"
+
 /* FILE CONTAINS:           */
 /* match_letters()          */
 /* find_bins()              */
@@ -20,12 +23,14 @@
 #define HOLE_SIZE .5 //smaller the number, smaller the hole
 #define R_RATIO .05 //number small radii allowed (per pixel)
 #define O_CONFIDENCE_THRESHOLD 80 //required confidence to accept an O
+#define X_TEMPLATE_FILE "../vision/xtemplate.png" //template X matches are warped onto
+#define X_TEMPLATE_SIZE 100 //size of the template
 /* corner finding */
-#define CORNER_COUNT 15 //how many corners to look for
+#define CORNER_COUNT 60 //how many corners to look for
 #define CORNER_QUALITY .5  //how sharp the corners must be
 #define MIN_CORNER_DISTANCE 30 //how close the corners may be 
 /* corner linking */
-#define EDGE_WIDTH 3 //how far to look for edge pixels when linking corners
+#define EDGE_WIDTH 3 //how far to look for edge pixels when linking corners (< 255)
 #define GAP_SIZE 15  //number of edgless pixels that can connect two corners
 /* rectange recognition */
 #define ANGLE_TOLERANCE .15 //how close to a right angle the bins must be
@@ -35,20 +40,22 @@
     #define M_PI 3.1415926535897932384626433832795028841971693993751058209749445923
 #endif
 
-// Rectangle Deffintion
-typedef struct Rect_s {
-    
-    /* area of the rectangle */
-    int32_t area;
-    
-    /* center of rectangle */
-    int32_t c_x;
-    int32_t c_y;
 
-    /* direction of rectangle */
-    int32_t theta;
-} Rect;
+// Distances from each pixel to the nearest edge pixel, along the column and
+// along the row, saturated at 255. Corners are linked by checking these
+// instead of searching a window around every point of the line.
+typedef struct EdgeDistance_s {
+    int width;
+    int height;
+    uint8_t* vertical;
+    uint8_t* horizontal;
+} EdgeDistance;
 
+// Set of linked corner pairs, one row of bits per corner
+typedef struct Adjacency_s {
+    int words_per_row;
+    uint32_t* bits;
+} Adjacency;
 
 /* PROTOTYPES */
 
@@ -59,13 +66,16 @@ int match_O(IplImage* binary, CvPoint* points, int pixel_count, CvPoint* r_point
 
 //bin detection
 Rect** find_bins(IplImage* frame, int* bin_count);
-int pair_corners(CvPoint2D32f* pt1, CvPoint2D32f* pt2, IplImage* edges, IplImage* debug);
+int pair_corners(CvPoint2D32f* pt1, CvPoint2D32f* pt2, EdgeDistance* dist, IplImage* debug);
 int mod(int x, int a);
-int test_connect(int c1, int c2, int** pairs, int* pair_counts);
+int test_connect(int c1, int c2, Adjacency* adjacency);
+static void edge_distance(IplImage* edges, EdgeDistance* dist);
+static int find_group(int* parents, int c);
 Rect* create_rect(CvPoint* ctr_pt, CvPoint* cls_pt, CvPoint* far_pt);
 
 //misc 
 int arctan(int x, int y);
+static int point_cmp(CvPoint* a, CvPoint* b);
 
 /* FUNCTION: find_bins() */
 
@@ -91,8 +101,12 @@ Rect** find_bins(IplImage* frame, int* bin_count){
         cvShowImage("Bin Edges", edge);
     #endif
 
+    //distance from every pixel to the edges, used to link corners
+    EdgeDistance dist;
+    edge_distance(edge, &dist);
+
     //Corner Detection
-    int i,j,l;
+    int i,j;
 
     IplImage* eigimage = cvCreateImage(cvGetSize(frame),IPL_DEPTH_32F,1);
     IplImage* tmpimage = cvCreateImage(cvGetSize(frame),IPL_DEPTH_32F,1);
@@ -122,65 +136,46 @@ Rect** find_bins(IplImage* frame, int* bin_count){
 
     #endif
 
-    //create table of adjacent corners
-    int** pairs;
-    int** groups;
-    int* group_sizes; //records sizes of groups of corners
-    int* pair_counts; //records number of pairs per corner
-    //int group_count = 0; //track number of groups
+    //table of adjacent corners
+    Adjacency adjacency;
+    adjacency.words_per_row = (corner_count + 31) / 32;
+    adjacency.bits = (uint32_t*)calloc(corner_count * adjacency.words_per_row + 1, sizeof(uint32_t));
+
+    //union-find forest grouping linked corners
+    int* parents = (int*)malloc((corner_count + 1) * sizeof(int));
+    int* group_sizes = (int*)calloc(corner_count + 1, sizeof(int)); //size of the group rooted at each corner
 
     //create list of rectangles
     Rect** rects = calloc(corner_count,sizeof(Rect*));
     int rect_count = 0;
 
-    group_sizes = (int*)calloc(corner_count,sizeof(int));
-    pair_counts = (int*)calloc(corner_count,sizeof(int));
-    groups = (int**)calloc(corner_count,sizeof(int*));
-    pairs = (int**)calloc(corner_count,sizeof(int*));
     for(i=0; i<corner_count; i++){
-        pair_counts[i] = 0;
+        parents[i] = i;
         group_sizes[i] = 1;
-        groups[i] = (int*)calloc(corner_count,sizeof(int));
-        pairs[i] = (int*)calloc(corner_count-1,sizeof(int));
-        groups[i][0] = i;
     }
     
     //pair and group corners based on edge detect
     for(i = 0; i<corner_count; i++){
         for(j=i+1; j<corner_count; j++){
-            int paired = pair_corners(&corners[i], &corners[j], edge, debug);
+            int paired = pair_corners(&corners[i], &corners[j], &dist, debug);
             if(!paired) continue;
 
-            int g_old, g_new; 
-            //find the old group that i belongs to
-            for(g_old = i; group_sizes[g_old]<0; g_old = groups[g_old][0]);
-            for(g_new = j; group_sizes[g_new]<0; g_new = groups[g_new][0]);
-            
-
+            //merge the smaller group into the larger one
+            int g_old = find_group(parents, i);
+            int g_new = find_group(parents, j);
             if(g_old != g_new){
-                //update old group to new group
-                for(l=0;l<group_sizes[g_old];l++){
-                    //check to see if groups[i][l] is already a member of groups[j]
-                    int k;
-                    int member_found = 0;
-                    for(k=0;k<group_sizes[g_new];k++){
-                        if (groups[g_new][k] == groups[g_old][l]){
-                            member_found = 1;
-                            break;
-                        }
-                    }
-                    if(!member_found){
-                        groups[g_new][group_sizes[g_new]++] = groups[g_old][l];
-                    }
+                if(group_sizes[g_old] > group_sizes[g_new]){
+                    int swap = g_old;
+                    g_old = g_new;
+                    g_new = swap;
                 }
-                //flag this group as moved elsewhere
-                group_sizes[g_old] = -1;
-                groups[g_old][0] = j;
+                parents[g_old] = g_new;
+                group_sizes[g_new] += group_sizes[g_old];
             }
 
             //record this match
-            pairs[i][pair_counts[i]++] = j;
-            pairs[j][pair_counts[j]++] = i;
+            adjacency.bits[i * adjacency.words_per_row + j / 32] |= 1u << (j % 32);
+            adjacency.bits[j * adjacency.words_per_row + i / 32] |= 1u << (i % 32);
 
             #ifdef VISUAL_DEBUG_BINS
                 CvScalar connect_color = {{0,0,255}};
@@ -194,6 +189,25 @@ Rect** find_bins(IplImage* frame, int* bin_count){
         }
     }
 
+    //list the members of each group contiguously, groups in order of their
+    //root, members in corner order
+    int* group_starts = (int*)calloc(corner_count + 1, sizeof(int));
+    int* members = (int*)malloc((corner_count + 1) * sizeof(int));
+    int* fill = (int*)calloc(corner_count + 1, sizeof(int));
+    for(i=0; i<corner_count; i++){
+        parents[i] = find_group(parents, i);
+        if(parents[i] == i){
+            group_starts[i + 1] = group_sizes[i];
+        }
+    }
+    for(i=0; i<corner_count; i++){
+        group_starts[i + 1] += group_starts[i];
+    }
+    for(i=0; i<corner_count; i++){
+        int root = parents[i];
+        members[group_starts[root] + fill[root]++] = i;
+    }
+
     //Identify Bins
     CvPoint pt[3];
     int dis[3];
@@ -202,40 +216,46 @@ Rect** find_bins(IplImage* frame, int* bin_count){
     int cor[3]; 
     int group_finished;
     for(i=0; i<corner_count; i++){
+        if(parents[i] != i) continue;
+
+        int* group = members + group_starts[i];
+        int group_size = group_sizes[i];
+
         #ifdef VISUAL_DEBUG_BINS
-            if(group_sizes[i] > 2){
-                for(j=0; j<group_sizes[i]; j++){
-                    for(l=0; l < pair_counts[groups[i][j]]; l++){
+            if(group_size > 2){
+                for(j=0; j<group_size; j++){
+                    for(l=0; l<corner_count; l++){
+                        if(!test_connect(group[j], l, &adjacency)) continue;
                         CvScalar group_color = {{255,0,255}};
                         CvPoint pt1, pt2;
-                        pt1.x = corners[groups[i][j]].x;
-                        pt2.x = corners[pairs[groups[i][j]][l]].x;
-                        pt1.y = corners[groups[i][j]].y;
-                        pt2.y = corners[pairs[groups[i][j]][l]].y;
+                        pt1.x = corners[group[j]].x;
+                        pt2.x = corners[l].x;
+                        pt1.y = corners[group[j]].y;
+                        pt2.y = corners[l].y;
                         cvLine(debug,pt1,pt2,group_color,1,8,0);
                     }
                 }
             }
         #endif
         group_finished = 0;
-        if(group_sizes[i] < 3) continue;
+        if(group_size < 3) continue;
         //there are at least 3 corners in this group
         //test all combinations of 3 corners to see if we find a right triangle
-        for(cor[0]=0; cor[0]<group_sizes[i]; cor[0]++){
-            for(cor[1]=cor[0]+1;cor[1]<group_sizes[i]; cor[1]++){
-                for(cor[2]=cor[1]+1; cor[2]<group_sizes[i]; cor[2]++){
+        for(cor[0]=0; cor[0]<group_size; cor[0]++){
+            for(cor[1]=cor[0]+1;cor[1]<group_size; cor[1]++){
+                for(cor[2]=cor[1]+1; cor[2]<group_size; cor[2]++){
                     for(j=0; j<3; j++){
                         //rename the coner coordinates
-                        pt[j].x = corners[groups[i][cor[j]]].x;
-                        pt[j].y = corners[groups[i][cor[j]]].y;
+                        pt[j].x = corners[group[cor[j]]].x;
+                        pt[j].y = corners[group[cor[j]]].y;
                     }
 
                     for(j=0; j<3; j++){
                         //make note of any disconections                        
                         int prv = mod(j-1,3);
                         int nxt = mod(j+1,3);
-                        connections[j] = test_connect(groups[i][cor[prv]],groups[i][cor[j]],pairs,pair_counts);
-                        connections[j] *= test_connect(groups[i][cor[nxt]],groups[i][cor[j]],pairs,pair_counts);
+                        connections[j] = test_connect(group[cor[prv]],group[cor[j]],&adjacency);
+                        connections[j] *= test_connect(group[cor[nxt]],group[cor[j]],&adjacency);
 
                         //gather distances between points 
                         dis[j] = (int)sqrt(pow(pt[prv].x-pt[nxt].x,2)+pow(pt[prv].y-pt[nxt].y,2)); 
@@ -297,15 +317,15 @@ Rect** find_bins(IplImage* frame, int* bin_count){
         cvShowImage("Bin Debug",debug);
     #endif
     //free memory
-    for(i=0; i<corner_count; i++){
-        free(pairs[i]);
-        free(groups[i]);
-    }
-    free(groups);
+    free(adjacency.bits);
+    free(parents);
     free(group_sizes);
-    free(pairs);
-    free(pair_counts);
+    free(group_starts);
+    free(members);
+    free(fill);
     free(corners);
+    free(dist.vertical);
+    free(dist.horizontal);
     cvReleaseImage(&edge);
     cvReleaseImage(&grayscale);
     cvReleaseImage(&tmpimage);
@@ -348,25 +368,99 @@ Rect* create_rect(CvPoint* ctr_pt, CvPoint* cls_pt, CvPoint* far_pt){
     return rect;
 }
 
-int test_connect(int c1, int c2, int** pairs, int* pair_counts){
-    int connected = 0;
-    int i;
-    for(i=0; i<pair_counts[c1]; i++){
-        if(pairs[c1][i] == c2){
-            connected = 1;
+int test_connect(int c1, int c2, Adjacency* adjacency){
+    return (adjacency->bits[c1 * adjacency->words_per_row + c2 / 32] >> (c2 % 32)) & 1;
+}
+
+//finds the root of the group corner c belongs to, flattening the path to it
+static int find_group(int* parents, int c){
+    int root = c;
+    while(parents[root] != root){
+        root = parents[root];
+    }
+    while(parents[c] != root){
+        int next = parents[c];
+        parents[c] = root;
+        c = next;
+    }
+    return root;
+}
+
+//computes the distance from every pixel to the nearest edge pixel in its
+//column and in its row, with a pass each way
+static void edge_distance(IplImage* edges, EdgeDistance* dist){
+    int width = edges->width;
+    int height = edges->height;
+    int x, y;
+
+    dist->width = width;
+    dist->height = height;
+    dist->vertical = (uint8_t*)malloc(width * height + 1);
+    dist->horizontal = (uint8_t*)malloc(width * height + 1);
+
+    for(y = 0; y < height; y++){
+        uint8_t* row = (uint8_t*)edges->imageData + y * edges->widthStep;
+        uint8_t* vertical = dist->vertical + y * width;
+        uint8_t* vertical_above = NULL;
+        uint8_t* horizontal = dist->horizontal + y * width;
+        int run = 255;
+
+        //the first row has no row above it
+        if(y > 0){
+            vertical_above = vertical - width;
+        }
+
+        for(x = 0; x < width; x++){
+            if(row[x] != 0){
+                vertical[x] = 0;
+                run = 0;
+            }else{
+                vertical[x] = (vertical_above == NULL || vertical_above[x] == 255) ? 255 : vertical_above[x] + 1;
+                if(run < 255) run++;
+            }
+            horizontal[x] = run;
+        }
+
+        run = 255;
+        for(x = width - 1; x >= 0; x--){
+            if(horizontal[x] == 0){
+                run = 0;
+            }else if(run < 255){
+                run++;
+            }
+            if(run < horizontal[x]){
+                horizontal[x] = run;
+            }
         }
     }
-    for(i=0; i<pair_counts[c2]; i++){
-        if(pairs[c2][i] == c1){
-            connected = 1;
+
+    for(y = height - 2; y >= 0; y--){
+        uint8_t* vertical = dist->vertical + y * width;
+        uint8_t* vertical_below = vertical + width;
+        for(x = 0; x < width; x++){
+            if(vertical_below[x] < 255 && vertical_below[x] + 1 < vertical[x]){
+                vertical[x] = vertical_below[x] + 1;
+            }
         }
     }
-    return connected;
 }
-int pair_corners(CvPoint2D32f* pt1, CvPoint2D32f* pt2, IplImage* edges, IplImage* debug){
+
+//checks for an edge pixel within EDGE_WIDTH of (major, minor) across the
+//line, where distances holds the distances along the minor axis
+static int edge_near(uint8_t* distances, int major, int minor, int major_size, int minor_size, int minor_stride, int major_stride){
+    if(major < 0 || major >= major_size) return 0;
+
+    //the nearest pixel of the window inside the image
+    int clamped = minor < 0 ? 0 : (minor >= minor_size ? minor_size - 1 : minor);
+    int offset = abs(clamped - minor);
+    if(offset > EDGE_WIDTH) return 0;
+
+    return distances[clamped * minor_stride + major * major_stride] <= EDGE_WIDTH - offset;
+}
+
+int pair_corners(CvPoint2D32f* pt1, CvPoint2D32f* pt2, EdgeDistance* dist, IplImage* debug){
     int x,y;
     int total_gap = 0;
-    int distance = 0;
     
     if(abs(pt1->x - pt2->x) > abs(pt1->y - pt2->y)){
         //sort the two corners by x value
@@ -383,23 +477,16 @@ int pair_corners(CvPoint2D32f* pt1, CvPoint2D32f* pt2, IplImage* edges, IplImage
             highx.x = pt1->x;
             highx.y = pt1->y;
         }
-        distance = highx.x - lowx.x;
 
         //compute the slope between these two points
         double slope = (double)(highx.y-lowx.y)/(highx.x-lowx.x);
         
-        //check the number of edge pixels between these two corners 
+        //count the points of the line with no edge pixels above or below them
         for(x=lowx.x; x<=highx.x; x++){
             int linept = (x-lowx.x) * slope + lowx.y;
-            int gap_found = 1;
-            for(y= linept-EDGE_WIDTH; y <= linept+EDGE_WIDTH; y++){
-                if(x < 0 || y < 0 || x >= edges->width || y >= edges->height) continue;
-                if(edges->imageData[x+y*edges->width] != 0){
-                    gap_found = 0;
-                }
+            if(!edge_near(dist->vertical, x, linept, dist->width, dist->height, dist->width, 1)){
+                if(++total_gap >= GAP_SIZE) return 0;
             }
-            total_gap += gap_found;
-
         }
     }else{
         //sort the two corners by y value
@@ -416,31 +503,21 @@ int pair_corners(CvPoint2D32f* pt1, CvPoint2D32f* pt2, IplImage* edges, IplImage
             highy.x = pt1->x;
             highy.y = pt1->y;
         }
-        distance = highy.y - lowy.y;
         
         //compute the slope between these two points
         double slope = (double)(highy.x-lowy.x)/(highy.y-lowy.y);
         
-        //check the number of edge pixels between these two corners 
+        //count the points of the line with no edge pixels left or right of them
         for(y=lowy.y; y<=highy.y; y++){
             int linept = (y-lowy.y) * slope + lowy.x;
-            int gap_found = 1;
-            for(x= linept-EDGE_WIDTH; x <= linept+EDGE_WIDTH; x++){
-                if(x < 0 || y < 0 || x >= edges->width || y >= edges->height) continue;
-                if(edges->imageData[x+y*edges->width] != 0){
-                    gap_found = 0;
-                }
+            if(!edge_near(dist->horizontal, y, linept, dist->height, dist->width, 1, dist->width)){
+                if(++total_gap >= GAP_SIZE) return 0;
             }
-            total_gap += gap_found;
         }
     }
     
-    //decide if the points are connected
-    int points_connected = 0;
-    if(total_gap < GAP_SIZE)
-        points_connected = 1;
-
-    return points_connected;
+    //the points are connected, fewer than GAP_SIZE points had no edge nearby
+    return 1;
 }
 
 int mod(int x, int a){
@@ -449,15 +526,29 @@ int mod(int x, int a){
     return x;
 }
 
+//orders points the way match_letters used to collect them, by column then
+//by row. Used to break ties between points at the same radius.
+static int point_cmp(CvPoint* a, CvPoint* b){
+    if(a->x != b->x) return a->x - b->x;
+    return a->y - b->y;
+}
+
 int match_letters(IplImage* binary, int index, int cent_x, int cent_y, int roix0, int roiy0, int roix, int roiy){
 
     int x,y; //useful variable names
     CvPoint* points; //an array of pixel coordinates
     int pixel_count = 0; //total number of pixels we find
-    CvPoint r_point; //a reference point which has the maximum radius
+    CvPoint r_point = {0, 0}; //a reference point which has the maximum radius
+
+    //clip the roi to the image
+    int x0 = roix0 < 0 ? 0 : roix0;
+    int y0 = roiy0 < 0 ? 0 : roiy0;
+    int x1 = roix0 + roix >= binary->width ? binary->width - 1 : roix0 + roix;
+    int y1 = roiy0 + roiy >= binary->height ? binary->height - 1 : roiy0 + roiy;
 
-    //allocate memory for points
-    points = (CvPoint*)calloc(binary->width * binary->height, sizeof(CvPoint)); 
+    //allocate a buffer big enough for every pixel of the roi. It is owned
+    //by this call, since match_letters may run on several threads at once
+    points = (CvPoint*)malloc(((x1 - x0 + 1 > 0 ? x1 - x0 + 1 : 0) * (y1 - y0 + 1 > 0 ? y1 - y0 + 1 : 0) + 1) * sizeof(CvPoint));
 
     //handle the debug image
     IplImage* debug = NULL;
@@ -473,28 +564,29 @@ int match_letters(IplImage* binary, int index, int cent_x, int cent_y, int roix0
         }
     #endif 
 
-    //populate a list of pixel coordinates, and find the furthest pixel
-    int maxr = 0;
-    for(x = roix0; x <= roix0 + roix; x++){
-        for( y = roiy0; y <= roiy0 + roiy; y++){
-            if(binary->imageData[y*binary->width + x] == index){
+    //populate a list of pixel coordinates, and find the furthest pixel.
+    //radii are compared squared
+    int maxr2 = -1;
+    for( y = y0; y <= y1; y++){
+        char* row = binary->imageData + y*binary->widthStep;
+        for(x = x0; x <= x1; x++){
+            if(row[x] == index){
                 //record this pixel
                 points[pixel_count].x = x;
                 points[pixel_count].y = y;
-                
-                //increment pixel count
-                pixel_count++;
                
                 //look for furthest pixel from centroid
                 int tempx = x - cent_x;
                 int tempy = y - cent_y; 
-                int r = (int)sqrt((double)(tempx*tempx + tempy*tempy));
+                int r2 = tempx*tempx + tempy*tempy;
 
-                if( r > maxr){
-                    maxr = r;
-                    r_point.x = x;
-                    r_point.y = y;
+                if( r2 > maxr2 || (r2 == maxr2 && point_cmp(&points[pixel_count], &r_point) < 0)){
+                    maxr2 = r2;
+                    r_point = points[pixel_count];
                 }
+
+                //increment pixel count
+                pixel_count++;
             }
 
             #ifdef VISUAL_DEBUG
@@ -555,9 +647,25 @@ int match_letters(IplImage* binary, int index, int cent_x, int cent_y, int roix0
 int match_X(IplImage* binary, CvPoint* points, int pixel_count, CvPoint* r_point, int cent_x, int cent_y, IplImage* debug){
 
     int i,x,y; //useful variable names
-    CvPoint* corners; //the corners of the image
-    
-    corners = (CvPoint*)calloc(4, sizeof(CvPoint)); 
+    CvPoint corners[4] = {{0, 0}, {0, 0}, {0, 0}, {0, 0}}; //the corners of the image
+
+    //template, warp matrix and warped image are kept between calls
+    static IplImage* xtemplate = NULL;
+    static IplImage* warped = NULL;
+    static CvMat* tmatrix = NULL;
+
+    //load template
+    if(xtemplate == NULL){
+        xtemplate = cvLoadImage(X_TEMPLATE_FILE,CV_LOAD_IMAGE_GRAYSCALE);
+        if(xtemplate == NULL){
+            printf("match_X: could not load %s\n", X_TEMPLATE_FILE);
+            return 0;
+        }
+        CvSize warpedsize = {X_TEMPLATE_SIZE,X_TEMPLATE_SIZE};
+        warped = cvCreateImage(warpedsize, 8, 1);
+        tmatrix = cvCreateMat(3,3,CV_32FC1);
+    }
+
     corners[0].x = r_point->x;
     corners[0].y = r_point->y;
 
@@ -566,10 +674,11 @@ int match_X(IplImage* binary, CvPoint* points, int pixel_count, CvPoint* r_point
     y = corners[0].y - cent_y;
     int theta = arctan(y,x);
 
-    //find the other 3 corners
-    int maxr1 = 0;
-    int maxr2 = 0;
-    int maxr3 = 0;
+    //find the other 3 corners, comparing radii squared. Ties go to the
+    //point last in column order
+    int maxr1 = -1;
+    int maxr2 = -1;
+    int maxr3 = -1;
     //keep track of the pixel sums on either side of angle0 
     int pxsum1 = 0; //this is bigger --> corner 0 goes in upper left
     int pxsum2 = 0; // this is bigger --> corner 0 goes in upper right
@@ -581,32 +690,29 @@ int match_X(IplImage* binary, CvPoint* points, int pixel_count, CvPoint* r_point
         //normalize angles
         if (tempang < theta) tempang += 360;
         
-        //find tempr
-        int tempr = (int)sqrt((double)(x*x + y*y));
+        //find tempr squared
+        int tempr2 = x*x + y*y;
 
         if( tempang - theta > 315 ){
             //we are in the same quadrant as the origional angle
             pxsum1++;
         } else if( tempang - theta > 225){
             //call this quadrant 3
-            if( tempr > maxr3){
-                maxr3 = tempr;
-                corners[3].x = points[i].x;
-                corners[3].y = points[i].y;
+            if( tempr2 > maxr3 || (tempr2 == maxr3 && point_cmp(&points[i], &corners[3]) > 0)){
+                maxr3 = tempr2;
+                corners[3] = points[i];
             }
        } else if( tempang - theta > 135) {
             //call this quadrant 2
-            if( tempr > maxr2) {
-                maxr2 = tempr;
-                corners[2].x = points[i].x;
-                corners[2].y = points[i].y;
+            if( tempr2 > maxr2 || (tempr2 == maxr2 && point_cmp(&points[i], &corners[2]) > 0)) {
+                maxr2 = tempr2;
+                corners[2] = points[i];
             }
        } else if( tempang - theta > 45) {
             //call this quadrant 1
-            if( tempr > maxr1) {
-                maxr1 = tempr;
-                corners[1].x = points[i].x;
-                corners[1].y = points[i].y;
+            if( tempr2 > maxr1 || (tempr2 == maxr1 && point_cmp(&points[i], &corners[1]) > 0)) {
+                maxr1 = tempr2;
+                corners[1] = points[i];
             }
        } else {
             //we are again in the same quadrant as the origional angle
@@ -659,17 +765,13 @@ int match_X(IplImage* binary, CvPoint* points, int pixel_count, CvPoint* r_point
 
     #endif
 
-    //load template
-    IplImage* xtemplate = cvLoadImage("../vision/xtemplate.png",CV_LOAD_IMAGE_GRAYSCALE);
     //get transformation matrix that would place corner values
         //in the correct location to compare to template
 
     //transform image
         //create an array for the 4 src points and dest points
-        CvPoint2D32f* src;
-        CvPoint2D32f* dst;
-        src = (CvPoint2D32f*)calloc(4, sizeof(CvPoint2D32f));
-        dst = (CvPoint2D32f*)calloc(4, sizeof(CvPoint2D32f));
+        CvPoint2D32f src[4];
+        CvPoint2D32f dst[4];
 
         //populate the src array 
         if( pxsum1 >= pxsum2 ){
@@ -689,19 +791,16 @@ int match_X(IplImage* binary, CvPoint* points, int pixel_count, CvPoint* r_point
         dst[0].x = 0;
         dst[0].y = 0;
         dst[1].x = 0;
-        dst[1].y = 100;
-        dst[2].x = 100;
-        dst[2].y = 100;
-        dst[3].x = 100;
+        dst[1].y = X_TEMPLATE_SIZE;
+        dst[2].x = X_TEMPLATE_SIZE;
+        dst[2].y = X_TEMPLATE_SIZE;
+        dst[3].x = X_TEMPLATE_SIZE;
         dst[3].y = 0;
 
         //get the transformation matrix
-        CvMat* tmatrix = cvCreateMat(3,3,CV_32FC1);
-        tmatrix = cvGetPerspectiveTransform( src, dst, tmatrix);
+        cvGetPerspectiveTransform( src, dst, tmatrix);
 
         //transform the image
-        CvSize warpedsize = {100,100};
-        IplImage* warped = cvCreateImage(warpedsize, 8, 1);
         CvScalar fillcolor = {{0}};
         cvWarpPerspective(binary, warped, tmatrix,CV_INTER_LINEAR+CV_WARP_FILL_OUTLIERS , fillcolor);
 
@@ -709,12 +808,13 @@ int match_X(IplImage* binary, CvPoint* points, int pixel_count, CvPoint* r_point
         IplImage* compared = cvCreateImage(cvGetSize(xtemplate),8,3);
     #endif
 
+ 
     //XOR the template image with our warped image 
     int xor_sum = 0;
     for ( i=xtemplate->width*xtemplate->height -1; i>=0; i--){
-        int p1 = xtemplate->imageData[i];
-        int p2 = warped->imageData[i];
-        if(( p1 != 0 &&  p2 != 0 ) || ( p1 == 0 && p2 == 0 )){
+        int p1 = xtemplate->imageData[(i / xtemplate->width) * xtemplate->widthStep + i % xtemplate->width];
+        int p2 = warped->imageData[(i / warped->width) * warped->widthStep + i % warped->width];
+        if( (p1 != 0) == (p2 != 0) ){
             xor_sum++;
         }
        
@@ -754,12 +854,6 @@ int match_X(IplImage* binary, CvPoint* points, int pixel_count, CvPoint* r_point
     #endif
 
     //free memory
-    cvReleaseImage(&xtemplate);
-    cvReleaseImage(&warped);
-    free(corners);
-    free(src);
-    free(dst);
-    cvReleaseMat(&tmatrix);
     #ifdef VISUAL_DEBUG_X
         cvReleaseImage(&compared);
     #endif
@@ -776,14 +870,18 @@ int match_O(IplImage* binary, CvPoint* points, int pixel_count, CvPoint* r_point
     y = r_point->y - mid_y; 
     int maxr = (int)sqrt(x*x + y*y);
 
+    //a whole radius r is below maxr * HOLE_SIZE exactly when r squared is
+    //below this
+    int hole_r = (int)ceil(maxr * HOLE_SIZE);
+    int hole_r2 = hole_r * hole_r;
+
     //count the number of pixels where the hole should be 
     int small_r_sum = 0;
     for( i=0; i<pixel_count; i++){
         x = points[i].x - mid_x;
         y = points[i].y - mid_y;
-        int r = (int)sqrt(x*x + y*y);
 
-        if( r < maxr * HOLE_SIZE){
+        if( x*x + y*y < hole_r2){
             small_r_sum++;
 
             #ifdef VISUAL_DEBUG_O
@@ -814,8 +912,48 @@ int match_O(IplImage* binary, CvPoint* points, int pixel_count, CvPoint* r_point
     return o_confidence;
 }
 
-//returns arctan of x and y, from -180 to 180 degrees
+//entries in the arctangent table, covering ratios 0 to 1
+#define ATAN_TABLE_SIZE 1024
+//fractional bits of the angles in the table
+#define ATAN_SHIFT 16
+
+//returns arctan of x and y, from -180 to 180 degrees, truncated toward 0.
+//Uses a fixed point table of atan over the first octant with linear
+//interpolation. Only angles within a hair of a whole degree can come out
+//one degree off from the floating point result
 int arctan(int x, int y){
-    int theta = (int)( atan2((double)y, (double)x) * 180 / M_PI );
-    return theta;
+    static int32_t table[ATAN_TABLE_SIZE + 1];
+    static int table_ready = 0;
+    int i;
+
+    if(!table_ready){
+        for(i = 0; i <= ATAN_TABLE_SIZE; i++){
+            table[i] = (int32_t)(atan((double)i / ATAN_TABLE_SIZE) * 180 / M_PI * (1 << ATAN_SHIFT) + 0.5);
+        }
+        table_ready = 1;
+    }
+
+    if(x == 0 && y == 0) return 0;
+
+    int64_t ax = x < 0 ? -(int64_t)x : x;
+    int64_t ay = y < 0 ? -(int64_t)y : y;
+    int64_t small = ax < ay ? ax : ay;
+    int64_t large = ax < ay ? ay : ax;
+
+    //ratio of the short side to the long side, with 8 fractional bits
+    //beyond the table index
+    int64_t ratio = (small * ATAN_TABLE_SIZE << 8) / large;
+    int idx = ratio >> 8;
+    int frac = ratio & 0xff;
+    int32_t angle = table[idx];
+    if(idx < ATAN_TABLE_SIZE){
+        angle += ((table[idx + 1] - table[idx]) * frac) >> 8;
+    }
+
+    //unfold the octant, then the quadrant
+    if(ay > ax) angle = (90 << ATAN_SHIFT) - angle;
+    if(x < 0) angle = (180 << ATAN_SHIFT) - angle;
+    if(y < 0) angle = -angle;
+
+    return angle / (1 << ATAN_SHIFT);
 }
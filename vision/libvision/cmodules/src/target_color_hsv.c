@@ -16,6 +16,9 @@
 #include <highgui.h>  
 #include <math.h>
 
+#include "pixel.h"
+#include "common/pool.h"
+
 /** 
  * \ingroup colortools
  * \{
@@ -56,6 +59,8 @@
 #define HUE_WEIGHT 2
 #define SAT_WEIGHT 1
 #define VAL_WEIGHT 1
+#define ROI_MARGIN 16 //pixels thresholded around a given roi
+#define MIN_BAND_ROWS 32 //fewest rows in a band of work for the thread pool
 
 struct HSVPixel_s {
     unsigned char h;
@@ -65,30 +70,117 @@ struct HSVPixel_s {
 
 typedef struct HSVPixel_s HSVPixel; 
 
-float Pixel_dist_hsv(HSVPixel* px_1, HSVPixel* px_2);
+//histogram of the color distances of one band of sample rows
+typedef struct HSVHistogramBand_s {
+    int* radii;
+    int smallestr;
+} HSVHistogramBand;
+
+typedef struct HSVHistogramJob_s {
+    IplImage* samples;
+    int sample_weight;
+    HSVPixel color;
+    int maxr;
+    int num_bands;
+    HSVHistogramBand bands[POOL_MAX_BANDS];
+} HSVHistogramJob;
+
+typedef struct HSVThresholdJob_s {
+    IplImage* in;
+    IplImage* out;
+    CvRect area;
+    HSVPixel color;
+    int limit;
+    int num_bands;
+} HSVThresholdJob;
+
+static float Pixel_dist_hsv(HSVPixel* px_1, HSVPixel* px_2);
+
+static int min(int a, int b);
+
+IplImage* find_target_color_hsv_roi(IplImage* frame, int hue, int saturation, int value, int min_blobsize, int dev_threshold, double precision_threshold, CvRect* roi, int decimation);
+int find_target_color_hsv_into(IplImage* frame, IplImage* out, int hue, int saturation, int value, int min_blobsize, int dev_threshold, double precision_threshold, CvRect* roi, int decimation);
+int find_target_color_hsv_level(IplImage* level, IplImage* out, int hue, int saturation, int value, int min_blobsize, int dev_threshold, double precision_threshold, int scale);
+int find_target_color_hsv_level_limit(IplImage* level, IplImage* out, int hue, int saturation, int value, int min_blobsize, int dev_threshold, double precision_threshold, int scale, int* r_limit);
+int find_target_color_hsv_rect(IplImage* frame, IplImage* out, int hue, int saturation, int value, int limit, CvRect area);
+static int color_limit(IplImage* samples, int sample_weight, HSVPixel* target, int min_blobsize, int dev_threshold, double precision_threshold);
+static void histogram_band(void* job, int band);
+static void threshold_rect(IplImage* in, IplImage* out, CvRect area, HSVPixel* color, int rlimit);
+static void threshold_band(void* job, int band);
+PIXEL_INLINE void threshold_row(const uint8_t* restrict in, uint8_t* restrict out, int n, int hue, int saturation, int value, int limit);
+static CvRect threshold_area(IplImage* frame, CvRect* roi);
 
-int min(int a, int b);
- 
 IplImage* find_target_color_hsv(IplImage* frame, int hue, int saturation, int value, int min_blobsize, int dev_threshold, double precision_threshold){ //should find the set of colors closest to the target color
-    int i,j,s;
-    int* radii; //holds the accumulation for all possible distances from target pixel
-    int blobsize = 0; //current number of pixels found in color "blob" (not necceserily a single blob)
-    int rlimit=0; // stddev; //the computed maximum allowable stddev
-    int raverage; //the average stddev from target color
-    int smallestr; //the smallest stddev found
-    double imgAverage_h=0; //hold average colors for this image as doubles
-    double imgAverage_s=0;
-    double imgAverage_v=0;
-    HSVPixel imgAverage;
-    HSVPixel tempPixel;
-   
-    //Initialize Images  
+    return find_target_color_hsv_roi(frame, hue, saturation, value, min_blobsize, dev_threshold, precision_threshold, NULL, 1);
+}
+
+/**
+ * \brief ROI restricted and decimated version of find_target_color_hsv()
+ *
+ * Only the pixels that are actually looked at are converted to HSV.  The
+ * color distance histogram is built from a grid sampling every decimation'th
+ * pixel of every decimation'th row of the whole frame, with each sample
+ * counted decimation^2 times so min_blobsize keeps its full resolution
+ * meaning.  Thresholding is then done at full resolution, but only inside roi
+ * grown by ROI_MARGIN pixels on each side.  The output is always the size of
+ * frame and is black outside of that area.
+ *
+ * \param roi Region to threshold, or NULL to threshold the whole frame
+ * \param decimation Histogram sampling step.  1 samples every pixel.
+ */
+IplImage* find_target_color_hsv_roi(IplImage* frame, int hue, int saturation, int value, int min_blobsize, int dev_threshold, double precision_threshold, CvRect* roi, int decimation){
     IplImage* out = cvCreateImage(cvGetSize(frame),8,1);
-    IplImage* in = cvCreateImage(cvGetSize(frame),8,3);
-    cvCvtColor(frame, in, CV_BGR2HSV);
+    find_target_color_hsv_into(frame, out, hue, saturation, value, min_blobsize, dev_threshold, precision_threshold, roi, decimation);
+    return out;
+}
+
+/**
+ * \brief find_target_color_hsv_roi() writing into a caller provided image
+ *
+ * Nothing is allocated for the output, so a caller processing a stream of
+ * frames can keep reusing the same output image.
+ *
+ * \param out 8 bit, single channel image the same size as frame
+ * \return 0 on success, -1 if out does not match frame
+ */
+int find_target_color_hsv_into(IplImage* frame, IplImage* out, int hue, int saturation, int value, int min_blobsize, int dev_threshold, double precision_threshold, CvRect* roi, int decimation){
+    if(out->width != frame->width || out->height != frame->height ||
+       out->nChannels != 1 || out->depth != IPL_DEPTH_8U) {
+        printf("Error: find_target_color_hsv output must be an 8 bit single channel image the size of the frame.\n");
+        return -1;
+    }
 
-    uchar* ptrIn = (uchar*) in->imageData;
-    uchar* ptrOut = (uchar*) out->imageData;
+    int x,y;
+   
+    if(decimation < 1) decimation = 1;
+
+    //Initialize Images.  samples holds the histogram grid and in holds the
+    //thresholded area, both converted to HSV.
+    CvRect area = threshold_area(frame, roi);
+    IplImage* samples = cvCreateImage(cvSize((frame->width + decimation - 1) / decimation,
+                                             (frame->height + decimation - 1) / decimation), 8, 3);
+    IplImage* in = cvCreateImage(cvSize(area.width, area.height),8,3);
+
+    if(decimation == 1){
+        cvCopy(frame, samples, NULL);
+    }else{
+        for(y = 0; y < samples->height; y++){
+            uchar* src = (uchar*) (frame->imageData + y * decimation * frame->widthStep);
+            uchar* dst = (uchar*) (samples->imageData + y * samples->widthStep);
+            for(x = 0; x < samples->width; x++){
+                dst[3*x+0] = src[3*decimation*x+0];
+                dst[3*x+1] = src[3*decimation*x+1];
+                dst[3*x+2] = src[3*decimation*x+2];
+            }
+        }
+    }
+    cvCvtColor(samples, samples, CV_BGR2HSV);
+
+    if(area.width > 0 && area.height > 0){
+        cvSetImageROI(frame, area);
+        cvCvtColor(frame, in, CV_BGR2HSV);
+        cvResetImageROI(frame);
+    }
    
     //Compile target color 
     HSVPixel color; 
@@ -96,42 +188,165 @@ IplImage* find_target_color_hsv(IplImage* frame, int hue, int saturation, int va
 	color.s = saturation;
 	color.v = value;
 
+    int rlimit = color_limit(samples, decimation * decimation, &color, min_blobsize, dev_threshold, precision_threshold);
+
+    //Update the Output Image, only looking inside the thresholded area
+    if(roi) cvSetZero(out);
+    threshold_rect(in, out, area, &color, rlimit);
+
+    cvReleaseImage(&in);
+    cvReleaseImage(&samples);
+
+    return 0;
+}
+
+/**
+ * \brief find_target_color_hsv() on a subsampled copy of a frame
+ *
+ * level must hold every scale'th pixel of every scale'th row of the frame,
+ * starting at the top left pixel.  Each of its pixels is counted scale^2
+ * times in the histogram, so the color limit is exactly the one
+ * find_target_color_hsv_roi() finds with a decimation of scale, and
+ * min_blobsize is still in full resolution pixels.  The whole level is
+ * thresholded.
+ *
+ * \param out 8 bit, single channel image the same size as level
+ * \return 0 on success, -1 if out does not match level
+ */
+int find_target_color_hsv_level(IplImage* level, IplImage* out, int hue, int saturation, int value, int min_blobsize, int dev_threshold, double precision_threshold, int scale){
+    return find_target_color_hsv_level_limit(level, out, hue, saturation, value, min_blobsize, dev_threshold, precision_threshold, scale, NULL);
+}
+
+/**
+ * \brief find_target_color_hsv_level(), also giving the color limit used
+ *
+ * Lets a caller that thresholds more parts of the same frame build the
+ * histogram only once, and threshold each part with
+ * find_target_color_hsv_rect().
+ *
+ * \param r_limit Where the color limit is stored, or NULL
+ */
+int find_target_color_hsv_level_limit(IplImage* level, IplImage* out, int hue, int saturation, int value, int min_blobsize, int dev_threshold, double precision_threshold, int scale, int* r_limit){
+    if(out->width != level->width || out->height != level->height ||
+       out->nChannels != 1 || out->depth != IPL_DEPTH_8U) {
+        printf("Error: find_target_color_hsv output must be an 8 bit single channel image the size of the level.\n");
+        return -1;
+    }
+
+    if(scale < 1) scale = 1;
+
+    IplImage* in = cvCreateImage(cvGetSize(level),8,3);
+    cvCvtColor(level, in, CV_BGR2HSV);
+
+    HSVPixel color;
+    color.h = hue;
+    color.s = saturation;
+    color.v = value;
+
+    int rlimit = color_limit(in, scale * scale, &color, min_blobsize, dev_threshold, precision_threshold);
+    threshold_rect(in, out, cvRect(0, 0, level->width, level->height), &color, rlimit);
+
+    cvReleaseImage(&in);
+
+    if(r_limit) *r_limit = rlimit;
+
+    return 0;
+}
+
+/**
+ * \brief thresholds only area of frame, with a limit from find_target_color_hsv_level_limit()
+ *
+ * area is clipped to the frame, and only it is converted to HSV.  Pixels of
+ * out outside of it are left as they are.
+ *
+ * \param out 8 bit, single channel image the same size as frame
+ * \return 0 on success, -1 if out does not match frame
+ */
+int find_target_color_hsv_rect(IplImage* frame, IplImage* out, int hue, int saturation, int value, int limit, CvRect area){
+    if(out->width != frame->width || out->height != frame->height ||
+       out->nChannels != 1 || out->depth != IPL_DEPTH_8U) {
+        printf("Error: find_target_color_hsv output must be an 8 bit single channel image the size of the frame.\n");
+        return -1;
+    }
+
+    int x0 = area.x < 0 ? 0 : area.x;
+    int y0 = area.y < 0 ? 0 : area.y;
+    int x1 = area.x + area.width > frame->width ? frame->width : area.x + area.width;
+    int y1 = area.y + area.height > frame->height ? frame->height : area.y + area.height;
+    if(x1 <= x0 || y1 <= y0) return 0;
+    area = cvRect(x0, y0, x1 - x0, y1 - y0);
+
+    IplImage* in = cvCreateImage(cvSize(area.width, area.height),8,3);
+    cvSetImageROI(frame, area);
+    cvCvtColor(frame, in, CV_BGR2HSV);
+    cvResetImageROI(frame);
+
+    HSVPixel color;
+    color.h = hue;
+    color.s = saturation;
+    color.v = value;
+
+    threshold_rect(in, out, area, &color, limit);
+
+    cvReleaseImage(&in);
+
+    return 0;
+}
+
+/**
+ * \brief the color distance below which a pixel is taken to be the target color
+ *
+ * The histogram is built from every pixel of samples, an HSV image, each
+ * counted sample_weight times.
+ * \private
+ */
+static int color_limit(IplImage* samples, int sample_weight, HSVPixel* target, int min_blobsize, int dev_threshold, double precision_threshold){
+    int i,b;
+    int* radii; //holds the accumulation for all possible distances from target pixel
+    int rlimit=0; // stddev; //the computed maximum allowable stddev
+    int smallestr; //the smallest stddev found
+    HSVPixel color = *target;
+    HSVHistogramJob job;
+
     int maxr = (int) sqrt(pow((short)256*HUE_WEIGHT,2)+
                         pow((short)256*SAT_WEIGHT,2)+
                         pow((short)256*VAL_WEIGHT,2));
     // It's easiest if maxr is always even
     if((double) maxr/2 != maxr/2) maxr++;
 
-    radii = (int*)calloc(maxr,sizeof(int));
-
-    // Initialize tables
-    for (i=0;i<maxr;i++) {
-        radii[i] = 0;
+    //Fill the accumulator table / histogram from the sample grid, one
+    //histogram per band of rows, then add the bands up in order.  Each
+    //sample stands in for sample_weight pixels of the full frame.
+    job.samples = samples;
+    job.sample_weight = sample_weight;
+    job.color = color;
+    job.maxr = maxr;
+    job.num_bands = pool_bands(samples->height, MIN_BAND_ROWS);
+    radii = (int*)calloc(job.num_bands * maxr,sizeof(int));
+    for(b = 0; b < job.num_bands; b++){
+        job.bands[b].radii = radii + b * maxr;
     }
+    pool_run(histogram_band, &job, job.num_bands);
 
-
-    //Fill the accumulator table / histogram
     smallestr = maxr;
+    for(b = 0; b < job.num_bands; b++){
+        HSVHistogramBand* band = &job.bands[b];
+        if(b > 0){
+            for(i = 0; i < maxr; i++){
+                radii[i] += band->radii[i];
+            }
+        }
+        if(band->smallestr < smallestr) smallestr = band->smallestr;
+    }
     int peakr = 0;
-    for(i=in->width*in->height; i>=0;i--){  
-        tempPixel.v = ptrIn[3*i+2];
-        tempPixel.h = ptrIn[3*i+0];
-        tempPixel.s = ptrIn[3*i+1];
-        s = (int)Pixel_dist_hsv(&color, &tempPixel); 
-        radii[s]++;
-        if(radii[s] > peakr) peakr = radii[s]; 
-        if(s < smallestr) smallestr = s;
-
-        // Update the average color
-        imgAverage_h = (imgAverage_h*(i)+tempPixel.h)/(i+1);
-        imgAverage_s = (imgAverage_s*(i)+tempPixel.s)/(i+1);
-        imgAverage_v = (imgAverage_v*(i)+tempPixel.v)/(i+1); 
+    for(i = 0; i < maxr; i++){
+        if(radii[i] > peakr) peakr = radii[i];
     }
 
     #ifdef VISUAL_DEBUG
         CvSize histsize = {maxr,300};
         IplImage* rgram = cvCreateImage(histsize, 8, 1);
-        uchar* histdata = rgram->imageData;
+        uchar* histdata = (uchar*) rgram->imageData;
 
         for(i=0; i<maxr; i++){
             int j;
@@ -144,16 +359,8 @@ IplImage* find_target_color_hsv(IplImage* frame, int hue, int saturation, int va
         }
     #endif
 
-    // Update the imgAverage pixel (converting all averages to integers)
-    imgAverage.h = (int)imgAverage_h;
-    imgAverage.s = (int)imgAverage_s;
-    imgAverage.v = (int)imgAverage_v;
-
-    raverage= Pixel_dist_hsv(&color,&imgAverage); 
-
     int tot_sum = 0;
     int prev_sum = 0;
-    int check1 = 0;
     rlimit = 0;
     //use a differential approach to locate the best place to draw the line
     for( i=smallestr; i<maxr && i<dev_threshold; i+=3){
@@ -170,40 +377,139 @@ IplImage* find_target_color_hsv(IplImage* frame, int hue, int saturation, int va
         //Draw a line representing the selected distance cut-off
         CvPoint pt1 = {rlimit,0};
         CvPoint pt2 = {rlimit,299};
-        CvScalar cutoffline_color = {254,254,254};
+        CvScalar cutoffline_color = {{254,254,254}};
         cvLine(rgram,pt1,pt2,cutoffline_color,1,8,0);
 
         cvNamedWindow("Rgram", CV_WINDOW_AUTOSIZE);
         cvShowImage("Rgram", rgram);
     #endif
 
-    for(i=in->width*in->height-1;i>=0;i--){ //Update the Output Image
-        tempPixel.v = ptrIn[3*i+2];
-        tempPixel.h = ptrIn[3*i+0];
-        tempPixel.s = ptrIn[3*i+1];
-        if((int)Pixel_dist_hsv(&color,&tempPixel) < rlimit){
-            // This pixel is "close" to the target color, mark it white
-            ptrOut[i] = 0xff;
-        } else {
-            // This pixel is not "close" to the target color: mark it black
-            ptrOut[i] = 0x00;
-        } 
-    }
-
     free(radii);
-    cvReleaseImage(&in);
     #ifdef VISUAL_DEBUG
         cvReleaseImage(&rgram);
     #endif
 
-    return out;
+    return rlimit;
+}
+
+/**
+ * \brief color_limit() histogram of one band of the sample rows
+ * \private
+ */
+static void histogram_band(void* _job, int b){
+    HSVHistogramJob* job = _job;
+    HSVHistogramBand* band = &job->bands[b];
+    int y_0 = pool_band_start(job->samples->height, job->num_bands, b);
+    int y_1 = pool_band_start(job->samples->height, job->num_bands, b + 1);
+    HSVPixel tempPixel;
+    uchar* ptrIn;
+    int x,y,s;
+
+    band->smallestr = job->maxr;
+
+    for(y = y_0; y < y_1; y++){
+        ptrIn = (uchar*) (job->samples->imageData + y * job->samples->widthStep);
+        for(x = 0; x < job->samples->width; x++){
+            tempPixel.v = ptrIn[3*x+2];
+            tempPixel.h = ptrIn[3*x+0];
+            tempPixel.s = ptrIn[3*x+1];
+            s = (int)Pixel_dist_hsv(&job->color, &tempPixel); 
+            band->radii[s] += job->sample_weight;
+            if(s < band->smallestr) band->smallestr = s;
+        }
+    }
+}
+
+/**
+ * \brief marks the pixels of area closer than rlimit to color white in out, the rest black
+ *
+ * in holds the HSV pixels of area, starting at its top left corner.  As in
+ * target_color_rgb.c, the squared distance is compared to rlimit^2, and large
+ * areas are split into bands of rows on the thread pool.
+ * \private
+ */
+static void threshold_rect(IplImage* in, IplImage* out, CvRect area, HSVPixel* color, int rlimit){
+    HSVThresholdJob job;
+
+    job.in = in;
+    job.out = out;
+    job.area = area;
+    job.color = *color;
+    job.limit = rlimit > 0 ? rlimit * rlimit : 0;
+    job.num_bands = pool_bands(area.height, MIN_BAND_ROWS);
+    pool_run(threshold_band, &job, job.num_bands);
+}
+
+/**
+ * \brief threshold_rect() over one band of rows of the area
+ * \private
+ */
+static void threshold_band(void* _job, int b){
+    HSVThresholdJob* job = _job;
+    int y_0 = pool_band_start(job->area.height, job->num_bands, b);
+    int y_1 = pool_band_start(job->area.height, job->num_bands, b + 1);
+    CvRect in_band = cvRect(0, y_0, job->area.width, y_1 - y_0);
+    PixelSpans spans = pixel_spans(job->in, NULL, in_band);
+    int i;
+
+    // in and out only line up as one span if area is all of out
+    if(job->area.width != job->out->width || !pixel_contiguous(job->out)){
+        spans.count = in_band.height;
+        spans.length = in_band.width;
+    }
+
+    for(i = 0; i < spans.count; i++){
+        threshold_row(pixel_at(job->in, 0, y_0 + i), pixel_at(job->out, job->area.x, job->area.y + y_0 + i),
+                      spans.length, job->color.h, job->color.s, job->color.v, job->limit);
+    }
+}
+
+/**
+ * \brief threshold_rect() kernel over n contiguous HSV pixels
+ * \private
+ */
+PIXEL_INLINE void threshold_row(const uint8_t* restrict in, uint8_t* restrict out, int n, int hue, int saturation, int value, int limit){
+    int x;
+
+    for(x = 0; x < n; x++){
+        int h_0 = abs(in[3*x+0] - hue);
+        int h_1 = abs(in[3*x+0] + hue - 179);
+        int h = (h_0 < h_1 ? h_0 : h_1) * HUE_WEIGHT;
+        int s = (in[3*x+1] - saturation) * SAT_WEIGHT;
+        int v = (in[3*x+2] - value) * VAL_WEIGHT;
+        out[x] = (h*h + s*s + v*v < limit) ? 0xff : 0x00;
+    }
+}
+
+/**
+ * \brief the part of frame covered by roi plus ROI_MARGIN, clipped to the frame
+ * \private
+ */
+static CvRect threshold_area(IplImage* frame, CvRect* roi) {
+    if(roi == NULL) {
+        return cvRect(0, 0, frame->width, frame->height);
+    }
+
+    int x0 = roi->x - ROI_MARGIN;
+    int y0 = roi->y - ROI_MARGIN;
+    int x1 = roi->x + roi->width + ROI_MARGIN;
+    int y1 = roi->y + roi->height + ROI_MARGIN;
+
+    if(x0 < 0) x0 = 0;
+    if(y0 < 0) y0 = 0;
+    if(x1 > frame->width) x1 = frame->width;
+    if(y1 > frame->height) y1 = frame->height;
+    if(x1 < x0) x1 = x0;
+    if(y1 < y0) y1 = y0;
+
+    return cvRect(x0, y0, x1 - x0, y1 - y0);
 }
 
 /**
  * \brief computes distance between two pixels in rgb space
  * \private
  */
-float Pixel_dist_hsv(HSVPixel* px_1, HSVPixel* px_2) {
+static float Pixel_dist_hsv(HSVPixel* px_1, HSVPixel* px_2) {
     int hue = min(abs(px_1->h - px_2->h), abs(px_1->h + px_2->h - 179) );
     int sat = px_1->s - px_2->s;
     int val = px_1->v - px_2->v;
@@ -212,7 +518,7 @@ float Pixel_dist_hsv(HSVPixel* px_1, HSVPixel* px_2) {
                 pow((short)val * VAL_WEIGHT, 2));
 }
 
-int min(int a, int b) {
+static int min(int a, int b) {
     int min;
     if (a < b ) 
 	min = a;
@@ -16,6 +16,9 @@
 #include <highgui.h>  
 #include <math.h>
 
+#include "pixel.h"
+#include "common/pool.h"
+
 /** 
  * \ingroup colortools
  * \{
@@ -59,6 +62,8 @@
 #define REL_SEPARATION_THRESHOLD .2 //how low the histogram must drop relative to current peak
 #define ABS_SEPARATION_THRESHOLD 100 //how absolutely low the histogram must drop in order to consider a blob 'isolated' 
 #define STDDEV_THRESHOLD 40 //required stddev of histogram to accept a blob
+#define ROI_MARGIN 16 //pixels thresholded around a given roi
+#define MIN_BAND_ROWS 32 //fewest rows in a band of work for the thread pool
 
 struct RGBPixel_s {
     unsigned char r;
@@ -68,14 +73,201 @@ struct RGBPixel_s {
 
 typedef struct RGBPixel_s RGBPixel; 
 
-float Pixel_dist_rgb(RGBPixel* px_1, RGBPixel* px_2);
+//histogram of the color distances of one band of sample rows
+typedef struct RGBHistogramBand_s {
+    int* radii;
+    int smallestr;
+    double sum_r;
+    double sum_g;
+    double sum_b;
+    int count;
+} RGBHistogramBand;
+
+typedef struct RGBHistogramJob_s {
+    IplImage* frame;
+    int step;
+    int sample_weight;
+    RGBPixel color;
+    int maxr;
+    int sample_rows;
+    int num_bands;
+    RGBHistogramBand bands[POOL_MAX_BANDS];
+} RGBHistogramJob;
+
+typedef struct RGBThresholdJob_s {
+    IplImage* frame;
+    IplImage* out;
+    CvRect area;
+    RGBPixel color;
+    int limit;
+    int num_bands;
+} RGBThresholdJob;
+
+static float Pixel_dist_rgb(RGBPixel* px_1, RGBPixel* px_2);
+
+static int min(int a, int b);
+
+IplImage* find_target_color_rgb_roi(IplImage* frame, int red, int green, int blue, int min_blobsize, int dev_threshold, double precision_threshold, CvRect* roi, int decimation);
+int find_target_color_rgb_into(IplImage* frame, IplImage* out, int red, int green, int blue, int min_blobsize, int dev_threshold, double precision_threshold, CvRect* roi, int decimation);
+int find_target_color_rgb_level(IplImage* level, IplImage* out, int red, int green, int blue, int min_blobsize, int dev_threshold, double precision_threshold, int scale);
+int find_target_color_rgb_level_limit(IplImage* level, IplImage* out, int red, int green, int blue, int min_blobsize, int dev_threshold, double precision_threshold, int scale, int* r_limit);
+int find_target_color_rgb_rect(IplImage* frame, IplImage* out, int red, int green, int blue, int limit, CvRect area);
+static int color_limit(IplImage* frame, int step, int sample_weight, RGBPixel* target, int min_blobsize, int dev_threshold, double precision_threshold);
+static void histogram_band(void* job, int band);
+static void threshold_rect(IplImage* frame, IplImage* out, CvRect area, RGBPixel* color, int rlimit);
+static void threshold_band(void* job, int band);
+PIXEL_INLINE void threshold_row(const uint8_t* restrict in, uint8_t* restrict out, int n, int red, int green, int blue, int limit);
+static CvRect threshold_area(IplImage* frame, CvRect* roi);
 
-int min(int a, int b);
- 
 IplImage* find_target_color_rgb(IplImage* frame, int red, int green, int blue, int min_blobsize, int dev_threshold, double precision_threshold){ //should find the set of colors closest to the target color
-    int i,j,s;
+    return find_target_color_rgb_roi(frame, red, green, blue, min_blobsize, dev_threshold, precision_threshold, NULL, 1);
+}
+
+/**
+ * \brief ROI restricted and decimated version of find_target_color_rgb()
+ *
+ * The color distance histogram is built from a grid sampling every
+ * decimation'th pixel of every decimation'th row of the whole frame.  Each
+ * sample is counted decimation^2 times so min_blobsize and the separation
+ * thresholds keep their full resolution meaning.  Thresholding is then done
+ * at full resolution, but only inside roi grown by ROI_MARGIN pixels on each
+ * side.  Everything outside of that area is black in the output, which is
+ * always the size of frame so coordinates found in it are full frame
+ * coordinates.
+ *
+ * \param roi Region to threshold, or NULL to threshold the whole frame
+ * \param decimation Histogram sampling step.  1 samples every pixel.
+ */
+IplImage* find_target_color_rgb_roi(IplImage* frame, int red, int green, int blue, int min_blobsize, int dev_threshold, double precision_threshold, CvRect* roi, int decimation){
+    IplImage* out = cvCreateImage(cvGetSize(frame),8,1);
+    find_target_color_rgb_into(frame, out, red, green, blue, min_blobsize, dev_threshold, precision_threshold, roi, decimation);
+    return out;
+}
+
+/**
+ * \brief find_target_color_rgb_roi() writing into a caller provided image
+ *
+ * Nothing is allocated for the output, so a caller processing a stream of
+ * frames can keep reusing the same output image.
+ *
+ * \param out 8 bit, single channel image the same size as frame
+ * \return 0 on success, -1 if out does not match frame
+ */
+int find_target_color_rgb_into(IplImage* frame, IplImage* out, int red, int green, int blue, int min_blobsize, int dev_threshold, double precision_threshold, CvRect* roi, int decimation){
+    if(out->width != frame->width || out->height != frame->height ||
+       out->nChannels != 1 || out->depth != IPL_DEPTH_8U) {
+        printf("Error: find_target_color_rgb output must be an 8 bit single channel image the size of the frame.\n");
+        return -1;
+    }
+
+    if(decimation < 1) decimation = 1;
+
+    //Compile target color
+    RGBPixel color;
+    color.r = red;
+	color.g = green;
+	color.b = blue;
+
+    int rlimit = color_limit(frame, decimation, decimation * decimation, &color, min_blobsize, dev_threshold, precision_threshold);
+
+    //Update the Output Image, only looking inside the thresholded area
+    CvRect area = threshold_area(frame, roi);
+    if(roi) cvSetZero(out);
+    threshold_rect(frame, out, area, &color, rlimit);
+
+    return 0;
+}
+
+/**
+ * \brief find_target_color_rgb() on a subsampled copy of a frame
+ *
+ * level must hold every scale'th pixel of every scale'th row of the frame,
+ * starting at the top left pixel.  Each of its pixels is counted scale^2
+ * times in the histogram, so the histogram and the color limit are exactly
+ * those find_target_color_rgb_roi() finds with a decimation of scale, and
+ * min_blobsize is still in full resolution pixels.  The whole level is
+ * thresholded.
+ *
+ * \param out 8 bit, single channel image the same size as level
+ * \return 0 on success, -1 if out does not match level
+ */
+int find_target_color_rgb_level(IplImage* level, IplImage* out, int red, int green, int blue, int min_blobsize, int dev_threshold, double precision_threshold, int scale){
+    return find_target_color_rgb_level_limit(level, out, red, green, blue, min_blobsize, dev_threshold, precision_threshold, scale, NULL);
+}
+
+/**
+ * \brief find_target_color_rgb_level(), also giving the color limit used
+ *
+ * Lets a caller that thresholds more parts of the same frame build the
+ * histogram only once, and threshold each part with
+ * find_target_color_rgb_rect().
+ *
+ * \param r_limit Where the color limit is stored, or NULL
+ */
+int find_target_color_rgb_level_limit(IplImage* level, IplImage* out, int red, int green, int blue, int min_blobsize, int dev_threshold, double precision_threshold, int scale, int* r_limit){
+    if(out->width != level->width || out->height != level->height ||
+       out->nChannels != 1 || out->depth != IPL_DEPTH_8U) {
+        printf("Error: find_target_color_rgb output must be an 8 bit single channel image the size of the level.\n");
+        return -1;
+    }
+
+    if(scale < 1) scale = 1;
+
+    RGBPixel color;
+    color.r = red;
+    color.g = green;
+    color.b = blue;
+
+    int rlimit = color_limit(level, 1, scale * scale, &color, min_blobsize, dev_threshold, precision_threshold);
+    threshold_rect(level, out, cvRect(0, 0, level->width, level->height), &color, rlimit);
+
+    if(r_limit) *r_limit = rlimit;
+
+    return 0;
+}
+
+/**
+ * \brief thresholds only area of frame, with a limit from find_target_color_rgb_level_limit()
+ *
+ * area is clipped to the frame.  Pixels of out outside of it are left as they
+ * are.
+ *
+ * \param out 8 bit, single channel image the same size as frame
+ * \return 0 on success, -1 if out does not match frame
+ */
+int find_target_color_rgb_rect(IplImage* frame, IplImage* out, int red, int green, int blue, int limit, CvRect area){
+    if(out->width != frame->width || out->height != frame->height ||
+       out->nChannels != 1 || out->depth != IPL_DEPTH_8U) {
+        printf("Error: find_target_color_rgb output must be an 8 bit single channel image the size of the frame.\n");
+        return -1;
+    }
+
+    int x0 = area.x < 0 ? 0 : area.x;
+    int y0 = area.y < 0 ? 0 : area.y;
+    int x1 = area.x + area.width > frame->width ? frame->width : area.x + area.width;
+    int y1 = area.y + area.height > frame->height ? frame->height : area.y + area.height;
+    if(x1 <= x0 || y1 <= y0) return 0;
+
+    RGBPixel color;
+    color.r = red;
+    color.g = green;
+    color.b = blue;
+
+    threshold_rect(frame, out, cvRect(x0, y0, x1 - x0, y1 - y0), &color, limit);
+
+    return 0;
+}
+
+/**
+ * \brief the color distance below which a pixel is taken to be the target color
+ *
+ * The histogram is built from every step'th pixel of every step'th row of
+ * frame, each counted sample_weight times.
+ * \private
+ */
+static int color_limit(IplImage* frame, int step, int sample_weight, RGBPixel* target, int min_blobsize, int dev_threshold, double precision_threshold){
+    int i,b;
     int* radii; //holds the accumulation for all possible distances from target pixel
-    int blobsize = 0; //current number of pixels found in color "blob" (not necceserily a single blob)
     int rlimit=0; // stddev; //the computed maximum allowable stddev
     int raverage; //the average stddev from target color
     int smallestr; //the smallest stddev found
@@ -85,20 +277,8 @@ IplImage* find_target_color_rgb(IplImage* frame, int red, int green, int blue, i
     double variance = 0; //the variance of the histogram
     int sample_size = 0; //the sample used to compute variance
     RGBPixel imgAverage;
-    RGBPixel tempPixel;
-   
-    //Initialize Images
-    IplImage* out = cvCreateImage(cvGetSize(frame),8,1);
-    IplImage* in = cvCloneImage(frame);
-
-    uchar* ptrIn = (uchar*) in->imageData;
-    uchar* ptrOut = (uchar*) out->imageData;
-   
-    //Compile target color
-    RGBPixel color;
-    color.r = red;
-	color.g = green;
-	color.b = blue;
+    RGBPixel color = *target;
+    RGBHistogramJob job;
 
     int maxr = (int) sqrt(pow((short)256*RED_WEIGHT,2)+
                         pow((short)256*GREEN_WEIGHT,2)+
@@ -106,30 +286,44 @@ IplImage* find_target_color_rgb(IplImage* frame, int red, int green, int blue, i
     // It's easiest if maxr is always even
     if((double) maxr/2 != maxr/2) maxr++;
 
-    radii = (int*)calloc(maxr,sizeof(int));
-
-    // Initialize tables
-    for (i=0;i<maxr;i++) {
-        radii[i] = 0;
+    //Fill the accumulator table / histogram from the sample grid, one
+    //histogram per band of sample rows, then add the bands up in order.
+    //Each sample stands in for sample_weight pixels of the full frame.
+    job.frame = frame;
+    job.step = step;
+    job.sample_weight = sample_weight;
+    job.color = color;
+    job.maxr = maxr;
+    job.sample_rows = (frame->height + step - 1) / step;
+    job.num_bands = pool_bands(job.sample_rows, MIN_BAND_ROWS);
+    radii = (int*)calloc(job.num_bands * maxr,sizeof(int));
+    for(b = 0; b < job.num_bands; b++){
+        job.bands[b].radii = radii + b * maxr;
     }
+    pool_run(histogram_band, &job, job.num_bands);
 
-    //Fill the accumulator table / histogram
+    int sample_count = 0;
     smallestr = maxr;
+    for(b = 0; b < job.num_bands; b++){
+        RGBHistogramBand* band = &job.bands[b];
+        if(b > 0){
+            for(i = 0; i < maxr; i++){
+                radii[i] += band->radii[i];
+            }
+        }
+        if(band->smallestr < smallestr) smallestr = band->smallestr;
+        imgAverage_r += band->sum_r;
+        imgAverage_g += band->sum_g;
+        imgAverage_b += band->sum_b;
+        sample_count += band->count;
+    }
     int peakr = 0;
-    for(i=in->width*in->height; i>=0;i--){  
-        tempPixel.r = ptrIn[3*i+2];
-        tempPixel.g = ptrIn[3*i+1];
-        tempPixel.b = ptrIn[3*i+0];
-        s = (int)Pixel_dist_rgb(&color, &tempPixel); 
-        radii[s]++;
-        if(radii[s] > peakr) peakr = radii[s]; 
-        if(s < smallestr) smallestr = s;
-
-        // Update the average color
-        imgAverage_r = (imgAverage_r*(i)+tempPixel.r)/(i+1);
-        imgAverage_g = (imgAverage_g*(i)+tempPixel.g)/(i+1);
-        imgAverage_b = (imgAverage_b*(i)+tempPixel.b)/(i+1); 
+    for(i = 0; i < maxr; i++){
+        if(radii[i] > peakr) peakr = radii[i];
     }
+    imgAverage_r /= sample_count;
+    imgAverage_g /= sample_count;
+    imgAverage_b /= sample_count;
 
     #ifdef VISUAL_DEBUG
         CvSize histsize = {maxr,300};
@@ -246,33 +440,134 @@ IplImage* find_target_color_rgb(IplImage* frame, int red, int green, int blue, i
         cvShowImage("Rgram", rgram);
     #endif
 
-    for(i=in->width*in->height-1;i>=0;i--){ //Update the Output Image
-        tempPixel.r = ptrIn[3*i+2];
-        tempPixel.g = ptrIn[3*i+1];
-        tempPixel.b = ptrIn[3*i+0];
-        if((int)Pixel_dist_rgb(&color,&tempPixel) < rlimit){
-            // This pixel is "close" to the target color, mark it white
-            ptrOut[i] = 0xff;
-        } else {
-            // This pixel is not "close" to the target color: mark it black
-            ptrOut[i] = 0x00;
-        } 
-    }
-
     free(radii);
-    cvReleaseImage(&in);
     #ifdef VISUAL_DEBUG
         cvReleaseImage(&rgram);
     #endif
 
-    return out;
+    return rlimit;
+}
+
+/**
+ * \brief color_limit() histogram of one band of the sample rows
+ * \private
+ */
+static void histogram_band(void* _job, int b){
+    RGBHistogramJob* job = _job;
+    RGBHistogramBand* band = &job->bands[b];
+    int row_0 = pool_band_start(job->sample_rows, job->num_bands, b);
+    int row_1 = pool_band_start(job->sample_rows, job->num_bands, b + 1);
+    RGBPixel tempPixel;
+    uchar* ptrIn;
+    int row,x,s;
+
+    band->smallestr = job->maxr;
+    band->sum_r = 0;
+    band->sum_g = 0;
+    band->sum_b = 0;
+    band->count = 0;
+
+    for(row = row_0; row < row_1; row++){
+        ptrIn = (uchar*) (job->frame->imageData + row * job->step * job->frame->widthStep);
+        for(x = 0; x < job->frame->width; x += job->step){
+            tempPixel.r = ptrIn[3*x+2];
+            tempPixel.g = ptrIn[3*x+1];
+            tempPixel.b = ptrIn[3*x+0];
+            s = (int)Pixel_dist_rgb(&job->color, &tempPixel); 
+            band->radii[s] += job->sample_weight;
+            if(s < band->smallestr) band->smallestr = s;
+
+            // Accumulate the average color
+            band->sum_r += tempPixel.r;
+            band->sum_g += tempPixel.g;
+            band->sum_b += tempPixel.b;
+            band->count++;
+        }
+    }
+}
+
+/**
+ * \brief marks the pixels of area closer than rlimit to color white in out, the rest black
+ *
+ * (int)Pixel_dist_rgb(...) < rlimit is the same test as comparing the squared
+ * distance to rlimit^2, which needs no square root and lets the row loop be
+ * vectorized.  Large areas are split into bands of rows on the thread pool.
+ * \private
+ */
+static void threshold_rect(IplImage* frame, IplImage* out, CvRect area, RGBPixel* color, int rlimit){
+    RGBThresholdJob job;
+
+    job.frame = frame;
+    job.out = out;
+    job.area = area;
+    job.color = *color;
+    job.limit = rlimit > 0 ? rlimit * rlimit : 0;
+    job.num_bands = pool_bands(area.height, MIN_BAND_ROWS);
+    pool_run(threshold_band, &job, job.num_bands);
+}
+
+/**
+ * \brief threshold_rect() over one band of rows of the area
+ * \private
+ */
+static void threshold_band(void* _job, int b){
+    RGBThresholdJob* job = _job;
+    int y_0 = pool_band_start(job->area.height, job->num_bands, b);
+    int y_1 = pool_band_start(job->area.height, job->num_bands, b + 1);
+    CvRect band = cvRect(job->area.x, job->area.y + y_0, job->area.width, y_1 - y_0);
+    PixelSpans spans = pixel_spans(job->frame, job->out, band);
+    int i;
+
+    for(i = 0; i < spans.count; i++){
+        threshold_row(pixel_at(job->frame, band.x, band.y + i), pixel_at(job->out, band.x, band.y + i),
+                      spans.length, job->color.r, job->color.g, job->color.b, job->limit);
+    }
+}
+
+/**
+ * \brief threshold_rect() kernel over n contiguous BGR pixels
+ * \private
+ */
+PIXEL_INLINE void threshold_row(const uint8_t* restrict in, uint8_t* restrict out, int n, int red, int green, int blue, int limit){
+    int x;
+
+    for(x = 0; x < n; x++){
+        int r = (in[3*x+2] - red) * RED_WEIGHT;
+        int g = (in[3*x+1] - green) * GREEN_WEIGHT;
+        int b = (in[3*x+0] - blue) * BLUE_WEIGHT;
+        out[x] = (r*r + g*g + b*b < limit) ? 0xff : 0x00;
+    }
+}
+
+/**
+ * \brief the part of frame covered by roi plus ROI_MARGIN, clipped to the frame
+ * \private
+ */
+static CvRect threshold_area(IplImage* frame, CvRect* roi) {
+    if(roi == NULL) {
+        return cvRect(0, 0, frame->width, frame->height);
+    }
+
+    int x0 = roi->x - ROI_MARGIN;
+    int y0 = roi->y - ROI_MARGIN;
+    int x1 = roi->x + roi->width + ROI_MARGIN;
+    int y1 = roi->y + roi->height + ROI_MARGIN;
+
+    if(x0 < 0) x0 = 0;
+    if(y0 < 0) y0 = 0;
+    if(x1 > frame->width) x1 = frame->width;
+    if(y1 > frame->height) y1 = frame->height;
+    if(x1 < x0) x1 = x0;
+    if(y1 < y0) y1 = y0;
+
+    return cvRect(x0, y0, x1 - x0, y1 - y0);
 }
 
 /**
  * \brief computes distance between two pixels in rgb space
  * \private
  */
-float Pixel_dist_rgb(RGBPixel* px_1, RGBPixel* px_2) {
+static float Pixel_dist_rgb(RGBPixel* px_1, RGBPixel* px_2) {
     int red = px_1->r - px_2->r;
     int green = px_1->g - px_2->g;
     int blue = px_1->b - px_2->b;
@@ -281,7 +576,7 @@ float Pixel_dist_rgb(RGBPixel* px_1, RGBPixel* px_2) {
                 pow((short)blue * BLUE_WEIGHT, 2));
 }
 
-int min(int a, int b) {
+static int min(int a, int b) {
     int min;
     if (a < b ) 
     min = a;
@@ -0,0 +1,625 @@
+/**
+ * \file template_tracker.c
+ * \brief Template tracking by normalized cross correlation on an image pyramid
+ *
+ * A tracker holds a template of the object and its last known center. For
+ * every frame, the search window around that center is copied out and
+ * shrunk by 2, 4, ... into a pyramid, and the template is matched in it
+ * coarse to fine:
+ *
+ *  1. At the coarsest level, the template is matched at every position of
+ *     the search window. Window sums come from integral images, so only the
+ *     dot product with the template is computed per position.
+ *  2. At each finer level, only the positions within 2 pixels of twice the
+ *     previous best are tried.
+ *
+ * Matching is by zero mean normalized cross correlation (OpenCV's
+ * CV_TM_CCOEFF_NORMED), with channel means removed separately and the
+ * channels normalized together. It doesn't depend on the brightness or
+ * contrast of the window, so frames are matched as they are, with no
+ * filtering first.
+ *
+ * A match is found when it stands out from its neighbourhood: its full
+ * resolution correlation less the best correlation on a ring of positions
+ * half a template away must be at least min_contrast. This only looks near
+ * the match, so it doesn't depend on the size of the search window, and it
+ * is in correlation units, so it doesn't depend on the size of the template
+ * either. The template is then blended with the matched window:
+ * template * (1 - alpha) + window * alpha.
+ *
+ * Every buffer belongs to the tracker and is only reallocated when it must
+ * grow, so trackers can run every frame without allocating.
+ */
+
+#include <cv.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+/* Most pyramid levels a tracker uses, counting full resolution */
+#define TRACKER_MAX_LEVELS 6
+
+/* Smallest template width or height a level may shrink it to */
+#define TRACKER_MIN_TEMPLATE 8
+
+/* Positions either side of the upscaled best match tried at finer levels */
+#define TRACKER_REFINE_RADIUS 2
+
+/* Windows with less variance than this per pixel are flat, and match
+   nothing */
+#define TRACKER_MIN_VARIANCE 1e-3
+
+/* Positions on the ring a match is compared with */
+#define TRACKER_RING_POSITIONS 16
+
+typedef struct TrackerLevel_s {
+    /* Search window at this level, channels interleaved */
+    float* search;
+    int width;
+    int height;
+    size_t capacity;
+
+    /* Template at this level with each channel's mean removed, and its norm */
+    float* template;
+    int t_width;
+    int t_height;
+    double t_norm;
+} TrackerLevel;
+
+typedef struct TemplateTracker_s {
+    int channels;
+    double alpha;
+    double min_contrast;
+
+    /* Last known center of the object, and the size of the search window
+       around it */
+    int c_x;
+    int c_y;
+    int search_width;
+    int search_height;
+
+    /* Full resolution template, as blended from the frames */
+    float* template;
+    int t_width;
+    int t_height;
+
+    int num_levels;
+    TrackerLevel levels[TRACKER_MAX_LEVELS];
+
+    /* Correlation at each position of the coarsest level */
+    float* surface;
+    size_t surface_capacity;
+
+    /* Integral images of the coarsest level: per channel sums, and sums of
+       squares over all channels */
+    double* integral;
+    double* integral_squares;
+    size_t integral_capacity;
+    size_t integral_squares_capacity;
+} TemplateTracker;
+
+/**
+ * \brief Result of one call to template_tracker_locate
+ */
+typedef struct TrackerMatch_s {
+    /* Center of the match in the frame */
+    int32_t x;
+    int32_t y;
+
+    /* Normalized correlation of the match, -1 to 1 */
+    double score;
+
+    /* score less the best correlation half a template away */
+    double contrast;
+
+    /* Nonzero if contrast reached min_contrast. The tracker only moves and
+       updates its template on a found match */
+    int32_t found;
+} TrackerMatch;
+
+TemplateTracker* template_tracker_new(IplImage* frame, int c_x, int c_y, int width, int height,
+                                      int search_width, int search_height,
+                                      double alpha, double min_contrast, int max_levels);
+int template_tracker_locate(TemplateTracker* tracker, IplImage* frame, TrackerMatch* match);
+int template_tracker_template(TemplateTracker* tracker, IplImage* out);
+void template_tracker_free(TemplateTracker* tracker);
+
+/* Grow *buffer to hold at least size elements of element_size bytes */
+static void reserve(void** buffer, size_t* capacity, size_t size, size_t element_size) {
+    if(size > *capacity) {
+        free(*buffer);
+        *buffer = malloc(size * element_size);
+        *capacity = size;
+    }
+}
+
+/* Rectangle of width x height centered on (c_x, c_y), clipped to the frame */
+static CvRect centered_rect(IplImage* frame, int c_x, int c_y, int width, int height) {
+    int x_0 = c_x - width / 2;
+    int y_0 = c_y - height / 2;
+    int x_1 = x_0 + width;
+    int y_1 = y_0 + height;
+
+    if(x_0 < 0) x_0 = 0;
+    if(y_0 < 0) y_0 = 0;
+    if(x_1 > frame->width) x_1 = frame->width;
+    if(y_1 > frame->height) y_1 = frame->height;
+
+    return cvRect(x_0, y_0, x_1 > x_0 ? x_1 - x_0 : 0, y_1 > y_0 ? y_1 - y_0 : 0);
+}
+
+/* Copy rect of frame into out as floats */
+static void copy_rect(IplImage* frame, CvRect rect, float* out) {
+    int row_length = rect.width * frame->nChannels;
+    int x, y;
+
+    for(y = 0; y < rect.height; y++) {
+        const uint8_t* in = (uint8_t*) frame->imageData + (rect.y + y) * frame->widthStep + rect.x * frame->nChannels;
+        for(x = 0; x < row_length; x++) {
+            out[x] = in[x];
+        }
+        out += row_length;
+    }
+}
+
+/* Average 2x2 squares of in into out, which is (width / 2) x (height / 2) */
+static void shrink(const float* in, int width, int height, int channels, float* out) {
+    int out_width = width / 2;
+    int out_height = height / 2;
+    int x, y, c;
+
+    for(y = 0; y < out_height; y++) {
+        const float* row_0 = in + 2 * y * width * channels;
+        const float* row_1 = row_0 + width * channels;
+        for(x = 0; x < out_width; x++) {
+            for(c = 0; c < channels; c++) {
+                int i = 2 * x * channels + c;
+                *out++ = 0.25f * (row_0[i] + row_0[i + channels] + row_1[i] + row_1[i + channels]);
+            }
+        }
+    }
+}
+
+/* Dot product, with independent partial sums so the additions don't wait on
+   each other */
+static float dot(const float* a, const float* b, int n) {
+    float sums[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    int i, k;
+
+    for(i = 0; i + 8 <= n; i += 8) {
+        for(k = 0; k < 8; k++) {
+            sums[k] += a[i + k] * b[i + k];
+        }
+    }
+    for(; i < n; i++) {
+        sums[0] += a[i] * b[i];
+    }
+    return (sums[0] + sums[1]) + (sums[2] + sums[3]) + ((sums[4] + sums[5]) + (sums[6] + sums[7]));
+}
+
+/* Build the template pyramid from the full resolution template, removing
+   the means of each level */
+static void build_template_levels(TemplateTracker* tracker) {
+    int channels = tracker->channels;
+    int l, i, c;
+
+    memcpy(tracker->levels[0].template, tracker->template,
+           tracker->t_width * tracker->t_height * channels * sizeof(float));
+
+    for(l = 0; l < tracker->num_levels; l++) {
+        TrackerLevel* level = &tracker->levels[l];
+        int n = level->t_width * level->t_height;
+        double means[4] = {0, 0, 0, 0};
+        double norm = 0;
+
+        if(l > 0) {
+            /* Shrink the previous level before its mean was removed */
+            shrink(tracker->levels[l - 1].search, tracker->levels[l - 1].t_width,
+                   tracker->levels[l - 1].t_height, channels, level->template);
+        }
+        /* Keep a copy with the mean for the next level to shrink. The search
+           buffer isn't in use between frames */
+        if(l + 1 < tracker->num_levels) {
+            memcpy(level->search, level->template, n * channels * sizeof(float));
+        }
+
+        for(i = 0; i < n; i++) {
+            for(c = 0; c < channels; c++) {
+                means[c] += level->template[i * channels + c];
+            }
+        }
+        for(c = 0; c < channels; c++) {
+            means[c] /= n;
+        }
+        for(i = 0; i < n; i++) {
+            for(c = 0; c < channels; c++) {
+                float value = level->template[i * channels + c] - means[c];
+                level->template[i * channels + c] = value;
+                norm += value * value;
+            }
+        }
+        level->t_norm = sqrt(norm);
+    }
+}
+
+/* Allocate the buffers of every level for the current template and search
+   window sizes */
+static void reserve_levels(TemplateTracker* tracker) {
+    int channels = tracker->channels;
+    int l;
+
+    for(l = 0; l < tracker->num_levels; l++) {
+        TrackerLevel* level = &tracker->levels[l];
+        size_t search_size = (size_t) (tracker->search_width >> l) * (tracker->search_height >> l) * channels;
+        size_t template_size = (size_t) level->t_width * level->t_height * channels;
+
+        /* The search buffer also holds a copy of the template while the
+           template pyramid is built */
+        reserve((void**) &level->search, &level->capacity,
+                search_size > template_size ? search_size : template_size, sizeof(float));
+    }
+}
+
+/* Correlation of the template at (u, v) of level, summing the window
+   directly */
+static double match_at(TemplateTracker* tracker, TrackerLevel* level, int u, int v) {
+    int channels = tracker->channels;
+    int row_length = level->t_width * channels;
+    int n = level->t_width * level->t_height;
+    double sums[4] = {0, 0, 0, 0};
+    double squares = 0, product = 0, variance;
+    int x, y, c;
+
+    for(y = 0; y < level->t_height; y++) {
+        const float* window = level->search + ((v + y) * level->width + u) * channels;
+        product += dot(level->template + y * row_length, window, row_length);
+        for(x = 0; x < level->t_width; x++) {
+            for(c = 0; c < channels; c++) {
+                float value = window[x * channels + c];
+                sums[c] += value;
+                squares += value * value;
+            }
+        }
+    }
+
+    variance = squares;
+    for(c = 0; c < channels; c++) {
+        variance -= sums[c] * sums[c] / n;
+    }
+    if(variance < TRACKER_MIN_VARIANCE * n || level->t_norm == 0) {
+        return 0;
+    }
+    return product / (level->t_norm * sqrt(variance));
+}
+
+/* Fill the integral images of the coarsest level */
+static void build_integrals(TemplateTracker* tracker, TrackerLevel* level) {
+    int channels = tracker->channels;
+    int stride = level->width + 1;
+    double* integral = tracker->integral;
+    double* squares = tracker->integral_squares;
+    int x, y, c;
+
+    memset(integral, 0, stride * channels * sizeof(double));
+    memset(squares, 0, stride * sizeof(double));
+
+    for(y = 1; y <= level->height; y++) {
+        const float* row = level->search + (y - 1) * level->width * channels;
+        double row_sums[4] = {0, 0, 0, 0};
+        double row_squares = 0;
+
+        for(c = 0; c < channels; c++) {
+            integral[y * stride * channels + c] = 0;
+        }
+        squares[y * stride] = 0;
+
+        for(x = 1; x <= level->width; x++) {
+            for(c = 0; c < channels; c++) {
+                double value = row[(x - 1) * channels + c];
+                row_sums[c] += value;
+                row_squares += value * value;
+                integral[(y * stride + x) * channels + c] =
+                    integral[((y - 1) * stride + x) * channels + c] + row_sums[c];
+            }
+            squares[y * stride + x] = squares[(y - 1) * stride + x] + row_squares;
+        }
+    }
+}
+
+/* Correlation at every position of the coarsest level. Returns the best
+   position in *best_u, *best_v */
+static void match_coarse(TemplateTracker* tracker, TrackerLevel* level, int* best_u, int* best_v) {
+    int channels = tracker->channels;
+    int stride = level->width + 1;
+    int row_length = level->t_width * channels;
+    int n = level->t_width * level->t_height;
+    int positions_x = level->width - level->t_width + 1;
+    int positions_y = level->height - level->t_height + 1;
+    int positions = positions_x * positions_y;
+    double best = -2;
+    int u, v, y, c;
+
+    reserve((void**) &tracker->surface, &tracker->surface_capacity, positions, sizeof(float));
+    build_integrals(tracker, level);
+
+    for(v = 0; v < positions_y; v++) {
+        for(u = 0; u < positions_x; u++) {
+            int top = v * stride, bottom = (v + level->t_height) * stride;
+            int left = u, right = u + level->t_width;
+            double window_variance, product = 0, score = 0;
+
+            window_variance = tracker->integral_squares[bottom + right] - tracker->integral_squares[bottom + left]
+                            - tracker->integral_squares[top + right] + tracker->integral_squares[top + left];
+            for(c = 0; c < channels; c++) {
+                double window_sum = tracker->integral[(bottom + right) * channels + c]
+                                  - tracker->integral[(bottom + left) * channels + c]
+                                  - tracker->integral[(top + right) * channels + c]
+                                  + tracker->integral[(top + left) * channels + c];
+                window_variance -= window_sum * window_sum / n;
+            }
+
+            if(window_variance >= TRACKER_MIN_VARIANCE * n && level->t_norm > 0) {
+                for(y = 0; y < level->t_height; y++) {
+                    product += dot(level->template + y * row_length,
+                                   level->search + ((v + y) * level->width + u) * channels, row_length);
+                }
+                score = product / (level->t_norm * sqrt(window_variance));
+            }
+
+            tracker->surface[v * positions_x + u] = score;
+            if(score > best) {
+                best = score;
+                *best_u = u;
+                *best_v = v;
+            }
+        }
+    }
+}
+
+/* Score at (u, v) of the full resolution level less the best correlation on
+   a ring of positions half a template away. Positions outside the search
+   window are skipped, and if there are none the score is returned */
+static double contrast(TemplateTracker* tracker, int u, int v, double score) {
+    TrackerLevel* level = &tracker->levels[0];
+    int max_u = level->width - level->t_width;
+    int max_v = level->height - level->t_height;
+    double radius_x = level->t_width / 2.0, radius_y = level->t_height / 2.0;
+    double best = -2;
+    int i;
+
+    for(i = 0; i < TRACKER_RING_POSITIONS; i++) {
+        double angle = 2 * CV_PI * i / TRACKER_RING_POSITIONS;
+        int x = u + (int) floor(radius_x * cos(angle) + 0.5);
+        int y = v + (int) floor(radius_y * sin(angle) + 0.5);
+        double ring_score;
+        if(x < 0 || y < 0 || x > max_u || y > max_v) {
+            continue;
+        }
+        ring_score = match_at(tracker, level, x, y);
+        if(ring_score > best) {
+            best = ring_score;
+        }
+    }
+
+    return best > -2 ? score - best : score;
+}
+
+/**
+ * \brief Start tracking the object centered at (c_x, c_y) in frame
+ *
+ * \param frame 8 bit image with 1 or 3 channels. Later frames must have the
+ *        same number of channels
+ * \param width Template size. Clipped to the frame
+ * \param search_width Size of the window searched around the last center
+ * \param alpha How much of each match is blended into the template, 0 to 1
+ * \param min_contrast How far a match's correlation must be above the best
+ *        correlation half a template away for it to count as found
+ * \param max_levels Most pyramid levels to use, counting full resolution
+ * \return New tracker, or NULL if the frame isn't supported or the template
+ *         is empty
+ */
+TemplateTracker* template_tracker_new(IplImage* frame, int c_x, int c_y, int width, int height,
+                                      int search_width, int search_height,
+                                      double alpha, double min_contrast, int max_levels) {
+    TemplateTracker* tracker;
+    CvRect rect;
+    int l;
+
+    if(frame->depth != IPL_DEPTH_8U || (frame->nChannels != 1 && frame->nChannels != 3)) {
+        printf("Error: template_tracker_new only accepts 8 bit images with 1 or 3 channels.\n");
+        return NULL;
+    }
+
+    rect = centered_rect(frame, c_x, c_y, width, height);
+    if(rect.width == 0 || rect.height == 0) {
+        return NULL;
+    }
+
+    tracker = calloc(1, sizeof(TemplateTracker));
+    tracker->channels = frame->nChannels;
+    tracker->alpha = alpha;
+    tracker->min_contrast = min_contrast;
+    tracker->c_x = c_x;
+    tracker->c_y = c_y;
+    tracker->search_width = search_width;
+    tracker->search_height = search_height;
+    tracker->t_width = rect.width;
+    tracker->t_height = rect.height;
+    tracker->template = malloc(rect.width * rect.height * tracker->channels * sizeof(float));
+    copy_rect(frame, rect, tracker->template);
+
+    if(max_levels > TRACKER_MAX_LEVELS) {
+        max_levels = TRACKER_MAX_LEVELS;
+    }
+    tracker->num_levels = 1;
+    while(tracker->num_levels < max_levels &&
+          (rect.width >> tracker->num_levels) >= TRACKER_MIN_TEMPLATE &&
+          (rect.height >> tracker->num_levels) >= TRACKER_MIN_TEMPLATE) {
+        tracker->num_levels++;
+    }
+
+    for(l = 0; l < tracker->num_levels; l++) {
+        TrackerLevel* level = &tracker->levels[l];
+        level->t_width = rect.width >> l;
+        level->t_height = rect.height >> l;
+        level->template = malloc(level->t_width * level->t_height * tracker->channels * sizeof(float));
+    }
+    reserve_levels(tracker);
+    build_template_levels(tracker);
+
+    return tracker;
+}
+
+/**
+ * \brief Find the object in frame
+ *
+ * When the match is found, the tracker's center moves to it and the template
+ * is blended with it.
+ *
+ * \param match Filled with the best match in the search window
+ * \return 1 if the match was found, 0 if not, -1 if the frame doesn't match
+ *         the one the tracker was made with
+ */
+int template_tracker_locate(TemplateTracker* tracker, IplImage* frame, TrackerMatch* match) {
+    int channels = tracker->channels;
+    CvRect rect;
+    TrackerLevel* coarse;
+    int u = 0, v = 0;
+    int l, x, y;
+
+    memset(match, 0, sizeof(TrackerMatch));
+    if(frame->depth != IPL_DEPTH_8U || frame->nChannels != channels) {
+        printf("Error: template_tracker_locate frames must be 8 bit images with the channels of the first.\n");
+        return -1;
+    }
+
+    match->x = tracker->c_x;
+    match->y = tracker->c_y;
+
+    rect = centered_rect(frame, tracker->c_x, tracker->c_y, tracker->search_width, tracker->search_height);
+    if(rect.width < tracker->t_width || rect.height < tracker->t_height) {
+        return 0;
+    }
+
+    /* Search window pyramid */
+    reserve_levels(tracker);
+    copy_rect(frame, rect, tracker->levels[0].search);
+    tracker->levels[0].width = rect.width;
+    tracker->levels[0].height = rect.height;
+    for(l = 1; l < tracker->num_levels; l++) {
+        TrackerLevel* finer = &tracker->levels[l - 1];
+        TrackerLevel* level = &tracker->levels[l];
+        shrink(finer->search, finer->width, finer->height, channels, level->search);
+        level->width = finer->width / 2;
+        level->height = finer->height / 2;
+    }
+
+    coarse = &tracker->levels[tracker->num_levels - 1];
+    if(coarse->width < coarse->t_width || coarse->height < coarse->t_height) {
+        return 0;
+    }
+
+    reserve((void**) &tracker->integral, &tracker->integral_capacity,
+            (size_t) (coarse->width + 1) * (coarse->height + 1) * channels, sizeof(double));
+    reserve((void**) &tracker->integral_squares, &tracker->integral_squares_capacity,
+            (size_t) (coarse->width + 1) * (coarse->height + 1), sizeof(double));
+    match_coarse(tracker, coarse, &u, &v);
+    match->score = tracker->surface[v * (coarse->width - coarse->t_width + 1) + u];
+
+    /* Refine around twice the previous best at each finer level */
+    for(l = tracker->num_levels - 2; l >= 0; l--) {
+        TrackerLevel* level = &tracker->levels[l];
+        int max_u = level->width - level->t_width;
+        int max_v = level->height - level->t_height;
+        int c_u = 2 * u, c_v = 2 * v;
+        double best = -2;
+
+        for(y = c_v - TRACKER_REFINE_RADIUS; y <= c_v + TRACKER_REFINE_RADIUS; y++) {
+            for(x = c_u - TRACKER_REFINE_RADIUS; x <= c_u + TRACKER_REFINE_RADIUS; x++) {
+                double score;
+                if(x < 0 || y < 0 || x > max_u || y > max_v) {
+                    continue;
+                }
+                score = match_at(tracker, level, x, y);
+                if(score > best) {
+                    best = score;
+                    u = x;
+                    v = y;
+                }
+            }
+        }
+        match->score = best;
+    }
+
+    match->x = rect.x + u + tracker->t_width / 2;
+    match->y = rect.y + v + tracker->t_height / 2;
+    match->contrast = contrast(tracker, u, v, match->score);
+    match->found = match->contrast >= tracker->min_contrast;
+
+    if(match->found) {
+        const float* window = tracker->levels[0].search;
+        int row_length = tracker->t_width * channels;
+        float keep = 1 - tracker->alpha;
+        float alpha = tracker->alpha;
+
+        tracker->c_x = match->x;
+        tracker->c_y = match->y;
+
+        for(y = 0; y < tracker->t_height; y++) {
+            float* template_row = tracker->template + y * row_length;
+            const float* window_row = window + ((v + y) * tracker->levels[0].width + u) * channels;
+            for(x = 0; x < row_length; x++) {
+                template_row[x] = keep * template_row[x] + alpha * window_row[x];
+            }
+        }
+        build_template_levels(tracker);
+    }
+
+    return match->found;
+}
+
+/**
+ * \brief Write the current template to out, for display
+ *
+ * \param out 8 bit image with the tracker's channels and the template's size
+ * \return 0 on success, -1 if out doesn't match the template
+ */
+int template_tracker_template(TemplateTracker* tracker, IplImage* out) {
+    int row_length = tracker->t_width * tracker->channels;
+    int x, y;
+
+    if(out->depth != IPL_DEPTH_8U || out->nChannels != tracker->channels ||
+       out->width != tracker->t_width || out->height != tracker->t_height) {
+        printf("Error: template_tracker_template output must be an 8 bit image the size of the template.\n");
+        return -1;
+    }
+
+    for(y = 0; y < tracker->t_height; y++) {
+        const float* in = tracker->template + y * row_length;
+        uint8_t* row = (uint8_t*) out->imageData + y * out->widthStep;
+        for(x = 0; x < row_length; x++) {
+            row[x] = (uint8_t) (in[x] + 0.5f);
+        }
+    }
+    return 0;
+}
+
+void template_tracker_free(TemplateTracker* tracker) {
+    int l;
+
+    if(tracker == NULL) {
+        return;
+    }
+    for(l = 0; l < tracker->num_levels; l++) {
+        free(tracker->levels[l].search);
+        free(tracker->levels[l].template);
+    }
+    free(tracker->template);
+    free(tracker->surface);
+    free(tracker->integral);
+    free(tracker->integral_squares);
+    free(tracker);
+}
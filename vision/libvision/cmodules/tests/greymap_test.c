@@ -0,0 +1,177 @@
+/**
+ * \file greymap_test.c
+ * \brief Checks greymap against a byte at a time reference
+ *
+ * Covers row lengths around the 32 byte vector width, rows padded past the
+ * end of the pixels, mapping in place, and every way of splitting the rows
+ * into bands, both on the thread pool and with a single thread. Padding bytes
+ * must be left alone. Run with "make test".
+ */
+
+#include <cv.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* From src/greymap.c and src/common/pool.c, linked in */
+int greymap(IplImage* img_in, IplImage* img_out, uint8_t map[256]);
+int greymap_bands(IplImage* img_in, IplImage* img_out, uint8_t map[256], int num_bands);
+void pool_set_threads(int num_threads);
+
+/* Value written to the padding at the end of each row */
+#define PAD_BYTE 0xa5
+
+static int failures = 0;
+
+/* Image whose rows are padded with pad extra bytes, filled with pad_byte */
+static IplImage* create_padded(int width, int height, int channels, int pad) {
+    IplImage* img = cvCreateImageHeader(cvSize(width, height), IPL_DEPTH_8U, channels);
+    int step = width * channels + pad;
+    uint8_t* data = malloc((size_t) step * height);
+
+    memset(data, PAD_BYTE, (size_t) step * height);
+    cvSetData(img, data, step);
+    return img;
+}
+
+static void release_padded(IplImage** img) {
+    free((*img)->imageData);
+    cvReleaseImageHeader(img);
+}
+
+static void fill_random(IplImage* img) {
+    int row_bytes = img->width * img->nChannels;
+    int x, y;
+
+    for(y = 0; y < img->height; y++) {
+        uint8_t* row = (uint8_t*) img->imageData + y * img->widthStep;
+        for(x = 0; x < row_bytes; x++) {
+            row[x] = rand();
+        }
+    }
+}
+
+static void copy_rows(IplImage* dst, IplImage* src) {
+    int y;
+
+    for(y = 0; y < src->height; y++) {
+        memcpy(dst->imageData + y * dst->widthStep, src->imageData + y * src->widthStep,
+               src->width * src->nChannels);
+    }
+}
+
+/* Compares out to map applied to in, one byte at a time, and checks that the
+   padding of out is untouched */
+static void check(const char* name, IplImage* in, IplImage* out, uint8_t map[256], int num_bands) {
+    int row_bytes = in->width * in->nChannels;
+    int x, y;
+
+    for(y = 0; y < in->height; y++) {
+        uint8_t* in_row = (uint8_t*) in->imageData + y * in->widthStep;
+        uint8_t* out_row = (uint8_t*) out->imageData + y * out->widthStep;
+
+        for(x = 0; x < row_bytes; x++) {
+            if(out_row[x] != map[in_row[x]]) {
+                printf("FAIL %s %dx%dx%d bands %d: byte (%d, %d) is %d, expected %d\n",
+                       name, in->width, in->height, in->nChannels, num_bands,
+                       x, y, out_row[x], map[in_row[x]]);
+                failures++;
+                return;
+            }
+        }
+        for(x = row_bytes; x < out->widthStep; x++) {
+            if(out_row[x] != PAD_BYTE) {
+                printf("FAIL %s %dx%dx%d bands %d: padding byte (%d, %d) was written\n",
+                       name, in->width, in->height, in->nChannels, num_bands, x, y);
+                failures++;
+                return;
+            }
+        }
+    }
+}
+
+/* Maps one image size into a separate image and in place, split into
+   num_bands bands, or with greymap's own choice if num_bands is 0 */
+static void test_size(int width, int height, int channels, int pad, uint8_t map[256], int num_bands) {
+    IplImage* in = create_padded(width, height, channels, pad);
+    IplImage* out = create_padded(width, height, channels, pad + 5);
+    IplImage* in_place = create_padded(width, height, channels, pad);
+    int status;
+
+    fill_random(in);
+    copy_rows(in_place, in);
+
+    if(num_bands == 0) {
+        status = greymap(in, out, map);
+    } else {
+        status = greymap_bands(in, out, map, num_bands);
+    }
+    if(status != 0) {
+        printf("FAIL separate %dx%dx%d bands %d: returned %d\n", width, height, channels, num_bands, status);
+        failures++;
+    }
+    check("separate", in, out, map, num_bands);
+
+    if(num_bands == 0) {
+        status = greymap(in_place, in_place, map);
+    } else {
+        status = greymap_bands(in_place, in_place, map, num_bands);
+    }
+    if(status != 0) {
+        printf("FAIL in place %dx%dx%d bands %d: returned %d\n", width, height, channels, num_bands, status);
+        failures++;
+    }
+    check("in place", in, in_place, map, num_bands);
+
+    release_padded(&in);
+    release_padded(&out);
+    release_padded(&in_place);
+}
+
+int main(void) {
+    static const int widths[] = {1, 7, 10, 11, 31, 32, 33, 64, 101, 640};
+    static const int heights[] = {1, 3, 17, 64, 480};
+    static const int bands[] = {0, 1, 2, 3, 7, 16, 1000};
+    static const int threads[] = {1, 4};
+    uint8_t map[256];
+    int t, w, h, b, c, i;
+
+    srand(1);
+    for(i = 0; i < 256; i++) {
+        map[i] = rand();
+    }
+
+    for(t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+        pool_set_threads(threads[t]);
+
+        for(w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+            for(h = 0; h < sizeof(heights) / sizeof(heights[0]); h++) {
+                for(b = 0; b < sizeof(bands) / sizeof(bands[0]); b++) {
+                    for(c = 1; c <= 3; c += 2) {
+                        test_size(widths[w], heights[h], c, 0, map, bands[b]);
+                        test_size(widths[w], heights[h], c, 13, map, bands[b]);
+                    }
+                }
+            }
+        }
+    }
+
+    /* Mismatched images are refused */
+    IplImage* in = create_padded(16, 16, 3, 0);
+    IplImage* out = create_padded(16, 15, 3, 0);
+    if(greymap(in, out, map) != -1) {
+        printf("FAIL mismatched sizes were accepted\n");
+        failures++;
+    }
+    release_padded(&in);
+    release_padded(&out);
+
+    if(failures) {
+        printf("greymap: %d failures\n", failures);
+        return 1;
+    }
+    printf("greymap: ok\n");
+    return 0;
+}
@@ -0,0 +1,72 @@
+
+import cv
+from . import cmodules
+
+
+class ColorConverter(object):
+
+    '''Converts BGR frames to HSV or Lab, one image per channel.
+
+    Gives what cv.CvtColor followed by cv.Split (or copying out one channel
+    with SetImageCOI) would, in a single pass over the frame and without the
+    three channel intermediate.  Only the channels asked for are computed.
+    The output images are kept and written again on the next call, so copy
+    them if they must outlive it.
+
+    HSV is scaled as CV_BGR2HSV scales 8 bit images: hue 0 to 180,
+    saturation and value 0 to 255.  It uses the same integer method as
+    OpenCV and is within one level of a floating point conversion for every
+    color, but hasn't been compared against cv.CvtColor itself, so it may
+    differ from it by one level.  Lab is scaled as CV_BGR2Lab scales 8 bit
+    images, and is within one level of the floating point conversion.
+
+    Arguments:
+
+        space - "hsv" or "lab".
+
+        channels - The channels wanted, in the order convert returns them,
+            as a string of channel letters of space.  For example "v", or
+            "sh" for saturation then hue.  Defaults to all three.
+
+    '''
+
+    def __init__(self, space="hsv", channels=None):
+        space = space.lower()
+        if space == "hsv":
+            self.convert_function = cmodules.color_convert.convert_hsv
+        elif space == "lab":
+            self.convert_function = cmodules.color_convert.convert_lab
+        else:
+            raise ValueError("Unknown color space %r, expected 'hsv' or 'lab'" % space)
+
+        if channels is None:
+            channels = space
+        channels = channels.lower()
+        for channel in channels:
+            if channel not in space:
+                raise ValueError("%r is not a channel of %s" % (channel, space))
+
+        self.space = space
+        self.channels = channels
+        self.size = None
+        self.images = {}
+
+    def convert(self, frame):
+        '''Convert an 8 bit BGR frame.
+
+        Returns a tuple of single channel images, one per channel asked for,
+        or a single image if only one channel was asked for.
+        '''
+
+        size = cv.GetSize(frame)
+        if size != self.size:
+            self.size = size
+            self.images = dict((c, cv.CreateImage(size, 8, 1)) for c in self.channels)
+
+        outputs = [self.images.get(c) for c in self.space]
+        if self.convert_function(frame, *outputs) != 0:
+            raise ValueError("frame must be an 8 bit BGR image")
+
+        if len(self.channels) == 1:
+            return self.images[self.channels]
+        return tuple(self.images[c] for c in self.channels)
@@ -1,5 +1,8 @@
 import cv
 
+from . import cmodules
+from . import hist
+
 
 def hsv_filter(src, low_h, high_h, min_s, max_s, min_v, max_v,
                hue_bandstop=False):
@@ -14,6 +17,14 @@ def hsv_filter(src, low_h, high_h, min_s, max_s, min_v, max_v,
     If hue_bandstop is True, the low_h and high_h will act as a band stop
     filter on hue, otherwise hue will be a band pass filter.
 
+    The frame is converted and thresholded in C (threshold_hsv in
+    cmodules/src/color_convert.c).  Given the same HSV values, the bounds are
+    applied exactly as the per pixel Python loop this replaced applied them.
+    The HSV values come from color_convert.c's own conversion, not
+    cv.CvtColor, and may be one level off from it, so a pixel right at a
+    bound can come out differently.  vision/utils/hsv_check.py measures both
+    against OpenCV.
+
     '''
 
     # OpenCV expects hue to be ranged from 0-180, since 0-360 wouldn't fit
@@ -21,37 +32,14 @@ def hsv_filter(src, low_h, high_h, min_s, max_s, min_v, max_v,
     high_h /= 2
     low_h /= 2
 
-    hsv = cv.CreateImage(cv.GetSize(src), 8, 3)
+    # The bounds are compared to each channel as doubles, so odd hues halved
+    # above behave as in Python.  See threshold_hsv in color_convert.c.
     binary = cv.CreateImage(cv.GetSize(src), 8, 1)
-    cv.SetZero(binary)
-    cv.CvtColor(src, hsv, cv.CV_BGR2HSV)
-
-    data = hsv.tostring()
-    for y in xrange(0, hsv.height):
-        for x in xrange(0, hsv.width):
-            index = y * hsv.width * 3 + x * 3
-            h = ord(data[0 + index])
-            s = ord(data[1 + index])
-            v = ord(data[2 + index])
-
-            if hue_bandstop:
-                if (h <= low_h or h >= high_h) and \
-                   s >= min_s and \
-                   s <= max_s and \
-                   v >= min_v and \
-                   v <= max_v:
-
-                    cv.Set2D(binary, y, x, (255,))
-
-            else:
-                if h >= low_h and \
-                   h <= high_h and \
-                   s >= min_s and \
-                   s <= max_s and \
-                   v >= min_v and \
-                   v <= max_v:
-
-                    cv.Set2D(binary, y, x, (255,))
+    result = cmodules.color_convert.threshold_hsv(src, binary, low_h, high_h,
+                                                  min_s, max_s, min_v, max_v,
+                                                  int(bool(hue_bandstop)))
+    if result != 0:
+        raise ValueError("src must be an 8 bit BGR image")
 
     return binary
 
@@ -64,54 +52,14 @@ def otsu_get_threshold(src):
     This is baised on Otsu's original paper published in IEEE Xplore: "A
     Threshold Selection Method from Gray-Level Histograms"
 
+    The histogram and threshold are computed in C, see hist.image_stats.
+
     '''
 
     if src.nChannels != 1:
         raise ValueError("Image must have one channel.")
 
-    # Compute Histogram
-    hist = cv.CreateHist([256], cv.CV_HIST_ARRAY, [[0, 255]], 1)
-    cv.CalcHist([src], hist)
-
-    # Convert to Probability Histogram
-    cv.NormalizeHist(hist, 1)
-
-    overall_moment = 0
-    for t in xrange(256):
-        overall_moment += t * cv.QueryHistValue_1D(hist, t)
-
-    # Find the threshold t that gives the highest variance
-    # Suffixes _b and _f mean background and foreground
-    num_pixels = src.width * src.height
-    weight_b = 0
-    moment_b = 0
-    highest_variance = 0
-    best_threshold = 0
-    for t in xrange(256):
-
-        hist_value = cv.QueryHistValue_1D(hist, t)
-
-        weight_b += hist_value
-        weight_f = 1 - weight_b
-        if weight_b == 0:
-            continue
-        if weight_f == 0:
-            break
-
-        moment_b += t * hist_value
-        moment_f = overall_moment - moment_b
-
-        mean_b = moment_b / weight_b
-        mean_f = moment_f / weight_f
-
-        variance_between = weight_b * weight_f * \
-            (mean_b - mean_f) ** 2
-
-        if variance_between >= highest_variance:
-            highest_variance = variance_between
-            best_threshold = t
-
-    return best_threshold
+    return hist.image_stats(src).otsu_threshold
 
 
 def otsu_threshold(src, max_value=255, threshold_type=cv.CV_THRESH_BINARY):
@@ -3,11 +3,32 @@ import ctypes
 from . import cmodules
 
 
-def greymap(img_in, img_out, mapping):
+def greymap(img_in, img_out, mapping, num_bands=None):
+    '''Map every byte of img_in through mapping, writing the result to img_out
+
+    Works on 8 bit images with any number of channels, each channel mapped
+    through the same table.  img_out must have the same size and channels as
+    img_in, and may be img_in itself to map the image in place.
+
+    Large images are split into bands of rows automatically, which are mapped
+    on the thread pool (see libvision.set_threads).  Give num_bands to choose
+    the number of bands yourself, 1 to keep the work in the calling thread.
+    It doesn't change the number of threads: the bands are shared between
+    the threads of the pool.
+
+    '''
     if len(mapping) != 256:
         raise Exception("Greyscale mapping must providing mapping of 256 bytes")
 
     array_type = ctypes.c_ubyte * 256
-    cmodules.cgreymap_mod._wrap_greymap(ctypes.py_object(img_in),
-                                        ctypes.py_object(img_out),
-                                        array_type(*mapping))
+    if num_bands is None:
+        result = cmodules.cgreymap_mod._wrap_greymap(ctypes.py_object(img_in),
+                                                     ctypes.py_object(img_out),
+                                                     array_type(*mapping))
+    else:
+        result = cmodules.cgreymap_mod._wrap_greymap_bands(ctypes.py_object(img_in),
+                                                           ctypes.py_object(img_out),
+                                                           array_type(*mapping),
+                                                           num_bands)
+    if result != 0:
+        raise ValueError("img_out must be an 8 bit image of the same size and channels as img_in")
@@ -0,0 +1,106 @@
+
+import math
+import ctypes
+from . import cmodules
+
+
+class LineSegment(object):
+
+    def __init__(self, csegment):
+        # End points, in pixels
+        self.p0 = (csegment.x_0, csegment.y_0)
+        self.p1 = (csegment.x_1, csegment.y_1)
+
+        # Width of the edge and length of the segment, in pixels
+        self.width = csegment.width
+        self.length = csegment.length
+
+        # Direction of the segment in [0, pi), from the x axis towards the y
+        # axis
+        self.angle = csegment.angle
+
+        # Pixels the segment was fit to
+        self.pixels = csegment.pixels
+
+    def rho_theta(self):
+        '''The line through the segment as (rho, theta), as cv.HoughLines2
+        gives it.'''
+        theta = (self.angle + math.pi / 2) % math.pi
+        rho = self.p0[0] * math.cos(theta) + self.p0[1] * math.sin(theta)
+        return (rho, theta)
+
+
+class LineDetector(object):
+
+    '''Finds straight edges in a mask without a Hough transform.
+
+    Regions of pixels whose gradients point the same way are fit with
+    rectangles, as in LSD, and collinear pieces of one edge are joined.  Runs
+    on the thresholded image itself, no Canny is needed first.
+
+    Arguments:
+
+        min_length - Shortest segment returned, in pixels.  Plays the part
+            of the threshold given to cv.HoughLines2.
+
+        gradient_threshold - Smallest gradient of an edge pixel, in grey
+            levels per pixel.
+
+        angle_tolerance - How far the gradient of a pixel may turn from that
+            of the region it joins, in radians.
+
+        min_density - Smallest fraction of its rectangle a region must fill.
+
+        merge_angle, merge_distance, merge_gap - Two segments are joined when
+            their angles are within merge_angle radians, the shorter one is
+            within merge_distance pixels of the line through the longer, and
+            the gap between them is at most merge_gap pixels.
+
+    '''
+
+    def __init__(self, min_length, gradient_threshold=20, angle_tolerance=math.pi / 8,
+                 min_density=0.7, merge_angle=0.1, merge_distance=4, merge_gap=20):
+
+        self.config = cmodules.LineConfig()
+        self.config.gradient_threshold = gradient_threshold
+        self.config.angle_tolerance = angle_tolerance
+        self.config.min_density = min_density
+        self.config.min_length = min_length
+        self.config.merge_angle = merge_angle
+        self.config.merge_distance = merge_distance
+        self.config.merge_gap = merge_gap
+
+        self.max_segments = 0
+        self.results = None
+        self.detector = cmodules.line_segments.line_detector_new(ctypes.byref(self.config))
+
+    def find_segments(self, image, max_segments=16, min_length=None):
+        '''Return a list of LineSegment found in image, longest first.
+
+        image must be an 8 bit single channel image, such as the output of
+        find_target_color_rgb.  min_length, if given, drops segments shorter
+        than it on top of the detector's own min_length, for callers tuning
+        it from frame to frame.
+        '''
+
+        if max_segments > self.max_segments:
+            self.max_segments = max_segments
+            self.results = (cmodules.LineSegment * max_segments)()
+
+        count = cmodules.line_segments.line_detector_run(
+            self.detector, image, self.results, max_segments)
+
+        segments = [LineSegment(self.results[i]) for i in range(0, count)]
+        if min_length is not None:
+            segments = [s for s in segments if s.length >= min_length]
+        return segments
+
+    def find_lines(self, image, max_lines=16, min_length=None):
+        '''Like find_segments, but return the lines as (rho, theta) tuples in
+        the form cv.HoughLines2 gives them, longest first.'''
+        return [s.rho_theta() for s in self.find_segments(image, max_lines, min_length)]
+
+    def __del__(self):
+        if getattr(self, "detector", None):
+            cmodules.line_segments.line_detector_free(self.detector)
+            self.detector = None
@@ -0,0 +1,153 @@
+
+import ctypes
+from . import cmodules
+
+TENTATIVE = 0
+CONFIRMED = 1
+LOST = 2
+
+
+class Track(object):
+
+    def __init__(self, ctrack, detections):
+        # Id of the object, kept for as long as it is tracked.  Ids are never
+        # reused by one MultiTracker.
+        self.id = ctrack.id
+
+        # TENTATIVE, CONFIRMED or LOST
+        self.state = ctrack.state
+
+        # Filtered center, or the predicted center if the object was not
+        # detected this frame
+        self.center = (ctrack.x, ctrack.y)
+
+        # Pixels moved per frame
+        self.velocity = (ctrack.v_x, ctrack.v_y)
+
+        # Standard deviations of the center, in pixels
+        self.sigma = (ctrack.sigma_x, ctrack.sigma_y)
+
+        # Running average of the sizes of the detections
+        self.size = ctrack.size
+
+        # Frames detected in, in total, and frames since the last detection
+        self.hits = ctrack.hits
+        self.missed = ctrack.missed
+
+        # The detection (such as a libvision.blob.Blob) assigned to the track
+        # this frame, or None
+        self.detection = detections[ctrack.detection] if ctrack.detection >= 0 else None
+
+    def search_rect(self, margin=0, n_sigma=3):
+        '''Returns an (x, y, width, height) rectangle around the next center
+        the object is expected at, n_sigma standard deviations wide in each
+        direction plus margin pixels.  Give the object's own half size as
+        margin for the rectangle to hold all of it.  Not clipped to the
+        frame, see libvision.tracking.clip_rectangle.'''
+        x = self.center[0] + self.velocity[0]
+        y = self.center[1] + self.velocity[1]
+        half_width = n_sigma * self.sigma[0] + margin
+        half_height = n_sigma * self.sigma[1] + margin
+        return (int(x - half_width), int(y - half_height),
+                int(2 * half_width + 1), int(2 * half_height + 1))
+
+
+class MultiTracker(object):
+
+    '''Follows many objects from frame to frame.
+
+    Each frame, update() is given the objects found in it, such as the blobs
+    from libvision.blob.find_blobs, and matches them to the objects seen
+    before.  Every object's motion is predicted with a constant velocity
+    Kalman filter, so objects that move steadily keep their ids when they
+    pass close to each other, and are picked up again after a few frames
+    without a detection.
+
+    A new object is tentative until it is detected in confirm_hits frames in
+    a row, and is forgotten if it misses one.  A confirmed object that is
+    not detected becomes lost, and is forgotten after max_missed frames.
+
+    Arguments:
+
+        process_noise - How much an object's velocity may change from one
+            frame to the next, in pixels per frame.
+
+        measurement_noise - How far a detection may be from the object's
+            true center, in pixels.
+
+        initial_speed - How fast a new object may be moving, in pixels per
+            frame.
+
+        gate - How far a detection may be from the predicted center and still
+            be matched to the object, in standard deviations.
+
+        max_size_ratio - Largest ratio between the sizes of an object and a
+            detection matched to it.  0 to not compare sizes.
+
+        confirm_hits, max_missed - See above.
+
+        assignment - "hungarian" to match objects and detections with the
+            least total distance, or "greedy" to match the closest pairs
+            first.
+
+    '''
+
+    def __init__(self, process_noise=1, measurement_noise=2, initial_speed=10,
+                 gate=5, max_size_ratio=3, confirm_hits=3, max_missed=8,
+                 assignment="hungarian"):
+
+        if assignment not in ("hungarian", "greedy"):
+            raise ValueError("Unknown assignment %r, expected 'hungarian' or 'greedy'" % assignment)
+
+        self.config = cmodules.MotConfig()
+        self.config.process_noise = process_noise
+        self.config.measurement_noise = measurement_noise
+        self.config.initial_speed = initial_speed
+        self.config.gate = gate
+        self.config.max_size_ratio = max_size_ratio
+        self.config.confirm_hits = confirm_hits
+        self.config.max_missed = max_missed
+        self.config.greedy = assignment == "greedy"
+
+        self.max_tracks = 0
+        self.results = None
+        self.tracks = []
+        self.tracker = cmodules.multi_tracker.mot_new(ctypes.byref(self.config))
+
+    def update(self, detections):
+        '''Update the tracks with the objects found in the next frame.
+
+        detections is a list of libvision.blob.Blob, or of (x, y, size)
+        tuples.  Returns the confirmed tracks, as a list of Track.  Every
+        track, including tentative and lost ones, is kept in self.tracks.
+        '''
+
+        cdetections = (cmodules.MotDetection * max(len(detections), 1))()
+        for i, detection in enumerate(detections):
+            if isinstance(detection, tuple):
+                x, y, size = detection
+            else:
+                (x, y), size = detection.centroid, detection.size
+            cdetections[i].x = x
+            cdetections[i].y = y
+            cdetections[i].size = size
+
+        # There can't be more tracks than last frame's, plus one per
+        # detection
+        max_tracks = len(self.tracks) + len(detections)
+        if max_tracks > self.max_tracks:
+            self.max_tracks = 2 * max_tracks
+            self.results = (cmodules.MotTrack * self.max_tracks)()
+
+        count = cmodules.multi_tracker.mot_update(
+            self.tracker, cdetections, len(detections), self.results, self.max_tracks)
+
+        self.tracks = [Track(self.results[i], detections) for i in range(0, count)]
+        return [t for t in self.tracks if t.state == CONFIRMED]
+
+    def close(self):
+        if getattr(self, "tracker", None):
+            cmodules.multi_tracker.mot_free(self.tracker)
+            self.tracker = None
+
+    __del__ = close
@@ -0,0 +1,100 @@
+
+import ctypes
+from . import cmodules
+
+
+class PipelineBlob(object):
+
+    def __init__(self, cblob):
+        # Id of blob. This is the index of the blob in the indexed image
+        self.id = cblob.id
+
+        # Pixels contained by the blob
+        self.size = cblob.size
+
+        # Center of mass, 'centroid'. This is a CvPoint
+        self.centroid = (cblob.c_x, cblob.c_y)
+
+        # Region of interest. This is a CvRect
+        self.roi = (cblob.x, cblob.y, cblob.w, cblob.h)
+
+        # Color as given by buoy_analyzer, 0 if color analysis is disabled
+        self.color = cblob.color
+
+
+class Pipeline(object):
+
+    '''Color targeting, morphology, blob finding and color analysis in one call.
+
+    Equivalent to running find_target_color_rgb (or _hsv), eroding/dilating the
+    result, then find_blobs and buoy_analyzer on the blobs found, but the
+    whole chain runs in C without returning to Python between stages and
+    without allocating new images for every frame.
+
+    Arguments:
+
+        target - Target color, as (r, g, b), or (h, s, v) if hsv is True.
+
+        min_blobsize, dev_threshold, precision_threshold - As given to
+            find_target_color_rgb.
+
+        min_blob_size, max_blobs - As given to find_blobs.
+
+        hsv - Threshold in HSV instead of RGB.
+
+        decimation - Sampling step used to build the color histogram.
+
+        morph_open, morph_close - Iterations of opening and closing done on
+            the thresholded image.  0 skips the operation.
+
+        analyze_color - Also classify the color of every blob found, as
+            buoy_analyzer does.
+
+    '''
+
+    def __init__(self, target, min_blobsize, dev_threshold, precision_threshold,
+                 min_blob_size, max_blobs, hsv=False, decimation=1,
+                 morph_open=0, morph_close=0, analyze_color=False):
+
+        self.config = cmodules.PipelineConfig()
+        if hsv:
+            self.config.color_space = cmodules.PIPELINE_HSV
+        else:
+            self.config.color_space = cmodules.PIPELINE_RGB
+        self.config.target[:] = [int(v) for v in target]
+        self.config.min_blobsize = min_blobsize
+        self.config.dev_threshold = dev_threshold
+        self.config.precision_threshold = precision_threshold
+        self.config.decimation = decimation
+        self.config.morph_open = morph_open
+        self.config.morph_close = morph_close
+        self.config.min_blob_size = min_blob_size
+        self.config.max_blobs = max_blobs
+        self.config.analyze_color = int(analyze_color)
+
+        self.max_blobs = max(max_blobs, 1)
+        self.results = (cmodules.PipelineBlob * self.max_blobs)()
+        self.pipeline = cmodules.pipeline.pipeline_new(ctypes.byref(self.config))
+
+    def run(self, frame, roi=None):
+        '''Run the pipeline over frame and return a list of PipelineBlob.
+
+        If roi is given as an (x, y, width, height) tuple, only that part of
+        the frame (and a small margin around it) is searched.  Blob centroids
+        and rois are still in frame coordinates.
+        '''
+
+        if roi is not None:
+            roi = cmodules.CvRect(*[int(v) for v in roi])
+
+        num_blobs = cmodules.pipeline.pipeline_run(self.pipeline, frame, roi,
+                                                   self.results, self.max_blobs)
+        if num_blobs < 0:
+            raise ValueError("Pipeline failed on frame")
+
+        return [PipelineBlob(self.results[i]) for i in range(num_blobs)]
+
+    def __del__(self):
+        if getattr(self, "pipeline", None):
+            cmodules.pipeline.pipeline_free(self.pipeline)
+            self.pipeline = None
@@ -0,0 +1,285 @@
+'''
+Timing of the stages of the vision loop.
+
+Each entity process has at most one active Profiler, started with start().
+The entity loop times capture and process_frame, CModule times every C
+function call, and the process manager times the pipe transfer of outputs.
+Samples go into RollingHistograms holding the last few hundred frames, from
+which the stage latency percentiles are read.
+
+Times come from monotonic(), which uses CLOCK_MONOTONIC.  Unlike time.time()
+it never jumps, and it is the same clock in every process, so a timestamp
+taken in an entity process can be compared to one taken in mission control.
+'''
+
+from collections import deque
+import ctypes
+import ctypes.util
+import math
+import time
+
+from .cmodules import cmodule
+
+CLOCK_MONOTONIC = 1
+
+# Stages timed by the vision loop itself.  ENTITY is the Python part of
+# process_frame, which is its total time minus the time spent in C modules.
+CAPTURE = "Capture"
+CMODULE = "CModule"
+ENTITY = "Entity"
+TRANSFER = "Transfer"
+
+
+class Timespec(ctypes.Structure):
+    _fields_ = [
+        ("tv_sec", ctypes.c_long),
+        ("tv_nsec", ctypes.c_long),
+    ]
+
+
+def _load_clock_gettime():
+    '''clock_gettime lives in librt on older glibc, in libc on newer ones.'''
+    for library in ("rt", "c"):
+        path = ctypes.util.find_library(library)
+        if path is None:
+            continue
+        try:
+            clock_gettime = ctypes.CDLL(path, use_errno=True).clock_gettime
+        except (OSError, AttributeError):
+            continue
+        clock_gettime.argtypes = [ctypes.c_int, ctypes.POINTER(Timespec)]
+        clock_gettime.restype = ctypes.c_int
+        return clock_gettime
+    return None
+
+_clock_gettime = _load_clock_gettime()
+
+
+def monotonic():
+    '''Seconds since some fixed point in the past.'''
+    now = Timespec()
+    if _clock_gettime(CLOCK_MONOTONIC, ctypes.byref(now)) != 0:
+        raise OSError(ctypes.get_errno(), "clock_gettime failed")
+    return now.tv_sec + now.tv_nsec * 1e-9
+
+if _clock_gettime is None:
+    monotonic = time.time
+
+
+class RollingHistogram(object):
+
+    '''Distribution of the last window samples.
+
+    Samples are counted in logarithmically spaced bins from MIN_VALUE to
+    MAX_VALUE seconds, BINS_PER_DECADE to a factor of ten, so a percentile
+    is accurate to about 6%.  Adding a sample and forgetting the oldest one
+    are O(1); reading a percentile is O(number of bins).
+
+    '''
+
+    MIN_VALUE = 1e-6
+    MAX_VALUE = 10.0
+    BINS_PER_DECADE = 20
+
+    def __init__(self, window=300):
+        self.window = window
+        self.num_bins = int(math.ceil(
+            math.log10(self.MAX_VALUE / self.MIN_VALUE) * self.BINS_PER_DECADE))
+        self.counts = [0] * self.num_bins
+        self.recent = deque()
+        self.recent_sum = 0.0
+
+    def add(self, value):
+        if len(self.recent) == self.window:
+            old_value, old_bin = self.recent.popleft()
+            self.counts[old_bin] -= 1
+            self.recent_sum -= old_value
+
+        if value <= self.MIN_VALUE:
+            b = 0
+        else:
+            b = min(int(math.log10(value / self.MIN_VALUE) * self.BINS_PER_DECADE),
+                    self.num_bins - 1)
+        self.counts[b] += 1
+        self.recent.append((value, b))
+        self.recent_sum += value
+
+    def __len__(self):
+        return len(self.recent)
+
+    def mean(self):
+        if not self.recent:
+            return 0.0
+        return self.recent_sum / len(self.recent)
+
+    def percentile(self, p):
+        '''The value below which p percent of the samples fall.
+
+        Returns the geometric center of the bin holding that sample, or 0 if
+        there are no samples.
+        '''
+        if not self.recent:
+            return 0.0
+
+        rank = max(1, int(math.ceil(p / 100.0 * len(self.recent))))
+        seen = 0
+        for b, count in enumerate(self.counts):
+            seen += count
+            if seen >= rank:
+                return self.MIN_VALUE * 10 ** ((b + 0.5) / self.BINS_PER_DECADE)
+        return self.MAX_VALUE
+
+
+class StageStats(object):
+
+    '''Summary of one stage, as sent from an entity to mission control.'''
+
+    def __init__(self, histogram):
+        self.count = len(histogram)
+        self.mean = histogram.mean()
+        self.p50 = histogram.percentile(50)
+        self.p99 = histogram.percentile(99)
+
+    def __repr__(self):
+        return "p50 %.2fms p99 %.2fms mean %.2fms (%d)" % (
+            self.p50 * 1000, self.p99 * 1000, self.mean * 1000, self.count)
+
+
+class ProfileReport(object):
+
+    '''Snapshot of a Profiler.
+
+    Attributes:
+        fps - Frames per second over the histogram window
+        dropped - Frames skipped since the profiler started
+        stages - Dictionary of stage name to StageStats
+
+    '''
+
+    def __init__(self, name, fps, dropped, stages):
+        self.name = name
+        self.fps = fps
+        self.dropped = dropped
+        self.stages = stages
+
+    def __repr__(self):
+        lines = ["%s: %.1f fps, %d dropped" % (self.name, self.fps, self.dropped)]
+        for stage in sorted(self.stages):
+            lines.append("    %-30s %r" % (stage, self.stages[stage]))
+        return "\n".join(lines)
+
+
+class Profiler(object):
+
+    '''Collects the stage timings of one entity.
+
+    Arguments:
+
+        name - Name of the entity, used in reports.
+
+        window - Number of samples kept for each stage.
+
+        report_interval - Seconds between reports, see report_due().
+
+    '''
+
+    def __init__(self, name, window=300, report_interval=1.0):
+        self.name = name
+        self.window = window
+        self.report_interval = report_interval
+        self.stages = {}
+        self.frame_times = deque(maxlen=window)
+        self.dropped = 0
+        self.last_report = monotonic()
+
+        # C module time inside the current frame
+        self.cmodule_time = 0.0
+
+    def record(self, stage, seconds):
+        try:
+            histogram = self.stages[stage]
+        except KeyError:
+            histogram = self.stages[stage] = RollingHistogram(self.window)
+        histogram.add(seconds)
+
+    def record_cmodule(self, function_name, seconds):
+        '''Called by CModule for every C function call.'''
+        self.cmodule_time += seconds
+        self.record(CMODULE + "." + function_name, seconds)
+
+    def timed_call(self, function_name, func, args):
+        '''Installed as cmodule.profile_hook while this profiler is active.'''
+        start = monotonic()
+        try:
+            return func(*args)
+        finally:
+            self.record_cmodule(function_name, monotonic() - start)
+
+    def stage(self, name):
+        '''Context manager timing its body as stage name.
+
+        >>> with profiler.stage("Convert"):
+        >>>     cv.CvtColor(frame, hsv, cv.CV_BGR2HSV)
+
+        '''
+        return StageTimer(self, name)
+
+    def frame_done(self, process_time):
+        '''Ends a frame, given the total time of process_frame.'''
+        self.frame_times.append(monotonic())
+        self.record(CMODULE, self.cmodule_time)
+        self.record(ENTITY, max(process_time - self.cmodule_time, 0.0))
+        self.cmodule_time = 0.0
+
+    def count_dropped(self, frames):
+        self.dropped += frames
+
+    def fps(self):
+        if len(self.frame_times) < 2:
+            return 0.0
+        elapsed = self.frame_times[-1] - self.frame_times[0]
+        if elapsed <= 0:
+            return 0.0
+        return (len(self.frame_times) - 1) / elapsed
+
+    def report_due(self):
+        return monotonic() - self.last_report >= self.report_interval
+
+    def report(self):
+        self.last_report = monotonic()
+        stages = dict((stage, StageStats(histogram))
+                      for stage, histogram in self.stages.iteritems())
+        return ProfileReport(self.name, self.fps(), self.dropped, stages)
+
+
+class StageTimer(object):
+
+    def __init__(self, profiler, name):
+        self.profiler = profiler
+        self.name = name
+
+    def __enter__(self):
+        self.start = monotonic()
+        return self
+
+    def __exit__(self, *exc_info):
+        self.profiler.record(self.name, monotonic() - self.start)
+        return False
+
+
+# The profiler of this process, or None when profiling is off
+active = None
+
+
+def start(name, **kwargs):
+    '''Make a new Profiler the active one of this process, and return it.'''
+    global active
+    active = Profiler(name, **kwargs)
+    cmodule.profile_hook = active.timed_call
+    return active
+
+
+def stop():
+    global active
+    active = None
+    cmodule.profile_hook = None
@@ -0,0 +1,77 @@
+
+import ctypes
+from . import cmodules
+from .blob import Blob
+
+
+class Pyramid(object):
+
+    '''Color targeting and blob finding on a downsampled image pyramid.
+
+    Gives the blobs find_target_color_rgb (or _hsv) followed by find_blobs
+    would, but when min_blob_size is large enough the search is done on a
+    copy of the frame shrunk by 2, 4, ... in each direction, and only the
+    areas around the blobs found there are looked at in full resolution.
+    Blob centroids and rois are in full resolution coordinates.
+
+    Arguments:
+
+        target - Target color, as (r, g, b), or (h, s, v) if hsv is True.
+
+        min_blobsize, dev_threshold, precision_threshold - As given to
+            find_target_color_rgb.
+
+        min_blob_size, max_blobs - As given to find_blobs.
+
+        hsv - Threshold in HSV instead of RGB.
+
+        levels - Number of pyramid levels, counting full resolution.  1
+            always searches at full resolution.
+
+        min_level_pixels - Fewest pixels a blob of min_blob_size may shrink
+            to at the level it is searched at.  Raise this if small blobs are
+            missed.
+
+    '''
+
+    def __init__(self, target, min_blobsize, dev_threshold, precision_threshold,
+                 min_blob_size, max_blobs, hsv=False, levels=3, min_level_pixels=32):
+
+        if hsv:
+            self.color_space = cmodules.PYRAMID_HSV
+        else:
+            self.color_space = cmodules.PYRAMID_RGB
+        self.target = [int(v) for v in target]
+        self.min_blobsize = min_blobsize
+        self.dev_threshold = dev_threshold
+        self.precision_threshold = precision_threshold
+        self.min_blob_size = min_blob_size
+        self.max_blobs = max_blobs
+
+        self.pyramid = cmodules.pyramid.pyramid_new(levels, min_level_pixels)
+
+    def find_blobs(self, frame):
+        '''Search frame and return a list of libvision.blob.Blob, largest first.'''
+
+        num_blobs = ctypes.c_int()
+        c_0, c_1, c_2 = self.target
+        cblobs = cmodules.pyramid.pyramid_find_blobs(
+            self.pyramid, frame, ctypes.pointer(num_blobs), self.color_space,
+            c_0, c_1, c_2, self.min_blobsize, self.dev_threshold,
+            self.precision_threshold, self.min_blob_size, self.max_blobs)
+
+        blobs = [Blob(cblobs[i]) for i in range(0, num_blobs.value)]
+        if cblobs:
+            cmodules.pyramid.free_blobs(cblobs, num_blobs)
+
+        return blobs
+
+    @property
+    def last_level(self):
+        '''Level the last frame was searched at, 0 being full resolution.'''
+        return cmodules.pyramid.pyramid_last_level(self.pyramid)
+
+    def __del__(self):
+        if getattr(self, "pyramid", None):
+            cmodules.pyramid.pyramid_free(self.pyramid)
+            self.pyramid = None
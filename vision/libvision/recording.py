@@ -0,0 +1,288 @@
+'''
+Recording of camera frames into a single indexed file.
+
+A recording holds every frame as raw pixels, or compressed with zlib or LZ4,
+along with the time it was captured and a snapshot of any variables the
+recorder was given.  An index of the frames is written when the recording is
+closed, so a reader can go to any frame directly.  Raw frames are read
+straight out of the memory mapped file, without being copied or decoded.
+
+Recordings are written by libvision.Camera when its record_path ends in
+RECORDING_EXTENSION, and read by Camera when its identifier does.
+
+File layout, all little endian:
+
+    File header (FILE_HEADER):
+        magic           8 bytes, FILE_MAGIC
+        version         uint32
+        (reserved)      uint32
+        index_offset    uint64, 0 until the recording is closed
+        frame_count     uint64
+
+    Frames, one after another, each starting on an 8 byte boundary:
+        Frame header (FRAME_HEADER):
+            magic           4 bytes, FRAME_MAGIC
+            compression     uint8, one of COMPRESSION
+            depth           uint8, bits per channel (8)
+            channels        uint8
+            (reserved)      uint8
+            width           uint16
+            height          uint16
+            frame_number    int64
+            timestamp       double, time.time() at capture
+            data_size       uint32
+            variables_size  uint32
+        Pixels, data_size bytes.  Rows of width * channels bytes, with no
+            padding, possibly compressed.
+        Variables, variables_size bytes of JSON.
+
+    Index (INDEX_HEADER then INDEX_ENTRY per frame):
+        magic           4 bytes, INDEX_MAGIC
+        count           uint32
+        offset          uint64, of the frame header
+        timestamp       double
+
+A recording that was never closed, because its process was killed, has no
+index.  RecordingReader then finds the frames by reading their headers, and
+ignores a last frame that was only partly written.
+'''
+
+import bisect
+import ctypes
+import json
+import mmap
+import struct
+import zlib
+
+import cv
+import numpy
+
+try:
+    import lz4.block as lz4_block
+except ImportError:
+    lz4_block = None
+
+RECORDING_EXTENSION = ".vrec"
+
+FILE_MAGIC = "SWVREC\r\n"
+FRAME_MAGIC = "FRME"
+INDEX_MAGIC = "INDX"
+VERSION = 1
+
+FILE_HEADER = struct.Struct("<8sIIQQ")
+FRAME_HEADER = struct.Struct("<4sBBBBHHqdII")
+INDEX_HEADER = struct.Struct("<4sI")
+INDEX_ENTRY = struct.Struct("<Qd")
+
+COMPRESSION = {
+    "raw": 0,
+    "zlib": 1,
+    "lz4": 2,
+}
+
+
+def is_recording(path):
+    '''True if path names a recording, by its extension.'''
+    return isinstance(path, basestring) and path.endswith(RECORDING_EXTENSION)
+
+
+def _align(offset):
+    return (offset + 7) & ~7
+
+
+class RecordingWriter(object):
+
+    '''Writes frames to a new recording.
+
+    Arguments:
+
+        path - File to write.  Replaced if it exists.
+
+        compression - "raw" to store pixels as they are, which is fastest to
+            replay, "zlib" for zlib at its fastest level, or "lz4", which
+            needs the lz4 module.
+
+    '''
+
+    def __init__(self, path, compression="raw"):
+        if compression not in COMPRESSION:
+            raise ValueError("Unknown compression %r, expected one of %s" %
+                             (compression, ", ".join(sorted(COMPRESSION))))
+        if compression == "lz4" and lz4_block is None:
+            raise ValueError("lz4 compression needs the lz4 module")
+
+        self.path = path
+        self.compression = compression
+        self.file = open(path, "wb")
+        self.file.write(FILE_HEADER.pack(FILE_MAGIC, VERSION, 0, 0, 0))
+        self.offset = FILE_HEADER.size
+        self.index = []
+
+    def write(self, image, timestamp, frame_number=None, variables=None):
+        '''Adds a frame to the recording.
+
+        image is an 8 bit numpy array of shape (height, width) or (height,
+        width, channels), or an 8 bit IplImage.  variables, if given, is a
+        dict that can be stored as JSON.
+        '''
+        if not isinstance(image, numpy.ndarray):
+            image = numpy.asarray(image[:, :])
+        if image.dtype != numpy.uint8:
+            raise ValueError("Only 8 bit frames can be recorded")
+        height, width = image.shape[:2]
+        channels = image.shape[2] if image.ndim == 3 else 1
+
+        data = numpy.ascontiguousarray(image).tostring()
+        if self.compression == "zlib":
+            data = zlib.compress(data, 1)
+        elif self.compression == "lz4":
+            data = lz4_block.compress(data, store_size=False)
+        variables_data = json.dumps(variables) if variables is not None else ""
+
+        if frame_number is None:
+            frame_number = len(self.index)
+        header = FRAME_HEADER.pack(FRAME_MAGIC, COMPRESSION[self.compression],
+                                   8, channels, 0, width, height, frame_number,
+                                   timestamp, len(data), len(variables_data))
+        size = FRAME_HEADER.size + len(data) + len(variables_data)
+        padding = _align(self.offset + size) - (self.offset + size)
+
+        self.file.write(header)
+        self.file.write(data)
+        self.file.write(variables_data)
+        self.file.write("\0" * padding)
+
+        self.index.append((self.offset, timestamp))
+        self.offset += size + padding
+
+    def close(self):
+        '''Writes the index and closes the file.'''
+        if not self.file:
+            return
+        self.file.write(INDEX_HEADER.pack(INDEX_MAGIC, len(self.index)))
+        for entry in self.index:
+            self.file.write(INDEX_ENTRY.pack(*entry))
+        self.file.seek(0)
+        self.file.write(FILE_HEADER.pack(FILE_MAGIC, VERSION, 0, self.offset, len(self.index)))
+        self.file.close()
+        self.file = None
+
+    __del__ = close
+
+
+class RecordingReader(object):
+
+    '''Reads the frames of a recording, in any order.
+
+    Frames are numbered from 0 in the order they were written.  The image
+    returned for a raw frame is a view of the mapped file, which is never
+    written back to: drawing on it only changes this process's copy.  It stays
+    valid until the reader is closed.
+    '''
+
+    def __init__(self, path):
+        self.path = path
+        self.file = open(path, "rb")
+        # A private mapping, so frames can be handed out as writable images
+        self.map = mmap.mmap(self.file.fileno(), 0, access=mmap.ACCESS_COPY)
+
+        if len(self.map) < FILE_HEADER.size:
+            raise ValueError("%s is not a recording" % path)
+        magic, version, _, index_offset, frame_count = FILE_HEADER.unpack_from(self.map, 0)
+        if magic != FILE_MAGIC:
+            raise ValueError("%s is not a recording" % path)
+        if version != VERSION:
+            raise ValueError("%s is a version %d recording, expected %d" % (path, version, VERSION))
+
+        if index_offset:
+            self.offsets, self.timestamps = self._read_index(index_offset, frame_count)
+        else:
+            self.offsets, self.timestamps = self._scan()
+
+    def _read_index(self, index_offset, frame_count):
+        magic, count = INDEX_HEADER.unpack_from(self.map, index_offset)
+        if magic != INDEX_MAGIC or count != frame_count:
+            raise ValueError("%s has a corrupt index" % self.path)
+        offsets = []
+        timestamps = []
+        position = index_offset + INDEX_HEADER.size
+        for i in xrange(count):
+            offset, timestamp = INDEX_ENTRY.unpack_from(self.map, position)
+            offsets.append(offset)
+            timestamps.append(timestamp)
+            position += INDEX_ENTRY.size
+        return offsets, timestamps
+
+    def _scan(self):
+        '''Finds the frames of a recording that has no index.'''
+        offsets = []
+        timestamps = []
+        offset = FILE_HEADER.size
+        while offset + FRAME_HEADER.size <= len(self.map):
+            fields = FRAME_HEADER.unpack_from(self.map, offset)
+            if fields[0] != FRAME_MAGIC:
+                break
+            size = FRAME_HEADER.size + fields[9] + fields[10]
+            if offset + size > len(self.map):
+                break
+            offsets.append(offset)
+            timestamps.append(fields[8])
+            offset = _align(offset + size)
+        return offsets, timestamps
+
+    def __len__(self):
+        return len(self.offsets)
+
+    def timestamp(self, i):
+        '''Capture time of frame i, without reading it.'''
+        return self.timestamps[i]
+
+    def find(self, timestamp):
+        '''Number of the last frame captured at or before timestamp, or 0.'''
+        return max(bisect.bisect_right(self.timestamps, timestamp) - 1, 0)
+
+    def frame(self, i):
+        '''Returns frame i as (image, timestamp, frame_number, variables).
+
+        image is an IplImage.  variables is the dict recorded with the frame,
+        or None.
+        '''
+        offset = self.offsets[i]
+        (_, compression, depth, channels, _, width, height, frame_number,
+         timestamp, data_size, variables_size) = FRAME_HEADER.unpack_from(self.map, offset)
+        data_offset = offset + FRAME_HEADER.size
+        step = width * channels
+
+        if compression == COMPRESSION["raw"]:
+            data = (ctypes.c_char * data_size).from_buffer(self.map, data_offset)
+        else:
+            compressed = self.map[data_offset:data_offset + data_size]
+            if compression == COMPRESSION["zlib"]:
+                data = zlib.decompress(compressed)
+            elif compression == COMPRESSION["lz4"] and lz4_block is not None:
+                data = lz4_block.decompress(compressed, uncompressed_size=step * height)
+            else:
+                raise ValueError("Frame %d of %s has unsupported compression %d" %
+                                 (i, self.path, compression))
+            # A private, writable copy of the pixels
+            data = ctypes.create_string_buffer(data, step * height)
+
+        image = cv.CreateImageHeader((width, height), depth, channels)
+        cv.SetData(image, data, step)
+
+        variables = None
+        if variables_size:
+            variables_offset = data_offset + data_size
+            variables = json.loads(self.map[variables_offset:variables_offset + variables_size])
+
+        return image, timestamp, frame_number, variables
+
+    def close(self):
+        if getattr(self, "map", None):
+            self.map.close()
+            self.map = None
+        if getattr(self, "file", None):
+            self.file.close()
+            self.file = None
+
+    __del__ = close
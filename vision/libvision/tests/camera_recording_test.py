@@ -0,0 +1,158 @@
+#!/usr/bin/env python
+"""
+Records frames from a Camera into a recording and plays them back
+
+A fake camera, patched in for cv.CaptureFromCAM and cv.QueryFrame, gives
+frames with known pixels.  Camera records them with record_path ending in
+RECORDING_EXTENSION, and a second Camera reads the recording back.  Every
+frame must come back with its pixels, capture time, frame number and
+variables.  Also checks that RecordThread carries on past a frame it fails to
+write, and that stop() returns when the queue is full.
+
+Exits with status 1 on any failure.  Run with "make test".
+"""
+
+from __future__ import print_function
+
+import os
+import shutil
+import sys
+import tempfile
+import time
+
+import numpy
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+
+import camera
+from camera import Camera, RecordThread
+from recording import RECORDING_EXTENSION
+
+cv = camera.cv
+
+FRAMES = 40
+WIDTH = 64
+HEIGHT = 48
+
+failures = []
+
+
+def check(condition, message):
+    if not condition:
+        failures.append(message)
+        print("FAIL", message)
+
+
+def fake_frame(i):
+    '''A frame whose pixels depend on its position and i.'''
+    y, x, c = numpy.indices((HEIGHT, WIDTH, 3))
+    return ((x * 3 + y * 5 + c * 70 + i * 11) % 256).astype(numpy.uint8)
+
+
+class FakeCapture(object):
+
+    '''Stands in for a cv capture, giving FRAMES frames of fake_frame().'''
+
+    def __init__(self):
+        self.count = 0
+        self.images = []
+
+    def query(self):
+        if self.count >= FRAMES:
+            return None
+        array = fake_frame(self.count)
+        self.count += 1
+        # Keep the array alive as long as the IplImage pointing into it
+        self.images.append(array)
+        return cv.GetImage(cv.fromarray(array))
+
+
+def round_trip(directory, compression):
+    path = os.path.join(directory, "%s%s" % (compression, RECORDING_EXTENSION))
+    fake = FakeCapture()
+    cv.CaptureFromCAM = lambda index: fake
+    cv.QueryFrame = lambda capture: capture.query()
+
+    recorded = []
+    source = Camera(0, record_path=path, record_compression=compression,
+                    record_variables=lambda: {"depth": len(recorded) * 0.5})
+    for i in xrange(FRAMES):
+        source.get_frame()
+        recorded.append(source.frame_time)
+    source.close()
+    check(source.frame_count == FRAMES, "%s: captured %d frames" % (compression, source.frame_count))
+
+    playback = Camera(path)
+    for i in xrange(FRAMES):
+        frame = playback.get_frame()
+        check(numpy.array_equal(numpy.asarray(frame[:, :]), fake_frame(i)),
+              "%s: frame %d pixels differ" % (compression, i))
+        check(playback.frame_time == recorded[i],
+              "%s: frame %d time is %r, recorded %r" % (compression, i, playback.frame_time, recorded[i]))
+        check(playback.variables == {"depth": i * 0.5},
+              "%s: frame %d variables are %r" % (compression, i, playback.variables))
+    check(playback.recording.frame(FRAMES - 1)[2] == FRAMES,
+          "%s: last frame number is %r" % (compression, playback.recording.frame(FRAMES - 1)[2]))
+    try:
+        playback.get_frame()
+        check(False, "%s: read past the last frame" % compression)
+    except Camera.CaptureError:
+        pass
+    playback.close()
+
+
+def record_thread_errors():
+    written = []
+
+    def write(image, timestamp, frame_number, variables):
+        if frame_number == 1:
+            raise IOError("write failed")
+        written.append(frame_number)
+
+    closed = []
+    thread = RecordThread(write, 4, lambda: closed.append(True))
+    thread.start()
+    for i in xrange(3):
+        thread.put(fake_frame(i), i, i)
+    check(thread.stop(), "record thread didn't stop after a failed write")
+    check(written == [0, 2], "frames written around a failed write: %r" % written)
+    check(thread.failed == 1, "failed writes counted as %d" % thread.failed)
+    check(closed == [True], "close called %d times" % len(closed))
+
+
+def record_thread_full_queue():
+    def write(image, timestamp, frame_number, variables):
+        time.sleep(0.2)
+
+    thread = RecordThread(write, 2)
+    thread.start()
+    for i in xrange(10):
+        thread.put(fake_frame(i), i, i)
+    check(thread.dropped > 0, "no frames dropped with a full queue")
+
+    start = time.time()
+    stopped = thread.stop(timeout=0.1)
+    check(time.time() - start < 1, "stop() with a full queue took %.1f s" % (time.time() - start))
+    check(not stopped, "stop() returned True before the queue was written")
+    thread.join(5)
+    check(not thread.is_alive(), "record thread didn't finish the queue after stop()")
+
+
+def main():
+    directory = tempfile.mkdtemp()
+    try:
+        for compression in ("raw", "zlib"):
+            round_trip(directory, compression)
+    finally:
+        shutil.rmtree(directory)
+    record_thread_errors()
+    record_thread_full_queue()
+
+    if failures:
+        print("camera recording: %d failures" % len(failures))
+        sys.exit(1)
+    print("camera recording: ok")
+
+
+if __name__ == "__main__":
+    main()
@@ -3,21 +3,12 @@ from time import time
 
 import cv
 
-import libvision
-
-DEFAULT_MATCH_METHOD = cv.CV_TM_CCORR
-MIN = 2  # Indexes into cv.minmaxloc outputs.
-MAX = 3
-# Depending on the matching method, a match will be at either min or max.  This
-# dict maps methods to min or max accordingly.
-MATCH_METHOD_MIN_OR_MAX = {
-    cv.CV_TM_SQDIFF: MIN,
-    cv.CV_TM_SQDIFF_NORMED: MIN,
-    cv.CV_TM_CCORR: MAX,
-    cv.CV_TM_CCORR_NORMED: MAX,
-    cv.CV_TM_CCOEFF: MAX,
-    cv.CV_TM_CCOEFF_NORMED: MAX,
-}
+from . import cmodules
+
+# Most pyramid levels the tracker searches, counting full resolution.  Each
+# level halves the image, so with 3 the full search is done at a quarter of
+# the frame's resolution.
+DEFAULT_MAX_LEVELS = 3
 
 
 class Tracker(object):
@@ -33,14 +24,22 @@ class Tracker(object):
     object location to find the object in the new frame.  The size of this
     search area is determined by the search_size argument to __init__().
 
+    Matching is done by the template_tracker cmodule: normalized cross
+    correlation (cv.CV_TM_CCOEFF_NORMED), searched in full on a shrunk copy
+    of the search area and refined at each finer level of an image pyramid.
+    It doesn't depend on the brightness or contrast of the search area, so
+    frames are matched as they are.
+
     '''
 
     def __init__(self, frame, center, size, search_size, alpha=0.2,
-                 min_z_score=5.0, match_method=DEFAULT_MATCH_METHOD, debug=False):
+                 min_contrast=0.4, max_levels=DEFAULT_MAX_LEVELS, debug=False):
         '''
         Arguments:
 
-            frame - Frame which the template is extracted from.
+            frame - Frame which the template is extracted from.  Must be an 8
+                bit image with 1 or 3 channels, and later frames must have the
+                same number of channels.
 
             center - The center of the object to track in the given frame.
             Must be a tuple (x,y).
@@ -60,13 +59,19 @@ class Tracker(object):
                 that was just found.  A value of 0 will keep the initial
                 template.
 
-            min_z_score - The number of standard deviations from the average
-                the template matching max/min must be for it to be considered a
-                valid match.
+            min_contrast - How far the best match's correlation must be above
+                the best correlation half a template away from it for the
+                match to be considered valid.  Correlations run from -1 to 1
+                and only the match's neighbourhood is looked at, so this
+                doesn't depend on the template or search sizes.  An object in
+                the search area usually scores 0.9 or more and an empty search
+                area under 0.2.  An object with no detail of its own, such as a
+                template inside a flat disc, can score anywhere from 0.2 to
+                0.7, since the match could slide around it.
 
-            match_method - The distance calculation that is used for template
-                matching.  Must be one of the OpenCV method constants defined
-                for OpenCV's MatchTemplate function (cv.CV_TM_*).
+            max_levels - The most pyramid levels to search, counting full
+                resolution.  Fewer are used if the template would shrink below
+                8 pixels.  1 searches every position at full resolution.
 
             debug - If this evaluates to True, various debugging windows will
                 be displayed.
@@ -75,65 +80,51 @@ class Tracker(object):
 
         self.object_center = center
         self.size = size
-        self.match_method = match_method
         self.alpha = alpha
-        self.min_z_score = min_z_score
+        self.min_contrast = min_contrast
         self.search_size = search_size
         self.debug = debug
 
-        template_rect = clip_rectangle((
-            center[0] - size[0] / 2,
-            center[1] - size[1] / 2,
-            size[0],
-            size[1],
-        ), frame.width, frame.height)
-        self._template = self._preprocess(crop(frame, template_rect))
+        # Last match, whether or not it was found
+        self.match = cmodules.TrackerMatch()
+
+        self._tracker = cmodules.template_tracker.template_tracker_new(
+            frame, int(center[0]), int(center[1]), int(size[0]), int(size[1]),
+            int(search_size[0]), int(search_size[1]), alpha, min_contrast,
+            max_levels)
+        if not self._tracker:
+            raise ValueError("Could not create a template at %s of size %s"
+                             % (center, size))
+
+        # The template size, clipped to the frame as template_tracker_new
+        # clips it
+        x = int(center[0]) - int(size[0]) // 2
+        y = int(center[1]) - int(size[1]) // 2
+        self._template_size = (
+            min(x + int(size[0]), frame.width) - max(x, 0),
+            min(y + int(size[1]), frame.height) - max(y, 0),
+        )
 
         if self.debug:
-            cv.NamedWindow("match")
             cv.NamedWindow("template")
             cv.NamedWindow("search region")
-            cv.NamedWindow("Histogram")
 
-    def _preprocess(self, frame):
+    def search_rect(self, frame):
         '''
-        Formats a raw rgb image into a processed image which template matching
-        is performed on.
-
-        In this case, the laplacian of the image and template is calculated,
-        and the matching is done on those preprocessed frames.  In the future,
-        this function should implement multiple preprocessing methods that can
-        be selected between on init.
-
-        '''
-
-        dst = cv.CreateImage(cv.GetSize(frame), cv.IPL_DEPTH_32F, frame.channels)
-        cv.Laplace(frame, dst, 19)
-        return dst
-
-    def _update_template(self, search_image, coordinates):
-        '''Updates the object template after a match for the object is found.
+        Returns the CvRect around the last known object location that the next
+        call to locate_object() will search.
 
-        search_image is the region which locate_object looked for the object
-        in.  coordinates is a tuple (x,y) of the position within search_image
-        that the object was found.  The search_image should already be
-        preprocessed.  The current template and search image are mixed together
-        as such:
-            self.template = self.template*(1-self.alpha) + match*self.alpha
+        This can also be given as the roi to the _roi variants of the color
+        targeting cmodules and to libvision.blob.find_blobs(), so they only
+        process the part of the frame the object can be in.
 
         '''
-        match_rectangle = (
-            int(coordinates[0] - self._template.width / 2),
-            int(coordinates[1] - self._template.height / 2),
-            int(self._template.width),
-            int(self._template.height)
-        )
-        cv.SetImageROI(search_image, match_rectangle)
-
-        cv.ConvertScale(self._template, self._template, 1 - self.alpha)
-        cv.ScaleAdd(search_image, self.alpha, self._template, self._template)
-
-        cv.ResetImageROI(search_image)
+        return clip_rectangle((
+            self.object_center[0] - self.search_size[0] / 2,  # x
+            self.object_center[1] - self.search_size[1] / 2,  # y
+            self.search_size[0],  # width
+            self.search_size[1],  # height
+        ), frame.width, frame.height)
 
     def locate_object(self, frame):
         '''
@@ -146,72 +137,35 @@ class Tracker(object):
         location.
         '''
 
-        if not self._template:
+        if not self._tracker:
             raise RuntimeError("The Tracker class can not be used after it is "
                                "unpickled.")
 
-        search_rect = clip_rectangle((
-            self.object_center[0] - self.search_size[0] / 2,  # x
-            self.object_center[1] - self.search_size[1] / 2,  # y
-            self.search_size[0],  # width
-            self.search_size[1],  # height
-        ), frame.width, frame.height)
-        search_image = self._preprocess(crop(frame, search_rect))
-        result = cv.CreateImage(
-            (
-                search_image.width - self._template.width + 1,
-                search_image.height - self._template.height + 1
-            ),
-            cv.IPL_DEPTH_32F, 1)
-        cv.MatchTemplate(search_image, self._template, result, self.match_method)
-        min_or_max = MATCH_METHOD_MIN_OR_MAX[self.match_method]
-        minmaxloc = cv.MinMaxLoc(result)
-        if abs(minmaxloc[1] - minmaxloc[0]) < 0.001:
-            return False
-        match_in_result = minmaxloc[min_or_max]
-
-        # Change from result image coordinates to search region coordinates to
-        # image coordinates
-        match_in_search_region = (
-            match_in_result[0] + self._template.width / 2,
-            match_in_result[1] + self._template.height / 2,
-        )
-        object_center = (
-            match_in_search_region[0] + search_rect[0],
-            match_in_search_region[1] + search_rect[1],
-        )
-        object_center = (
-            int(in_range(0, object_center[0], frame.width - 1)),
-            int(in_range(0, object_center[1], frame.height - 1)),
-        )
-
-        # Determine if the max/min is significant.
-        hist = cv.CreateHist([256], cv.CV_HIST_ARRAY, [[0, 255]], 1)
-        cv.CalcHist([scale_32f_image(result)], hist)
-        # XXX stddevs from mean should be calculated from either 0 or 255
-        #    depending on min or max
-        distance = abs(libvision.hist.num_stddev_from_mean(hist, 255))
-        if distance < self.min_z_score:
-            object_found = False
-        else:
-            object_found = True
-            self._update_template(search_image, match_in_search_region)
-            self.object_center = object_center
-
         if self.debug:
+            search_rect = self.search_rect(frame)
+            search_image = crop(frame, search_rect)
+
+        found = cmodules.template_tracker.template_tracker_locate(
+            self._tracker, frame, self.match)
+        if found < 0:
+            raise ValueError("frame must be an 8 bit image with the channels "
+                             "of the first frame")
+        object_found = found == 1
+        if object_found:
+            self.object_center = (self.match.x, self.match.y)
 
-            result_8bit = scale_32f_image(result)
+        if self.debug:
+            template = cv.CreateImage(self._template_size, 8, frame.channels)
+            cmodules.template_tracker.template_tracker_template(
+                self._tracker, template)
             if object_found:
-                cv.Circle(result_8bit, match_in_result, 5, (0, 255, 0))
-                cv.Circle(search_image, match_in_search_region, 5, (0, 255, 0))
-            hist_image = libvision.hist.histogram_image(hist)
+                cv.Circle(search_image, (
+                    self.match.x - search_rect[0],
+                    self.match.y - search_rect[1],
+                ), 5, (0, 255, 0))
+            cv.ShowImage("template", template)
+            cv.ShowImage("search region", search_image)
 
-            cv.ShowImage("match", result_8bit)
-            cv.ShowImage("template", scale_32f_image(self._template))
-            cv.ShowImage("search region", scale_32f_image(search_image))
-            cv.ShowImage("Histogram", hist_image)
-
-        # Update Template
         if object_found:
             return self.object_center
         else:
@@ -220,18 +174,23 @@ class Tracker(object):
     def __getstate__(self):
         '''Makes this object safe for pickling.
 
-        OpenCV object cannot be pickled.  Something very weird happens if you
-        try.  This function is called while pickling.  The dictionary returned
-        by this function is what is actually pickled, which excludes the
-        IplImage which won't pickle correctly.
+        The native tracker cannot be pickled.  This function is called while
+        pickling.  The dictionary returned by this function is what is
+        actually pickled, which excludes the tracker.
 
         Note that for this reason, this class does not work correctly after pickled.
 
         '''
         pickleable_copy = self.__dict__.copy()
-        pickleable_copy['_template'] = None
+        pickleable_copy['_tracker'] = None
+        pickleable_copy['match'] = None
         return pickleable_copy
 
+    def __del__(self):
+        if getattr(self, "_tracker", None):
+            cmodules.template_tracker.template_tracker_free(self._tracker)
+            self._tracker = None
+
 
 def scale_32f_image(image):
     '''
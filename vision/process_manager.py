@@ -4,21 +4,42 @@ import time
 import traceback
 from multiprocessing import Process, Pipe
 
+import seawolf
 import svr
 
 import sw3
 
+from frame_ring import FrameRing
+from libvision import profiler
+
+# Stages published for each profiled process, as
+# VisionProfile.<process name>.<stage>50 and <stage>99, in milliseconds
+PUBLISHED_STAGES = [profiler.CAPTURE, profiler.CMODULE, profiler.ENTITY, profiler.TRANSFER]
+
 
 class ProcessManager(object):
 
-    def __init__(self, extra_kwargs={}):
+    def __init__(self, extra_kwargs={}, shared_frames=False, profile=False):
         '''
         :param extra_kwargs:
             Keyward args that are passed to each process started.
+        :param shared_frames:
+            If True, frames of each camera are captured by a single capture
+            process into a FrameRing, and every entity on that camera reads
+            them from shared memory.  Only entities with shares_frames set
+            take part.
+        :param profile:
+            If True, entities time each stage of their loop and the results
+            are published as VisionProfile.* seawolf variables.
         '''
         # holds the list currently running processes
         self.extra_kwargs = extra_kwargs
         self.process_list = {}
+        self.shared_frames = shared_frames
+        self.profile = profile
+
+        # camera name -> CaptureProcess filling that camera's ring
+        self.capture_processes = {}
 
     def start_process(self, proc_cls, name, *args, **kwargs):
         '''Initiates a process of the class proc_cls.'''
@@ -26,9 +47,23 @@ class ProcessManager(object):
         self.process_list[name] = vision_process
         for key, value in self.extra_kwargs.iteritems():
             kwargs[key] = value
+        if self.profile:
+            kwargs["profile"] = True
+        if self.shared_frames and args and getattr(proc_cls, "shares_frames", False):
+            kwargs["frame_ring"] = self.get_frame_ring(args[0])
         vision_process.run(*args, **kwargs)
         return vision_process
 
+    def get_frame_ring(self, camera_name):
+        '''Returns the FrameRing of a camera, starting its capture process
+        if it isn't running yet.'''
+        if camera_name not in self.capture_processes:
+            capture_process = CaptureProcess(camera_name,
+                                             self.extra_kwargs.get("cameras", {}))
+            capture_process.run()
+            self.capture_processes[camera_name] = capture_process
+        return self.capture_processes[camera_name].ring
+
     def get_data(self, *process_names, **kwargs):
         '''get data from all running processes and
            package the output into a dictionary blah blah'''
@@ -74,6 +109,16 @@ class ProcessManager(object):
             else:
                 raise ValueError("Attempted to send data to non-existant process")
 
+    def publish_profile(self, process_name, report):
+        '''Sets the VisionProfile variables of a process from a ProfileReport.'''
+        prefix = "VisionProfile.%s." % process_name
+        seawolf.var.set(prefix + "FPS", report.fps)
+        seawolf.var.set(prefix + "Dropped", report.dropped)
+        for stage in PUBLISHED_STAGES:
+            if stage in report.stages:
+                seawolf.var.set(prefix + stage + "50", report.stages[stage].p50 * 1000)
+                seawolf.var.set(prefix + stage + "99", report.stages[stage].p99 * 1000)
+
     def ping(self):
         '''verify that all processes are alive'''
         pass
@@ -83,7 +128,11 @@ class ProcessManager(object):
         for process in self.process_list.values():
             process.kill()
 
+        for capture_process in self.capture_processes.values():
+            capture_process.kill()
+
         self.process_list = {}
+        self.capture_processes = {}
 
 
 class VisionProcess(object):
@@ -94,6 +143,9 @@ class VisionProcess(object):
         self.entity_cls = entity_cls
         self.name = name
 
+        # Time outputs spend in the pipe, if the entity is profiled
+        self.transfer_times = profiler.RollingHistogram()
+
     def get_data(self, delay=0):
         '''check for incoming data from this process'''
         # return any new data from the queue
@@ -105,7 +157,13 @@ class VisionProcess(object):
             # elif str(data.__class__) == str(SensorCapture):
             elif isinstance(data, SensorCapture):
                 sw3.data.freeze(self.name)
+            elif isinstance(data, profiler.ProfileReport):
+                if self.transfer_times:
+                    data.stages[profiler.TRANSFER] = profiler.StageStats(self.transfer_times)
+                self.process_manager.publish_profile(self.name, data)
             else:
+                if hasattr(data, "sent_time"):
+                    self.transfer_times.add(profiler.monotonic() - data.sent_time)
                 # print "Data:", data
                 # print str(data.__class__), str(SensorCapture)
                 return data
@@ -140,6 +198,49 @@ def run_entity(upstream_conn, entity_cls, *args, **kwargs):
         sys.exit()
 
 
+class CaptureProcess(object):
+
+    '''Grabs the frames of one camera into a FrameRing.'''
+
+    def __init__(self, camera_name, cameras):
+        self.camera_name = camera_name
+        self.cameras = cameras
+        self.ring = FrameRing()
+
+    def run(self):
+        self.process = Process(target=run_capture,
+                               args=(self.ring, self.camera_name, self.cameras))
+        self.process.daemon = True
+        self.process.start()
+
+    def kill(self):
+        self.process.terminate()
+        self.process.join()
+
+
+def run_capture(ring, camera_name, cameras):
+    '''perpetually captures frames from camera_name into ring.  The camera
+       is opened the same way VisionEntity opens it, except that cameras are
+       captured in a thread.'''
+    import libvision
+
+    try:
+        if camera_name in cameras:
+            # Each frame is copied into the ring before the next is
+            # captured, so the capture thread's buffers can be used as is
+            capture = libvision.Camera(cameras[camera_name], threaded=True)
+        else:
+            svr.connect()
+            capture = svr.Stream(camera_name)
+            capture.unpause()
+
+        while True:
+            ring.put(capture.get_frame())
+    except Exception:
+        traceback.print_exc()
+        sys.exit()
+
+
 class KillSignal(Exception):
     pass
 
@@ -0,0 +1,101 @@
+#!/usr/bin/env python
+"""
+Check libvision's HSV conversion and hsv_filter against OpenCV
+
+ColorConverter("hsv") and filters.hsv_filter convert to HSV in C (see
+libvision/cmodules/src/color_convert.c) instead of calling cv.CvtColor.  This
+converts an image holding every 8 bit BGR color both ways and reports:
+
+    - how many pixels of each channel differ from cv.CvtColor's CV_BGR2HSV,
+      and by how much at most,
+    - for a few sets of bounds, how many pixels hsv_filter marks differently
+      from the per pixel Python loop it replaced, run on cv.CvtColor's HSV.
+
+Exits with status 1 if anything differs.
+
+Usage:
+
+    ./hsv_check.py
+"""
+
+from __future__ import print_function
+
+import os
+import sys
+
+import numpy as np
+
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+
+from libvision import filters
+from libvision.color_convert import ColorConverter
+from libvision.convert import cv, cv2_to_cv, cv_to_cv2
+
+# (low_h, high_h, min_s, max_s, min_v, max_v, hue_bandstop), hue 0 to 360 as
+# hsv_filter takes it
+FILTER_BOUNDS = [
+    (20, 60, 100, 255, 50, 255, False),
+    (15, 41, 0, 255, 0, 255, False),
+    (30, 330, 80, 200, 40, 220, True),
+    (0, 360, 0, 255, 0, 255, False),
+    (101, 99, 0, 255, 0, 255, False),
+    (-10, 400, -5, 300, -5, 300, True),
+]
+
+
+def all_colors():
+    '''A 4096x4096 BGR image with every 8 bit color once.'''
+    colors = np.arange(1 << 24, dtype=np.uint32)
+    bgr = np.empty((1 << 24, 3), dtype=np.uint8)
+    bgr[:, 0] = colors & 0xff
+    bgr[:, 1] = (colors >> 8) & 0xff
+    bgr[:, 2] = colors >> 16
+    return cv2_to_cv(bgr.reshape(4096, 4096, 3))
+
+
+def python_filter(hsv, low_h, high_h, min_s, max_s, min_v, max_v, hue_bandstop):
+    '''The conditions of the Python loop hsv_filter used to run, with the
+    bounds halved the way filters.py halves them.'''
+    high_h /= 2
+    low_h /= 2
+    h = hsv[:, :, 0].astype(np.float64)
+    s = hsv[:, :, 1].astype(np.float64)
+    v = hsv[:, :, 2].astype(np.float64)
+
+    if hue_bandstop:
+        accept = (h <= low_h) | (h >= high_h)
+    else:
+        accept = (h >= low_h) & (h <= high_h)
+    accept &= (s >= min_s) & (s <= max_s) & (v >= min_v) & (v <= max_v)
+    return accept
+
+
+def main():
+    failed = False
+    frame = all_colors()
+
+    reference = cv.CreateImage(cv.GetSize(frame), 8, 3)
+    cv.CvtColor(frame, reference, cv.CV_BGR2HSV)
+    reference = cv_to_cv2(reference)
+
+    channels = ColorConverter("hsv").convert(frame)
+    for i, name in enumerate("hsv"):
+        difference = np.abs(cv_to_cv2(channels[i]).astype(np.int32) -
+                            reference[:, :, i].astype(np.int32))
+        print("%s: %d of %d colors differ from cv.CvtColor, by at most %d" %
+              (name, np.count_nonzero(difference), difference.size, difference.max()))
+        failed = failed or difference.any()
+
+    for bounds in FILTER_BOUNDS:
+        mask = cv_to_cv2(filters.hsv_filter(frame, *bounds)) != 0
+        expected = python_filter(reference, *bounds)
+        mismatches = np.count_nonzero(mask != expected)
+        print("hsv_filter%r: %d of %d colors differ from the Python loop" %
+              (bounds, mismatches, mask.size))
+        failed = failed or mismatches
+
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()